@@ -0,0 +1,73 @@
+// Entry points of the cycle benchmark. Built for the Cortex-M0+ into
+// kbd_bench.elf with the keyboard sources and the host HAL, and called by
+// kbd_cycles (host/m0bench.c) under the instruction set simulator. The
+// functions measured are called by their own symbols.
+
+#include "hal_host.h"
+#include "keyboard.h"
+#include "nvm_flash.h"
+#include "settings.h"
+#include "timebase.h"
+
+#define NUM_BENCH_KEYS 20
+
+// Plain keys of the default keymap: the number and top letter rows, away
+// from the layer keys
+static const uint8_t BENCH_KEYS[NUM_BENCH_KEYS] = {
+	KEY_INDEX(1, 1), KEY_INDEX(1, 2), KEY_INDEX(1, 3), KEY_INDEX(1, 4), KEY_INDEX(1, 5),
+	KEY_INDEX(1, 6), KEY_INDEX(1, 7), KEY_INDEX(1, 8), KEY_INDEX(1, 9), KEY_INDEX(1, 10),
+	KEY_INDEX(2, 1), KEY_INDEX(2, 2), KEY_INDEX(2, 3), KEY_INDEX(2, 4), KEY_INDEX(2, 5),
+	KEY_INDEX(2, 6), KEY_INDEX(2, 7), KEY_INDEX(2, 8), KEY_INDEX(2, 9), KEY_INDEX(2, 10),
+};
+
+// Argument buffer of the functions taking a pointer
+uint8_t bench_buffer[64];
+
+// Keys held per row, read by the PORT model of host/m0bench.c
+uint16_t bench_matrix[NUM_ROWS];
+
+void bench_setup(void)
+{
+	hal_host_init();
+	timebase_init();
+	configure_pins();
+	nvm_flash_init();
+	settings_init();
+	configure_keymap();
+	configure_adc();
+	configure_dac();
+	configure_usb_hid();
+	configure_i2c();
+	configure_tc();
+}
+
+void bench_hold_keys(unsigned count)
+{
+	for (unsigned i = 0; i < NUM_BENCH_KEYS; i++)
+	{
+		const unsigned row = KEY_INDEX_ROW(BENCH_KEYS[i]);
+		const unsigned col = KEY_INDEX_COL(BENCH_KEYS[i]);
+		hal_host_set_key(row, col, i < count);
+		if (i < count)
+		{
+			bench_matrix[row] |= 1 << col;
+		}
+		else
+		{
+			bench_matrix[row] &= ~(1 << col);
+		}
+	}
+}
+
+// What happens between two scans: the peripheral transfers complete and the
+// host takes the reports
+void bench_poll(void)
+{
+	uint8_t report[HAL_HOST_REPORT_SIZE];
+	while (hal_host_complete_adc() || hal_host_complete_i2c())
+	{
+	}
+	while (hal_host_poll(HAL_HOST_KEYBOARD, report) || hal_host_poll(HAL_HOST_MULTIMEDIA, report))
+	{
+	}
+}
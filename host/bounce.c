@@ -0,0 +1,122 @@
+#include "bounce.h"
+
+#include <stddef.h>
+
+// Chatter lengths follow the datasheet bounce times: up to 5 ms on make for
+// MX style switches, less on break. Worn contacts open for a few hundred µs
+// to a few ms; interference couples spikes of tens of µs into the long
+// column lines.
+const struct bounce_model BOUNCE_MODELS[] = {
+	{ "ideal", "clean edges" },
+	{ "cherry", "make and break chatter", 5000, 1500, 8 },
+	{ "worn", "chatter and dropouts while held", 5000, 3000, 12, 15, 200, 3000 },
+	{ "emi", "clean edges and interference spikes", 0, 0, 0, 0, 0, 0, 50, 40 },
+	{ "noisy", "chatter, dropouts and spikes", 5000, 3000, 12, 15, 200, 3000, 50, 40 },
+};
+const unsigned NUM_BOUNCE_MODELS = sizeof(BOUNCE_MODELS) / sizeof(BOUNCE_MODELS[0]);
+
+uint32_t bounce_random(uint32_t* state)
+{
+	// xorshift32
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+static inline uint32_t random_range(uint32_t* state, uint32_t min, uint32_t max)
+{
+	return (max > min) ? min + bounce_random(state) % (max - min + 1) : min;
+}
+
+static void add_glitch(struct bounce_wave* wave, uint32_t start, uint32_t length)
+{
+	if (wave->num_glitches < BOUNCE_MAX_GLITCHES && length > 0)
+	{
+		wave->glitches[wave->num_glitches].start = start;
+		wave->glitches[wave->num_glitches].length = length;
+		wave->num_glitches++;
+	}
+}
+
+static void add_chatter(struct bounce_wave* wave, uint32_t* random, uint32_t edge, uint32_t duration,
+	uint8_t max_edges, uint32_t limit)
+{
+	if (duration == 0 || max_edges == 0)
+	{
+		return;
+	}
+
+	// Bounces shrink as the contact settles: each takes a share of what is
+	// left of the chatter time, half of it back at the previous level
+	const unsigned n = random_range(random, 1, max_edges);
+	uint32_t t = edge;
+	uint32_t left = random_range(random, duration / 4, duration);
+	for (unsigned i = 0; i < n && left > 10; i++)
+	{
+		const uint32_t settle = random_range(random, left / 8, left / 3);
+		const uint32_t bounce = random_range(random, settle / 4, settle / 2 + 1);
+		t += settle;
+		if (t + bounce >= limit)
+		{
+			break;
+		}
+		add_glitch(wave, t, bounce);
+		t += bounce;
+		left = (left > settle + bounce) ? left - settle - bounce : 0;
+	}
+}
+
+// Number of events at rate per second over length µs
+static unsigned poisson_count(uint32_t* random, uint32_t rate, uint32_t length)
+{
+	// Expected count in 1/1024ths, the fraction resolved by a draw
+	const uint64_t expected = (uint64_t)rate * length * 1024 / 1000000;
+	unsigned n = expected / 1024;
+	if (bounce_random(random) % 1024 < expected % 1024)
+	{
+		n++;
+	}
+	return n;
+}
+
+void bounce_generate(const struct bounce_model* model, uint32_t* random, uint32_t press, uint32_t release,
+	uint32_t end, struct bounce_wave* wave)
+{
+	wave->press = press;
+	wave->release = release;
+	wave->num_glitches = 0;
+
+	add_chatter(wave, random, press, model->press_chatter_us, model->chatter_edges, release);
+	add_chatter(wave, random, release, model->release_chatter_us, model->chatter_edges, end);
+
+	const unsigned dropouts = poisson_count(random, model->dropout_rate, release - press);
+	for (unsigned i = 0; i < dropouts; i++)
+	{
+		// Open only while held
+		const uint32_t start = random_range(random, press, release - 1);
+		const uint32_t length = random_range(random, model->dropout_min_us, model->dropout_max_us);
+		add_glitch(wave, start, (length < release - start) ? length : release - start);
+	}
+
+	const unsigned spikes = poisson_count(random, model->spike_rate, end - press);
+	for (unsigned i = 0; i < spikes; i++)
+	{
+		add_glitch(wave, random_range(random, press, end - 1), random_range(random, 1, model->spike_max_us));
+	}
+}
+
+bool bounce_level(const struct bounce_wave* wave, uint32_t t)
+{
+	bool closed = (t >= wave->press && t < wave->release);
+	for (unsigned i = 0; i < wave->num_glitches; i++)
+	{
+		const struct bounce_glitch* g = &wave->glitches[i];
+		if (t >= g->start && t - g->start < g->length)
+		{
+			return !closed;
+		}
+	}
+	return closed;
+}
@@ -0,0 +1,62 @@
+#ifndef BOUNCE_H_
+#define BOUNCE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Switch bounce waveforms. A keystroke is an ideal press and release, with
+// glitches laid over it: intervals where the contact reads the opposite of
+// the ideal level. Times in µs.
+
+struct bounce_model
+{
+	const char* name;
+	const char* description;
+
+	// Contact chatter after each edge: up to chatter_edges bounces within
+	// chatter_us, shorter and further apart as the contact settles
+	uint16_t press_chatter_us;
+	uint16_t release_chatter_us;
+	uint8_t chatter_edges;
+
+	// Worn contact opening while held, per second held
+	uint16_t dropout_rate;
+	uint16_t dropout_min_us;
+	uint16_t dropout_max_us;
+
+	// Interference spikes of either level, per second
+	uint16_t spike_rate;
+	uint16_t spike_max_us;
+};
+
+extern const struct bounce_model BOUNCE_MODELS[];
+extern const unsigned NUM_BOUNCE_MODELS;
+
+#define BOUNCE_MAX_GLITCHES 64
+
+struct bounce_glitch
+{
+	uint32_t start;
+	uint32_t length;
+};
+
+struct bounce_wave
+{
+	uint32_t press;
+	uint32_t release;
+	unsigned num_glitches;
+	struct bounce_glitch glitches[BOUNCE_MAX_GLITCHES];
+};
+
+// Pseudo random numbers of the models, seeded with anything but 0
+uint32_t bounce_random(uint32_t* state);
+
+// Keystroke pressed at press, released at release; the wave covers the time
+// up to end, the next keystroke
+void bounce_generate(const struct bounce_model* model, uint32_t* random, uint32_t press, uint32_t release,
+	uint32_t end, struct bounce_wave* wave);
+
+// Contact closed at time t
+bool bounce_level(const struct bounce_wave* wave, uint32_t t);
+
+#endif /* BOUNCE_H_ */
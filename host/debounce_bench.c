@@ -0,0 +1,192 @@
+// Debounce benchmark: every debounce mode at every scan period against the
+// bounce models, on the same keystrokes. For each it reports the latency
+// from the ideal press to the debounced one, the keystrokes that never made
+// it through and the extra presses leaking through (chatter). --ms takes the
+// debounce times to sweep, 1,5,10,20 ms by default.
+//
+// usage: kbd_debounce_bench [--keystrokes N] [--ms LIST] [--seed N] [--csv]
+
+#include "bounce.h"
+#include "hal_host.h"
+#include "keyboard_debounce.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_KEYSTROKES 100000
+#define MAX_DEBOUNCE_MS 8
+
+// Keystrokes of fast typing
+#define HOLD_MIN_US 30000
+#define HOLD_MAX_US 120000
+#define GAP_MIN_US  30000
+#define GAP_MAX_US  120000
+
+static const unsigned SCAN_PERIODS_MS[] = { 1, 2, 4, 8 };
+static const char* const MODE_NAMES[NUM_DEBOUNCE_MODES] = { "none", "eager", "defer" };
+
+struct bench_result
+{
+	uint32_t p50;
+	uint32_t p99;
+	uint32_t max;
+	unsigned missed;
+	unsigned chatter;
+};
+
+static uint32_t g_latencies[MAX_KEYSTROKES];
+
+static void run(const struct bounce_model* model, unsigned period_ms, enum debounce_mode mode, unsigned ms,
+	unsigned keystrokes, uint32_t seed, struct bench_result* result)
+{
+	const uint32_t period = period_ms * 1000;
+	matrix_row_t matrix[NUM_ROWS];
+	struct bounce_wave wave;
+	uint32_t random = seed;
+	unsigned num_latencies = 0;
+	bool prev = false;
+
+	// The key is at row 0, column 0
+	debounce_init();
+	debounce_configure(mode, (ms + period_ms - 1) / period_ms);
+	memset(result, 0, sizeof(*result));
+
+	uint32_t press = 10000;
+	for (unsigned k = 0; k < keystrokes; k++)
+	{
+		const uint32_t release = press + HOLD_MIN_US + bounce_random(&random) % (HOLD_MAX_US - HOLD_MIN_US);
+		const uint32_t end = release + GAP_MIN_US + bounce_random(&random) % (GAP_MAX_US - GAP_MIN_US);
+		bounce_generate(model, &random, press, release, end, &wave);
+
+		unsigned presses = 0;
+		for (uint32_t t = (press + period - 1) / period * period; t < end; t += period)
+		{
+			memset(matrix, 0, sizeof(matrix));
+			matrix[0] = bounce_level(&wave, t) ? 1 : 0;
+			debounce_matrix(matrix);
+
+			const bool pressed = (matrix[0] & 1) != 0;
+			if (pressed && !prev && presses++ == 0)
+			{
+				g_latencies[num_latencies++] = t - press;
+			}
+			prev = pressed;
+		}
+
+		if (presses == 0)
+		{
+			result->missed++;
+		}
+		else
+		{
+			result->chatter += presses - 1;
+		}
+		press = end;
+	}
+
+	if (num_latencies > 0)
+	{
+		qsort(g_latencies, num_latencies, sizeof(g_latencies[0]), hal_host_compare_u32);
+		result->p50 = g_latencies[(num_latencies - 1) / 2];
+		result->p99 = g_latencies[(num_latencies * 99 + 99) / 100 - 1];
+		result->max = g_latencies[num_latencies - 1];
+	}
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: kbd_debounce_bench [--keystrokes N] [--ms LIST] [--seed N] [--csv]\n");
+	exit(2);
+}
+
+int main(int argc, char** argv)
+{
+	unsigned keystrokes = 2000;
+	// A single scan at every period (ticks = 1), then typical windows
+	unsigned debounce_ms[MAX_DEBOUNCE_MS] = { 1, 5, 10, 20 };
+	unsigned num_debounce_ms = 4;
+	uint32_t seed = 1;
+	bool csv = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--keystrokes") == 0 && i + 1 < argc)
+		{
+			keystrokes = strtoul(argv[++i], NULL, 0);
+			if (keystrokes == 0 || keystrokes > MAX_KEYSTROKES)
+			{
+				usage();
+			}
+		}
+		else if (strcmp(argv[i], "--ms") == 0 && i + 1 < argc)
+		{
+			// Comma separated debounce times
+			char* list = argv[++i];
+			num_debounce_ms = 0;
+			while (*list != 0 && num_debounce_ms < MAX_DEBOUNCE_MS)
+			{
+				debounce_ms[num_debounce_ms++] = strtoul(list, &list, 0);
+				if (*list == ',')
+				{
+					list++;
+				}
+			}
+		}
+		else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+		{
+			seed = strtoul(argv[++i], NULL, 0);
+			if (seed == 0)
+			{
+				usage();
+			}
+		}
+		else if (strcmp(argv[i], "--csv") == 0)
+		{
+			csv = true;
+		}
+		else
+		{
+			usage();
+		}
+	}
+
+	if (csv)
+	{
+		printf("model,scan_ms,mode,debounce_ms,p50_us,p99_us,max_us,missed,chatter\n");
+	}
+	else
+	{
+		printf("# %u keystrokes per row, seed %u; latency in ms from the ideal press\n", keystrokes, seed);
+		printf("%-8s %7s %-6s %8s %7s %7s %7s %7s %7s\n",
+			"model", "scan_ms", "mode", "debounce", "p50", "p99", "max", "missed", "chatter");
+	}
+
+	for (unsigned m = 0; m < NUM_BOUNCE_MODELS; m++)
+	{
+		for (unsigned p = 0; p < sizeof(SCAN_PERIODS_MS) / sizeof(SCAN_PERIODS_MS[0]); p++)
+		{
+			for (unsigned mode = 0; mode < NUM_DEBOUNCE_MODES; mode++)
+			{
+				// The debounce time means nothing without debouncing
+				const unsigned n = (mode == DEBOUNCE_NONE) ? 1 : num_debounce_ms;
+				for (unsigned d = 0; d < n; d++)
+				{
+					const unsigned ms = (mode == DEBOUNCE_NONE) ? 0 : debounce_ms[d];
+					struct bench_result r;
+					run(&BOUNCE_MODELS[m], SCAN_PERIODS_MS[p], mode, ms, keystrokes, seed, &r);
+
+					printf(csv ? "%s,%u,%s,%u,%u,%u,%u,%u,%u\n" : "%-8s %7u %-6s %8u ",
+						BOUNCE_MODELS[m].name, SCAN_PERIODS_MS[p], MODE_NAMES[mode], ms,
+						r.p50, r.p99, r.max, r.missed, r.chatter);
+					if (!csv)
+					{
+						printf("%7.3f %7.3f %7.3f %7u %7u\n", r.p50 / 1000.0, r.p99 / 1000.0, r.max / 1000.0,
+							r.missed, r.chatter);
+					}
+				}
+			}
+		}
+	}
+	return 0;
+}
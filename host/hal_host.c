@@ -0,0 +1,411 @@
+#include "hal_host.h"
+#include "keyboard.h"
+#include "keymap.h"
+#include "profile.h"
+#include "trace.h"
+
+#include <stdio.h>
+
+// Defined by keyboard.c, called by the USB stack on the board (conf_usb.h)
+bool hid_keyboard_enable_callback(void);
+bool hid_multimedia_enable_callback(void);
+
+// A report is queued when it changes and handed to one of two banks, as
+// udd_ep_run_next does; the host takes the banks in order.
+struct host_endpoint
+{
+	uint8_t report[HAL_HOST_REPORT_SIZE];
+	bool report_valid;
+	uint8_t banks[2][HAL_HOST_REPORT_SIZE];
+	uint8_t num_banks;
+	uint8_t first_bank;
+	uint32_t superseded;
+};
+
+enum i2c_state
+{
+	I2C_IDLE,
+	I2C_WRITE,
+	I2C_READ
+};
+
+static struct host_endpoint g_endpoints[HAL_HOST_NUM_INTERFACES];
+
+static uint8_t g_keymap[KEYMAP_MAX_SIZE] __attribute__((aligned(4)));
+
+static uint16_t g_matrix[NUM_ROWS];
+static hal_callback_t g_scanCallback;
+static uint16_t g_frame;
+static hal_callback_t g_alarmCallback;
+static uint32_t g_alarmTime;
+static bool g_alarmSet;
+static uint16_t g_ledLevel;
+
+static bool g_peripheralConnected;
+static uint8_t g_peripheralData[KBD_I2C_DATA_LEN];
+
+static hal_adc_callback_t g_adcCallback;
+static bool g_adcPending;
+
+static hal_callback_t g_I2CWriteCallback;
+static hal_callback_t g_I2CReadCallback;
+static hal_callback_t g_I2CErrorCallback;
+static enum i2c_state g_I2CState;
+static uint8_t* g_I2CData;
+static uint16_t g_I2CLength;
+
+void hal_host_init(void)
+{
+	memset(g_endpoints, 0, sizeof(g_endpoints));
+	memset(g_matrix, 0, sizeof(g_matrix));
+	g_frame = 0;
+	g_hostTime = 0;
+	g_alarmSet = false;
+	g_ledLevel = 0;
+	g_peripheralConnected = false;
+	g_adcPending = false;
+	g_I2CState = I2C_IDLE;
+}
+
+// Matrix
+
+// The cycle benchmark builds the board driver instead
+#ifndef KBD_PORT_MATRIX
+void hal_matrix_init(void)
+{
+}
+
+uint16_t hal_matrix_read_row(unsigned row)
+{
+	return g_matrix[row];
+}
+
+void hal_matrix_release_rows(void)
+{
+}
+#endif
+
+void hal_host_set_key(unsigned row, unsigned col, bool pressed)
+{
+	if (pressed)
+	{
+		g_matrix[row] |= 1 << col;
+	}
+	else
+	{
+		g_matrix[row] &= ~(1 << col);
+	}
+}
+
+// Timer
+
+void hal_scan_timer_init(hal_callback_t callback)
+{
+	g_scanCallback = callback;
+}
+
+void hal_host_scan(void)
+{
+	g_scanCallback();
+}
+
+bool hal_reset_kept_ram(void)
+{
+	// Statics outlive a new start of the simulation
+	return true;
+}
+
+// Time
+
+uint32_t g_hostTime;
+
+void hal_time_init(hal_callback_t alarm_callback)
+{
+	g_alarmCallback = alarm_callback;
+}
+
+void hal_time_set_alarm(uint32_t time)
+{
+	g_alarmTime = time;
+	g_alarmSet = true;
+}
+
+void hal_time_cancel_alarm(void)
+{
+	g_alarmSet = false;
+}
+
+void hal_host_set_time(uint32_t time)
+{
+	g_hostTime = time;
+
+	// The callback may set the next alarm, possibly reached already
+	while (g_alarmSet && (int32_t)(g_hostTime - g_alarmTime) >= 0)
+	{
+		g_alarmSet = false;
+		g_alarmCallback();
+	}
+}
+
+// LED
+
+void hal_led_init(void)
+{
+}
+
+void hal_led_write(uint16_t level)
+{
+	g_ledLevel = level;
+}
+
+uint16_t hal_host_get_led_level(void)
+{
+	return g_ledLevel;
+}
+
+void hal_host_set_leds(uint8_t leds)
+{
+	hid_keyboard_led_callback(leds);
+}
+
+// Peripheral
+
+void hal_host_set_peripheral(bool connected, const uint8_t* data)
+{
+	g_peripheralConnected = connected;
+	if (data != NULL)
+	{
+		memcpy(g_peripheralData, data, KBD_I2C_DATA_LEN);
+	}
+}
+
+void hal_id_adc_init(hal_adc_callback_t callback)
+{
+	g_adcCallback = callback;
+}
+
+void hal_id_adc_start(void)
+{
+	g_adcPending = true;
+}
+
+bool hal_host_complete_adc(void)
+{
+	if (!g_adcPending)
+	{
+		return false;
+	}
+
+	g_adcPending = false;
+	g_adcCallback(g_peripheralConnected ? 0xFF : 0x00);
+	return true;
+}
+
+void hal_i2c_init(hal_callback_t write_complete, hal_callback_t read_complete, hal_callback_t error)
+{
+	g_I2CWriteCallback = write_complete;
+	g_I2CReadCallback = read_complete;
+	g_I2CErrorCallback = error;
+}
+
+void hal_i2c_write_no_stop(uint8_t address, uint8_t* data, uint16_t length)
+{
+	UNUSED(address);
+	g_I2CState = I2C_WRITE;
+	g_I2CData = data;
+	g_I2CLength = length;
+}
+
+void hal_i2c_read(uint8_t address, uint8_t* data, uint16_t length)
+{
+	UNUSED(address);
+	g_I2CState = I2C_READ;
+	g_I2CData = data;
+	g_I2CLength = length;
+}
+
+void hal_i2c_send_stop(void)
+{
+}
+
+void hal_i2c_cancel(void)
+{
+	g_I2CState = I2C_IDLE;
+}
+
+bool hal_host_complete_i2c(void)
+{
+	const enum i2c_state state = g_I2CState;
+	g_I2CState = I2C_IDLE;
+
+	switch (state)
+	{
+	case I2C_WRITE:
+		if (!g_peripheralConnected)
+		{
+			g_I2CErrorCallback();
+			return true;
+		}
+		g_I2CWriteCallback();
+		return true;
+
+	case I2C_READ:
+		memcpy(g_I2CData, g_peripheralData, Min(g_I2CLength, KBD_I2C_DATA_LEN));
+		g_I2CReadCallback();
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+uint16_t hal_host_get_i2c_length(void)
+{
+	return (g_I2CState == I2C_IDLE) ? 0 : g_I2CLength;
+}
+
+// USB
+
+void hal_usb_start(void)
+{
+	// Enumerated at once
+	hid_keyboard_enable_callback();
+	hid_multimedia_enable_callback();
+}
+
+uint16_t hal_usb_frame_number(void)
+{
+	return g_frame;
+}
+
+void hal_host_set_frame(uint16_t frame)
+{
+	g_frame = frame & 0x7FF;
+}
+
+static void endpoint_send(struct host_endpoint* ep)
+{
+	if (!ep->report_valid || ep->num_banks == 2)
+	{
+		return;
+	}
+
+	memcpy(ep->banks[(ep->first_bank + ep->num_banks) % 2], ep->report, HAL_HOST_REPORT_SIZE);
+	ep->num_banks++;
+	ep->report_valid = false;
+
+	if (ep == &g_endpoints[HAL_HOST_KEYBOARD])
+	{
+		PROFILE_MARK(PROFILE_REPORT_ARMED);
+		TRACE(TRACE_KBD_ARMED, 0);
+	}
+	else if (ep == &g_endpoints[HAL_HOST_MULTIMEDIA])
+	{
+		TRACE(TRACE_MEDIA_ARMED, 0);
+	}
+}
+
+static void endpoint_update(struct host_endpoint* ep, const uint8_t* report)
+{
+	if (memcmp(ep->report, report, HAL_HOST_REPORT_SIZE) != 0)
+	{
+		if (ep->report_valid)
+		{
+			ep->superseded++;
+		}
+		memcpy(ep->report, report, HAL_HOST_REPORT_SIZE);
+		ep->report_valid = true;
+		endpoint_send(ep);
+	}
+}
+
+bool hal_host_poll(enum hal_host_interface iface, uint8_t* report)
+{
+	struct host_endpoint* ep = &g_endpoints[iface];
+	if (ep->num_banks == 0)
+	{
+		return false;
+	}
+
+	memcpy(report, ep->banks[ep->first_bank], HAL_HOST_REPORT_SIZE);
+	ep->first_bank ^= 1;
+	ep->num_banks--;
+
+	if (iface == HAL_HOST_KEYBOARD)
+	{
+		hid_keyboard_report_sent_callback();
+	}
+	endpoint_send(ep);
+	return true;
+}
+
+unsigned hal_host_get_queue_depth(enum hal_host_interface iface)
+{
+	return g_endpoints[iface].num_banks + g_endpoints[iface].report_valid;
+}
+
+uint32_t hal_host_get_superseded(enum hal_host_interface iface)
+{
+	return g_endpoints[iface].superseded;
+}
+
+void hal_hid_kbd_send(uint8_t modifiers, uint8_t* keys)
+{
+	uint8_t report[HAL_HOST_REPORT_SIZE] = { modifiers, 0 };
+	memcpy(&report[2], keys, HAL_HOST_REPORT_SIZE - 2);
+	endpoint_update(&g_endpoints[HAL_HOST_KEYBOARD], report);
+}
+
+bool hal_hid_kbd_is_report_pending(void)
+{
+	return g_endpoints[HAL_HOST_KEYBOARD].report_valid;
+}
+
+void hal_hid_kbd_idle_tick(void)
+{
+	// Idle rate 0, as set by hosts in report protocol
+}
+
+void hal_hid_multimedia_send(const uint16_t* usages)
+{
+	uint8_t report[HAL_HOST_REPORT_SIZE];
+	for (unsigned i = 0; i < UDI_HID_MULTIMEDIA_MAX_USAGES; i++)
+	{
+		report[2 * i] = usages[i];
+		report[2 * i + 1] = usages[i] >> 8;
+	}
+	endpoint_update(&g_endpoints[HAL_HOST_MULTIMEDIA], report);
+}
+
+void hal_hid_multimedia_idle_tick(void)
+{
+}
+
+// Host tools
+
+bool hal_host_load_keymap(const char* path)
+{
+	FILE* f = fopen(path, "rb");
+	if (f == NULL)
+	{
+		perror(path);
+		return false;
+	}
+	const size_t length = fread(g_keymap, 1, sizeof(g_keymap), f);
+	fclose(f);
+
+	// Read in place, so the blob stays in g_keymap
+	if (!keymap_load(g_keymap, length))
+	{
+		fprintf(stderr, "%s: not a valid keymap\n", path);
+		return false;
+	}
+	return true;
+}
+
+int hal_host_compare_u32(const void* a, const void* b)
+{
+	const uint32_t x = *(const uint32_t*)a;
+	const uint32_t y = *(const uint32_t*)b;
+	return (x > y) - (x < y);
+}
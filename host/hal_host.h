@@ -0,0 +1,66 @@
+#ifndef HAL_HOST_H_
+#define HAL_HOST_H_
+
+#include "hal.h"
+
+// Simulation side of the host HAL. The test program plays the switches, the
+// scan timer, the peripheral half and the USB host, in that order or any
+// other, and sees the reports exactly as the host would take them.
+
+enum hal_host_interface
+{
+	HAL_HOST_KEYBOARD,
+	HAL_HOST_MULTIMEDIA,
+	HAL_HOST_NUM_INTERFACES
+};
+
+// Keyboard report: modifiers, reserved, 6 keys. Consumer report: 4 usages.
+#define HAL_HOST_REPORT_SIZE 8
+
+void hal_host_init(void);
+
+// Switch states seen by the following scans
+void hal_host_set_key(unsigned row, unsigned col, bool pressed);
+
+// Runs the scan interrupt
+void hal_host_scan(void);
+
+// USB frame counter, 1 ms
+void hal_host_set_frame(uint16_t frame);
+
+// Microsecond time; runs the alarm when reached
+void hal_host_set_time(uint32_t time);
+
+// Host polls an interrupt IN endpoint: takes the oldest report queued on it
+// and completes the transfer. Returns false when nothing is queued.
+bool hal_host_poll(enum hal_host_interface iface, uint8_t* report);
+
+// Reports waiting on an endpoint: the armed banks and a changed report
+// behind them. Superseded reports changed again before they were armed, so
+// the host never saw them.
+unsigned hal_host_get_queue_depth(enum hal_host_interface iface);
+uint32_t hal_host_get_superseded(enum hal_host_interface iface);
+
+// Host sets the keyboard LEDs (SET_REPORT)
+void hal_host_set_leds(uint8_t leds);
+uint16_t hal_host_get_led_level(void);
+
+// Peripheral half: presence on the ID pin and the key data it returns. The
+// ADC conversion and I2C transfers started by the firmware stay pending
+// until completed here; false when none is pending.
+void hal_host_set_peripheral(bool connected, const uint8_t* data);
+bool hal_host_complete_adc(void);
+bool hal_host_complete_i2c(void);
+
+// Bytes of the pending I2C transfer, 0 when none, to time its completion
+uint16_t hal_host_get_i2c_length(void);
+
+// Loads a blob written by tools/keymap_compiler.py --blob in place of the
+// default keymap. The blob is kept here and read in place, as from a keymap
+// store slot. False, with a message, when it can't be read or is invalid.
+bool hal_host_load_keymap(const char* path);
+
+// qsort order of uint32_t values, for the percentiles of the host tools
+int hal_host_compare_u32(const void* a, const void* b);
+
+#endif /* HAL_HOST_H_ */
@@ -0,0 +1,47 @@
+#ifndef HOST_PLATFORM_H_
+#define HOST_PLATFORM_H_
+
+// The parts of ASF the keyboard logic relies on, for the host build. The
+// simulation is single threaded: "interrupts" are plain calls made by the
+// test program between scans, so critical sections have nothing to do.
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// The matrix driver of the cycle benchmark brings ASF's compiler.h, which
+// has these already
+#ifndef UTILS_COMPILER_H_INCLUDED
+#define UNUSED(v)   ((void)(v))
+#define Assert(e)   assert(e)
+
+#define Min(a, b)   (((a) < (b)) ? (a) : (b))
+#define Max(a, b)   (((a) > (b)) ? (a) : (b))
+#define min(a, b)   Min(a, b)
+#define max(a, b)   Max(a, b)
+#endif
+
+static inline void system_interrupt_enter_critical_section(void)
+{
+}
+
+static inline void system_interrupt_leave_critical_section(void)
+{
+}
+
+#ifndef UTILS_COMPILER_H_INCLUDED
+typedef uint32_t irqflags_t;
+
+static inline irqflags_t cpu_irq_save(void)
+{
+	return 0;
+}
+
+static inline void cpu_irq_restore(irqflags_t flags)
+{
+	(void)flags;
+}
+#endif
+
+#endif /* HOST_PLATFORM_H_ */
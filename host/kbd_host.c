@@ -0,0 +1,657 @@
+// Smoke test of the host build: a few keys through the whole pipeline, from
+// the switch matrix to the reports the host takes.
+
+#include "hal.h"
+#include "hal_host.h"
+#include "key_stats.h"
+#include "keyboard.h"
+#include "keyboard_debounce.h"
+#include "keymap.h"
+#include "keymap_store.h"
+#include "nvm_flash.h"
+#include "settings.h"
+#include "timebase.h"
+
+#include <stdio.h>
+
+// Defined by keyboard.c, called by the USB stack on the board (conf_usb.h)
+void hid_keyboard_disable_callback(void);
+void hid_multimedia_disable_callback(void);
+
+#define HID_LSHIFT_MODIFIER 0x02
+#define HID_KEY_A           0x04
+#define HID_KEY_B           0x05
+#define HID_KEY_C           0x06
+#define HID_KEY_X           0x1B
+#define HID_AL_CALCULATOR   0x0192
+
+static unsigned g_failures = 0;
+
+// Usages coming down in the keyboard reports, in order, and the last
+// consumer usage reported
+static uint8_t g_typed[8];
+static unsigned g_numTyped = 0;
+static uint16_t g_mediaUsage = 0;
+
+static struct deadline g_deadlines[3];
+static unsigned g_deadlineOrder = 0;
+
+// Each callback appends its number to the order
+static void deadline_0(void)
+{
+	g_deadlineOrder = g_deadlineOrder * 10 + 1;
+}
+
+static void deadline_1(void)
+{
+	g_deadlineOrder = g_deadlineOrder * 10 + 2;
+}
+
+static void deadline_2(void)
+{
+	// Rescheduled from its own callback
+	g_deadlineOrder = g_deadlineOrder * 10 + 3;
+	if (g_deadlineOrder < 1000)
+	{
+		deadline_schedule(&g_deadlines[2], g_deadlines[2].time + 500, deadline_2);
+	}
+}
+
+static void check(bool ok, const char* what)
+{
+	printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+	if (!ok)
+	{
+		g_failures++;
+	}
+}
+
+// Levels of a key through the debounce filter alone, one scan per character
+// of the raw levels
+static bool debounce_levels(enum debounce_mode mode, uint8_t ticks, const char* raw, const char* expected)
+{
+	debounce_init();
+	debounce_configure(mode, ticks);
+	bool ok = true;
+	for (unsigned i = 0; raw[i] != 0; i++)
+	{
+		matrix_row_t matrix[NUM_ROWS] = { 0 };
+		matrix[0] = raw[i] == '1';
+		debounce_matrix(matrix);
+		ok = ok && (matrix[0] != 0) == (expected[i] == '1');
+	}
+	debounce_init();
+	return ok;
+}
+
+// Copy of a keymap blob with one byte changed and its CRC fixed up
+static uint16_t alter_blob(uint8_t* copy, const uint8_t* blob, uint16_t offset, uint8_t value)
+{
+	const uint16_t length = blob[8] | (blob[9] << 8);
+	memcpy(copy, blob, length);
+	copy[offset] = value;
+
+	const uint32_t crc = keymap_crc32(copy, length - 4);
+	for (unsigned i = 0; i < 4; i++)
+	{
+		copy[length - 4 + i] = crc >> (8 * i);
+	}
+	return length;
+}
+
+static uint16_t alter_keymap(uint8_t* copy, uint16_t offset, uint8_t value)
+{
+	uint16_t length;
+	return alter_blob(copy, keymap_get_default(&length), offset, value);
+}
+
+// Only the structure checks can reject these
+static bool parse_altered_blob(const uint8_t* blob, uint16_t offset, uint8_t value)
+{
+	uint8_t copy[KEYMAP_MAX_SIZE];
+	const uint16_t length = alter_blob(copy, blob, offset, value);
+	struct keymap keymap;
+	return keymap_parse(copy, length, &keymap);
+}
+
+static bool parse_altered_keymap(uint16_t offset, uint8_t value)
+{
+	uint16_t length;
+	return parse_altered_blob(keymap_get_default(&length), offset, value);
+}
+
+// Offset of the low byte of a key of layer 0 in a blob
+static uint16_t key_offset(const uint8_t* blob, unsigned row, unsigned col)
+{
+	const uint16_t layer = blob[KEYMAP_HEADER_SIZE] | (blob[KEYMAP_HEADER_SIZE + 1] << 8);
+	const uint16_t bitmap = blob[layer + 2 * row] | (blob[layer + 2 * row + 1] << 8);
+	unsigned index = blob[layer + 2 * NUM_ROWS + row];
+	for (unsigned c = 0; c < col; c++)
+	{
+		index += (bitmap >> c) & 1;
+	}
+	return layer + 2 * NUM_ROWS + ((NUM_ROWS + 1) & ~1) + 2 * index;
+}
+
+// One scan period: the scan, the peripheral transfers it starts, then the
+// host polls of both endpoints
+static void step(uint8_t* keyboard_report);
+static bool report_has_key(const uint8_t* report, uint8_t usage);
+
+// Runs scans and the store until the upload or reset in progress ends
+static enum keymap_store_status run_keymap_store(uint8_t* report)
+{
+	for (unsigned i = 0; i < 100; i++)
+	{
+		step(report);
+		keymap_store_task();
+		const enum keymap_store_status status = keymap_store_get_status();
+		if (status == KEYMAP_STORE_DONE || status == KEYMAP_STORE_FAILED)
+		{
+			step(report);
+			return status;
+		}
+	}
+	return keymap_store_get_status();
+}
+
+// Sends the first length bytes of a blob as the vendor interface would: in
+// chunks, each waiting until the store takes it
+static bool upload_keymap(const uint8_t* blob, uint16_t length, uint16_t sent, uint8_t* report)
+{
+	if (!keymap_store_begin(length))
+	{
+		return false;
+	}
+
+	for (uint16_t offset = 0; offset < sent; offset += KEYMAP_STORE_CHUNK_SIZE)
+	{
+		while (!keymap_store_is_write_ready())
+		{
+			step(report);
+			keymap_store_task();
+		}
+		if (!keymap_store_write(offset, blob + offset, min(sent - offset, KEYMAP_STORE_CHUNK_SIZE)))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Reboot: the default keymap, then the newest valid slot
+static void reload_keymap(void)
+{
+	keymap_init();
+	keymap_store_init();
+}
+
+static void step(uint8_t* keyboard_report)
+{
+	hal_host_scan();
+	while (hal_host_complete_adc() || hal_host_complete_i2c())
+	{
+	}
+
+	uint8_t report[HAL_HOST_REPORT_SIZE];
+	while (hal_host_poll(HAL_HOST_KEYBOARD, report))
+	{
+		for (unsigned i = 2; i < HAL_HOST_REPORT_SIZE; i++)
+		{
+			if (report[i] != 0 && !report_has_key(keyboard_report, report[i]) && g_numTyped < sizeof(g_typed))
+			{
+				g_typed[g_numTyped++] = report[i];
+			}
+		}
+		memcpy(keyboard_report, report, sizeof(report));
+	}
+	while (hal_host_poll(HAL_HOST_MULTIMEDIA, report))
+	{
+		if (report[0] != 0 || report[1] != 0)
+		{
+			g_mediaUsage = report[0] | (report[1] << 8);
+		}
+	}
+}
+
+// Taps a key, on the Fn layer if fn, for a few scans each way
+static void tap_key(bool fn, unsigned row, unsigned col, uint8_t* report)
+{
+	hal_host_set_key(5, 1, fn);
+	step(report);
+	hal_host_set_key(row, col, true);
+	for (unsigned i = 0; i < 3; i++)
+	{
+		step(report);
+	}
+	hal_host_set_key(row, col, false);
+	hal_host_set_key(5, 1, false);
+	for (unsigned i = 0; i < 3; i++)
+	{
+		step(report);
+	}
+}
+
+static bool report_has_key(const uint8_t* report, uint8_t usage)
+{
+	for (unsigned i = 2; i < HAL_HOST_REPORT_SIZE; i++)
+	{
+		if (report[i] == usage)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// Scans until the settings changed are due and written
+static bool write_settings(uint8_t* report)
+{
+	for (unsigned i = 0; i < 2 * SETTINGS_WRITE_DELAY_MS / KBD_SCAN_PERIOD_MS; i++)
+	{
+		step(report);
+		settings_task();
+		if (!settings_is_pending())
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// Sets the backlight level, written after the delay, then reads the log
+// back as after a reboot
+static uint32_t store_backlight(uint32_t level, uint8_t* report)
+{
+	settings_set(SETTING_BACKLIGHT, level);
+	write_settings(report);
+	settings_init();
+	return settings_get(SETTING_BACKLIGHT);
+}
+
+// Rows of the settings log starting with a header record
+static unsigned settings_rows(void)
+{
+	unsigned rows = 0;
+	for (unsigned r = 0; r < NVM_RWWEE_SIZE / NVM_ROW_SIZE; r++)
+	{
+		rows += g_nvmHostRwwee[r * NVM_ROW_SIZE] == 0xFE;
+	}
+	return rows;
+}
+
+// Offset in the settings log of the backlight record of this level
+static int find_backlight_record(uint32_t level)
+{
+	for (unsigned i = 0; i < NVM_RWWEE_SIZE; i += 8)
+	{
+		const uint8_t* record = &g_nvmHostRwwee[i];
+		if (record[0] == SETTING_BACKLIGHT
+			&& (record[4] | (record[5] << 8) | (record[6] << 16) | ((uint32_t)record[7] << 24)) == level)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+// Fn + G, held until debounced whatever the mode
+static void toggle_gaming(uint8_t* report)
+{
+	hal_host_set_key(5, 1, true);
+	for (unsigned i = 0; i < 10; i++)
+	{
+		step(report);
+	}
+	hal_host_set_key(3, 5, true);
+	for (unsigned i = 0; i < 10; i++)
+	{
+		step(report);
+	}
+	hal_host_set_key(3, 5, false);
+	hal_host_set_key(5, 1, false);
+	for (unsigned i = 0; i < 10; i++)
+	{
+		step(report);
+	}
+}
+
+// usage: kbd_host [TRACE_KEYMAP]
+//
+// The blob of host/traces/keymap.json, when given, brings the combos whose
+// checks the default keymap can't exercise.
+int main(int argc, char** argv)
+{
+	uint8_t report[HAL_HOST_REPORT_SIZE] = { 0 };
+
+	hal_host_init();
+	timebase_init();
+	configure_pins();
+	nvm_flash_init();
+	settings_init();
+	key_stats_init();
+	configure_keymap();
+	configure_adc();
+	configure_dac();
+	configure_usb_hid();
+	configure_i2c();
+	configure_tc();
+
+	// Left shift + A
+	hal_host_set_key(4, 0, true);
+	step(report);
+	hal_host_set_key(3, 1, true);
+	step(report);
+	check(report[0] == HID_LSHIFT_MODIFIER && report[2] == HID_KEY_A, "shift + A reported");
+
+	hal_host_set_key(3, 1, false);
+	hal_host_set_key(4, 0, false);
+	step(report);
+	check(report[0] == 0 && report[2] == 0, "keys released");
+
+	// Peripheral half, reported once it has been present long enough
+	const uint8_t peripheral[KBD_I2C_DATA_LEN] = { 0, 0, HID_KEY_B };
+	hal_host_set_peripheral(true, peripheral);
+	for (unsigned i = 0; i < 100; i++)
+	{
+		step(report);
+	}
+	check(report[2] == HID_KEY_B, "peripheral key reported");
+
+	// Caps lock LED
+	hal_host_set_leds(KBD_LED_CAPS_LOCK);
+	check(hal_host_get_led_level() == settings_get(SETTING_BACKLIGHT), "caps lock LED lit");
+
+	// Debounce: an eager change locks the key for the next ticks scans, a
+	// deferred one passes once seen for ticks scans after its edge
+	check(debounce_levels(DEBOUNCE_EAGER, 3, "1000011000", "1111000000"), "eager change locked for the debounce time");
+	check(debounce_levels(DEBOUNCE_EAGER, 1, "1010110100", "1110011100"), "eager change locked for a single scan");
+	check(debounce_levels(DEBOUNCE_DEFER, 3, "1111000010", "0001111000"), "deferred change after the debounce time");
+	check(debounce_levels(DEBOUNCE_DEFER, 1, "1101100100", "0111110000"), "deferred change after a single scan");
+
+	// Key statistics: A bounces once after its press and after its release,
+	// both rejected by the eager debounce. The totals are flushed at suspend
+	// and read back as after a reset.
+	static const bool bounce[] = { 1, 0, 1, 1, 1, 1, 1, 0, 1, 0, 0, 0, 0, 0 };
+	debounce_configure(DEBOUNCE_EAGER, DEBOUNCE_TICKS(20));
+	for (unsigned n = 0; n < 3; n++)
+	{
+		for (unsigned i = 0; i < sizeof(bounce) / sizeof(bounce[0]); i++)
+		{
+			hal_host_set_key(3, 1, bounce[i]);
+			step(report);
+		}
+	}
+	struct key_stats stats;
+	key_stats_get(KEY_INDEX(3, 1), &stats);
+	check(stats.presses == 4 && stats.chatter == 6, "key presses and chatter counted");
+
+	key_stats_suspend_callback();
+	for (unsigned i = 0; i < 20; i++)
+	{
+		step(report);
+		key_stats_task();
+	}
+	key_stats_init();
+	key_stats_get(KEY_INDEX(3, 1), &stats);
+	check(key_stats_get_sequence() == 1 && stats.presses == 4 && stats.chatter == 6, "key statistics flushed");
+
+	check(key_stats_reset(), "key statistics reset");
+	for (unsigned i = 0; i < 20; i++)
+	{
+		step(report);
+		key_stats_task();
+	}
+	key_stats_init();
+	key_stats_get(KEY_INDEX(3, 1), &stats);
+	check(key_stats_get_sequence() == 2 && stats.presses == 0 && stats.chatter == 0, "cleared key statistics stored");
+
+	// A saturated chatter count waits for the batch
+	for (unsigned i = 0; i < 300; i++)
+	{
+		key_stats_chatter(KEY_INDEX(3, 1));
+	}
+	for (unsigned i = 0; i < 20; i++)
+	{
+		step(report);
+		key_stats_task();
+	}
+	key_stats_get(KEY_INDEX(3, 1), &stats);
+	check(key_stats_get_sequence() == 2 && stats.chatter == UINT8_MAX, "saturated chatter count not flushed");
+
+	// The flush waits while another client holds the controller
+	check(nvm_flash_acquire(NVM_FLASH_SETTINGS), "controller acquired");
+	key_stats_suspend_callback();
+	for (unsigned i = 0; i < 20; i++)
+	{
+		step(report);
+		key_stats_task();
+	}
+	const bool waited = key_stats_get_sequence() == 2;
+	nvm_flash_release(NVM_FLASH_SETTINGS);
+	for (unsigned i = 0; i < 20; i++)
+	{
+		step(report);
+		key_stats_task();
+	}
+	check(waited && key_stats_get_sequence() == 3, "key statistics flush waits for the controller");
+
+	// Gaming mode reports both edges of a key at the first scan that sees
+	// them, even with the deferred debounce set: it runs eager, so only the
+	// bounces within the debounce time after an edge are ignored
+	settings_set(SETTING_DEBOUNCE_MODE, DEBOUNCE_DEFER);
+	settings_set(SETTING_DEBOUNCE_MS, 20);
+	keyboard_apply_settings();
+	hal_host_set_key(3, 1, true);
+	step(report);
+	check(!report_has_key(report, HID_KEY_A), "deferred press held back");
+	hal_host_set_key(3, 1, false);
+	toggle_gaming(report);
+
+	hal_host_set_key(3, 1, true);
+	step(report);
+	const bool gaming_press = report_has_key(report, HID_KEY_A);
+	for (unsigned i = 0; i < 10; i++)
+	{
+		step(report);
+	}
+	hal_host_set_key(3, 1, false);
+	step(report);
+	check(gaming_press && !report_has_key(report, HID_KEY_A), "gaming press and release reported at the first scan");
+
+	toggle_gaming(report);
+	settings_set(SETTING_DEBOUNCE_MODE, DEBOUNCE_NONE);
+	settings_set(SETTING_DEBOUNCE_MS, 5);
+	keyboard_apply_settings();
+
+	// Settings log: a change is written once no other came for the write
+	// delay, then read back after a reboot
+	settings_set(SETTING_BACKLIGHT, 0x123);
+	step(report);
+	settings_task();
+	check(settings_is_pending() && settings_rows() == 0, "setting change waits for the write delay");
+	check(write_settings(report) && settings_rows() == 1, "setting change written");
+	settings_init();
+	check(settings_get(SETTING_BACKLIGHT) == 0x123 && settings_get(SETTING_DEBOUNCE_MS) == 5, "settings read back after a reboot");
+
+	// Each change takes a page; a full row is compacted into the next one,
+	// which starts with all the values, and then erased
+	uint32_t level = 0;
+	for (unsigned i = 0; i < 8; i++)
+	{
+		level = store_backlight(0x100 + i, report);
+	}
+	check(level == 0x107 && settings_rows() == 1, "settings log compacted");
+
+	// Power lost while a change is written: the page torn in the middle of
+	// a record fails its CRC and the previous value stays
+	settings_set(SETTING_BACKLIGHT, 0x200);
+	write_settings(report);
+	const int torn = find_backlight_record(0x200);
+	if (torn >= 0)
+	{
+		g_nvmHostRwwee[torn + 5] = 0;
+	}
+	settings_init();
+	check(torn >= 0 && settings_get(SETTING_BACKLIGHT) == 0x107, "torn setting write ignored after a reboot");
+	check(store_backlight(0x201, report) == 0x201 && store_backlight(0x202, report) == 0x202, "settings written after a torn page");
+
+	// Power lost during a compaction: before the old row is erased, the new
+	// row wins; before the new row is written, the old one is kept
+	static uint8_t log[NVM_RWWEE_SIZE];
+	memcpy(log, g_nvmHostRwwee, sizeof(log));
+	settings_set(SETTING_BACKLIGHT, 0x203);
+	write_settings(report);
+	for (unsigned r = 0; r < NVM_RWWEE_SIZE; r += NVM_ROW_SIZE)
+	{
+		if (g_nvmHostRwwee[r] == 0xFF)
+		{
+			memcpy(&g_nvmHostRwwee[r], &log[r], NVM_ROW_SIZE);
+		}
+	}
+	settings_init();
+	check(settings_rows() == 2 && settings_get(SETTING_BACKLIGHT) == 0x203, "new row used after a compaction cut short");
+	memcpy(g_nvmHostRwwee, log, sizeof(log));
+	settings_init();
+	check(settings_get(SETTING_BACKLIGHT) == 0x202, "old row used after a compaction cut short");
+	check(store_backlight(0x204, report) == 0x204 && settings_rows() == 1, "settings log compacted after a reboot");
+
+	settings_set(SETTING_BACKLIGHT, KBD_LED_DAC_ON);
+	write_settings(report);
+
+	// Leader sequences of the default keymap, on Fn + Space: C L runs the
+	// calculator, C X matches nothing and is typed in order
+	g_numTyped = 0;
+	tap_key(true, 5, 6, report);
+	tap_key(false, 4, 4, report);
+	tap_key(false, 3, 9, report);
+	check(g_mediaUsage == HID_AL_CALCULATOR && g_numTyped == 0, "leader sequence action");
+	tap_key(true, 5, 6, report);
+	tap_key(false, 4, 4, report);
+	tap_key(false, 4, 3, report);
+	for (unsigned i = 0; i < 5; i++)
+	{
+		step(report);
+	}
+	check(g_numTyped == 2 && g_typed[0] == HID_KEY_C && g_typed[1] == HID_KEY_X
+		&& !report_has_key(report, HID_KEY_X), "unmatched leader sequence typed");
+
+	// Keymap blobs: every row start and layer offset is checked against the
+	// keys before it and the length, and leader trie nodes against the nodes
+	// before them
+	const uint16_t layer0 = KEYMAP_HEADER_SIZE + 2 * NUM_LAYERS;
+	uint16_t length;
+	const uint8_t* blob = keymap_get_default(&length);
+	struct keymap parsed;
+	keymap_parse(blob, length, &parsed);
+	// Leader trie nodes of 10 bytes, right before the macro offsets
+	const uint16_t leader_nodes = parsed.macro_offsets - blob - 10 * blob[16];
+	check(parse_altered_keymap(0, blob[0]), "default keymap parsed");
+	check(!parse_altered_keymap(layer0 + 2 * NUM_ROWS + 2, blob[layer0 + 2 * NUM_ROWS + 2] + 1), "bad row start rejected");
+	check(!parse_altered_keymap(layer0 + 2 * NUM_ROWS, 1), "bad first row start rejected");
+	check(!parse_altered_keymap(KEYMAP_HEADER_SIZE + 2, 0xF0), "bad layer offset rejected");
+	check(!parse_altered_keymap(5, NUM_LAYERS + 1), "too many layers rejected");
+	check(!parse_altered_keymap(leader_nodes + 10 + 6, 1), "leader node looping on itself rejected");
+	check(!parse_altered_keymap(leader_nodes + 8, 5), "leader node children out of the trie rejected");
+
+	// Combos: 2 to COMBO_MAX_KEYS keys of the matrix as row masks, and the
+	// combo masks of the keys holding the same keys. The trace keymap has
+	// one, J + K: row 3, columns 7 and 8.
+	if (argc > 1)
+	{
+		check(hal_host_load_keymap(argv[1]), "trace keymap loaded");
+		uint16_t traces_length;
+		uint8_t traces[KEYMAP_MAX_SIZE];
+		const uint8_t* loaded = keymap_get_blob(&traces_length);
+		memcpy(traces, loaded, traces_length);
+		keymap_load(blob, length);
+		keymap_parse(traces, traces_length, &parsed);
+		const uint16_t row3 = parsed.combos - traces + 2 + 2 * 3;
+		const uint16_t key_combos = parsed.combos - traces + 2 + 2 * NUM_ROWS;
+		check(parsed.num_combos == 1 && traces[row3] == 0x80 && traces[row3 + 1] == 0x01
+			&& parse_altered_blob(traces, 0, traces[0]), "trace keymap parsed");
+		check(!parse_altered_blob(traces, row3 + 1, 0x81), "combo key out of the matrix rejected");
+		check(!parse_altered_blob(traces, row3, 0x00), "combo of a single key rejected");
+		check(!parse_altered_blob(traces, row3 - 2, 0x01), "combo key without its combo mask rejected");
+		check(!parse_altered_blob(traces, key_combos + 3 * NUM_ROWS, 0x03), "combo mask of a missing combo rejected");
+
+		// Its leader trie: C and E after the leader key, A and L after C,
+		// each pair sorted by key
+		const uint16_t traces_leader = parsed.macro_offsets - traces - 10 * traces[16];
+		check(traces[traces_leader + 10 * 3] == 0x04 && traces[traces_leader + 10 * 4] == 0x0F,
+			"leader children sorted");
+		check(!parse_altered_blob(traces, traces_leader + 10 * 3, 0x10), "leader children out of order rejected");
+	}
+
+	// Keymap store: an upload with B in place of A is written while it is
+	// received, checked in flash, swapped in and read in place after a reboot
+	uint8_t keymap_b[KEYMAP_MAX_SIZE];
+	uint8_t keymap_c[KEYMAP_MAX_SIZE];
+	const uint16_t a = key_offset(blob, 3, 1);
+	alter_keymap(keymap_b, a, HID_KEY_B);
+	alter_keymap(keymap_c, a, HID_KEY_C);
+	check(keymap_get_key(0, 3, 1) == HID_KEY_A, "default keymap active");
+	check(upload_keymap(keymap_b, length, length, report) && keymap_store_commit()
+		&& run_keymap_store(report) == KEYMAP_STORE_DONE, "keymap uploaded");
+	uint16_t active_length;
+	const uint8_t* active = keymap_get_blob(&active_length);
+	check(keymap_get_key(0, 3, 1) == HID_KEY_B && keymap_store_get_sequence() == 1
+		&& active != keymap_b && memcmp(active, keymap_b, length) == 0, "uploaded keymap active in flash");
+	reload_keymap();
+	check(keymap_get_key(0, 3, 1) == HID_KEY_B && keymap_store_get_sequence() == 1, "uploaded keymap kept over a reboot");
+
+	// Chunks out of order or across a flash page are refused
+	check(keymap_store_begin(length) && !keymap_store_write(KEYMAP_STORE_CHUNK_SIZE, keymap_c, 1)
+		&& !keymap_store_write(0, keymap_c, NVM_PAGE_SIZE + 1), "bad chunks refused");
+
+	// Power lost in the middle of an upload: the slot has no footer
+	check(upload_keymap(keymap_c, length, length / 2, report), "half an upload written");
+	for (unsigned i = 0; i < 10; i++)
+	{
+		step(report);
+		keymap_store_task();
+	}
+	reload_keymap();
+	check(keymap_get_key(0, 3, 1) == HID_KEY_B && keymap_store_get_sequence() == 1, "torn upload ignored after a reboot");
+
+	// A blob damaged on the way fails its CRC in flash and never gets a footer
+	keymap_c[a + 1] ^= 0x10;
+	check(upload_keymap(keymap_c, length, length, report) && keymap_store_commit()
+		&& run_keymap_store(report) == KEYMAP_STORE_FAILED, "bad CRC refused");
+	check(keymap_get_key(0, 3, 1) == HID_KEY_B, "keymap kept after a bad CRC");
+	reload_keymap();
+	check(keymap_get_key(0, 3, 1) == HID_KEY_B && keymap_store_get_sequence() == 1, "bad CRC ignored after a reboot");
+
+	// Back to the default, stored as the newest slot
+	check(keymap_store_reset() && run_keymap_store(report) == KEYMAP_STORE_DONE
+		&& keymap_get_key(0, 3, 1) == HID_KEY_A && keymap_store_get_sequence() == 2, "default keymap stored");
+	reload_keymap();
+	check(keymap_get_key(0, 3, 1) == HID_KEY_A && keymap_store_get_sequence() == 2, "default keymap kept over a reboot");
+
+	// With both interfaces disabled, a keymap staged earlier is applied
+	// before the stored one, which the store waits for
+	hid_keyboard_disable_callback();
+	hid_multimedia_disable_callback();
+	check(keymap_stage(keymap_b, length) && keymap_store_reset() && run_keymap_store(report) == KEYMAP_STORE_DONE,
+		"keymap stored with another one staged");
+	hal_usb_start();
+	step(report);
+	check(keymap_get_key(0, 3, 1) == HID_KEY_A && !keymap_is_staged() && keymap_store_get_sequence() == 3,
+		"stored keymap applied after the staged one");
+
+	// Deadlines on the timebase alarm, across the wrap of the count
+	const uint32_t start = 0xFFFFF000;
+	hal_host_set_time(start);
+	deadline_schedule(&g_deadlines[0], start + 3000, deadline_0);
+	deadline_schedule(&g_deadlines[1], start + 1000, deadline_1);
+	deadline_schedule(&g_deadlines[2], start + 2000, deadline_2);
+	hal_host_set_time(start + 999);
+	check(g_deadlineOrder == 0 && now() == start + 999, "no deadline before its time");
+	hal_host_set_time(start + 1000);
+	check(g_deadlineOrder == 2, "first deadline");
+	deadline_cancel(&g_deadlines[0]);
+	hal_host_set_time(start + 10000);
+	check(g_deadlineOrder == 2333 && !deadline_is_scheduled(&g_deadlines[2]), "deadlines in order, cancelled one skipped");
+
+	return g_failures == 0 ? 0 : 1;
+}
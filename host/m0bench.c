@@ -0,0 +1,338 @@
+// Cycle counts of firmware functions on the Cortex-M0+: loads kbd_bench.elf
+// (host/bench_target.c with the keyboard sources, built with the ARM
+// toolchain) into the instruction set simulator of host/m0sim.c and times
+// the scan and the callbacks from a known state. Counts with wait states
+// assume every new flash word is fetched from the NVM (no cache). The key
+// matrix is read by the board driver (src/hal_samd21_matrix.c) from a model
+// of the PORT registers, with the keys of bench_matrix held.
+//
+// usage: kbd_cycles ELF [--wait-states N] [--csv] [--baseline CSV [--tolerance PCT]]
+//
+// With --baseline, a previous --csv output, a benchmark taking more cycles
+// than the baseline plus the tolerance (default 2%) fails the run, and so
+// does one missing from the baseline: the cycles_baseline target records it.
+
+#include "keyboard.h"
+#include "keyboard_i2c.h"
+#include "m0sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FLASH_SIZE       0x40000 // As host/bench.ld
+#define RAM_SIZE         0x8000
+#define MAX_INSTRUCTIONS 10000000
+
+#define PORT_BASE       0x41004400
+#define PORT_GROUP_SIZE 0x80
+#define NUM_PORT_GROUPS 2
+
+enum port_register
+{
+	PORT_DIR = 0x00,
+	PORT_DIRCLR = 0x04,
+	PORT_DIRSET = 0x08,
+	PORT_DIRTGL = 0x0C,
+	PORT_OUT = 0x10,
+	PORT_OUTCLR = 0x14,
+	PORT_OUTSET = 0x18,
+	PORT_OUTTGL = 0x1C,
+	PORT_IN = 0x20
+};
+
+struct port_model
+{
+	uint32_t dir[NUM_PORT_GROUPS];
+	uint32_t out[NUM_PORT_GROUPS];
+	uint32_t matrix;  // Address of bench_matrix in the target
+};
+
+enum bench_keys
+{
+	KEYS_PRESSED,   // Pressed at the call
+	KEYS_HELD       // Held for a few scans before
+};
+
+struct benchmark
+{
+	const char* name;
+	const char* function;
+	unsigned keys;
+	enum bench_keys state;
+	unsigned num_args;
+	uint32_t args[3];
+	const char* pointer_arg; // Symbol passed after args
+};
+
+static const struct benchmark BENCHMARKS[] = {
+	{ "scan_idle", "keyboard_scan", 0, KEYS_HELD },
+	{ "scan_press_6", "keyboard_scan", 6, KEYS_PRESSED },
+	{ "scan_held_6", "keyboard_scan", 6, KEYS_HELD },
+	{ "scan_press_20", "keyboard_scan", 20, KEYS_PRESSED },
+	{ "scan_held_20", "keyboard_scan", 20, KEYS_HELD },
+	{ "send_reports_6", "keyboard_send_reports", 6, KEYS_HELD },
+	{ "report_sent", "hid_keyboard_report_sent_callback", 6, KEYS_HELD },
+	{ "i2c_data_callback", "i2c_data_callback", 0, KEYS_HELD, 1, { KBD_I2C_REG_KEY_DATA }, "bench_buffer" },
+	{ "i2c_write_callback", "i2c_write_callback", 0, KEYS_HELD, 1, { KBD_I2C_REG_IND_LED } },
+	{ "keymap_get_key", "keymap_get_key", 0, KEYS_HELD, 3, { 0, 3, 1 } },
+};
+
+#define NUM_BENCHMARKS (sizeof(BENCHMARKS) / sizeof(BENCHMARKS[0]))
+
+struct bench_result
+{
+	struct m0sim_stats stats;
+	uint32_t stack;
+};
+
+// Pins read high through their pull-ups, except the columns of the keys held
+// on a row driven low
+static uint32_t port_input(struct m0sim* sim, const struct port_model* port, unsigned group)
+{
+	uint32_t in = 0xFFFFFFFF;
+	for (unsigned r = 0; r < NUM_ROWS; r++)
+	{
+		const uint32_t row_pin = 1u << (ROWMAP[r] & 0x1f);
+		if ((ROWMAP[r] >> 5) >= NUM_PORT_GROUPS || (port->dir[ROWMAP[r] >> 5] & row_pin) == 0
+			|| (port->out[ROWMAP[r] >> 5] & row_pin) != 0)
+		{
+			continue;
+		}
+
+		const uint32_t address = port->matrix + r * sizeof(uint16_t);
+		const uint16_t keys = m0sim_read32(sim, address & ~3u) >> ((address & 2) * 8);
+		for (unsigned c = 0; c < NUM_COLS; c++)
+		{
+			if ((keys & (1 << c)) != 0 && (COLMAP[c] >> 5) == group)
+			{
+				in &= ~(1u << (COLMAP[c] & 0x1f));
+			}
+		}
+	}
+	return in;
+}
+
+// DIR, OUT and IN of the PORT groups; the pin configuration is plain memory
+static bool port_io(struct m0sim* sim, uint32_t address, unsigned size, bool store, uint32_t* value)
+{
+	struct port_model* port = sim->io_context;
+	if (address < PORT_BASE || address >= PORT_BASE + NUM_PORT_GROUPS * PORT_GROUP_SIZE || size != 4)
+	{
+		return false;
+	}
+
+	const unsigned group = (address - PORT_BASE) / PORT_GROUP_SIZE;
+	const unsigned offset = (address - PORT_BASE) % PORT_GROUP_SIZE;
+	if (offset == PORT_IN)
+	{
+		if (!store)
+		{
+			*value = port_input(sim, port, group);
+		}
+		return true;
+	}
+	if (offset > PORT_OUTTGL || (offset & 3) != 0)
+	{
+		return false;
+	}
+
+	// DIR and OUT, each followed by its clear, set and toggle registers
+	uint32_t* reg = (offset < PORT_OUT) ? &port->dir[group] : &port->out[group];
+	if (!store)
+	{
+		*value = *reg;
+		return true;
+	}
+	switch (offset & 0xC)
+	{
+	case PORT_DIR:
+		*reg = *value;
+		break;
+	case PORT_DIRCLR:
+		*reg &= ~*value;
+		break;
+	case PORT_DIRSET:
+		*reg |= *value;
+		break;
+	case PORT_DIRTGL:
+		*reg ^= *value;
+		break;
+	}
+	return true;
+}
+
+static bool call(struct m0sim* sim, const char* function, const uint32_t* args, unsigned num_args)
+{
+	const uint32_t address = m0sim_symbol(sim, function);
+	if (address == 0)
+	{
+		fprintf(stderr, "%s: no such symbol\n", function);
+		return false;
+	}
+	if (!m0sim_call(sim, address, args, num_args, M0SIM_RAM_BASE + RAM_SIZE, MAX_INSTRUCTIONS))
+	{
+		fprintf(stderr, "%s: %s at %08x\n", function, sim->fault, (unsigned)sim->r[15]);
+		return false;
+	}
+	return true;
+}
+
+static bool scan(struct m0sim* sim)
+{
+	return call(sim, "keyboard_scan", NULL, 0) && call(sim, "bench_poll", NULL, 0);
+}
+
+static bool run(const char* elf, const struct benchmark* b, struct bench_result* result)
+{
+	// A fresh image for each, so no benchmark sees the state of another
+	struct m0sim sim;
+	bool ok = m0sim_init(&sim, FLASH_SIZE, RAM_SIZE) && m0sim_load_elf(&sim, elf);
+	if (!ok)
+	{
+		fprintf(stderr, "%s: cannot load\n", elf);
+	}
+
+	struct port_model port = { .matrix = m0sim_symbol(&sim, "bench_matrix") };
+	sim.io = port_io;
+	sim.io_context = &port;
+
+	uint32_t keys = (b->state == KEYS_HELD) ? b->keys : 0;
+	ok = ok && call(&sim, "bench_setup", NULL, 0) && call(&sim, "bench_hold_keys", &keys, 1);
+	for (unsigned i = 0; ok && i < 3; i++)
+	{
+		ok = scan(&sim);
+	}
+	keys = b->keys;
+	ok = ok && call(&sim, "bench_hold_keys", &keys, 1);
+
+	uint32_t args[4];
+	unsigned num_args = b->num_args;
+	memcpy(args, b->args, sizeof(b->args));
+	if (b->pointer_arg != NULL)
+	{
+		args[num_args++] = m0sim_symbol(&sim, b->pointer_arg);
+	}
+
+	ok = ok && call(&sim, b->function, args, num_args);
+	result->stats = sim.stats;
+	result->stack = M0SIM_RAM_BASE + RAM_SIZE - sim.stats.min_sp;
+	m0sim_free(&sim);
+	return ok;
+}
+
+// Cycles with wait states of a benchmark in a --csv output, 0 when absent
+static uint64_t baseline_cycles(const char* path, const char* name)
+{
+	FILE* f = fopen(path, "r");
+	if (f == NULL)
+	{
+		perror(path);
+		exit(2);
+	}
+
+	char line[256];
+	uint64_t cycles = 0;
+	while (fgets(line, sizeof(line), f) != NULL)
+	{
+		const size_t length = strlen(name);
+		unsigned long long instructions, base, with_wait_states;
+		if (strncmp(line, name, length) == 0 && line[length] == ','
+			&& sscanf(line + length + 1, "%llu,%llu,%llu", &instructions, &base, &with_wait_states) == 3)
+		{
+			cycles = with_wait_states;
+		}
+	}
+	fclose(f);
+	return cycles;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: kbd_cycles ELF [--wait-states N] [--csv] [--baseline CSV [--tolerance PCT]]\n");
+	exit(2);
+}
+
+int main(int argc, char** argv)
+{
+	const char* elf = NULL;
+	const char* baseline = NULL;
+	unsigned wait_states = 2;
+	unsigned tolerance = 2;
+	bool csv = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--wait-states") == 0 && i + 1 < argc)
+		{
+			wait_states = strtoul(argv[++i], NULL, 0);
+		}
+		else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+		{
+			baseline = argv[++i];
+		}
+		else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc)
+		{
+			tolerance = strtoul(argv[++i], NULL, 0);
+		}
+		else if (strcmp(argv[i], "--csv") == 0)
+		{
+			csv = true;
+		}
+		else if (argv[i][0] != '-' && elf == NULL)
+		{
+			elf = argv[i];
+		}
+		else
+		{
+			usage();
+		}
+	}
+	if (elf == NULL)
+	{
+		usage();
+	}
+
+	if (csv)
+	{
+		printf("benchmark,instructions,cycles,cycles_%uws,stack\n", wait_states);
+	}
+	else
+	{
+		printf("# %u flash wait states, no NVM cache\n", wait_states);
+		printf("%-20s %12s %8s %10s %6s\n", "benchmark", "instructions", "cycles", "cycles_ws", "stack");
+	}
+
+	int status = 0;
+	for (unsigned i = 0; i < NUM_BENCHMARKS; i++)
+	{
+		struct bench_result r;
+		if (!run(elf, &BENCHMARKS[i], &r))
+		{
+			status = 1;
+			continue;
+		}
+
+		const uint64_t cycles = m0sim_cycles(&r.stats, wait_states);
+		printf(csv ? "%s,%llu,%llu,%llu,%u\n" : "%-20s %12llu %8llu %10llu %6u\n", BENCHMARKS[i].name,
+			(unsigned long long)r.stats.instructions, (unsigned long long)r.stats.cycles,
+			(unsigned long long)cycles, (unsigned)r.stack);
+
+		if (baseline != NULL)
+		{
+			const uint64_t limit = baseline_cycles(baseline, BENCHMARKS[i].name);
+			if (limit == 0)
+			{
+				fprintf(stderr, "%s: not in the baseline\n", BENCHMARKS[i].name);
+				status = 1;
+			}
+			else if (cycles * 100 > limit * (100 + tolerance))
+			{
+				fprintf(stderr, "%s: %llu cycles, baseline %llu\n", BENCHMARKS[i].name,
+					(unsigned long long)cycles, (unsigned long long)limit);
+				status = 1;
+			}
+		}
+	}
+	return status;
+}
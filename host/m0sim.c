@@ -0,0 +1,813 @@
+#include "m0sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Returning to this address ends a call
+#define RETURN_ADDRESS 0xFFFFFFFE
+
+#define PAGE_SIZE 4096
+
+// Memory outside flash and RAM, allocated as it is written
+struct m0sim_page
+{
+	struct m0sim_page* next;
+	uint32_t address;
+	uint8_t data[PAGE_SIZE];
+};
+
+struct m0sim_symbol
+{
+	char* name;
+	uint32_t value;
+};
+
+bool m0sim_init(struct m0sim* sim, uint32_t flash_size, uint32_t ram_size)
+{
+	memset(sim, 0, sizeof(*sim));
+	sim->flash = calloc(1, flash_size);
+	sim->ram = calloc(1, ram_size);
+	sim->flash_size = flash_size;
+	sim->ram_size = ram_size;
+	return sim->flash != NULL && sim->ram != NULL;
+}
+
+void m0sim_free(struct m0sim* sim)
+{
+	while (sim->pages != NULL)
+	{
+		struct m0sim_page* next = sim->pages->next;
+		free(sim->pages);
+		sim->pages = next;
+	}
+	for (unsigned i = 0; i < sim->num_symbols; i++)
+	{
+		free(sim->symbols[i].name);
+	}
+	free(sim->symbols);
+	free(sim->flash);
+	free(sim->ram);
+}
+
+// Memory
+
+static uint8_t* page_byte(struct m0sim* sim, uint32_t address, bool allocate)
+{
+	const uint32_t base = address & ~(PAGE_SIZE - 1);
+	for (struct m0sim_page* page = sim->pages; page != NULL; page = page->next)
+	{
+		if (page->address == base)
+		{
+			return &page->data[address - base];
+		}
+	}
+	if (!allocate)
+	{
+		return NULL;
+	}
+
+	struct m0sim_page* page = calloc(1, sizeof(*page));
+	page->address = base;
+	page->next = sim->pages;
+	sim->pages = page;
+	return &page->data[address - base];
+}
+
+static inline bool in_flash(const struct m0sim* sim, uint32_t address)
+{
+	return address - M0SIM_FLASH_BASE < sim->flash_size;
+}
+
+static inline bool in_ram(const struct m0sim* sim, uint32_t address)
+{
+	return address - M0SIM_RAM_BASE < sim->ram_size;
+}
+
+static uint32_t load(struct m0sim* sim, uint32_t address, unsigned size)
+{
+	if (address & (size - 1))
+	{
+		sim->fault = "unaligned load";
+		return 0;
+	}
+
+	const uint8_t* p;
+	if (in_flash(sim, address))
+	{
+		sim->stats.flash_accesses++;
+		p = &sim->flash[address - M0SIM_FLASH_BASE];
+	}
+	else if (in_ram(sim, address))
+	{
+		p = &sim->ram[address - M0SIM_RAM_BASE];
+	}
+	else
+	{
+		static const uint8_t zero[4];
+		sim->stats.peripheral_accesses++;
+		uint32_t value;
+		if (sim->io != NULL && sim->io(sim, address, size, false, &value))
+		{
+			return value;
+		}
+		p = page_byte(sim, address, false);
+		p = (p != NULL) ? p : zero;
+	}
+
+	uint32_t value = 0;
+	for (unsigned i = 0; i < size; i++)
+	{
+		value |= (uint32_t)p[i] << (8 * i);
+	}
+	return value;
+}
+
+static void store(struct m0sim* sim, uint32_t address, uint32_t value, unsigned size)
+{
+	if (address & (size - 1))
+	{
+		sim->fault = "unaligned store";
+		return;
+	}
+
+	uint8_t* p;
+	if (in_ram(sim, address))
+	{
+		p = &sim->ram[address - M0SIM_RAM_BASE];
+	}
+	else if (in_flash(sim, address))
+	{
+		sim->fault = "store to flash";
+		return;
+	}
+	else
+	{
+		sim->stats.peripheral_accesses++;
+		if (sim->io != NULL && sim->io(sim, address, size, true, &value))
+		{
+			return;
+		}
+		p = page_byte(sim, address, true);
+	}
+
+	for (unsigned i = 0; i < size; i++)
+	{
+		p[i] = value >> (8 * i);
+	}
+}
+
+uint32_t m0sim_read32(struct m0sim* sim, uint32_t address)
+{
+	const struct m0sim_stats stats = sim->stats;
+	const uint32_t value = load(sim, address, 4);
+	sim->stats = stats;
+	return value;
+}
+
+void m0sim_write(struct m0sim* sim, uint32_t address, const void* data, uint32_t length)
+{
+	const uint8_t* bytes = data;
+	for (uint32_t i = 0; i < length; i++)
+	{
+		if (in_flash(sim, address + i))
+		{
+			sim->flash[address + i - M0SIM_FLASH_BASE] = bytes[i];
+		}
+		else if (in_ram(sim, address + i))
+		{
+			sim->ram[address + i - M0SIM_RAM_BASE] = bytes[i];
+		}
+		else
+		{
+			*page_byte(sim, address + i, true) = bytes[i];
+		}
+	}
+}
+
+// ELF
+
+struct elf_header
+{
+	uint8_t ident[16];
+	uint16_t type, machine;
+	uint32_t version, entry, phoff, shoff, flags;
+	uint16_t ehsize, phentsize, phnum, shentsize, shnum, shstrndx;
+};
+
+struct elf_program_header
+{
+	uint32_t type, offset, vaddr, paddr, filesz, memsz, flags, align;
+};
+
+struct elf_section_header
+{
+	uint32_t name, type, flags, addr, offset, size, link, info, addralign, entsize;
+};
+
+struct elf_symbol
+{
+	uint32_t name, value, size;
+	uint8_t info, other;
+	uint16_t shndx;
+};
+
+#define ELF_MACHINE_ARM 40
+#define ELF_PT_LOAD     1
+#define ELF_SHT_SYMTAB  2
+
+static bool load_symbols(struct m0sim* sim, const uint8_t* file, size_t size, const struct elf_header* header)
+{
+	for (unsigned i = 0; i < header->shnum; i++)
+	{
+		const struct elf_section_header* section =
+			(const struct elf_section_header*)(file + header->shoff + i * header->shentsize);
+		if (section->type != ELF_SHT_SYMTAB || section->link >= header->shnum)
+		{
+			continue;
+		}
+
+		const struct elf_section_header* strings =
+			(const struct elf_section_header*)(file + header->shoff + section->link * header->shentsize);
+		if (section->offset + section->size > size || strings->offset + strings->size > size)
+		{
+			return false;
+		}
+
+		const unsigned count = section->size / sizeof(struct elf_symbol);
+		sim->symbols = calloc(count, sizeof(*sim->symbols));
+		for (unsigned s = 0; s < count; s++)
+		{
+			const struct elf_symbol* symbol = (const struct elf_symbol*)(file + section->offset) + s;
+			if (symbol->name == 0 || symbol->name >= strings->size)
+			{
+				continue;
+			}
+			sim->symbols[sim->num_symbols].name = strdup((const char*)file + strings->offset + symbol->name);
+			sim->symbols[sim->num_symbols].value = symbol->value;
+			sim->num_symbols++;
+		}
+		return true;
+	}
+	return true;
+}
+
+bool m0sim_load_elf(struct m0sim* sim, const char* path)
+{
+	FILE* f = fopen(path, "rb");
+	if (f == NULL)
+	{
+		return false;
+	}
+	fseek(f, 0, SEEK_END);
+	const long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	uint8_t* file = malloc(size);
+	const bool read = file != NULL && fread(file, 1, size, f) == (size_t)size;
+	fclose(f);
+
+	const struct elf_header* header = (const struct elf_header*)file;
+	bool ok = read && (size_t)size >= sizeof(*header) && memcmp(header->ident, "\177ELF\1\1", 6) == 0
+		&& header->machine == ELF_MACHINE_ARM && header->phoff + header->phnum * sizeof(struct elf_program_header) <= (size_t)size
+		&& header->shoff + header->shnum * sizeof(struct elf_section_header) <= (size_t)size;
+
+	for (unsigned i = 0; ok && i < header->phnum; i++)
+	{
+		const struct elf_program_header* segment =
+			(const struct elf_program_header*)(file + header->phoff + i * header->phentsize);
+		if (segment->type != ELF_PT_LOAD || segment->memsz == 0)
+		{
+			continue;
+		}
+		ok = segment->offset + segment->filesz <= (size_t)size;
+		if (ok)
+		{
+			// Initialized data is loaded where it runs, the startup code is
+			// not run
+			m0sim_write(sim, segment->vaddr, file + segment->offset, segment->filesz);
+			for (uint32_t b = segment->filesz; b < segment->memsz; b++)
+			{
+				const uint8_t zero = 0;
+				m0sim_write(sim, segment->vaddr + b, &zero, 1);
+			}
+		}
+	}
+
+	ok = ok && load_symbols(sim, file, size, header);
+	free(file);
+	return ok;
+}
+
+uint32_t m0sim_symbol(const struct m0sim* sim, const char* name)
+{
+	for (unsigned i = 0; i < sim->num_symbols; i++)
+	{
+		if (strcmp(sim->symbols[i].name, name) == 0)
+		{
+			return sim->symbols[i].value;
+		}
+	}
+	return 0;
+}
+
+// Execution
+
+static inline uint16_t fetch(struct m0sim* sim, uint32_t address)
+{
+	// The core fetches 32 bits at a time
+	if (in_flash(sim, address))
+	{
+		if ((address & ~3u) != sim->last_fetch)
+		{
+			sim->last_fetch = address & ~3u;
+			sim->stats.flash_accesses++;
+		}
+		return sim->flash[address] | (sim->flash[address + 1] << 8);
+	}
+	if (in_ram(sim, address))
+	{
+		sim->last_fetch = 1;
+		return sim->ram[address - M0SIM_RAM_BASE] | (sim->ram[address - M0SIM_RAM_BASE + 1] << 8);
+	}
+	sim->fault = "instruction fetch outside flash and RAM";
+	return 0;
+}
+
+static inline void set_nz(struct m0sim* sim, uint32_t result)
+{
+	sim->n = (result >> 31) != 0;
+	sim->z = result == 0;
+}
+
+static inline uint32_t add_with_carry(struct m0sim* sim, uint32_t a, uint32_t b, bool carry)
+{
+	const uint64_t unsigned_sum = (uint64_t)a + b + carry;
+	const uint32_t result = (uint32_t)unsigned_sum;
+	set_nz(sim, result);
+	sim->c = (unsigned_sum >> 32) != 0;
+	sim->v = ((~(a ^ b) & (a ^ result)) >> 31) != 0;
+	return result;
+}
+
+static inline bool condition(const struct m0sim* sim, unsigned cond)
+{
+	switch (cond)
+	{
+	case 0x0: return sim->z;
+	case 0x1: return !sim->z;
+	case 0x2: return sim->c;
+	case 0x3: return !sim->c;
+	case 0x4: return sim->n;
+	case 0x5: return !sim->n;
+	case 0x6: return sim->v;
+	case 0x7: return !sim->v;
+	case 0x8: return sim->c && !sim->z;
+	case 0x9: return !sim->c || sim->z;
+	case 0xA: return sim->n == sim->v;
+	case 0xB: return sim->n != sim->v;
+	case 0xC: return !sim->z && sim->n == sim->v;
+	case 0xD: return sim->z || sim->n != sim->v;
+	default: return true;
+	}
+}
+
+// Shifts by register, as the ALU operations do them
+static uint32_t shift(struct m0sim* sim, unsigned type, uint32_t value, unsigned amount)
+{
+	amount &= 0xFF;
+	if (amount == 0)
+	{
+		return value;
+	}
+
+	switch (type)
+	{
+	case 0: // LSL
+		sim->c = (amount <= 32) ? ((value >> (32 - amount)) & 1) : 0;
+		return (amount < 32) ? value << amount : 0;
+	case 1: // LSR
+		sim->c = (amount <= 32) ? ((value >> (amount - 1)) & 1) : 0;
+		return (amount < 32) ? value >> amount : 0;
+	case 2: // ASR
+		if (amount >= 32)
+		{
+			sim->c = value >> 31;
+			return (int32_t)value >> 31;
+		}
+		sim->c = ((int32_t)value >> (amount - 1)) & 1;
+		return (int32_t)value >> amount;
+	default: // ROR
+		amount &= 31;
+		value = (amount != 0) ? (value >> amount) | (value << (32 - amount)) : value;
+		sim->c = value >> 31;
+		return value;
+	}
+}
+
+static inline void branch(struct m0sim* sim, uint32_t target)
+{
+	sim->r[15] = target & ~1u;
+}
+
+static void execute_32(struct m0sim* sim, uint16_t first, uint32_t pc)
+{
+	const uint16_t second = fetch(sim, pc + 2);
+	sim->r[15] = pc + 4;
+
+	if ((first & 0xF800) == 0xF000 && (second & 0xD000) == 0xD000)
+	{
+		// BL
+		const uint32_t s = (first >> 10) & 1;
+		const uint32_t i1 = !(((second >> 13) & 1) ^ s);
+		const uint32_t i2 = !(((second >> 11) & 1) ^ s);
+		uint32_t offset = (s << 24) | (i1 << 23) | (i2 << 22) | ((first & 0x3FF) << 12) | ((second & 0x7FF) << 1);
+		offset = (offset ^ 0x1000000) - 0x1000000;
+		sim->r[14] = (pc + 4) | 1;
+		branch(sim, pc + 4 + offset);
+		sim->stats.cycles += 3;
+		return;
+	}
+
+	if ((first & 0xFFF0) == 0xF380 && (second & 0xFF00) == 0x8800)
+	{
+		// MSR
+		const uint32_t value = sim->r[first & 0xF];
+		switch (second & 0xFF)
+		{
+		case 8: sim->r[13] = value & ~3u; break;
+		case 16: sim->primask = value & 1; break;
+		default: break;
+		}
+		sim->stats.cycles += 3;
+		return;
+	}
+
+	if (first == 0xF3EF && (second & 0xF000) == 0x8000)
+	{
+		// MRS
+		uint32_t value = 0;
+		switch (second & 0xFF)
+		{
+		case 0: case 1: case 2: case 3:
+			value = (sim->n << 31) | (sim->z << 30) | (sim->c << 29) | (sim->v << 28);
+			break;
+		case 8: value = sim->r[13]; break;
+		case 16: value = sim->primask; break;
+		default: break;
+		}
+		sim->r[(second >> 8) & 0xF] = value;
+		sim->stats.cycles += 3;
+		return;
+	}
+
+	if (first == 0xF3BF && (second & 0xFF00) == 0x8F00)
+	{
+		// DSB, DMB, ISB
+		sim->stats.cycles += 3;
+		return;
+	}
+
+	sim->fault = "undefined 32-bit instruction";
+}
+
+static void execute(struct m0sim* sim)
+{
+	const uint32_t pc = sim->r[15];
+	const uint16_t op = fetch(sim, pc);
+	if ((op & 0xE000) == 0xE000 && (op & 0x1800) != 0)
+	{
+		execute_32(sim, op, pc);
+		return;
+	}
+
+	// Reads of the PC give the address of the instruction + 4
+	sim->r[15] = pc + 4;
+	uint32_t* r = sim->r;
+	const unsigned rd = op & 7;
+	const unsigned rn = (op >> 3) & 7;
+	const unsigned rm = (op >> 6) & 7;
+	const unsigned imm5 = (op >> 6) & 0x1F;
+	uint32_t next = pc + 2;
+	unsigned cycles = 1;
+
+	switch (op >> 11)
+	{
+	case 0x00: // LSLS imm
+		if (imm5 != 0)
+		{
+			sim->c = (r[rn] >> (32 - imm5)) & 1;
+		}
+		r[rd] = r[rn] << imm5;
+		set_nz(sim, r[rd]);
+		break;
+
+	case 0x01: // LSRS imm
+	case 0x02: // ASRS imm
+		r[rd] = shift(sim, op >> 11, r[rn], imm5 ? imm5 : 32);
+		set_nz(sim, r[rd]);
+		break;
+
+	case 0x03: // ADDS/SUBS reg, imm3
+	{
+		const uint32_t operand = (op & 0x400) ? rm : r[rm];
+		r[rd] = (op & 0x200) ? add_with_carry(sim, r[rn], ~operand, 1) : add_with_carry(sim, r[rn], operand, 0);
+		break;
+	}
+
+	case 0x04: // MOVS imm8
+		r[(op >> 8) & 7] = op & 0xFF;
+		set_nz(sim, op & 0xFF);
+		break;
+
+	case 0x05: // CMP imm8
+		add_with_carry(sim, r[(op >> 8) & 7], ~(uint32_t)(op & 0xFF), 1);
+		break;
+
+	case 0x06: // ADDS imm8
+		r[(op >> 8) & 7] = add_with_carry(sim, r[(op >> 8) & 7], op & 0xFF, 0);
+		break;
+
+	case 0x07: // SUBS imm8
+		r[(op >> 8) & 7] = add_with_carry(sim, r[(op >> 8) & 7], ~(uint32_t)(op & 0xFF), 1);
+		break;
+
+	case 0x08:
+		if ((op & 0x400) == 0)
+		{
+			// Data processing
+			const uint32_t a = r[rd];
+			const uint32_t b = r[rn];
+			switch ((op >> 6) & 0xF)
+			{
+			case 0x0: r[rd] = a & b; set_nz(sim, r[rd]); break;
+			case 0x1: r[rd] = a ^ b; set_nz(sim, r[rd]); break;
+			case 0x2: r[rd] = shift(sim, 0, a, b); set_nz(sim, r[rd]); break;
+			case 0x3: r[rd] = shift(sim, 1, a, b); set_nz(sim, r[rd]); break;
+			case 0x4: r[rd] = shift(sim, 2, a, b); set_nz(sim, r[rd]); break;
+			case 0x5: r[rd] = add_with_carry(sim, a, b, sim->c); break;
+			case 0x6: r[rd] = add_with_carry(sim, a, ~b, sim->c); break;
+			case 0x7: r[rd] = shift(sim, 3, a, b); set_nz(sim, r[rd]); break;
+			case 0x8: set_nz(sim, a & b); break;
+			case 0x9: r[rd] = add_with_carry(sim, ~b, 0, 1); break;
+			case 0xA: add_with_carry(sim, a, ~b, 1); break;
+			case 0xB: add_with_carry(sim, a, b, 0); break;
+			case 0xC: r[rd] = a | b; set_nz(sim, r[rd]); break;
+			case 0xD: r[rd] = a * b; set_nz(sim, r[rd]); break;
+			case 0xE: r[rd] = a & ~b; set_nz(sim, r[rd]); break;
+			default: r[rd] = ~b; set_nz(sim, r[rd]); break;
+			}
+			break;
+		}
+
+		{
+			// High registers and branch exchange
+			const unsigned d = (op & 7) | ((op >> 4) & 8);
+			const unsigned m = (op >> 3) & 0xF;
+			switch ((op >> 8) & 3)
+			{
+			case 0: // ADD
+				if (d == 15)
+				{
+					cycles++;
+					next = (r[15] + r[m]) & ~1u;
+				}
+				else
+				{
+					r[d] = r[d] + r[m];
+				}
+				break;
+			case 1: // CMP
+				add_with_carry(sim, r[d], ~r[m], 1);
+				break;
+			case 2: // MOV
+				if (d == 15)
+				{
+					cycles++;
+					next = r[m] & ~1u;
+				}
+				else
+				{
+					r[d] = r[m];
+				}
+				break;
+			default: // BX, BLX
+				if (op & 0x80)
+				{
+					r[14] = (pc + 2) | 1;
+				}
+				cycles++;
+				next = r[m] & ~1u;
+				break;
+			}
+		}
+		break;
+
+	case 0x09: // LDR literal
+		r[(op >> 8) & 7] = load(sim, ((pc + 4) & ~3u) + (op & 0xFF) * 4, 4);
+		cycles = 2;
+		break;
+
+	case 0x0A:
+	case 0x0B: // Load/store, register offset
+	{
+		const uint32_t address = r[rn] + r[rm];
+		cycles = 2;
+		switch ((op >> 9) & 7)
+		{
+		case 0: store(sim, address, r[rd], 4); break;
+		case 1: store(sim, address, r[rd], 2); break;
+		case 2: store(sim, address, r[rd], 1); break;
+		case 3: r[rd] = (int8_t)load(sim, address, 1); break;
+		case 4: r[rd] = load(sim, address, 4); break;
+		case 5: r[rd] = load(sim, address, 2); break;
+		case 6: r[rd] = load(sim, address, 1); break;
+		default: r[rd] = (int16_t)load(sim, address, 2); break;
+		}
+		break;
+	}
+
+	case 0x0C: store(sim, r[rn] + imm5 * 4, r[rd], 4); cycles = 2; break;
+	case 0x0D: r[rd] = load(sim, r[rn] + imm5 * 4, 4); cycles = 2; break;
+	case 0x0E: store(sim, r[rn] + imm5, r[rd], 1); cycles = 2; break;
+	case 0x0F: r[rd] = load(sim, r[rn] + imm5, 1); cycles = 2; break;
+	case 0x10: store(sim, r[rn] + imm5 * 2, r[rd], 2); cycles = 2; break;
+	case 0x11: r[rd] = load(sim, r[rn] + imm5 * 2, 2); cycles = 2; break;
+	case 0x12: store(sim, r[13] + (op & 0xFF) * 4, r[(op >> 8) & 7], 4); cycles = 2; break;
+	case 0x13: r[(op >> 8) & 7] = load(sim, r[13] + (op & 0xFF) * 4, 4); cycles = 2; break;
+	case 0x14: r[(op >> 8) & 7] = ((pc + 4) & ~3u) + (op & 0xFF) * 4; break; // ADR
+	case 0x15: r[(op >> 8) & 7] = r[13] + (op & 0xFF) * 4; break; // ADD SP imm
+
+	case 0x16:
+	case 0x17: // Miscellaneous
+		if ((op & 0xFF00) == 0xB000)
+		{
+			// ADD/SUB SP, imm7
+			r[13] += (op & 0x80) ? -(uint32_t)((op & 0x7F) * 4) : (op & 0x7F) * 4;
+		}
+		else if ((op & 0xFF00) == 0xB200)
+		{
+			switch ((op >> 6) & 3)
+			{
+			case 0: r[rd] = (int16_t)r[rn]; break;
+			case 1: r[rd] = (int8_t)r[rn]; break;
+			case 2: r[rd] = (uint16_t)r[rn]; break;
+			default: r[rd] = (uint8_t)r[rn]; break;
+			}
+		}
+		else if ((op & 0xFE00) == 0xB400)
+		{
+			// PUSH
+			const unsigned list = (op & 0xFF) | ((op & 0x100) ? 0x4000 : 0);
+			uint32_t address = r[13] - 4 * __builtin_popcount(list);
+			r[13] = address;
+			for (unsigned i = 0; i < 15; i++)
+			{
+				if (list & (1 << i))
+				{
+					store(sim, address, r[i], 4);
+					address += 4;
+					cycles++;
+				}
+			}
+		}
+		else if ((op & 0xFFEF) == 0xB662)
+		{
+			// CPSIE/CPSID i
+			sim->primask = (op & 0x10) != 0;
+		}
+		else if ((op & 0xFF00) == 0xBA00 && ((op >> 6) & 3) != 2)
+		{
+			const uint32_t v = r[rn];
+			switch ((op >> 6) & 3)
+			{
+			case 0: r[rd] = __builtin_bswap32(v); break;
+			case 1: r[rd] = ((v & 0x00FF00FF) << 8) | ((v >> 8) & 0x00FF00FF); break;
+			default: r[rd] = (int16_t)(((v & 0xFF) << 8) | ((v >> 8) & 0xFF)); break;
+			}
+		}
+		else if ((op & 0xFE00) == 0xBC00)
+		{
+			// POP
+			uint32_t address = r[13];
+			for (unsigned i = 0; i < 8; i++)
+			{
+				if (op & (1 << i))
+				{
+					r[i] = load(sim, address, 4);
+					address += 4;
+					cycles++;
+				}
+			}
+			if (op & 0x100)
+			{
+				next = load(sim, address, 4) & ~1u;
+				address += 4;
+				cycles += 3;
+			}
+			r[13] = address;
+		}
+		else if ((op & 0xFF00) == 0xBF00 && (op & 0xF) == 0)
+		{
+			// Hints (NOP, YIELD, WFE, WFI, SEV)
+		}
+		else
+		{
+			sim->fault = (op & 0xFF00) == 0xBE00 ? "breakpoint" : "undefined instruction";
+		}
+		break;
+
+	case 0x18: // STM
+	case 0x19: // LDM
+	{
+		const unsigned base = (op >> 8) & 7;
+		uint32_t address = r[base];
+		for (unsigned i = 0; i < 8; i++)
+		{
+			if (op & (1 << i))
+			{
+				if (op & 0x800)
+				{
+					r[i] = load(sim, address, 4);
+				}
+				else
+				{
+					store(sim, address, r[i], 4);
+				}
+				address += 4;
+				cycles++;
+			}
+		}
+		// Written back unless the base was loaded
+		if (!(op & 0x800) || !(op & (1 << base)))
+		{
+			r[base] = address;
+		}
+		break;
+	}
+
+	case 0x1A:
+	case 0x1B: // B<cond>, SVC
+	{
+		const unsigned cond = (op >> 8) & 0xF;
+		if (cond >= 0xE)
+		{
+			sim->fault = (cond == 0xF) ? "supervisor call" : "undefined instruction";
+		}
+		else if (condition(sim, cond))
+		{
+			next = pc + 4 + (int8_t)(op & 0xFF) * 2;
+			cycles = 2;
+		}
+		break;
+	}
+
+	case 0x1C: // B
+		next = pc + 4 + (((int32_t)((uint32_t)op << 21)) >> 20);
+		cycles = 2;
+		break;
+
+	default:
+		sim->fault = "undefined instruction";
+		break;
+	}
+
+	sim->r[15] = next;
+	sim->stats.cycles += cycles;
+}
+
+bool m0sim_call(struct m0sim* sim, uint32_t address, const uint32_t* args, unsigned num_args, uint32_t sp,
+	uint64_t max_instructions)
+{
+	for (unsigned i = 0; i < 4; i++)
+	{
+		sim->r[i] = (i < num_args) ? args[i] : 0;
+	}
+	sim->r[13] = sp & ~7u;
+	sim->r[14] = RETURN_ADDRESS | 1;
+	sim->r[15] = address & ~1u;
+	sim->last_fetch = 1;
+	sim->fault = NULL;
+	memset(&sim->stats, 0, sizeof(sim->stats));
+	sim->stats.min_sp = sim->r[13];
+
+	while (sim->r[15] != RETURN_ADDRESS)
+	{
+		if (sim->stats.instructions == max_instructions)
+		{
+			sim->fault = "instruction limit";
+			return false;
+		}
+
+		execute(sim);
+		sim->stats.instructions++;
+		if (sim->r[13] < sim->stats.min_sp)
+		{
+			sim->stats.min_sp = sim->r[13];
+		}
+		if (sim->fault != NULL)
+		{
+			return false;
+		}
+	}
+	return true;
+}
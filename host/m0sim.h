@@ -0,0 +1,83 @@
+#ifndef M0SIM_H_
+#define M0SIM_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Instruction set simulator of the Cortex-M0+ (ARMv6-M Thumb), for cycle
+// counts of firmware functions. Cycles follow the Cortex-M0+ timings with a
+// single cycle multiplier, as on the SAMD21. Flash wait states are counted
+// apart: every fetch from a 32-bit flash word other than the last one, and
+// every data load from flash, is a flash access costing the wait states. The
+// NVM cache is not modelled, so counts with wait states are an upper bound.
+// Memory outside flash and RAM reads back what was written, 0 otherwise,
+// unless a peripheral model takes the access.
+
+#define M0SIM_FLASH_BASE 0x00000000
+#define M0SIM_RAM_BASE   0x20000000
+
+struct m0sim_stats
+{
+	uint64_t instructions;
+	uint64_t cycles;            // Without wait states
+	uint64_t flash_accesses;    // Each costing the wait states
+	uint64_t peripheral_accesses;
+	uint32_t min_sp;
+};
+
+struct m0sim;
+struct m0sim_page;
+struct m0sim_symbol;
+
+// Peripheral model, called for each access outside flash and RAM once it is
+// counted. Returns true when it took the store or gave the value loaded,
+// false to leave the access to the plain memory.
+typedef bool (*m0sim_io_t)(struct m0sim* sim, uint32_t address, unsigned size, bool store, uint32_t* value);
+
+struct m0sim
+{
+	uint32_t r[16];
+	bool n, z, c, v;
+	bool primask;
+
+	uint8_t* flash;
+	uint32_t flash_size;
+	uint8_t* ram;
+	uint32_t ram_size;
+	struct m0sim_page* pages;
+	struct m0sim_symbol* symbols;
+	unsigned num_symbols;
+
+	m0sim_io_t io;
+	void* io_context;
+
+	uint32_t last_fetch;
+	struct m0sim_stats stats;
+	const char* fault;
+};
+
+bool m0sim_init(struct m0sim* sim, uint32_t flash_size, uint32_t ram_size);
+void m0sim_free(struct m0sim* sim);
+
+// Loads the PT_LOAD segments of an ELF file at their addresses, and its
+// symbols
+bool m0sim_load_elf(struct m0sim* sim, const char* path);
+// Address of a symbol, 0 when not found. Thumb functions have bit 0 set.
+uint32_t m0sim_symbol(const struct m0sim* sim, const char* name);
+
+uint32_t m0sim_read32(struct m0sim* sim, uint32_t address);
+void m0sim_write(struct m0sim* sim, uint32_t address, const void* data, uint32_t length);
+
+// Calls the function at address with up to 4 arguments and the stack at sp;
+// returns false on a fault or when max_instructions run out. The result is
+// in r[0], the counts of this call in stats.
+bool m0sim_call(struct m0sim* sim, uint32_t address, const uint32_t* args, unsigned num_args, uint32_t sp,
+	uint64_t max_instructions);
+
+static inline uint64_t m0sim_cycles(const struct m0sim_stats* stats, unsigned wait_states)
+{
+	return stats->cycles + stats->flash_accesses * wait_states;
+}
+
+#endif /* M0SIM_H_ */
@@ -0,0 +1,166 @@
+// Checks of the instruction set simulator on hand assembled code: the
+// result of the ALU operations with their flags, and the cycles and flash
+// accesses of short programs worked out from the Cortex-M0+ timings.
+
+#include "m0sim.h"
+
+#include <stdio.h>
+
+#define STACK_TOP (M0SIM_RAM_BASE + 0x1000)
+#define BX_LR     0x4770
+
+struct alu_case
+{
+	const char* name;
+	uint16_t op;
+	uint32_t r0, r1;
+	bool carry;
+	uint32_t result;
+	int n, z, c, v; // -1: not checked
+};
+
+static const struct alu_case ALU_CASES[] = {
+	{ "adds carry out", 0x1840, 0xFFFFFFFF, 1, 0, 0, 0, 1, 1, 0 },
+	{ "adds overflow", 0x1840, 0x7FFFFFFF, 1, 0, 0x80000000, 1, 0, 0, 1 },
+	{ "subs borrow", 0x1A40, 1, 2, 0, 0xFFFFFFFF, 1, 0, 0, 0 },
+	{ "cmp equal", 0x4288, 5, 5, 0, 5, 0, 1, 1, 0 },
+	{ "lsls #4", 0x0100, 0x10000001, 0, 0, 0x10, 0, 0, 1, -1 },
+	{ "lsrs #1", 0x0840, 3, 0, 0, 1, 0, 0, 1, -1 },
+	{ "asrs #31", 0x17C0, 0x80000000, 0, 0, 0xFFFFFFFF, 1, 0, 0, -1 },
+	{ "lsrs #32", 0x0800, 0x80000000, 0, 0, 0, 0, 1, 1, -1 },
+	{ "muls", 0x4348, 7, 6, 0, 42, 0, 0, -1, -1 },
+	{ "rsbs", 0x4248, 0, 5, 0, (uint32_t)-5, 1, 0, 0, 0 },
+	{ "adcs", 0x4148, 1, 2, 1, 4, 0, 0, 0, 0 },
+	{ "sbcs", 0x4188, 5, 2, 0, 2, 0, 0, 1, 0 },
+	{ "rors", 0x41C8, 1, 1, 0, 0x80000000, 1, 0, 1, -1 },
+	{ "bics", 0x4388, 0xFF, 0x0F, 0, 0xF0, 0, 0, -1, -1 },
+	{ "mvns", 0x43C8, 0, 0, 0, 0xFFFFFFFF, 1, 0, -1, -1 },
+	{ "lsls by 32", 0x4088, 1, 32, 0, 0, 0, 1, 1, -1 },
+	{ "lsls by 33", 0x4088, 1, 33, 1, 0, 0, 1, 0, -1 },
+	{ "sxtb", 0xB248, 0, 0x80, 0, 0xFFFFFF80, -1, -1, -1, -1 },
+	{ "uxth", 0xB288, 0, 0xFFFF1234, 0, 0x1234, -1, -1, -1, -1 },
+	{ "rev", 0xBA08, 0, 0x11223344, 0, 0x44332211, -1, -1, -1, -1 },
+	{ "rev16", 0xBA48, 0, 0x11223344, 0, 0x22114433, -1, -1, -1, -1 },
+};
+
+// Sum of 10..1
+static const uint16_t SUM_PROGRAM[] = {
+	0x2000,         // movs r0, #0
+	0x210A,         // movs r1, #10
+	0x1840,         // loop: adds r0, r0, r1
+	0x3901,         // subs r1, #1
+	0xD1FC,         // bne loop
+	BX_LR,
+};
+
+// Squares 6 in a subroutine and passes the result through RAM
+static const uint16_t CALL_PROGRAM[] = {
+	0xB510,         // 00: push {r4, lr}
+	0x4C03,         // 02: ldr r4, [pc, #12]
+	0x2006,         // 04: movs r0, #6
+	0xF000, 0xF805, // 06: bl square
+	0x6060,         // 0a: str r0, [r4, #4]
+	0x6860,         // 0c: ldr r0, [r4, #4]
+	0xBD10,         // 0e: pop {r4, pc}
+	0x0100, 0x2000, // 10: .word 0x20000100
+	0x4340,         // 14: square: muls r0, r0, r0
+	BX_LR,          // 16
+};
+
+// Stores a value to a peripheral register and loads it back
+static const uint16_t IO_PROGRAM[] = {
+	0x4802,         // 00: ldr r0, [pc, #8]
+	0x6001,         // 02: str r1, [r0]
+	0x6800,         // 04: ldr r0, [r0]
+	BX_LR,          // 06
+	0x0000, 0x0000, // 08
+	0x4420, 0x4100, // 0c: .word 0x41004420
+};
+
+static unsigned g_failures = 0;
+
+// Register at 0x41004420 loading one more than the value stored
+static uint32_t g_ioRegister;
+
+static bool io_model(struct m0sim* sim, uint32_t address, unsigned size, bool store, uint32_t* value)
+{
+	(void)sim;
+	if (address != 0x41004420 || size != 4)
+	{
+		return false;
+	}
+	if (store)
+	{
+		g_ioRegister = *value;
+	}
+	else
+	{
+		*value = g_ioRegister + 1;
+	}
+	return true;
+}
+
+static void check(bool ok, const char* what)
+{
+	printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+	if (!ok)
+	{
+		g_failures++;
+	}
+}
+
+static bool flag_ok(int expected, bool flag)
+{
+	return expected < 0 || (expected != 0) == flag;
+}
+
+static bool run(struct m0sim* sim, const uint16_t* program, size_t size, const uint32_t* args, unsigned num_args)
+{
+	m0sim_write(sim, 0, program, size);
+	return m0sim_call(sim, 1, args, num_args, STACK_TOP, 1000);
+}
+
+int main(void)
+{
+	struct m0sim sim;
+	if (!m0sim_init(&sim, 0x1000, 0x1000))
+	{
+		return 1;
+	}
+
+	for (unsigned i = 0; i < sizeof(ALU_CASES) / sizeof(ALU_CASES[0]); i++)
+	{
+		const struct alu_case* t = &ALU_CASES[i];
+		const uint16_t program[] = { t->op, BX_LR };
+		const uint32_t args[] = { t->r0, t->r1 };
+		sim.c = t->carry;
+		const bool ok = run(&sim, program, sizeof(program), args, 2) && sim.r[0] == t->result
+			&& flag_ok(t->n, sim.n) && flag_ok(t->z, sim.z) && flag_ok(t->c, sim.c) && flag_ok(t->v, sim.v);
+		check(ok, t->name);
+	}
+
+	// 2 moves, 10 iterations of 4 cycles less the branch not taken, return
+	bool ok = run(&sim, SUM_PROGRAM, sizeof(SUM_PROGRAM), NULL, 0);
+	check(ok && sim.r[0] == 55, "loop result");
+	check(sim.stats.instructions == 33 && sim.stats.cycles == 43, "loop cycles");
+	// Words 0, 4 and 8, then 4 and 8 again for each further iteration
+	check(sim.stats.flash_accesses == 21, "loop flash accesses");
+	check(m0sim_cycles(&sim.stats, 2) == 85, "loop cycles with 2 wait states");
+
+	// push 3, ldr 2, movs 1, bl 3, muls 1, bx 2, str 2, ldr 2, pop 5
+	ok = run(&sim, CALL_PROGRAM, sizeof(CALL_PROGRAM), NULL, 0);
+	check(ok && sim.r[0] == 36 && m0sim_read32(&sim, 0x20000104) == 36, "call result");
+	check(sim.stats.instructions == 9 && sim.stats.cycles == 21, "call cycles");
+	// Words 0, 4, 8, 14, 8 and c, and the literal
+	check(sim.stats.flash_accesses == 7, "call flash accesses");
+	check(sim.stats.min_sp == STACK_TOP - 8 && sim.r[13] == STACK_TOP, "call stack");
+
+	sim.io = io_model;
+	const uint32_t io_args[] = { 0, 41 };
+	ok = run(&sim, IO_PROGRAM, sizeof(IO_PROGRAM), io_args, 2);
+	check(ok && sim.r[0] == 42 && g_ioRegister == 41 && sim.stats.peripheral_accesses == 2, "peripheral model");
+
+	m0sim_free(&sim);
+	printf("%u failures\n", g_failures);
+	return g_failures != 0;
+}
@@ -0,0 +1,100 @@
+#include "key_stats.h"
+#include "keymap_store.h"
+#include "nvm_flash.h"
+
+// The RWWEE section, and the key statistics and keymap store rows of the
+// main array in RAM, erased at start. Commands complete at once and the ready "interrupt" is a
+// direct call.
+uint8_t g_nvmHostRwwee[NVM_RWWEE_SIZE] __attribute__((aligned(NVM_ROW_SIZE)));
+uint8_t g_nvmHostKeyStats[2 * KEY_STATS_SLOT_SIZE] __attribute__((aligned(NVM_ROW_SIZE)));
+uint8_t g_nvmHostKeymaps[4 * KEYMAP_STORE_SLOT_SIZE] __attribute__((aligned(NVM_ROW_SIZE)));
+
+static nvm_flash_callback_t g_readyCallback = NULL;
+static enum nvm_flash_owner g_owner = NVM_FLASH_FREE;
+
+static inline bool is_emulated(uintptr_t address, uint16_t length)
+{
+	const uintptr_t stats = (uintptr_t)g_nvmHostKeyStats;
+	const uintptr_t keymaps = (uintptr_t)g_nvmHostKeymaps;
+	return (address >= NVM_RWWEE_START && address + length <= NVM_RWWEE_START + NVM_RWWEE_SIZE)
+		|| (address >= stats && address + length <= stats + sizeof(g_nvmHostKeyStats))
+		|| (address >= keymaps && address + length <= keymaps + sizeof(g_nvmHostKeymaps));
+}
+
+void nvm_flash_init(void)
+{
+	memset(g_nvmHostRwwee, 0xFF, sizeof(g_nvmHostRwwee));
+	memset(g_nvmHostKeyStats, 0xFF, sizeof(g_nvmHostKeyStats));
+	memset(g_nvmHostKeymaps, 0xFF, sizeof(g_nvmHostKeymaps));
+	g_owner = NVM_FLASH_FREE;
+}
+
+void nvm_flash_register_ready_callback(nvm_flash_callback_t callback)
+{
+	g_readyCallback = callback;
+}
+
+void nvm_flash_enable_ready_interrupt(void)
+{
+	if (g_readyCallback != NULL)
+	{
+		g_readyCallback();
+	}
+}
+
+bool nvm_flash_is_ready(void)
+{
+	return true;
+}
+
+bool nvm_flash_has_error(void)
+{
+	return false;
+}
+
+bool nvm_flash_acquire(enum nvm_flash_owner owner)
+{
+	if (g_owner != NVM_FLASH_FREE && g_owner != owner)
+	{
+		return false;
+	}
+	g_owner = owner;
+	return true;
+}
+
+void nvm_flash_release(enum nvm_flash_owner owner)
+{
+	if (g_owner == owner)
+	{
+		g_owner = NVM_FLASH_FREE;
+	}
+}
+
+bool nvm_flash_erase_row(uintptr_t address)
+{
+	address &= ~(uintptr_t)(NVM_ROW_SIZE - 1);
+	if (!is_emulated(address, NVM_ROW_SIZE))
+	{
+		return false;
+	}
+
+	memset((uint8_t*)address, 0xFF, NVM_ROW_SIZE);
+	return true;
+}
+
+bool nvm_flash_write_page(uintptr_t address, const uint8_t* data, uint16_t length)
+{
+	address &= ~(uintptr_t)(NVM_PAGE_SIZE - 1);
+	if (length > NVM_PAGE_SIZE || !is_emulated(address, NVM_PAGE_SIZE))
+	{
+		return false;
+	}
+
+	// Programming only clears bits
+	uint8_t* page = (uint8_t*)address;
+	for (uint16_t i = 0; i < length; i++)
+	{
+		page[i] &= data[i];
+	}
+	return true;
+}
@@ -0,0 +1,707 @@
+// Deterministic replay of switch traces through the host build.
+//
+// A trace lists physical switch states in time, bounce included, and what
+// the host does. Simulated time advances from event to event: the scan
+// interrupt every KBD_SCAN_PERIOD_MS, the ID pin ADC and the I2C transfers
+// it starts, and the host polls of the interrupt endpoints every bInterval.
+// The output is every report the host takes, then the press-to-host latency
+// percentiles of the keys, so a run can be diffed against a checked-in
+// expectation.
+//
+// Trace lines (times in µs, '#' starts a comment):
+//   <t> key <row> <col> <0|1>        switch opens or closes
+//   <t> peripheral <0|1> [8 bytes]   peripheral half plugged, its key data (hex)
+//   <t> leds <mask>                  host sets the keyboard LEDs
+//   <t> end                          stop (default: 500 ms after the last line)
+//
+// A press is the first closing edge of a switch whose key the host sees as
+// up. Its latency runs until the first report holding the key. Only keys of
+// layer 0 that map to one usage or modifier are measured; presses resolved
+// to something else, a combo or another layer, count as unmatched.
+//
+// Tap-hold keys of layer 0 are summed up per policy: a tap runs from the
+// release to the first report of the tap key, a hold from the press to the
+// first report of the hold modifier.
+//
+// --keymap FILE replays against a blob written by tools/keymap_compiler.py
+// instead of the default keymap.
+//
+// Built with KBD_PROFILE, the profiler histograms follow on stderr. Built
+// with KBD_TRACE, --dump FILE writes the event trace for
+// tools/trace_decode.py.
+
+#include "hal_host.h"
+#include "keyboard.h"
+#include "keymap.h"
+#include "nvm_flash.h"
+#include "profile.h"
+#include "settings.h"
+#include "timebase.h"
+#include "trace.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SCAN_PERIOD_US (KBD_SCAN_PERIOD_MS * 1000)
+#define POLL_PERIOD_US 2000     // bInterval of both IN endpoints
+#define ADC_US         20       // ID pin conversion after the scan
+#define I2C_BYTE_US    90       // 9 bit times at 100 kHz
+#define DRAIN_US       500000
+
+#define MAX_EVENTS  65536
+#define MAX_PRESSES 65536
+#define MAX_TAP_HOLD_PRESSES 4096
+
+#define NUM_TAP_HOLD_POLICIES 3
+
+enum event_type
+{
+	EVENT_KEY,
+	EVENT_PERIPHERAL,
+	EVENT_LEDS,
+	EVENT_END
+};
+
+struct input_event
+{
+	uint64_t time;
+	enum event_type type;
+	uint8_t row;
+	uint8_t col;
+	uint8_t value;
+	uint8_t data[KBD_I2C_DATA_LEN];
+};
+
+// How a key shows in the reports: a usage of either interface or a modifier
+struct key_probe
+{
+	enum hal_host_interface iface;
+	uint16_t usage;
+	uint8_t modifier;
+	bool measured;
+	bool down;          // Seen by the host
+	bool press_pending;
+	uint64_t press_time;
+
+	// Tap-hold keys: the tap key is the usage above, the hold key the
+	// modifier when it is one
+	bool tap_hold;
+	uint8_t policy;
+	bool tap_down;
+	bool hold_down;
+	bool release_pending;
+	uint64_t release_time;
+};
+
+struct tap_hold_summary
+{
+	unsigned taps;
+	unsigned holds;
+	unsigned num_latencies;
+	uint32_t latencies[MAX_TAP_HOLD_PRESSES];
+};
+
+static struct input_event g_events[MAX_EVENTS];
+static unsigned g_numEvents = 0;
+
+static struct key_probe g_probes[NUM_ROWS][NUM_COLS];
+static uint32_t g_latencies[MAX_PRESSES];
+static unsigned g_numLatencies = 0;
+static unsigned g_numPresses = 0;
+
+static const char* const POLICY_NAMES[NUM_TAP_HOLD_POLICIES] = {
+	"timeout", "permissive_hold", "hold_on_other_key_press"
+};
+static struct tap_hold_summary g_tapHold[NUM_TAP_HOLD_POLICIES];
+
+static FILE* g_out;
+
+static int parse_trace(const char* path)
+{
+	FILE* f = fopen(path, "r");
+	if (f == NULL)
+	{
+		perror(path);
+		return -1;
+	}
+
+	char line[256];
+	unsigned n = 0;
+	uint64_t last = 0;
+	while (fgets(line, sizeof(line), f) != NULL)
+	{
+		n++;
+		char* comment = strchr(line, '#');
+		if (comment != NULL)
+		{
+			*comment = 0;
+		}
+
+		char kind[16];
+		uint64_t time;
+		int pos;
+		if (sscanf(line, " %" SCNu64 " %15s %n", &time, kind, &pos) < 2)
+		{
+			continue;
+		}
+
+		if (g_numEvents == MAX_EVENTS || time < last)
+		{
+			fprintf(stderr, "%s:%u: too many events or time going back\n", path, n);
+			fclose(f);
+			return -1;
+		}
+		last = time;
+
+		struct input_event* e = &g_events[g_numEvents];
+		memset(e, 0, sizeof(*e));
+		e->time = time;
+		const char* args = line + pos;
+		unsigned a, b, c;
+		bool ok = true;
+		if (strcmp(kind, "key") == 0)
+		{
+			e->type = EVENT_KEY;
+			ok = sscanf(args, "%u %u %u", &a, &b, &c) == 3 && a < NUM_ROWS && b < NUM_COLS;
+			e->row = a;
+			e->col = b;
+			e->value = c != 0;
+		}
+		else if (strcmp(kind, "peripheral") == 0)
+		{
+			e->type = EVENT_PERIPHERAL;
+			int used;
+			ok = sscanf(args, "%u%n", &a, &used) == 1;
+			e->value = a != 0;
+			args += used;
+			for (unsigned i = 0; ok && i < KBD_I2C_DATA_LEN && sscanf(args, "%x%n", &b, &used) == 1; i++)
+			{
+				e->data[i] = b;
+				args += used;
+			}
+		}
+		else if (strcmp(kind, "leds") == 0)
+		{
+			e->type = EVENT_LEDS;
+			ok = sscanf(args, "%x", &a) == 1;
+			e->value = a;
+		}
+		else if (strcmp(kind, "end") == 0)
+		{
+			e->type = EVENT_END;
+		}
+		else
+		{
+			ok = false;
+		}
+
+		if (!ok)
+		{
+			fprintf(stderr, "%s:%u: bad line\n", path, n);
+			fclose(f);
+			return -1;
+		}
+		g_numEvents++;
+	}
+
+	fclose(f);
+	if (g_numEvents == 0 || g_events[g_numEvents - 1].type != EVENT_END)
+	{
+		struct input_event* e = &g_events[g_numEvents++];
+		memset(e, 0, sizeof(*e));
+		e->time = last + DRAIN_US;
+		e->type = EVENT_END;
+	}
+	return 0;
+}
+
+static inline uint8_t key_modifier(uint16_t key_id)
+{
+	return ((key_id >> 8) & 0xF) ? 1 << (((key_id >> 8) & 0xF) - 1) : 0;
+}
+
+static void init_probes(void)
+{
+	memset(g_probes, 0, sizeof(g_probes));
+	for (unsigned r = 0; r < NUM_ROWS; r++)
+	{
+		for (unsigned c = 0; c < NUM_COLS; c++)
+		{
+			struct key_probe* p = &g_probes[r][c];
+			const uint16_t key_id = keymap_get_key(0, r, c);
+			struct tap_hold_key th;
+			switch (key_id & 0xf000)
+			{
+			case KEY_SET_META:
+				// Tap-hold keys with a keyboard key on tap
+				if (((key_id >> 8) & 0xF) == KEY_META_TAP_HOLD && keymap_get_tap_hold_key(key_id & 0xFF, &th)
+					&& (th.tap & 0xf000) == KEY_SET_DEFAULT && (th.tap & 0xFF) != 0
+					&& th.policy < NUM_TAP_HOLD_POLICIES)
+				{
+					p->iface = HAL_HOST_KEYBOARD;
+					p->usage = th.tap & 0xFF;
+					p->modifier = ((th.hold & 0xf000) == KEY_SET_DEFAULT && (th.hold & 0xFF) == 0) ? key_modifier(th.hold) : 0;
+					p->tap_hold = true;
+					p->policy = th.policy;
+				}
+				break;
+			case KEY_SET_MULTIMEDIA:
+				p->iface = HAL_HOST_MULTIMEDIA;
+				p->usage = keymap_get_consumer_usage(key_id & 0xFF);
+				p->measured = p->usage != 0;
+				break;
+			default:
+				// Keys with a modifier are seen by their usage
+				p->iface = HAL_HOST_KEYBOARD;
+				p->usage = key_id & 0xFF;
+				p->modifier = key_modifier(key_id);
+				p->measured = key_id != 0;
+				break;
+			}
+		}
+	}
+}
+
+static bool report_has_usage(const uint8_t* report, uint8_t usage)
+{
+	for (unsigned i = 2; i < HAL_HOST_REPORT_SIZE; i++)
+	{
+		if (report[i] == usage)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool report_has(const struct key_probe* p, const uint8_t* report)
+{
+	if (p->iface == HAL_HOST_MULTIMEDIA)
+	{
+		for (unsigned i = 0; i < UDI_HID_MULTIMEDIA_MAX_USAGES; i++)
+		{
+			if ((report[2 * i] | (report[2 * i + 1] << 8)) == p->usage)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	if (p->usage == 0)
+	{
+		return (report[0] & p->modifier) != 0;
+	}
+	return report_has_usage(report, p->usage);
+}
+
+static void tap_hold_latency(struct key_probe* p, uint64_t since, uint64_t time)
+{
+	struct tap_hold_summary* summary = &g_tapHold[p->policy];
+	if (summary->num_latencies < MAX_TAP_HOLD_PRESSES)
+	{
+		summary->latencies[summary->num_latencies++] = time - since;
+	}
+}
+
+static void tap_hold_report_taken(struct key_probe* p, uint64_t time, const uint8_t* report)
+{
+	struct tap_hold_summary* summary = &g_tapHold[p->policy];
+	const bool tap = report_has_usage(report, p->usage);
+	const bool hold = p->modifier != 0 && (report[0] & p->modifier) != 0;
+
+	if (tap && !p->tap_down && p->release_pending)
+	{
+		summary->taps++;
+		tap_hold_latency(p, p->release_time, time);
+		p->press_pending = false;
+		p->release_pending = false;
+	}
+	if (hold && !p->hold_down && p->press_pending)
+	{
+		summary->holds++;
+		tap_hold_latency(p, p->press_time, time);
+		p->press_pending = false;
+	}
+	p->tap_down = tap;
+	p->hold_down = hold;
+}
+
+static void key_edge(uint64_t time, unsigned row, unsigned col, bool closed)
+{
+	struct key_probe* p = &g_probes[row][col];
+	if (p->tap_hold)
+	{
+		// Bounces are ignored: the first closing edge starts a press, the
+		// first opening edge after it a release
+		if (closed && !p->press_pending && !p->release_pending && !p->hold_down)
+		{
+			p->press_pending = true;
+			p->press_time = time;
+		}
+		else if (!closed && p->press_pending && !p->release_pending)
+		{
+			p->release_pending = true;
+			p->release_time = time;
+		}
+	}
+	else if (closed && p->measured && !p->down && !p->press_pending)
+	{
+		p->press_pending = true;
+		p->press_time = time;
+		g_numPresses++;
+	}
+	hal_host_set_key(row, col, closed);
+}
+
+static void report_taken(uint64_t time, enum hal_host_interface iface, const uint8_t* report)
+{
+	fprintf(g_out, "%10.3f %s", time / 1000.0, iface == HAL_HOST_KEYBOARD ? "kbd  " : "media");
+	if (iface == HAL_HOST_KEYBOARD)
+	{
+		fprintf(g_out, " %02x |", report[0]);
+		for (unsigned i = 2; i < HAL_HOST_REPORT_SIZE; i++)
+		{
+			fprintf(g_out, " %02x", report[i]);
+		}
+	}
+	else
+	{
+		for (unsigned i = 0; i < UDI_HID_MULTIMEDIA_MAX_USAGES; i++)
+		{
+			fprintf(g_out, " %04x", report[2 * i] | (report[2 * i + 1] << 8));
+		}
+	}
+	fprintf(g_out, "\n");
+
+	for (unsigned r = 0; r < NUM_ROWS; r++)
+	{
+		for (unsigned c = 0; c < NUM_COLS; c++)
+		{
+			struct key_probe* p = &g_probes[r][c];
+			if (p->tap_hold && iface == HAL_HOST_KEYBOARD)
+			{
+				tap_hold_report_taken(p, time, report);
+				continue;
+			}
+			if (!p->measured || p->iface != iface)
+			{
+				continue;
+			}
+
+			p->down = report_has(p, report);
+			if (p->down && p->press_pending)
+			{
+				p->press_pending = false;
+				if (g_numLatencies < MAX_PRESSES)
+				{
+					g_latencies[g_numLatencies++] = time - p->press_time;
+				}
+			}
+		}
+	}
+}
+
+static uint32_t percentile(const uint32_t* latencies, unsigned n, unsigned pct)
+{
+	// Nearest rank
+	const unsigned rank = (pct * n + 99) / 100;
+	return latencies[rank > 0 ? rank - 1 : 0];
+}
+
+static void print_latencies(uint32_t* latencies, unsigned n)
+{
+	if (n == 0)
+	{
+		return;
+	}
+
+	qsort(latencies, n, sizeof(latencies[0]), hal_host_compare_u32);
+	fprintf(g_out, "# latency_us min %u p50 %u p90 %u p99 %u max %u\n", latencies[0],
+		percentile(latencies, n, 50), percentile(latencies, n, 90), percentile(latencies, n, 99), latencies[n - 1]);
+}
+
+static void print_summary(void)
+{
+	fprintf(g_out, "# presses %u, reported %u, unmatched %u\n", g_numPresses, g_numLatencies, g_numPresses - g_numLatencies);
+	print_latencies(g_latencies, g_numLatencies);
+
+	for (unsigned i = 0; i < NUM_TAP_HOLD_POLICIES; i++)
+	{
+		struct tap_hold_summary* summary = &g_tapHold[i];
+		if (summary->num_latencies > 0)
+		{
+			fprintf(g_out, "# tap-hold %s: taps %u, holds %u\n", POLICY_NAMES[i], summary->taps, summary->holds);
+			print_latencies(summary->latencies, summary->num_latencies);
+		}
+	}
+}
+
+#ifdef KBD_PROFILE
+static void print_profile(void)
+{
+	static const char* const names[NUM_PROFILE_INTERVALS] = {
+		"scan->event", "event->built", "built->armed", "armed->sent", "total"
+	};
+
+	for (unsigned i = 0; i < NUM_PROFILE_INTERVALS; i++)
+	{
+		struct profile_histogram h;
+		profile_get_histogram(i, &h);
+		unsigned samples = 0;
+		for (unsigned b = 0; b < PROFILE_NUM_BUCKETS; b++)
+		{
+			samples += h.buckets[b];
+		}
+		fprintf(stderr, "# profile %-12s samples %u mean_us %u max_us %" PRIu32 "\n",
+			names[i], samples, samples ? (unsigned)(h.sum / samples) : 0, h.max);
+	}
+}
+#endif
+
+#ifdef KBD_TRACE
+static int write_dump(const char* path)
+{
+	FILE* f = fopen(path, "wb");
+	if (f == NULL)
+	{
+		perror(path);
+		return 1;
+	}
+
+	// Format of tools/trace_decode.py
+	fwrite("KTRC\x01", 1, 5, f);
+	struct trace_record record;
+	for (unsigned i = 0; trace_read(i, &record, 1) == 1; i++)
+	{
+		const uint8_t bytes[4] = { record.delta, record.delta >> 8, record.event, record.payload };
+		fwrite(bytes, 1, sizeof(bytes), f);
+	}
+	return fclose(f) == 0 ? 0 : 1;
+}
+#endif
+
+static void run(uint64_t scan_phase, uint64_t poll_phase)
+{
+	uint64_t next_scan = scan_phase;
+	uint64_t next_poll = poll_phase;
+	uint64_t adc_done = UINT64_MAX;
+	uint64_t i2c_done = UINT64_MAX;
+	unsigned e = 0;
+
+	for (;;)
+	{
+		// Earliest source first; on ties trace events, then transfer
+		// completions, then the scan, then the host
+		uint64_t now = g_events[e].time;
+		now = Min(now, Min(adc_done, i2c_done));
+		now = Min(now, Min(next_scan, next_poll));
+		hal_host_set_frame(now / 1000);
+		hal_host_set_time(now);
+
+		if (g_events[e].time == now)
+		{
+			const struct input_event* ev = &g_events[e++];
+			switch (ev->type)
+			{
+			case EVENT_KEY:
+				key_edge(now, ev->row, ev->col, ev->value);
+				break;
+			case EVENT_PERIPHERAL:
+				hal_host_set_peripheral(ev->value, ev->data);
+				break;
+			case EVENT_LEDS:
+				hal_host_set_leds(ev->value);
+				break;
+			case EVENT_END:
+				return;
+			}
+			continue;
+		}
+
+		if (adc_done == now)
+		{
+			adc_done = UINT64_MAX;
+			hal_host_complete_adc();
+		}
+		else if (i2c_done == now)
+		{
+			i2c_done = UINT64_MAX;
+			hal_host_complete_i2c();
+		}
+		else if (next_scan == now)
+		{
+			next_scan += SCAN_PERIOD_US;
+			hal_host_scan();
+			adc_done = now + ADC_US;
+		}
+		else
+		{
+			next_poll += POLL_PERIOD_US;
+			uint8_t report[HAL_HOST_REPORT_SIZE];
+			for (unsigned i = 0; i < HAL_HOST_NUM_INTERFACES; i++)
+			{
+				if (hal_host_poll(i, report))
+				{
+					report_taken(now, i, report);
+				}
+			}
+		}
+
+		// The scan cancels the transfer in progress, completions start the
+		// next one
+		const unsigned length = hal_host_get_i2c_length();
+		if (length == 0)
+		{
+			i2c_done = UINT64_MAX;
+		}
+		else if (i2c_done == UINT64_MAX)
+		{
+			i2c_done = now + (length + 1) * I2C_BYTE_US;
+		}
+	}
+}
+
+static int compare_output(FILE* a, const char* expected)
+{
+	FILE* b = fopen(expected, "r");
+	if (b == NULL)
+	{
+		perror(expected);
+		return 1;
+	}
+
+	char la[256], lb[256];
+	unsigned n = 0;
+	int result = 0;
+	for (;;)
+	{
+		const bool ea = fgets(la, sizeof(la), a) == NULL;
+		const bool eb = fgets(lb, sizeof(lb), b) == NULL;
+		n++;
+		if (ea && eb)
+		{
+			break;
+		}
+		if (ea || eb || strcmp(la, lb) != 0)
+		{
+			fprintf(stderr, "%s:%u differs from the replay:\n- %s+ %s", expected, n,
+				eb ? "(end)\n" : lb, ea ? "(end)\n" : la);
+			result = 1;
+			break;
+		}
+	}
+
+	fclose(b);
+	return result;
+}
+
+static void usage(void)
+{
+#ifdef KBD_TRACE
+	fprintf(stderr, "usage: kbd_replay [--scan-phase US] [--poll-phase US] [--keymap FILE] [--expect FILE] [--dump FILE] TRACE\n");
+#else
+	fprintf(stderr, "usage: kbd_replay [--scan-phase US] [--poll-phase US] [--keymap FILE] [--expect FILE] TRACE\n");
+#endif
+	exit(2);
+}
+
+int main(int argc, char** argv)
+{
+	uint64_t scan_phase = 0;
+	uint64_t poll_phase = 1000;
+	const char* keymap = NULL;
+	const char* expect = NULL;
+	const char* trace = NULL;
+#ifdef KBD_TRACE
+	const char* dump = NULL;
+#endif
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--scan-phase") == 0 && i + 1 < argc)
+		{
+			scan_phase = strtoull(argv[++i], NULL, 0) % SCAN_PERIOD_US;
+		}
+		else if (strcmp(argv[i], "--poll-phase") == 0 && i + 1 < argc)
+		{
+			poll_phase = strtoull(argv[++i], NULL, 0) % POLL_PERIOD_US;
+		}
+		else if (strcmp(argv[i], "--keymap") == 0 && i + 1 < argc)
+		{
+			keymap = argv[++i];
+		}
+		else if (strcmp(argv[i], "--expect") == 0 && i + 1 < argc)
+		{
+			expect = argv[++i];
+		}
+#ifdef KBD_TRACE
+		else if (strcmp(argv[i], "--dump") == 0 && i + 1 < argc)
+		{
+			dump = argv[++i];
+		}
+#endif
+		else if (argv[i][0] != '-' && trace == NULL)
+		{
+			trace = argv[i];
+		}
+		else
+		{
+			usage();
+		}
+	}
+	if (trace == NULL || parse_trace(trace) != 0)
+	{
+		usage();
+	}
+
+	// With --expect the output goes to a temporary file that is compared
+	g_out = (expect != NULL) ? tmpfile() : stdout;
+	if (g_out == NULL)
+	{
+		perror("tmpfile");
+		return 1;
+	}
+
+	hal_host_init();
+	timebase_init();
+#ifdef KBD_TRACE
+	trace_init();
+#endif
+	configure_pins();
+	nvm_flash_init();
+	settings_init();
+	configure_keymap();
+	if (keymap != NULL && !hal_host_load_keymap(keymap))
+	{
+		return 1;
+	}
+	configure_adc();
+	configure_dac();
+	configure_usb_hid();
+	configure_i2c();
+	configure_tc();
+	init_probes();
+
+	run(scan_phase, poll_phase);
+	print_summary();
+#ifdef KBD_PROFILE
+	print_profile();
+#endif
+#ifdef KBD_TRACE
+	if (dump != NULL && write_dump(dump) != 0)
+	{
+		return 1;
+	}
+#endif
+
+	if (expect == NULL)
+	{
+		return 0;
+	}
+
+	rewind(g_out);
+	return compare_output(g_out, expect);
+}
@@ -0,0 +1,733 @@
+// End-to-end stress benchmark of the keyboard logic, on simulated time as in
+// kbd_replay: scans, ID pin conversions, I2C transfers and host polls.
+//
+// The sweep finds the highest key event rate delivered without loss. Layer
+// 0 keys that map to a plain usage are struck at a rate doubled until
+// presses get lost, then bisected. Each keystroke bounces, and at most
+// SWEEP_MAX_HELD switches are held so rollover never hides a key. A press
+// is lost when the host never sees its usage come down. The peripheral
+// half keeps hot-plugging and typing, and the host keeps setting the LEDs.
+//
+// The load phase then strikes every switch at random, matrix and
+// peripheral alike, plays a macro twice a second and lets rollover happen.
+// It reports the rates, the report queue high-water marks and the time the
+// host spends running the scan callback, and all the firmware callbacks per
+// scan.
+//
+// Last, the macro is played on its own, back to back, for its throughput:
+// the characters the host sees per second from the press of the macro key
+// to the last one. The default keymap has no macro; --keymap FILE loads a
+// blob of tools/keymap_compiler.py with one, like host/traces/keymap.json.
+//
+// These times are host nanoseconds, which only compare runs on one machine;
+// kbd_cycles counts Cortex-M0+ cycles of the scan. With --csv every figure
+// is a name,value line.
+//
+// usage: kbd_stress [--seconds N] [--load-rate N] [--model NAME] [--seed N]
+//                   [--keymap FILE] [--csv] [--min-rate EVENTS]
+
+#include "bounce.h"
+#include "hal_host.h"
+#include "keyboard.h"
+#include "keyboard_debounce.h"
+#include "keyboard_macro.h"
+#include "keymap.h"
+#include "nvm_flash.h"
+#include "settings.h"
+#include "timebase.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SCAN_PERIOD_US (KBD_SCAN_PERIOD_MS * 1000)
+#define POLL_PERIOD_US 2000     // bInterval of both IN endpoints
+#define ADC_US         20       // ID pin conversion after the scan
+#define I2C_BYTE_US    90       // 9 bit times at 100 kHz
+#define SETTLE_US      20000    // Bounce after a release, before the next keystroke
+#define DRAIN_US       500000
+
+// Peripheral switches: a modifier, two media bits and key usages F13 on
+#define NUM_PERIPHERAL_SWITCHES 8
+#define PERIPHERAL_FIRST_USAGE  0x68
+#define NUM_SWITCHES            (NUM_KEYS + NUM_PERIPHERAL_SWITCHES)
+
+#define SWEEP_MAX_HELD   5
+#define SWEEP_FIRST_RATE 25      // Keystrokes per second
+#define SWEEP_MAX_RATE   12800
+#define SWEEP_BISECTIONS 5
+
+// Momentary layer and the "hello" macro of host/traces/keymap.json
+#define MACRO_LAYER_KEY KEY_INDEX(5, 1)
+#define MACRO_KEY       KEY_INDEX(2, 2)
+#define MACRO_PERIOD_US 500000
+#define MACRO_PLAYS     20
+
+struct stress_switch
+{
+	struct bounce_wave wave;
+	uint32_t end;         // Wave over, free for the next keystroke
+	uint16_t usage;       // Keyboard usage checked on the host, 0 if none
+	bool in_pool;         // Struck in the phase
+	bool host_down;
+	unsigned presses;
+	unsigned seen;
+};
+
+struct stress_stats
+{
+	unsigned keystrokes;
+	unsigned checked;
+	unsigned lost;
+	unsigned extra;
+	unsigned scans;
+	unsigned macro_scans;
+	unsigned chars;           // Usages coming down in keyboard reports
+	uint64_t last_char_time;
+	unsigned reports[HAL_HOST_NUM_INTERFACES];
+	unsigned rollover_reports;
+	unsigned queue_high_water[HAL_HOST_NUM_INTERFACES];
+	uint32_t superseded[HAL_HOST_NUM_INTERFACES];
+	uint32_t key_events;
+	uint64_t callback_host_ns;
+	uint32_t scan_host_ns_p50;
+	uint32_t scan_host_ns_p99;
+	uint32_t scan_host_ns_max;
+};
+
+static struct stress_switch g_switches[NUM_SWITCHES];
+static uint8_t g_lastReport[HAL_HOST_REPORT_SIZE];
+static const struct bounce_model* g_model;
+static uint32_t g_random;
+static bool g_connected;
+
+// Simulation time and the next time of each source
+static uint64_t g_now;
+static uint64_t g_nextScan;
+static uint64_t g_nextPoll;
+static uint64_t g_adcDone;
+static uint64_t g_i2cDone;
+
+static uint32_t* g_scanNs;
+static unsigned g_maxScans;
+static struct stress_stats* g_stats;
+
+static uint64_t host_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint32_t random_range(uint32_t min, uint32_t max)
+{
+	return min + bounce_random(&g_random) % (max - min + 1);
+}
+
+static bool switch_closed(unsigned s, uint32_t t)
+{
+	const struct stress_switch* sw = &g_switches[s];
+	return t < sw->end && bounce_level(&sw->wave, t);
+}
+
+static bool switch_busy(unsigned s, uint32_t t)
+{
+	return t < g_switches[s].end;
+}
+
+static unsigned held_switches(uint32_t t)
+{
+	unsigned held = 0;
+	for (unsigned s = 0; s < NUM_SWITCHES; s++)
+	{
+		if (t < g_switches[s].wave.release && switch_busy(s, t))
+		{
+			held++;
+		}
+	}
+	return held;
+}
+
+static void strike(unsigned s, uint32_t press, uint32_t hold)
+{
+	struct stress_switch* sw = &g_switches[s];
+	sw->end = press + hold + SETTLE_US;
+	bounce_generate(g_model, &g_random, press, press + hold, sw->end, &sw->wave);
+	sw->presses++;
+	g_stats->keystrokes++;
+}
+
+static void init_switches(void)
+{
+	memset(g_switches, 0, sizeof(g_switches));
+
+	// Combo keys are resolved late or to something else
+	bool combo_key[NUM_KEYS] = { false };
+	for (unsigned k = 0; k < NUM_KEYS; k++)
+	{
+		combo_key[k] = keymap_get_key_combos(k) != 0;
+	}
+
+	for (unsigned k = 0; k < NUM_KEYS; k++)
+	{
+		const uint16_t key_id = keymap_get_key(0, KEY_INDEX_ROW(k), KEY_INDEX_COL(k));
+		if ((key_id & 0xFF00) == KEY_SET_DEFAULT && key_id >= 0x04 && key_id < 0xE0 && !combo_key[k])
+		{
+			g_switches[k].usage = key_id;
+		}
+	}
+	for (unsigned p = 3; p < NUM_PERIPHERAL_SWITCHES; p++)
+	{
+		g_switches[NUM_KEYS + p].usage = PERIPHERAL_FIRST_USAGE + p - 3;
+	}
+}
+
+static void peripheral_data(uint32_t t, uint8_t* data)
+{
+	const unsigned p = NUM_KEYS;
+	memset(data, 0, KBD_I2C_DATA_LEN);
+	data[0] = switch_closed(p, t) ? 0x02 : 0;                                     // Left shift
+	data[1] = (switch_closed(p + 1, t) ? 0x04 : 0) | (switch_closed(p + 2, t) ? 0x10 : 0); // Play, mute
+	unsigned n = 2;
+	for (unsigned i = 3; i < NUM_PERIPHERAL_SWITCHES && n < KBD_I2C_DATA_LEN; i++)
+	{
+		if (switch_closed(p + i, t))
+		{
+			data[n++] = g_switches[p + i].usage;
+		}
+	}
+}
+
+static void sample_queues(void)
+{
+	for (unsigned i = 0; i < HAL_HOST_NUM_INTERFACES; i++)
+	{
+		g_stats->queue_high_water[i] = Max(g_stats->queue_high_water[i], hal_host_get_queue_depth(i));
+	}
+}
+
+static bool report_has(const uint8_t* report, uint16_t usage)
+{
+	for (unsigned i = 2; i < HAL_HOST_REPORT_SIZE; i++)
+	{
+		if (report[i] == usage)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+static void report_taken(const uint8_t* report)
+{
+	// Keys behind a rollover report are not known to be up or down
+	if (report[2] == 0x01)
+	{
+		g_stats->rollover_reports++;
+		return;
+	}
+
+	for (unsigned i = 2; i < HAL_HOST_REPORT_SIZE; i++)
+	{
+		if (report[i] != 0 && !report_has(g_lastReport, report[i]))
+		{
+			g_stats->chars++;
+			g_stats->last_char_time = g_now;
+		}
+	}
+	memcpy(g_lastReport, report, sizeof(g_lastReport));
+
+	for (unsigned s = 0; s < NUM_SWITCHES; s++)
+	{
+		struct stress_switch* sw = &g_switches[s];
+		if (sw->usage == 0)
+		{
+			continue;
+		}
+		const bool down = report_has(report, sw->usage);
+		if (down && !sw->host_down)
+		{
+			sw->seen++;
+		}
+		sw->host_down = down;
+	}
+}
+
+// Runs the firmware and the host up to time end
+static void simulate(uint64_t end)
+{
+	for (;;)
+	{
+		// On ties transfer completions first, then the scan, then the host
+		uint64_t now = Min(Min(g_adcDone, g_i2cDone), Min(g_nextScan, g_nextPoll));
+		if (now >= end)
+		{
+			g_now = end;
+			return;
+		}
+		g_now = now;
+		hal_host_set_frame(now / 1000);
+		hal_host_set_time(now);
+
+		uint64_t start = host_ns();
+		if (g_adcDone == now)
+		{
+			g_adcDone = UINT64_MAX;
+			hal_host_complete_adc();
+		}
+		else if (g_i2cDone == now)
+		{
+			uint8_t data[KBD_I2C_DATA_LEN];
+			peripheral_data(now, data);
+			hal_host_set_peripheral(g_connected, data);
+
+			g_i2cDone = UINT64_MAX;
+			start = host_ns();
+			hal_host_complete_i2c();
+		}
+		else if (g_nextScan == now)
+		{
+			g_nextScan += SCAN_PERIOD_US;
+			for (unsigned k = 0; k < NUM_KEYS; k++)
+			{
+				hal_host_set_key(KEY_INDEX_ROW(k), KEY_INDEX_COL(k), switch_closed(k, now));
+			}
+
+			start = host_ns();
+			hal_host_scan();
+			const uint32_t ns = host_ns() - start;
+			if (g_stats->scans < g_maxScans)
+			{
+				g_scanNs[g_stats->scans] = ns;
+			}
+			g_stats->scans++;
+			g_stats->macro_scans += macro_is_playing();
+			g_adcDone = now + ADC_US;
+		}
+		else
+		{
+			g_nextPoll += POLL_PERIOD_US;
+			uint8_t report[HAL_HOST_REPORT_SIZE];
+			for (unsigned i = 0; i < HAL_HOST_NUM_INTERFACES; i++)
+			{
+				if (hal_host_poll(i, report))
+				{
+					g_stats->reports[i]++;
+					if (i == HAL_HOST_KEYBOARD)
+					{
+						report_taken(report);
+					}
+				}
+			}
+		}
+		g_stats->callback_host_ns += host_ns() - start;
+		sample_queues();
+
+		// The scan cancels the transfer in progress, completions start the
+		// next one
+		const unsigned length = hal_host_get_i2c_length();
+		if (length == 0)
+		{
+			g_i2cDone = UINT64_MAX;
+		}
+		else if (g_i2cDone == UINT64_MAX)
+		{
+			g_i2cDone = now + (length + 1) * I2C_BYTE_US;
+		}
+	}
+}
+
+// Strikes the switches in the pool at rate keystrokes per second for
+// seconds, then lets the firmware and the host settle
+static void run_phase(unsigned rate, unsigned seconds, uint32_t hold_min, uint32_t hold_max, unsigned max_held,
+	bool macros, uint32_t seed, struct stress_stats* stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	g_stats = stats;
+	g_random = seed;
+	for (unsigned s = 0; s < NUM_SWITCHES; s++)
+	{
+		g_switches[s].presses = 0;
+		g_switches[s].seen = 0;
+	}
+
+	struct kbd_counters before;
+	get_counters(&before);
+	uint32_t superseded[HAL_HOST_NUM_INTERFACES];
+	for (unsigned i = 0; i < HAL_HOST_NUM_INTERFACES; i++)
+	{
+		superseded[i] = hal_host_get_superseded(i);
+	}
+
+	const uint64_t start = g_now;
+	const uint64_t end = start + (uint64_t)seconds * 1000000;
+	const uint32_t interval = 1000000 / rate;
+	uint64_t next_press = start;
+	uint64_t next_leds = start;
+	uint64_t next_plug = start + random_range(1000000, 3000000);
+	uint64_t next_macro = start + MACRO_PERIOD_US;
+
+	while (g_now < end)
+	{
+		const uint64_t next = Min(Min(next_press, next_leds), Min(next_plug, macros ? next_macro : UINT64_MAX));
+		simulate(Min(next, end));
+		if (g_now >= end)
+		{
+			break;
+		}
+
+		const uint32_t t = g_now;
+		if (next_press == g_now)
+		{
+			next_press += random_range(interval / 2, interval * 3 / 2);
+			if (held_switches(t) < max_held)
+			{
+				// A few tries at a free switch of the pool
+				for (unsigned i = 0; i < 8; i++)
+				{
+					const unsigned s = bounce_random(&g_random) % NUM_SWITCHES;
+					if (g_switches[s].in_pool && !switch_busy(s, t))
+					{
+						strike(s, t, random_range(hold_min, hold_max));
+						break;
+					}
+				}
+			}
+		}
+		else if (next_leds == g_now)
+		{
+			next_leds += random_range(50000, 150000);
+			hal_host_set_leds(bounce_random(&g_random) & 0x1F);
+		}
+		else if (next_plug == g_now)
+		{
+			next_plug += random_range(1000000, 3000000);
+			g_connected = !g_connected;
+			hal_host_set_peripheral(g_connected, NULL);
+		}
+		else
+		{
+			next_macro += MACRO_PERIOD_US;
+			if (!switch_busy(MACRO_LAYER_KEY, t) && !switch_busy(MACRO_KEY, t + 15000))
+			{
+				strike(MACRO_LAYER_KEY, t, 60000);
+				strike(MACRO_KEY, t + 15000, 20000);
+			}
+		}
+	}
+	simulate(g_now + SETTLE_US + DRAIN_US);
+
+	// Peripheral keys are lost while it is unplugged
+	for (unsigned s = 0; s < NUM_KEYS; s++)
+	{
+		const struct stress_switch* sw = &g_switches[s];
+		if (sw->usage == 0 || !sw->in_pool)
+		{
+			continue;
+		}
+		stats->checked += sw->presses;
+		stats->lost += (sw->seen < sw->presses) ? sw->presses - sw->seen : 0;
+		stats->extra += (sw->seen > sw->presses) ? sw->seen - sw->presses : 0;
+	}
+
+	struct kbd_counters after;
+	get_counters(&after);
+	stats->key_events = after.key_events - before.key_events;
+	for (unsigned i = 0; i < HAL_HOST_NUM_INTERFACES; i++)
+	{
+		stats->superseded[i] = hal_host_get_superseded(i) - superseded[i];
+	}
+
+	const unsigned n = Min(stats->scans, g_maxScans);
+	if (n > 0)
+	{
+		qsort(g_scanNs, n, sizeof(g_scanNs[0]), hal_host_compare_u32);
+		stats->scan_host_ns_p50 = g_scanNs[(n - 1) / 2];
+		stats->scan_host_ns_p99 = g_scanNs[(n * 99 + 99) / 100 - 1];
+		stats->scan_host_ns_max = g_scanNs[n - 1];
+	}
+}
+
+static void set_pool(bool all)
+{
+	// The sweep strikes the matrix keys it checks, and the peripheral
+	for (unsigned s = 0; s < NUM_SWITCHES; s++)
+	{
+		g_switches[s].in_pool = all || g_switches[s].usage != 0 || s >= NUM_KEYS;
+	}
+}
+
+static bool run_sweep_rate(unsigned rate, unsigned seconds, uint32_t seed, bool csv, double* events_per_s)
+{
+	// Holds shrink with the rate so that about three keys are down
+	const uint32_t hold = 3000000 / rate;
+	struct stress_stats s;
+	run_phase(rate, seconds, hold / 2, hold * 3 / 2, SWEEP_MAX_HELD, false, seed, &s);
+
+	const double events = 2.0 * s.checked / seconds;
+	*events_per_s = events;
+	if (csv)
+	{
+		printf("sweep.%u.keystrokes,%u\nsweep.%u.events_per_s,%.1f\nsweep.%u.lost,%u\nsweep.%u.extra,%u\n"
+			"sweep.%u.kbd_queue_high_water,%u\nsweep.%u.kbd_superseded,%u\n",
+			rate, s.checked, rate, events, rate, s.lost, rate, s.extra,
+			rate, s.queue_high_water[HAL_HOST_KEYBOARD], rate, s.superseded[HAL_HOST_KEYBOARD]);
+	}
+	else
+	{
+		printf("%11u %10.1f %10u %7u %7u %7u %10u\n", rate, events, s.checked, s.lost, s.extra,
+			s.queue_high_water[HAL_HOST_KEYBOARD], s.superseded[HAL_HOST_KEYBOARD]);
+	}
+	return s.lost == 0;
+}
+
+// Returns the key events per second of the fastest rate without loss
+static double run_sweep(unsigned seconds, uint32_t seed, bool csv)
+{
+	if (!csv)
+	{
+		printf("# sweep: %u s per rate, at most %u held\n", seconds, SWEEP_MAX_HELD);
+		printf("%11s %10s %10s %7s %7s %7s %10s\n",
+			"keystrokes", "events/s", "checked", "lost", "extra", "kbd_hw", "superseded");
+	}
+
+	set_pool(false);
+	unsigned pass = 0;
+	unsigned fail = 0;
+	double best = 0;
+	double events;
+	for (unsigned rate = SWEEP_FIRST_RATE; rate <= SWEEP_MAX_RATE; rate *= 2)
+	{
+		if (!run_sweep_rate(rate, seconds, seed, csv, &events))
+		{
+			fail = rate;
+			break;
+		}
+		pass = rate;
+		best = Max(best, events);
+	}
+
+	for (unsigned i = 0; i < SWEEP_BISECTIONS && fail > pass + 1; i++)
+	{
+		const unsigned rate = (pass + fail) / 2;
+		if (run_sweep_rate(rate, seconds, seed, csv, &events))
+		{
+			pass = rate;
+			best = Max(best, events);
+		}
+		else
+		{
+			fail = rate;
+		}
+	}
+	return best;
+}
+
+static bool has_macro(void)
+{
+	const uint16_t key_id = keymap_get_key(1, KEY_INDEX_ROW(MACRO_KEY), KEY_INDEX_COL(MACRO_KEY));
+	return (key_id & 0xFF00) == KEY_MACRO(0);
+}
+
+static void print_value(bool csv, const char* name, double value, const char* unit)
+{
+	if (csv)
+	{
+		printf("%s,%g\n", name, value);
+	}
+	else
+	{
+		printf("%-28s %12.1f %s\n", strchr(name, '.') + 1, value, unit);
+	}
+}
+
+static void run_load(unsigned rate, unsigned seconds, uint32_t seed, bool csv)
+{
+	set_pool(true);
+	struct stress_stats s;
+	run_phase(rate, seconds, 30000, 150000, NUM_SWITCHES, has_macro(), seed, &s);
+
+	if (!csv)
+	{
+		printf("# load: %u s, %u keystrokes per second over all %u switches\n", seconds, rate, NUM_SWITCHES);
+	}
+	print_value(csv, "load.keystrokes_per_s", (double)s.keystrokes / seconds, "/s");
+	print_value(csv, "load.key_events_per_s", (double)s.key_events / seconds, "/s");
+	print_value(csv, "load.kbd_reports_per_s", (double)s.reports[HAL_HOST_KEYBOARD] / seconds, "/s");
+	print_value(csv, "load.media_reports_per_s", (double)s.reports[HAL_HOST_MULTIMEDIA] / seconds, "/s");
+	print_value(csv, "load.rollover_reports", s.rollover_reports, "");
+	print_value(csv, "load.macro_scans", s.macro_scans, "");
+	print_value(csv, "load.kbd_queue_high_water", s.queue_high_water[HAL_HOST_KEYBOARD], "reports");
+	print_value(csv, "load.media_queue_high_water", s.queue_high_water[HAL_HOST_MULTIMEDIA], "reports");
+	print_value(csv, "load.kbd_superseded", s.superseded[HAL_HOST_KEYBOARD], "reports");
+	print_value(csv, "load.media_superseded", s.superseded[HAL_HOST_MULTIMEDIA], "reports");
+	print_value(csv, "load.scan_host_ns_p50", s.scan_host_ns_p50, "ns");
+	print_value(csv, "load.scan_host_ns_p99", s.scan_host_ns_p99, "ns");
+	print_value(csv, "load.scan_host_ns_max", s.scan_host_ns_max, "ns");
+	print_value(csv, "load.callback_host_ns_per_scan", s.scans ? (double)s.callback_host_ns / s.scans : 0, "ns");
+}
+
+// Plays the macro alone, each time once the previous one is over
+static void run_macro(uint32_t seed, bool csv)
+{
+	struct stress_stats s;
+	memset(&s, 0, sizeof(s));
+	g_stats = &s;
+	g_random = seed;
+
+	uint64_t playing_us = 0;
+	for (unsigned i = 0; i < MACRO_PLAYS; i++)
+	{
+		const uint64_t t = g_now;
+		strike(MACRO_LAYER_KEY, t, 60000);
+		strike(MACRO_KEY, t + 15000, 20000);
+		do
+		{
+			simulate(g_now + SCAN_PERIOD_US);
+		}
+		while (switch_busy(MACRO_LAYER_KEY, g_now) || switch_busy(MACRO_KEY, g_now) || macro_is_playing());
+		simulate(g_now + SETTLE_US);
+		playing_us += s.last_char_time - (t + 15000);
+	}
+
+	const double chars_per_s = playing_us ? s.chars * 1000000.0 / playing_us : 0;
+	if (!csv)
+	{
+		printf("# macro: played %u times alone, from the press of its key to its last character\n", MACRO_PLAYS);
+	}
+	print_value(csv, "macro.chars", s.chars, "");
+	print_value(csv, "macro.chars_per_s", chars_per_s, "/s");
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: kbd_stress [--seconds N] [--load-rate N] [--model NAME] [--seed N] [--keymap FILE] [--csv] [--min-rate EVENTS]\n");
+	exit(2);
+}
+
+int main(int argc, char** argv)
+{
+	unsigned seconds = 5;
+	unsigned load_rate = 50;
+	unsigned min_rate = 0;
+	uint32_t seed = 1;
+	const char* keymap = NULL;
+	bool csv = false;
+	g_model = &BOUNCE_MODELS[1];
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc)
+		{
+			seconds = strtoul(argv[++i], NULL, 0);
+		}
+		else if (strcmp(argv[i], "--load-rate") == 0 && i + 1 < argc)
+		{
+			load_rate = strtoul(argv[++i], NULL, 0);
+		}
+		else if (strcmp(argv[i], "--model") == 0 && i + 1 < argc)
+		{
+			const char* name = argv[++i];
+			g_model = NULL;
+			for (unsigned m = 0; m < NUM_BOUNCE_MODELS; m++)
+			{
+				if (strcmp(BOUNCE_MODELS[m].name, name) == 0)
+				{
+					g_model = &BOUNCE_MODELS[m];
+				}
+			}
+			if (g_model == NULL)
+			{
+				usage();
+			}
+		}
+		else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+		{
+			seed = strtoul(argv[++i], NULL, 0);
+		}
+		else if (strcmp(argv[i], "--keymap") == 0 && i + 1 < argc)
+		{
+			keymap = argv[++i];
+		}
+		else if (strcmp(argv[i], "--csv") == 0)
+		{
+			csv = true;
+		}
+		else if (strcmp(argv[i], "--min-rate") == 0 && i + 1 < argc)
+		{
+			min_rate = strtoul(argv[++i], NULL, 0);
+		}
+		else
+		{
+			usage();
+		}
+	}
+	if (seconds == 0 || load_rate == 0 || seed == 0)
+	{
+		usage();
+	}
+
+	g_maxScans = (seconds * 1000000 + SETTLE_US + DRAIN_US) / SCAN_PERIOD_US + 1;
+	g_scanNs = malloc(g_maxScans * sizeof(g_scanNs[0]));
+
+	hal_host_init();
+	timebase_init();
+	configure_pins();
+	nvm_flash_init();
+	settings_init();
+	configure_keymap();
+	if (keymap != NULL && !hal_host_load_keymap(keymap))
+	{
+		return 1;
+	}
+	configure_adc();
+	configure_dac();
+	configure_usb_hid();
+	configure_i2c();
+	configure_tc();
+
+	// Debouncing as a board with these switches would be set up
+	settings_set(SETTING_DEBOUNCE_MODE, DEBOUNCE_EAGER);
+	keyboard_apply_settings();
+
+	g_nextScan = 0;
+	g_nextPoll = 1000;
+	g_adcDone = UINT64_MAX;
+	g_i2cDone = UINT64_MAX;
+	init_switches();
+
+	if (csv)
+	{
+		printf("name,value\n");
+	}
+	else
+	{
+		printf("# model %s, debounce eager %u ms, seed %u\n", g_model->name,
+			(unsigned)settings_get(SETTING_DEBOUNCE_MS), seed);
+	}
+
+	const double max_rate = run_sweep(seconds, seed, csv);
+	if (csv)
+	{
+		printf("max_sustained_events_per_s,%.1f\n", max_rate);
+	}
+	else
+	{
+		printf("max sustained: %.1f key events/s without loss\n", max_rate);
+	}
+
+	run_load(load_rate, seconds, seed, csv);
+	if (has_macro())
+	{
+		run_macro(seed, csv);
+	}
+	free(g_scanNs);
+
+	if (max_rate < min_rate)
+	{
+		fprintf(stderr, "max sustained %.1f key events/s, below %u\n", max_rate, min_rate);
+		return 1;
+	}
+	return 0;
+}
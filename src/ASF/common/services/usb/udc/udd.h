@@ -314,11 +314,34 @@ bool udd_ep_wait_stall_clear(udd_ep_id_t ep,
 bool udd_ep_run(udd_ep_id_t ep, bool b_shortpacket,
 		uint8_t * buf, iram_size_t buf_size,
 		udd_callback_trans_t callback);
+
+/**
+ * \brief Queues a single packet on an IN endpoint behind the on going transfer
+ *
+ * The SAMD21 device controller only has one bank per endpoint direction, so
+ * the second bank is emulated: the staged buffer is armed from the transfer
+ * complete interrupt of the current job, before its callback is called.
+ * This lets a class driver hand over the next report while the previous one
+ * is still waiting for the host, without losing a polling interval.
+ * If no transfer is on going, this behaves like udd_ep_run() without short packet.
+ *
+ * \param ep            The ID of the IN endpoint to use
+ * \param buf           Buffer on Internal RAM to send, it must stay untouched
+ *                      until \a callback is called.
+ * \param buf_size      Buffer size to send, at most one endpoint size
+ * \param callback      NULL or function to call at the end of transfer
+ *
+ * \return \c 1 if the buffer is armed or staged, \c 0 if both banks are busy.
+ */
+bool udd_ep_run_next(udd_ep_id_t ep, uint8_t * buf, iram_size_t buf_size,
+		udd_callback_trans_t callback);
+
 /**
  * \brief Aborts transfer on going on endpoint
  *
  * If a transfer is on going, then it is stopped and
  * the callback registered is called to signal the end of transfer.
+ * A job staged by udd_ep_run_next() is aborted as well.
  * Note: The control endpoint is not authorized.
  *
  * \param ep            Endpoint to abort
@@ -284,6 +284,12 @@ typedef struct {
 	iram_size_t buf_size;
 	//! Total number of data transferred on endpoint
 	iram_size_t nb_trans;
+	//! Buffer staged in the second bank, armed when the current job completes (endpoint IN)
+	uint8_t *next_buf;
+	//! Size of the staged buffer
+	iram_size_t next_buf_size;
+	//! Callback to call at the end of the staged transfer
+	udd_callback_trans_t next_call_trans;
 	//! Endpoint size
 	uint16_t ep_size;
 	//! A job is registered on this endpoint
@@ -292,6 +298,8 @@ typedef struct {
 	uint8_t b_shortpacket:1;
 	//! The cache buffer is currently used on endpoint OUT
 	uint8_t b_use_out_cache_buffer:1;
+	//! A second job is staged behind the current one on endpoint IN
+	uint8_t b_next_staged:1;
 } udd_ep_job_t;
 
 /** Array to register a job on bulk/interrupt/isochronous endpoint */
@@ -356,10 +364,24 @@ static void udd_ep_trans_in_next(void* pointer)
 		return;
 	}
 
-	/* Job complete then call callback */
-	ptr_job->busy = false;
-	if (NULL != ptr_job->call_trans) {
-		ptr_job->call_trans(UDD_EP_TRANSFER_OK, ptr_job->nb_trans, ep);
+	/* Job complete. If a job is staged in the second bank, arm it now from
+	 * the transfer complete interrupt so it goes out on the next IN token,
+	 * then call the callback of the finished job */
+	udd_callback_trans_t call_trans = ptr_job->call_trans;
+	nb_trans = ptr_job->nb_trans;
+	if (ptr_job->b_next_staged) {
+		ptr_job->b_next_staged = false;
+		ptr_job->buf = ptr_job->next_buf;
+		ptr_job->buf_size = ptr_job->next_buf_size;
+		ptr_job->nb_trans = 0;
+		ptr_job->call_trans = ptr_job->next_call_trans;
+		ptr_job->b_shortpacket = false;
+		usb_device_endpoint_write_buffer_job(&usb_device,ep_num,&ptr_job->buf[0],ptr_job->buf_size);
+	} else {
+		ptr_job->busy = false;
+	}
+	if (NULL != call_trans) {
+		call_trans(UDD_EP_TRANSFER_OK, nb_trans, ep);
 	}
 }
 
@@ -456,6 +478,14 @@ void udd_ep_abort(udd_ep_id_t ep)
 		/* It can be a Transfer or stall callback */
 		ptr_job->call_trans(UDD_EP_TRANSFER_ABORT, ptr_job->nb_trans, ep);
 	}
+
+	/* The staged job never reached the bank, abort it too */
+	if (ptr_job->b_next_staged) {
+		ptr_job->b_next_staged = false;
+		if (NULL != ptr_job->next_call_trans) {
+			ptr_job->next_call_trans(UDD_EP_TRANSFER_ABORT, 0, ep);
+		}
+	}
 }
 
 bool udd_is_high_speed(void)
@@ -711,6 +741,43 @@ bool udd_ep_run(udd_ep_id_t ep, bool b_shortpacket, uint8_t * buf, iram_size_t b
 	}
 }
 
+bool udd_ep_run_next(udd_ep_id_t ep, uint8_t * buf, iram_size_t buf_size,
+		udd_callback_trans_t callback)
+{
+	udd_ep_id_t ep_num;
+	udd_ep_job_t *ptr_job;
+	irqflags_t flags;
+
+	ep_num = ep & USB_EP_ADDR_MASK;
+
+	if ((USB_DEVICE_MAX_EP < ep_num) || !(ep & USB_EP_DIR_IN) || (udd_ep_is_halted(ep))) {
+		return false;
+	}
+
+	ptr_job = udd_ep_get_job(ep);
+	if ((0 == buf_size) || (ptr_job->ep_size < buf_size)) {
+		return false; /* Only single packet jobs can be staged */
+	}
+
+	flags = cpu_irq_save();
+	if (ptr_job->busy == false) {
+		/* Endpoint idle, the first bank is free */
+		cpu_irq_restore(flags);
+		return udd_ep_run(ep, false, buf, buf_size, callback);
+	}
+	if (ptr_job->b_next_staged) {
+		cpu_irq_restore(flags);
+		return false; /* Both banks already in use */
+	}
+	ptr_job->next_buf = buf;
+	ptr_job->next_buf_size = buf_size;
+	ptr_job->next_call_trans = callback;
+	ptr_job->b_next_staged = true;
+	cpu_irq_restore(flags);
+
+	return true;
+}
+
 void udd_set_address(uint8_t address)
 {
 	usb_device_set_address(&usb_device,address);
@@ -263,7 +263,7 @@ struct usb_module {
 	/** Hardware module pointer of the associated USB peripheral. */
 	Usb *hw;
 
-#if !SAMD11 && !SAML22
+#if !SAMD11 && !SAML22 && !defined(USB_DEVICE_ONLY)
 	/** Array to store host related callback functions */
 	usb_host_callback_t host_callback[USB_HOST_CALLBACK_N];
 	usb_host_pipe_callback_t host_pipe_callback[USB_PIPE_NUM][USB_HOST_PIPE_CALLBACK_N];
@@ -357,7 +357,7 @@ void usb_get_config_defaults(struct usb_config *module_config);
 enum status_code usb_init(struct usb_module *module_inst, Usb *const hw,
 		struct usb_config *module_config);
 
-#if !SAMD11 && !SAML22
+#if !SAMD11 && !SAML22 && !defined(USB_DEVICE_ONLY)
 /**
  * \brief Enable the USB host by setting the VBUS OK
  *
@@ -713,7 +713,7 @@ enum status_code usb_device_endpoint_setup_buffer_job(struct usb_module *module_
 void usb_device_endpoint_abort_job(struct usb_module *module_inst, uint8_t ep);
 /** @} */
 
-#if !SAMD11 && !SAML22
+#if !SAMD11 && !SAML22 && !defined(USB_DEVICE_ONLY)
 /**
  * \name USB Host Pipe Operations
  * @{
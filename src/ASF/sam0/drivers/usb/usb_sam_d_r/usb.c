@@ -36,6 +36,14 @@
 #include <string.h>
 #include "usb.h"
 
+#ifdef USB_DEVICE_ONLY
+#  include "conf_usb.h"
+/** The hardware only reads the descriptors of the enabled endpoints */
+#  define USB_DESCRIPTOR_EPT_NUM (USB_DEVICE_MAX_EP + 1)
+#else
+#  define USB_DESCRIPTOR_EPT_NUM USB_EPT_NUM
+#endif
+
 #ifndef UHD_BULK_INTERVAL_MIN
 /** Minimal bulk interval value */
 #  define UHD_BULK_INTERVAL_MIN 1
@@ -79,8 +87,8 @@
 COMPILER_PACK_SET(1)
 COMPILER_WORD_ALIGNED
 union {
-	UsbDeviceDescriptor usb_endpoint_table[USB_EPT_NUM];
-#if !SAMD11
+	UsbDeviceDescriptor usb_endpoint_table[USB_DESCRIPTOR_EPT_NUM];
+#if !SAMD11 && !defined(USB_DEVICE_ONLY)
 	UsbHostDescriptor usb_pipe_table[USB_PIPE_NUM];
 #endif
 } usb_descriptor_table;
@@ -92,7 +100,7 @@ COMPILER_PACK_RESET()
  */
 static struct usb_module *_usb_instances;
 
-#if !SAMD11
+#if !SAMD11 && !defined(USB_DEVICE_ONLY)
 /**
  * \brief Host pipe callback structure variable
  */
@@ -130,7 +138,7 @@ static const uint8_t _usb_endpoint_irq_bits[USB_DEVICE_EP_CALLBACK_N] = {
 	USB_DEVICE_EPINTFLAG_STALL_Msk
 };
 
-#if !SAMD11
+#if !SAMD11 && !defined(USB_DEVICE_ONLY)
 /**
  * \brief Bit mask for pipe job busy status
  */
@@ -1448,6 +1456,7 @@ enum status_code usb_device_endpoint_set_config(struct usb_module *module_inst,
 
 	uint8_t ep_num = ep_config->ep_address & USB_EP_ADDR_MASK;
 	uint8_t ep_bank = (ep_config->ep_address & USB_EP_DIR_IN) ? 1 : 0;
+	Assert(ep_num < USB_DESCRIPTOR_EPT_NUM);
 
 	switch (ep_config->ep_type) {
 		case USB_DEVICE_ENDPOINT_TYPE_DISABLE:
@@ -1676,7 +1685,7 @@ enum status_code usb_device_endpoint_write_buffer_job(struct usb_module *module_
 	/* Sanity check arguments */
 	Assert(module_inst);
 	Assert(module_inst->hw);
-	Assert(ep_num < USB_EPT_NUM);
+	Assert(ep_num < USB_DESCRIPTOR_EPT_NUM);
 
 	uint8_t flag;
 	flag = (uint8_t)(module_inst->hw->DEVICE.DeviceEndpoint[ep_num].EPCFG.bit.EPTYPE1);
@@ -1711,7 +1720,7 @@ enum status_code usb_device_endpoint_read_buffer_job(struct usb_module *module_i
 	/* Sanity check arguments */
 	Assert(module_inst);
 	Assert(module_inst->hw);
-	Assert(ep_num < USB_EPT_NUM);
+	Assert(ep_num < USB_DESCRIPTOR_EPT_NUM);
 
 	uint8_t flag;
 	flag = (uint8_t)(module_inst->hw->DEVICE.DeviceEndpoint[ep_num].EPCFG.bit.EPTYPE0);
@@ -1909,7 +1918,7 @@ void usb_disable(struct usb_module *module_inst)
 void USB_Handler(void)
 {
 	if (_usb_instances->hw->DEVICE.CTRLA.bit.MODE) {
-#if !SAMD11
+#if !SAMD11 && !defined(USB_DEVICE_ONLY)
 		/*host mode ISR */
 		_usb_host_interrupt_handler();
 #endif
@@ -1971,7 +1980,7 @@ enum status_code usb_init(struct usb_module *module_inst, Usb *const hw,
 	struct system_pinmux_config pin_config;
 	struct system_gclk_chan_config gclk_chan_config;
 
-#if !SAMD11
+#if !SAMD11 && !defined(USB_DEVICE_ONLY)
 	host_pipe_job_busy_status = 0;
 #endif
 
@@ -2053,7 +2062,7 @@ enum status_code usb_init(struct usb_module *module_inst, Usb *const hw,
 	memset((uint8_t *)(&usb_descriptor_table.usb_endpoint_table[0]), 0,
 			sizeof(usb_descriptor_table.usb_endpoint_table));
 
-#if !SAMD11
+#if !SAMD11 && !defined(USB_DEVICE_ONLY)
 	/* callback related init */
 	for (i = 0; i < USB_HOST_CALLBACK_N; i++) {
 		module_inst->host_callback[i] = NULL;
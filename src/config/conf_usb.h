@@ -84,8 +84,8 @@
 // extern void user_callback_vbus_action(bool b_vbus_high);
 // #define  UDC_SOF_EVENT()                  user_callback_sof_action()
 // extern void user_callback_sof_action(void);
-// #define  UDC_SUSPEND_EVENT()              user_callback_suspend_action()
-// extern void user_callback_suspend_action(void);
+#define  UDC_SUSPEND_EVENT()              key_stats_suspend_callback()
+extern void key_stats_suspend_callback(void);
 // #define  UDC_RESUME_EVENT()               user_callback_resume_action()
 // extern void user_callback_resume_action(void);
 //! Mandatory when USB_DEVICE_ATTR authorizes remote wakeup feature
@@ -114,9 +114,14 @@
 extern bool hid_keyboard_enable_callback(void);
 #define UDI_HID_KBD_DISABLE_EXT() hid_keyboard_disable_callback()
 extern void hid_keyboard_disable_callback(void);
-#define  UDI_HID_KBD_CHANGE_LED(value)
-// #define  UDI_HID_KBD_CHANGE_LED(value) my_callback_keyboard_led(value)
-// extern void my_callback_keyboard_led(uint8_t value)
+#define UDI_HID_KBD_CHANGE_LED(value) hid_keyboard_led_callback(value)
+extern void hid_keyboard_led_callback(uint8_t value);
+#define UDI_HID_KBD_REPORT_SENT_EXT() hid_keyboard_report_sent_callback()
+extern void hid_keyboard_report_sent_callback(void);
+
+//! Serve the consumer control collection from the keyboard interface, with
+//! report IDs on a single endpoint, instead of a dedicated interface
+// #define UDI_HID_KBD_SHARED_EP
 
 #define UDI_HID_MULTIMEDIA_ENABLE_EXT() hid_multimedia_enable_callback()
 extern bool hid_multimedia_enable_callback(void);
@@ -138,6 +143,11 @@ extern void hid_multimedia_disable_callback(void);
 //! Control endpoint size
 #define  USB_DEVICE_EP_CTRL_SIZE    8
 
+// The vendor interface uses both directions of the last endpoint
+#ifdef UDI_HID_KBD_SHARED_EP
 #define  USB_DEVICE_MAX_EP          2
+#else
+#define  USB_DEVICE_MAX_EP          3
+#endif
 
 #endif // _CONF_USB_H_
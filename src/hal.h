@@ -0,0 +1,83 @@
+#ifndef HAL_H_
+#define HAL_H_
+
+// Boundary between the keyboard logic and the hardware. hal_samd21.c
+// implements it on the board with ASF; host/hal_host.c implements it for the
+// Linux build (KBD_HOST), where host_platform.h stands in for ASF.
+#ifdef KBD_HOST
+#include "host_platform.h"
+#include "hid_consumer.h"
+#else
+#include <asf.h>
+
+#include "udi_hid_kbd.h"
+#include "udi_hid_multimedia.h"
+#endif
+
+typedef void (*hal_callback_t)(void);
+typedef void (*hal_adc_callback_t)(uint16_t result);
+
+// Key matrix. A row is driven low while the columns, pulled up, are read;
+// the other rows are left floating.
+void hal_matrix_init(void);
+uint16_t hal_matrix_read_row(unsigned row);
+void hal_matrix_release_rows(void);
+
+// Scan interrupt, every KBD_SCAN_PERIOD_MS
+void hal_scan_timer_init(hal_callback_t callback);
+
+// True when the last reset kept the RAM contents: a software, watchdog or
+// reset pin reset, not a power-on or brown-out
+bool hal_reset_kept_ram(void);
+
+// Microsecond timebase: a free running 32-bit count at 1 MHz, kept in
+// standby. The alarm interrupt comes when the count reaches the alarm time;
+// a time already passed is reached at once.
+void hal_time_init(hal_callback_t alarm_callback);
+static inline uint32_t hal_time_now(void);
+void hal_time_set_alarm(uint32_t time);
+void hal_time_cancel_alarm(void);
+
+#ifdef KBD_HOST
+// Set by the test program through hal_host_set_time()
+extern uint32_t g_hostTime;
+
+static inline uint32_t hal_time_now(void)
+{
+	return g_hostTime;
+}
+#else
+static inline uint32_t hal_time_now(void)
+{
+	// Kept synchronized by continuous read requests (hal_time_init)
+	return TC4->COUNT32.COUNT.reg;
+}
+#endif
+
+// On-board LED, 10-bit DAC level
+void hal_led_init(void);
+void hal_led_write(uint16_t level);
+
+// Peripheral half: presence sensed on the ID pin, key data read over I2C.
+// Transfers complete asynchronously through the callbacks.
+void hal_id_adc_init(hal_adc_callback_t callback);
+void hal_id_adc_start(void);
+
+void hal_i2c_init(hal_callback_t write_complete, hal_callback_t read_complete, hal_callback_t error);
+void hal_i2c_write_no_stop(uint8_t address, uint8_t* data, uint16_t length);
+void hal_i2c_read(uint8_t address, uint8_t* data, uint16_t length);
+void hal_i2c_send_stop(void);
+void hal_i2c_cancel(void);
+
+// HID report sinks. Reports are queued on change and taken by host polls.
+void hal_usb_start(void);
+uint16_t hal_usb_frame_number(void);
+
+void hal_hid_kbd_send(uint8_t modifiers, uint8_t* keys);
+bool hal_hid_kbd_is_report_pending(void);
+void hal_hid_kbd_idle_tick(void);
+
+void hal_hid_multimedia_send(const uint16_t* usages);
+void hal_hid_multimedia_idle_tick(void);
+
+#endif /* HAL_H_ */
@@ -0,0 +1,301 @@
+#include "hal.h"
+#include "keyboard.h"
+#include "stack_monitor.h"
+
+static struct tc_module g_tcInstance;
+static hal_callback_t g_scanCallback;
+
+static struct tc_module g_timeInstance;
+static hal_callback_t g_alarmCallback;
+
+static struct dac_module g_dacInstance;
+
+static struct adc_module g_adcInstance;
+static uint16_t g_adcResult;
+static hal_adc_callback_t g_adcCallback;
+
+static struct i2c_master_module g_I2CControllerInstance;
+static struct i2c_master_packet g_I2CPacket;
+static hal_callback_t g_I2CWriteCallback;
+static hal_callback_t g_I2CReadCallback;
+static hal_callback_t g_I2CErrorCallback;
+
+static void scan_tc_callback(struct tc_module *const module)
+{
+	stack_sample(STACK_ISR_SCAN);
+	g_scanCallback();
+
+	UNUSED(module);
+}
+
+void hal_scan_timer_init(hal_callback_t callback)
+{
+	struct tc_config timerconfig;
+	tc_get_config_defaults(&timerconfig);
+		
+	// 8 MHz / 256 / 125 = 250 Hz, so the scan also serves as the 4 ms HID idle timebase
+	timerconfig.counter_size = TC_COUNTER_SIZE_8BIT;
+	timerconfig.clock_source = GCLK_GENERATOR_3;
+	timerconfig.clock_prescaler = TC_CLOCK_PRESCALER_DIV256;
+	timerconfig.counter_8_bit.period = 125;
+	timerconfig.counter_8_bit.compare_capture_channel[0] = 100;
+		
+	tc_init(&g_tcInstance, TC3, &timerconfig);
+	tc_enable(&g_tcInstance);
+		
+	g_scanCallback = callback;
+	tc_register_callback(&g_tcInstance, scan_tc_callback, TC_CALLBACK_CC_CHANNEL0);
+	tc_enable_callback(&g_tcInstance, TC_CALLBACK_CC_CHANNEL0);
+}
+
+bool hal_reset_kept_ram(void)
+{
+	switch (system_get_reset_cause())
+	{
+	case SYSTEM_RESET_CAUSE_SOFTWARE:
+	case SYSTEM_RESET_CAUSE_WDT:
+	case SYSTEM_RESET_CAUSE_EXTERNAL_RESET:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+
+// Compare value ahead of the count by more than the write synchronization
+#define ALARM_LEAD_US 4
+
+static void alarm_tc_callback(struct tc_module *const module)
+{
+	stack_sample(STACK_ISR_TIME);
+	g_alarmCallback();
+
+	UNUSED(module);
+}
+
+void hal_time_init(hal_callback_t alarm_callback)
+{
+	struct tc_config timerconfig;
+	tc_get_config_defaults(&timerconfig);
+
+	// TC4 and TC5 chained, 8 MHz / 8: counts µs and wraps after 71 minutes.
+	// GCLK3 and OSC8M run in standby (conf_clocks.h), so does the count.
+	timerconfig.counter_size = TC_COUNTER_SIZE_32BIT;
+	timerconfig.clock_source = GCLK_GENERATOR_3;
+	timerconfig.clock_prescaler = TC_CLOCK_PRESCALER_DIV8;
+	timerconfig.run_in_standby = true;
+
+	tc_init(&g_timeInstance, TC4, &timerconfig);
+	tc_enable(&g_timeInstance);
+
+	// COUNT synchronized continuously, so that reading it is a plain load
+	TC4->COUNT32.READREQ.reg = TC_READREQ_RCONT | TC_READREQ_RREQ | TC_READREQ_ADDR(TC_COUNT32_COUNT_OFFSET);
+
+	g_alarmCallback = alarm_callback;
+	tc_register_callback(&g_timeInstance, alarm_tc_callback, TC_CALLBACK_CC_CHANNEL0);
+}
+
+void hal_time_set_alarm(uint32_t time)
+{
+	uint32_t lead = ALARM_LEAD_US;
+	for (;;)
+	{
+		// A match needs the compare value ahead of the count
+		const uint32_t earliest = hal_time_now() + lead;
+		const uint32_t compare = ((int32_t)(time - earliest) < 0) ? earliest : time;
+		tc_set_compare_value(&g_timeInstance, TC_COMPARE_CAPTURE_CHANNEL_0, compare);
+
+		// Slower than the lead, it would match only after a wrap
+		if ((int32_t)(hal_time_now() - compare) < 0)
+		{
+			break;
+		}
+		lead *= 2;
+	}
+
+	// The match flag is set at every turn, alarm or not
+	TC4->COUNT32.INTFLAG.reg = TC_INTFLAG_MC0;
+	tc_enable_callback(&g_timeInstance, TC_CALLBACK_CC_CHANNEL0);
+}
+
+void hal_time_cancel_alarm(void)
+{
+	tc_disable_callback(&g_timeInstance, TC_CALLBACK_CC_CHANNEL0);
+}
+
+
+void hal_led_init(void)
+{
+	struct dac_config dacconfig;
+	dac_get_config_defaults(&dacconfig);
+	
+	dacconfig.reference = DAC_REFERENCE_AVCC;
+	dacconfig.left_adjust = false;
+	dacconfig.clock_source = GCLK_GENERATOR_3;
+	
+	dac_init(&g_dacInstance, DAC, &dacconfig);
+	dac_enable(&g_dacInstance);
+	
+	
+	struct dac_chan_config chanconfig;
+	dac_chan_get_config_defaults(&chanconfig);
+	
+	dac_chan_set_config(&g_dacInstance, PIN_KBD_LED_CHAN, &chanconfig);
+	dac_chan_enable(&g_dacInstance, PIN_KBD_LED_CHAN);
+}
+
+void hal_led_write(uint16_t level)
+{
+	dac_chan_write(&g_dacInstance, PIN_KBD_LED_CHAN, level);
+}
+
+
+static void adc_complete_callback(struct adc_module *const module)
+{
+	stack_sample(STACK_ISR_ADC);
+	g_adcCallback(g_adcResult);
+
+	UNUSED(module);
+}
+
+void hal_id_adc_init(hal_adc_callback_t callback)
+{
+	struct adc_config adcconfig;
+	adc_get_config_defaults(&adcconfig);
+	
+	adcconfig.gain_factor = ADC_GAIN_FACTOR_1X;
+	adcconfig.clock_prescaler = ADC_CLOCK_PRESCALER_DIV8;
+	adcconfig.reference = ADC_REFERENCE_INT1V;
+	adcconfig.resolution = ADC_RESOLUTION_8BIT;
+	adcconfig.positive_input = PIN_KBD_ID_CHAN;
+	
+	adcconfig.clock_source = GCLK_GENERATOR_3;
+	
+	adc_init(&g_adcInstance, ADC, &adcconfig);
+	adc_enable(&g_adcInstance);
+	
+	g_adcCallback = callback;
+	adc_register_callback(&g_adcInstance, adc_complete_callback, ADC_CALLBACK_READ_BUFFER);
+	adc_enable_callback(&g_adcInstance, ADC_CALLBACK_READ_BUFFER);
+}
+
+void hal_id_adc_start(void)
+{
+	adc_read_buffer_job(&g_adcInstance, &g_adcResult, 1);
+}
+
+
+static void i2c_write_complete_callback(struct i2c_master_module *const module)
+{
+	stack_sample(STACK_ISR_I2C);
+	g_I2CWriteCallback();
+
+	UNUSED(module);
+}
+
+static void i2c_read_complete_callback(struct i2c_master_module *const module)
+{
+	stack_sample(STACK_ISR_I2C);
+	g_I2CReadCallback();
+
+	UNUSED(module);
+}
+
+static void i2c_error_callback(struct i2c_master_module *const module)
+{
+	stack_sample(STACK_ISR_I2C);
+	g_I2CErrorCallback();
+
+	UNUSED(module);
+}
+
+void hal_i2c_init(hal_callback_t write_complete, hal_callback_t read_complete, hal_callback_t error)
+{
+	struct i2c_master_config i2cconfig;
+	i2c_master_get_config_defaults(&i2cconfig);
+	
+	i2cconfig.buffer_timeout = 65535;
+	i2cconfig.generator_source = GCLK_GENERATOR_3;
+	
+	i2c_master_init(&g_I2CControllerInstance, KBD_I2C_SERCOM_IFACE, &i2cconfig);
+	i2c_master_enable(&g_I2CControllerInstance);
+
+	g_I2CWriteCallback = write_complete;
+	g_I2CReadCallback = read_complete;
+	g_I2CErrorCallback = error;
+
+	i2c_master_register_callback(&g_I2CControllerInstance, i2c_read_complete_callback, I2C_MASTER_CALLBACK_READ_COMPLETE);
+	i2c_master_enable_callback(&g_I2CControllerInstance, I2C_MASTER_CALLBACK_READ_COMPLETE);
+	i2c_master_register_callback(&g_I2CControllerInstance, i2c_write_complete_callback, I2C_MASTER_CALLBACK_WRITE_COMPLETE);
+	i2c_master_enable_callback(&g_I2CControllerInstance, I2C_MASTER_CALLBACK_WRITE_COMPLETE);
+	i2c_master_register_callback(&g_I2CControllerInstance, i2c_error_callback, I2C_MASTER_CALLBACK_ERROR);
+	i2c_master_enable_callback(&g_I2CControllerInstance, I2C_MASTER_CALLBACK_ERROR);
+}
+
+static void set_packet(uint8_t address, uint8_t* data, uint16_t length)
+{
+	g_I2CPacket.address = address;
+	g_I2CPacket.ten_bit_address = false;
+	g_I2CPacket.high_speed = false;
+	g_I2CPacket.data = data;
+	g_I2CPacket.data_length = length;
+}
+
+void hal_i2c_write_no_stop(uint8_t address, uint8_t* data, uint16_t length)
+{
+	set_packet(address, data, length);
+	i2c_master_write_packet_job_no_stop(&g_I2CControllerInstance, &g_I2CPacket);
+}
+
+void hal_i2c_read(uint8_t address, uint8_t* data, uint16_t length)
+{
+	set_packet(address, data, length);
+	i2c_master_read_packet_job(&g_I2CControllerInstance, &g_I2CPacket);
+}
+
+void hal_i2c_send_stop(void)
+{
+	i2c_master_send_stop(&g_I2CControllerInstance);
+}
+
+void hal_i2c_cancel(void)
+{
+	i2c_master_cancel_job(&g_I2CControllerInstance);
+}
+
+
+void hal_usb_start(void)
+{
+	udc_start();
+}
+
+uint16_t hal_usb_frame_number(void)
+{
+	return udd_get_frame_number();
+}
+
+void hal_hid_kbd_send(uint8_t modifiers, uint8_t* keys)
+{
+	udi_hid_kbd_send_event(modifiers, keys);
+}
+
+bool hal_hid_kbd_is_report_pending(void)
+{
+	return udi_hid_kbd_is_report_pending();
+}
+
+void hal_hid_kbd_idle_tick(void)
+{
+	udi_hid_kbd_idle_tick();
+}
+
+void hal_hid_multimedia_send(const uint16_t* usages)
+{
+	udi_hid_multimedia_send_event(usages);
+}
+
+void hal_hid_multimedia_idle_tick(void)
+{
+	udi_hid_multimedia_idle_tick();
+}
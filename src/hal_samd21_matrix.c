@@ -0,0 +1,123 @@
+// First, so that in the cycle benchmark build (KBD_HOST) the ASF
+// definitions take the place of those of host_platform.h
+#include <port.h>
+
+#include "hal.h"
+#include "keyboard.h"
+
+// Key matrix on the PORT pins of ROWMAP and COLMAP. Kept apart from the
+// rest of the board HAL so that the cycle benchmark (host/m0bench.c) runs it
+// against modelled PORT registers.
+
+static struct
+{
+	uint32_t row_mask_porta;
+	uint32_t row_mask_portb;
+	uint32_t col_mask_porta;
+	uint32_t col_mask_portb;
+
+	struct port_config row_read_config;
+	struct port_config row_disable_config;
+} g_keyPinConsts;
+
+void hal_matrix_init(void)
+{
+	// Calculate the row mask (for configuring multiple rows at a time)
+	g_keyPinConsts.row_mask_porta = 0;
+	g_keyPinConsts.row_mask_portb = 0;
+	for (unsigned r = 0; r < NUM_ROWS; r++)
+	{
+		if ((ROWMAP[r] & 0x20) == 0)
+		{
+			g_keyPinConsts.row_mask_porta |= (1 << ROWMAP[r]);
+		}
+		else
+		{
+			g_keyPinConsts.row_mask_portb |= (1 << (ROWMAP[r] & 0x1f));
+		}
+	}
+
+	// Fill config data for rows that are disabled (not currently being read)
+	// These rows are set as tri-stated
+	port_get_config_defaults(&g_keyPinConsts.row_disable_config);
+	g_keyPinConsts.row_disable_config.powersave = true;
+	port_group_set_config(&PORTA, g_keyPinConsts.row_mask_porta, &g_keyPinConsts.row_disable_config);
+	port_group_set_config(&PORTB, g_keyPinConsts.row_mask_portb, &g_keyPinConsts.row_disable_config);
+
+	// Fill config data for the actively-read row
+	// This row is set as an output
+	port_get_config_defaults(&g_keyPinConsts.row_read_config);
+	g_keyPinConsts.row_read_config.direction = PORT_PIN_DIR_OUTPUT;
+
+	// Calculate the column mask (for configuring/reading multiple columns at a time)
+	g_keyPinConsts.col_mask_porta = 0;
+	g_keyPinConsts.col_mask_portb = 0;
+	for (unsigned c = 0; c < NUM_COLS; c++)
+	{
+		if ((COLMAP[c] & 0x20) == 0)
+		{
+			g_keyPinConsts.col_mask_porta |= (1 << COLMAP[c]);
+		}
+		else
+		{
+			g_keyPinConsts.col_mask_portb |= (1 << (COLMAP[c] & 0x1f));
+		}
+	}
+	
+	// Configure columns. Columns are set as inputs with pull-ups enabled
+	struct port_config colconfig;
+	port_get_config_defaults(&colconfig);
+	colconfig.direction = PORT_PIN_DIR_INPUT;
+	colconfig.input_pull = PORT_PIN_PULL_UP;
+	port_group_set_config(&PORTA, g_keyPinConsts.col_mask_porta, &colconfig);
+	port_group_set_config(&PORTB, g_keyPinConsts.col_mask_portb, &colconfig);
+}
+
+uint16_t hal_matrix_read_row(unsigned r)
+{
+	const uint32_t row_port_bitmask = 1 << (ROWMAP[r] & 0x1f);
+	if ((ROWMAP[r] & 0x20) == 0)
+	{
+		port_group_set_config(&PORTA, g_keyPinConsts.row_mask_porta & (~row_port_bitmask), &g_keyPinConsts.row_disable_config);
+		port_group_set_config(&PORTA, row_port_bitmask, &g_keyPinConsts.row_read_config);
+		port_group_set_output_level(&PORTA, row_port_bitmask, 0);
+		
+		port_group_set_config(&PORTB, g_keyPinConsts.row_mask_portb, &g_keyPinConsts.row_disable_config);
+	}
+	else
+	{
+		port_group_set_config(&PORTB, g_keyPinConsts.row_mask_portb & (~row_port_bitmask), &g_keyPinConsts.row_disable_config);
+		port_group_set_config(&PORTB, row_port_bitmask, &g_keyPinConsts.row_read_config);
+		port_group_set_output_level(&PORTB, row_port_bitmask, 0);
+		
+		port_group_set_config(&PORTA, g_keyPinConsts.row_mask_porta, &g_keyPinConsts.row_disable_config);
+	}
+
+	const uint32_t col_porta = port_group_get_input_level(&PORTA, g_keyPinConsts.col_mask_porta);
+	const uint32_t col_portb = port_group_get_input_level(&PORTB, g_keyPinConsts.col_mask_portb);
+	uint16_t row = 0;
+	for (unsigned c = 0; c < NUM_COLS; c++)
+	{
+		bool is_pressed;
+		if ((COLMAP[c] & 0x20) == 0)
+		{
+			is_pressed = (col_porta & (1 << COLMAP[c])) == 0;
+		}
+		else
+		{
+			is_pressed = (col_portb & (1 << (COLMAP[c] & 0x1f))) == 0;
+		}
+		
+		if (is_pressed)
+		{
+			row |= 1 << c;
+		}
+	}
+	return row;
+}
+
+void hal_matrix_release_rows(void)
+{
+	port_group_set_config(&PORTA, g_keyPinConsts.row_mask_porta, &g_keyPinConsts.row_disable_config);
+	port_group_set_config(&PORTB, g_keyPinConsts.row_mask_portb, &g_keyPinConsts.row_disable_config);
+}
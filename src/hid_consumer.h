@@ -0,0 +1,45 @@
+#ifndef HID_CONSUMER_H_
+#define HID_CONSUMER_H_
+
+// Consumer control definitions shared by the USB interfaces and the logic,
+// which the host build uses without the USB stack
+
+// Bits of the legacy 1-byte multimedia field sent by the peripheral
+#define HID_MULTIMEDIA_KEY_SCAN_PREVIOUS 0x01
+#define HID_MULTIMEDIA_KEY_SCAN_NEXT     0x02
+#define HID_MULTIMEDIA_KEY_PLAY_PAUSE    0x04
+#define HID_MULTIMEDIA_KEY_MUTE          0x10
+#define HID_MULTIMEDIA_KEY_VOLUME_UP     0x20
+#define HID_MULTIMEDIA_KEY_VOLUME_DOWN   0x40
+
+// Consumer Page (0x0C) usages
+#define HID_CONSUMER_BRIGHTNESS_UP       0x006F
+#define HID_CONSUMER_BRIGHTNESS_DOWN     0x0070
+#define HID_CONSUMER_SCAN_NEXT           0x00B5
+#define HID_CONSUMER_SCAN_PREVIOUS       0x00B6
+#define HID_CONSUMER_STOP                0x00B7
+#define HID_CONSUMER_EJECT               0x00B8
+#define HID_CONSUMER_PLAY_PAUSE          0x00CD
+#define HID_CONSUMER_MUTE                0x00E2
+#define HID_CONSUMER_VOLUME_UP           0x00E9
+#define HID_CONSUMER_VOLUME_DOWN         0x00EA
+#define HID_CONSUMER_AL_MEDIA_SELECT     0x0183
+#define HID_CONSUMER_AL_EMAIL            0x018A
+#define HID_CONSUMER_AL_CALCULATOR       0x0192
+#define HID_CONSUMER_AL_FILE_BROWSER     0x0194
+#define HID_CONSUMER_AL_WEB_BROWSER      0x0196
+#define HID_CONSUMER_AL_LOCK_SCREEN      0x019E
+#define HID_CONSUMER_AC_SEARCH           0x0221
+#define HID_CONSUMER_AC_HOME             0x0223
+#define HID_CONSUMER_AC_BACK             0x0224
+#define HID_CONSUMER_AC_FORWARD          0x0225
+#define HID_CONSUMER_AC_REFRESH          0x0227
+#define HID_CONSUMER_AC_BOOKMARKS        0x022A
+
+//! Highest Consumer Page usage that can be reported
+#define HID_CONSUMER_USAGE_MAX           0x03FF
+
+//! Number of consumer usages that can be reported at the same time
+#define UDI_HID_MULTIMEDIA_MAX_USAGES   4
+
+#endif /* HID_CONSUMER_H_ */
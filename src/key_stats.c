@@ -0,0 +1,313 @@
+#include "key_stats.h"
+#include "nvm_flash.h"
+
+#include <string.h>
+
+#ifdef KBD_HOST
+// Emulated in RAM by host/nvm_flash_host.c
+extern uint8_t g_nvmHostKeyStats[];
+#define STORE_START ((uintptr_t)g_nvmHostKeyStats)
+#define NUM_SLOTS   2
+#else
+// Provided by the linker script
+extern uint8_t _key_stats_start;
+extern uint8_t _key_stats_end;
+#define STORE_START ((uintptr_t)&_key_stats_start)
+#define NUM_SLOTS   (((uintptr_t)&_key_stats_end - STORE_START) / KEY_STATS_SLOT_SIZE)
+#endif
+
+#define SLOT_ADDRESS(s) (STORE_START + (s) * KEY_STATS_SLOT_SIZE)
+#define FOOTER_OFFSET   (KEY_STATS_SLOT_SIZE - NVM_PAGE_SIZE)
+
+// A slot holds the totals of KEYS_PER_PAGE keys per page, then the footer
+#define KEYS_PER_PAGE  10
+#define NUM_DATA_PAGES ((NUM_KEYS + KEYS_PER_PAGE - 1) / KEYS_PER_PAGE)
+
+#if KEYS_PER_PAGE * 6 > NVM_PAGE_SIZE
+#error "The totals of a page of keys must fit a flash page"
+#endif
+
+#if (NUM_DATA_PAGES + 1) * NVM_PAGE_SIZE > KEY_STATS_SLOT_SIZE
+#error "The totals of all the keys and the footer must fit a slot"
+#endif
+
+struct key_stats_page
+{
+	uint32_t presses[KEYS_PER_PAGE];
+	uint16_t chatter[KEYS_PER_PAGE];
+	uint8_t reserved[NVM_PAGE_SIZE - KEYS_PER_PAGE * 6];
+};
+
+struct key_stats_footer
+{
+	uint32_t magic;
+	uint32_t sequence;
+};
+
+enum flush_step
+{
+	STEP_IDLE,
+	STEP_ERASE,
+	STEP_WRITE,
+	STEP_FOOTER,
+	STEP_VERIFY
+};
+
+// Counts since the last flush. The flush comes long before a press count
+// can wrap; a chatter count saturates until then.
+static uint16_t g_presses[NUM_KEYS];
+static uint8_t g_chatter[NUM_KEYS];
+static volatile uint32_t g_unflushed = 0;
+static volatile bool g_flushRequested = false;
+
+// Slot and sequence number of the stored totals, cleared by a reset until
+// the next flush
+static bool g_found = false;
+static uint8_t g_activeSlot = 0;
+static uint32_t g_sequence = 0;
+static bool g_cleared = false;
+
+// Flush in progress. Keys below g_keysWritten have their totals in the new
+// slot and their counts in RAM restarted.
+static enum flush_step g_step = STEP_IDLE;
+static uint8_t g_slot;
+static uint16_t g_offset;
+static uint8_t g_keysWritten;
+
+static uint32_t g_lastScan = 0;
+
+static inline const struct key_stats_page* get_page(uint8_t slot, unsigned page)
+{
+	return (const struct key_stats_page*)(SLOT_ADDRESS(slot) + page * NVM_PAGE_SIZE);
+}
+
+static inline const struct key_stats_footer* get_footer(uint8_t slot)
+{
+	return (const struct key_stats_footer*)(SLOT_ADDRESS(slot) + FOOTER_OFFSET);
+}
+
+void key_stats_init(void)
+{
+	memset(g_presses, 0, sizeof(g_presses));
+	memset(g_chatter, 0, sizeof(g_chatter));
+	g_unflushed = 0;
+	g_flushRequested = false;
+	g_found = false;
+	g_activeSlot = 0;
+	g_sequence = 0;
+	g_cleared = false;
+	g_step = STEP_IDLE;
+
+	for (unsigned s = 0; s < NUM_SLOTS; s++)
+	{
+		const struct key_stats_footer* footer = get_footer(s);
+		if (footer->magic == KEY_STATS_MAGIC && (!g_found || footer->sequence > g_sequence))
+		{
+			g_found = true;
+			g_activeSlot = s;
+			g_sequence = footer->sequence;
+		}
+	}
+}
+
+void key_stats_press(uint8_t key)
+{
+	g_presses[key]++;
+	g_unflushed++;
+}
+
+void key_stats_chatter(uint8_t key)
+{
+	if (g_chatter[key] != UINT8_MAX)
+	{
+		g_chatter[key]++;
+		g_unflushed++;
+	}
+}
+
+static const struct key_stats_page* get_totals(uint8_t key)
+{
+	if (g_step != STEP_IDLE && key < g_keysWritten)
+	{
+		return get_page(g_slot, key / KEYS_PER_PAGE);
+	}
+	if (g_found && !g_cleared)
+	{
+		return get_page(g_activeSlot, key / KEYS_PER_PAGE);
+	}
+	return NULL;
+}
+
+void key_stats_get(uint8_t key, struct key_stats* stats)
+{
+	// The flush runs in the main loop too, so only the counts move
+	const struct key_stats_page* totals = get_totals(key);
+	uint32_t chatter = g_chatter[key];
+	stats->presses = g_presses[key];
+	if (totals != NULL)
+	{
+		stats->presses += totals->presses[key % KEYS_PER_PAGE];
+		chatter += totals->chatter[key % KEYS_PER_PAGE];
+	}
+	stats->chatter = min(chatter, UINT16_MAX);
+}
+
+bool key_stats_reset(void)
+{
+	if (g_step != STEP_IDLE)
+	{
+		return false;
+	}
+
+	system_interrupt_enter_critical_section();
+	memset(g_presses, 0, sizeof(g_presses));
+	memset(g_chatter, 0, sizeof(g_chatter));
+	g_unflushed = 0;
+	system_interrupt_leave_critical_section();
+
+	g_cleared = true;
+	g_flushRequested = true;
+	return true;
+}
+
+uint32_t key_stats_get_sequence(void)
+{
+	return g_sequence;
+}
+
+void key_stats_suspend_callback(void)
+{
+	if (g_unflushed != 0)
+	{
+		g_flushRequested = true;
+	}
+}
+
+static void build_page(unsigned page, struct key_stats_page* data)
+{
+	// Totals move to the page and the counts restart, atomically with the
+	// scan interrupt
+	memset(data, 0xFF, sizeof(*data));
+	const unsigned first = page * KEYS_PER_PAGE;
+	for (unsigned i = 0; i < KEYS_PER_PAGE; i++)
+	{
+		const struct key_stats_page* totals = get_totals(first + i);
+		uint32_t presses = 0;
+		uint32_t chatter = 0;
+		if (first + i < NUM_KEYS)
+		{
+			system_interrupt_enter_critical_section();
+			presses = g_presses[first + i];
+			chatter = g_chatter[first + i];
+			g_presses[first + i] = 0;
+			g_chatter[first + i] = 0;
+			system_interrupt_leave_critical_section();
+
+			if (totals != NULL)
+			{
+				presses += totals->presses[i];
+				chatter += totals->chatter[i];
+			}
+		}
+		data->presses[i] = presses;
+		data->chatter[i] = min(chatter, UINT16_MAX);
+	}
+}
+
+static void flush_done(bool ok)
+{
+	// On failure the stored totals are untouched; the counts moved to the
+	// new slot are lost
+	if (ok)
+	{
+		g_activeSlot = g_slot;
+		g_sequence++;
+		g_found = true;
+		g_cleared = false;
+	}
+	g_step = STEP_IDLE;
+	nvm_flash_release(NVM_FLASH_KEY_STATS);
+}
+
+void key_stats_task(void)
+{
+	if (g_step == STEP_IDLE)
+	{
+		if (!g_flushRequested && g_unflushed < KEY_STATS_FLUSH_PRESSES)
+		{
+			return;
+		}
+
+		g_flushRequested = false;
+		g_unflushed = 0;
+		g_slot = g_found ? (g_activeSlot + 1) % NUM_SLOTS : 0;
+		g_offset = 0;
+		g_keysWritten = 0;
+		g_step = STEP_ERASE;
+	}
+
+	// As for the keymap store, the CPU stalls while the main array is erased
+	// or written, so commands are issued just after a scan. The flush waits
+	// for the other clients of the controller.
+	const uint32_t scan = keyboard_get_scan_count();
+	if (scan == g_lastScan || !nvm_flash_is_ready() || !nvm_flash_acquire(NVM_FLASH_KEY_STATS))
+	{
+		return;
+	}
+
+	if (nvm_flash_has_error())
+	{
+		flush_done(false);
+		return;
+	}
+
+	const uintptr_t slot = SLOT_ADDRESS(g_slot);
+	switch (g_step)
+	{
+	case STEP_ERASE:
+		nvm_flash_erase_row(slot + g_offset);
+		g_offset += NVM_ROW_SIZE;
+		if (g_offset == KEY_STATS_SLOT_SIZE)
+		{
+			g_offset = 0;
+			g_step = STEP_WRITE;
+		}
+		break;
+
+	case STEP_WRITE:
+	{
+		// The page is copied to the controller by the write command
+		struct key_stats_page page;
+		build_page(g_offset / NVM_PAGE_SIZE, &page);
+		nvm_flash_write_page(slot + g_offset, (const uint8_t*)&page, sizeof(page));
+		g_offset += NVM_PAGE_SIZE;
+		g_keysWritten = min(g_keysWritten + KEYS_PER_PAGE, NUM_KEYS);
+		if (g_keysWritten == NUM_KEYS)
+		{
+			g_step = STEP_FOOTER;
+		}
+		break;
+	}
+
+	case STEP_FOOTER:
+	{
+		const struct key_stats_footer footer = {
+			.magic = KEY_STATS_MAGIC,
+			.sequence = g_sequence + 1
+		};
+		nvm_flash_write_page(slot + FOOTER_OFFSET, (const uint8_t*)&footer, sizeof(footer));
+		g_step = STEP_VERIFY;
+		break;
+	}
+
+	case STEP_VERIFY:
+		flush_done(get_footer(g_slot)->magic == KEY_STATS_MAGIC
+			&& get_footer(g_slot)->sequence == g_sequence + 1);
+		break;
+
+	default:
+		break;
+	}
+
+	g_lastScan = scan;
+}
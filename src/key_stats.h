@@ -0,0 +1,46 @@
+#ifndef KEY_STATS_H_
+#define KEY_STATS_H_
+
+#include "hal.h"
+
+#include "keyboard.h"
+
+// Per-key statistics of the matrix, to plan switch replacements and tune the
+// debounce: presses, and bounces rejected by the debounce filter (chatter).
+// RAM only holds the counts since the last flush. The totals live in the
+// key statistics region of the linker script and are rewritten in a batch
+// every KEY_STATS_FLUSH_PRESSES counted events and when the USB bus
+// suspends. Counts not flushed yet are lost on a reset.
+#define KEY_STATS_FLUSH_PRESSES 4096
+
+// Two slots of three rows; a slot is valid once its footer is written
+#define KEY_STATS_SLOT_SIZE 768
+#define KEY_STATS_MAGIC     0x5354534B    // "KSTS"
+
+struct key_stats
+{
+	uint32_t presses;
+	uint16_t chatter;  // Saturating
+};
+
+void key_stats_init(void);
+
+// Scan interrupt, on matrix changes only
+void key_stats_press(uint8_t key);
+void key_stats_chatter(uint8_t key);
+
+void key_stats_get(uint8_t key, struct key_stats* stats);
+
+// Clears the counts, stored by a flush started at once. Fails while a flush
+// is in progress.
+bool key_stats_reset(void);
+
+uint32_t key_stats_get_sequence(void);
+
+// Main loop. Issues at most one flash command per scan, right after it.
+void key_stats_task(void);
+
+// UDC_SUSPEND_EVENT: counts are flushed before the host may cut the power
+void key_stats_suspend_callback(void);
+
+#endif /* KEY_STATS_H_ */
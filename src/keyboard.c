@@ -1,107 +1,98 @@
 #include "keyboard.h"
+#include "key_stats.h"
+#include "keyboard_combo.h"
+#include "keyboard_debounce.h"
+#include "keyboard_gaming.h"
+#include "keyboard_layer.h"
+#include "keyboard_leader.h"
+#include "keyboard_macro.h"
+#include "keyboard_tap_hold.h"
+#include "keymap.h"
+#include "profile.h"
+#include "settings.h"
+#include "timer_wheel.h"
+#include "trace.h"
 
 #include <string.h>
 
 #define MAX_KEYPRESSES 6
 
-static struct
-{
-	uint32_t row_mask_porta;
-	uint32_t row_mask_portb;
-	uint32_t col_mask_porta;
-	uint32_t col_mask_portb;
-
-	struct port_config row_read_config;
-	struct port_config row_disable_config;
-} g_keyPinConsts;
-
 struct kbd_keypress_info
 {
 	uint8_t modifier_code;
-	uint8_t multimedia_code;
 	uint8_t keypress_array[MAX_KEYPRESSES];
 	uint8_t num_keypresses;
+	uint16_t consumer_usages[UDI_HID_MULTIMEDIA_MAX_USAGES];
+	uint8_t num_consumer_usages;
+};
+
+// Consumer usages of the bits of the multimedia byte sent by the peripheral
+static const uint16_t PERIPHERAL_MULTIMEDIA_USAGES[8] = {
+	HID_CONSUMER_SCAN_PREVIOUS, HID_CONSUMER_SCAN_NEXT, HID_CONSUMER_PLAY_PAUSE, 0,
+	HID_CONSUMER_MUTE, HID_CONSUMER_VOLUME_UP, HID_CONSUMER_VOLUME_DOWN, 0
 };
 
 static volatile bool g_enableKeyboard = false;
 static volatile bool g_enableMultimedia = false;
 
-static struct tc_module g_tcInstance;
+static volatile uint32_t g_scanCount = 0;
+static uint32_t g_keyEventCount = 0;
+static uint32_t g_keyboardReportCount = 0;
+
+// Keys pressed at the last scan (bit c of row r)
+static matrix_row_t g_matrix[NUM_ROWS];
 
-static struct dac_module g_dacInstance;
+// Keys contributing to the reports, and the key each one was resolved to
+// when it was registered
+static matrix_row_t g_registeredKeys[NUM_ROWS];
+static uint16_t g_heldKeys[NUM_ROWS][NUM_COLS];
 
 static uint8_t g_I2CData[KBD_I2C_DATA_LEN];
 static bool g_I2CHasData = false;
 
-void configure_pins(void)
+// Indicator LED state last received from the host
+static uint8_t g_indicatorLeds = 0;
+static struct kbd_led_latency g_ledLatency;
+
+static void configure_debounce(void)
 {
-	// Calculate the row mask (for configuring multiple rows at a time)
-	g_keyPinConsts.row_mask_porta = 0;
-	g_keyPinConsts.row_mask_portb = 0;
-	for (unsigned r = 0; r < NUM_ROWS; r++)
+	// Gaming mode reports both edges at the first scan they are seen: a
+	// deferred change would hold the releases back for the debounce time
+	enum debounce_mode mode = settings_get(SETTING_DEBOUNCE_MODE);
+	if (mode == DEBOUNCE_DEFER && gaming_is_enabled())
 	{
-		if ((ROWMAP[r] & 0x20) == 0)
-		{
-			g_keyPinConsts.row_mask_porta |= (1 << ROWMAP[r]);
-		}
-		else
-		{
-			g_keyPinConsts.row_mask_portb |= (1 << (ROWMAP[r] & 0x1f));
-		}
+		mode = DEBOUNCE_EAGER;
 	}
+	debounce_configure(mode, DEBOUNCE_TICKS(settings_get(SETTING_DEBOUNCE_MS)));
+}
 
-	// Fill config data for rows that are disabled (not currently being read)
-	// These rows are set as tri-stated
-	port_get_config_defaults(&g_keyPinConsts.row_disable_config);
-	g_keyPinConsts.row_disable_config.powersave = true;
-	port_group_set_config(&PORTA, g_keyPinConsts.row_mask_porta, &g_keyPinConsts.row_disable_config);
-	port_group_set_config(&PORTB, g_keyPinConsts.row_mask_portb, &g_keyPinConsts.row_disable_config);
-
-	// Fill config data for the actively-read row
-	// This row is set as an output
-	port_get_config_defaults(&g_keyPinConsts.row_read_config);
-	g_keyPinConsts.row_read_config.direction = PORT_PIN_DIR_OUTPUT;
-
-	// Calculate the column mask (for configuring/reading multiple columns at a time)
-	g_keyPinConsts.col_mask_porta = 0;
-	g_keyPinConsts.col_mask_portb = 0;
-	for (unsigned c = 0; c < NUM_COLS; c++)
-	{
-		if ((COLMAP[c] & 0x20) == 0)
-		{
-			g_keyPinConsts.col_mask_porta |= (1 << COLMAP[c]);
-		}
-		else
-		{
-			g_keyPinConsts.col_mask_portb |= (1 << (COLMAP[c] & 0x1f));
-		}
-	}
-	
-	// Configure columns. Columns are set as inputs with pull-ups enabled
-	struct port_config colconfig;
-	port_get_config_defaults(&colconfig);
-	colconfig.direction = PORT_PIN_DIR_INPUT;
-	colconfig.input_pull = PORT_PIN_PULL_UP;
-	port_group_set_config(&PORTA, g_keyPinConsts.col_mask_porta, &colconfig);
-	port_group_set_config(&PORTB, g_keyPinConsts.col_mask_portb, &colconfig);
+void configure_pins(void)
+{
+	hal_matrix_init();
+}
+
+void configure_keymap(void)
+{
+	memset(g_matrix, 0, sizeof(g_matrix));
+	memset(g_registeredKeys, 0, sizeof(g_registeredKeys));
+	memset(g_heldKeys, 0, sizeof(g_heldKeys));
+
+	timer_wheel_init();
+	keymap_init();
+	layer_init();
+	tap_hold_init();
+	combo_init();
+	macro_init();
+	leader_init();
+	gaming_init();
+
+	debounce_init();
+	configure_debounce();
 }
 
 void configure_tc(void)
 {
-	struct tc_config timerconfig;
-	tc_get_config_defaults(&timerconfig);
-		
-	timerconfig.counter_size = TC_COUNTER_SIZE_8BIT;
-	timerconfig.clock_source = GCLK_GENERATOR_3;
-	timerconfig.clock_prescaler = TC_CLOCK_PRESCALER_DIV256;
-	timerconfig.counter_8_bit.period = 125;
-	timerconfig.counter_8_bit.compare_capture_channel[0] = 100;
-		
-	tc_init(&g_tcInstance, TC3, &timerconfig);
-	tc_enable(&g_tcInstance);
-		
-	tc_register_callback(&g_tcInstance, keyboard_scan_tc_callback, TC_CALLBACK_CC_CHANNEL0);
-	tc_enable_callback(&g_tcInstance, TC_CALLBACK_CC_CHANNEL0);
+	hal_scan_timer_init(keyboard_scan);
 }
 
 void configure_i2c(void)
@@ -110,31 +101,26 @@ void configure_i2c(void)
 
 	i2c_kbd_data_register_callback(i2c_data_callback);
 	i2c_kbd_data_enable_callback();
+
+	i2c_kbd_write_register_callback(i2c_write_callback);
 }
 
 void configure_usb_hid(void)
 {
-	udc_start();
+	hal_usb_start();
 }
 
 void configure_dac(void)
 {
-	struct dac_config dacconfig;
-	dac_get_config_defaults(&dacconfig);
-	
-	dacconfig.reference = DAC_REFERENCE_AVCC;
-	dacconfig.left_adjust = false;
-	dacconfig.clock_source = GCLK_GENERATOR_3;
-	
-	dac_init(&g_dacInstance, DAC, &dacconfig);
-	dac_enable(&g_dacInstance);
-	
-	
-	struct dac_chan_config chanconfig;
-	dac_chan_get_config_defaults(&chanconfig);
-	
-	dac_chan_set_config(&g_dacInstance, PIN_KBD_LED_CHAN, &chanconfig);
-	dac_chan_enable(&g_dacInstance, PIN_KBD_LED_CHAN);
+	hal_led_init();
+}
+
+static inline void add_consumer_usage(uint16_t usage, struct kbd_keypress_info* keyinfo)
+{
+	if (usage != 0 && keyinfo->num_consumer_usages < UDI_HID_MULTIMEDIA_MAX_USAGES)
+	{
+		keyinfo->consumer_usages[keyinfo->num_consumer_usages++] = usage;
+	}
 }
 
 static inline void handle_keypress(uint16_t key_id, struct kbd_keypress_info* keyinfo)
@@ -142,11 +128,18 @@ static inline void handle_keypress(uint16_t key_id, struct kbd_keypress_info* ke
 	switch (key_id & 0xf000)
 	{
 		case KEY_SET_META:
-			// TODO: Not implemented
+			// Layer keys act through the layer state; nothing to report
 			break;
 		case KEY_SET_MULTIMEDIA:
-			keyinfo->multimedia_code |= key_id & 0xFF;
+		{
+			const uint8_t index = key_id & 0xFF;
+			const uint16_t usage = keymap_get_consumer_usage(index);
+			if (usage != 0)
+			{
+				add_consumer_usage(usage, keyinfo);
+			}
 			break;
+		}
 		default:
 		{
 			uint8_t modcode = (key_id >> 8) & 0xF;
@@ -170,13 +163,64 @@ static inline void handle_keypress(uint16_t key_id, struct kbd_keypress_info* ke
 	}
 }
 
-void keyboard_scan_tc_callback(struct tc_module *const module)
+void keyboard_register_key(uint8_t key, uint16_t key_id)
 {
-	if (!g_enableKeyboard && !g_enableMultimedia)
+	const unsigned r = KEY_INDEX_ROW(key);
+	const unsigned c = KEY_INDEX_COL(key);
+
+	g_heldKeys[r][c] = key_id;
+	g_registeredKeys[r] |= 1 << c;
+	layer_key_pressed(key_id);
+}
+
+bool keyboard_unregister_key(uint8_t key)
+{
+	const unsigned r = KEY_INDEX_ROW(key);
+	const unsigned c = KEY_INDEX_COL(key);
+
+	if ((g_registeredKeys[r] & (1 << c)) == 0)
+	{
+		return false;
+	}
+
+	// Release the key it was resolved to, whatever the current layers are
+	layer_key_released(g_heldKeys[r][c]);
+	g_heldKeys[r][c] = 0;
+	g_registeredKeys[r] &= ~(1 << c);
+	return true;
+}
+
+void keyboard_key_event(uint8_t key, bool pressed)
+{
+	// Events are held back while a tap-hold key is undecided
+	if (tap_hold_buffer_event(key, pressed))
 	{
 		return;
 	}
-	
+
+	if (pressed)
+	{
+		// Resolve the key once, with the layers active at press time
+		const uint16_t key_id = layer_resolve_key(KEY_INDEX_ROW(key), KEY_INDEX_COL(key));
+		if (gaming_toggle_key(key_id))
+		{
+			configure_debounce();
+			return;
+		}
+		if (leader_key_event(key_id) || tap_hold_begin(key, key_id) || macro_begin(key_id))
+		{
+			return;
+		}
+		keyboard_register_key(key, key_id);
+	}
+	else
+	{
+		keyboard_unregister_key(key);
+	}
+}
+
+void keyboard_send_reports(void)
+{
 	struct kbd_keypress_info keyinfo;
 	memset(&keyinfo, 0, sizeof(struct kbd_keypress_info));
 
@@ -184,7 +228,13 @@ void keyboard_scan_tc_callback(struct tc_module *const module)
 	if (g_I2CHasData)
 	{
 		keyinfo.modifier_code |= g_I2CData[0];
-		keyinfo.multimedia_code |= g_I2CData[1];
+		for (unsigned b = 0; b < 8; b++)
+		{
+			if (g_I2CData[1] & (1 << b))
+			{
+				add_consumer_usage(PERIPHERAL_MULTIMEDIA_USAGES[b], &keyinfo);
+			}
+		}
 
 		for (unsigned i = 2; i < KBD_I2C_DATA_LEN; i++)
 		{
@@ -200,48 +250,32 @@ void keyboard_scan_tc_callback(struct tc_module *const module)
 	}
 	system_interrupt_leave_critical_section();
 
+	matrix_row_t keys[NUM_ROWS];
+	memcpy(keys, g_registeredKeys, sizeof(keys));
+	gaming_filter_keys(keys);
+
 	for (unsigned r = 0; r < NUM_ROWS; r++)
 	{
-		const uint32_t row_port_bitmask = 1 << (ROWMAP[r] & 0x1f);
-		if ((ROWMAP[r] & 0x20) == 0)
+		if (keys[r] == 0)
 		{
-			port_group_set_config(&PORTA, g_keyPinConsts.row_mask_porta & (~row_port_bitmask), &g_keyPinConsts.row_disable_config);
-			port_group_set_config(&PORTA, row_port_bitmask, &g_keyPinConsts.row_read_config);
-			port_group_set_output_level(&PORTA, row_port_bitmask, 0);
-			
-			port_group_set_config(&PORTB, g_keyPinConsts.row_mask_portb, &g_keyPinConsts.row_disable_config);
-		}
-		else
-		{
-			port_group_set_config(&PORTB, g_keyPinConsts.row_mask_portb & (~row_port_bitmask), &g_keyPinConsts.row_disable_config);
-			port_group_set_config(&PORTB, row_port_bitmask, &g_keyPinConsts.row_read_config);
-			port_group_set_output_level(&PORTB, row_port_bitmask, 0);
-			
-			port_group_set_config(&PORTA, g_keyPinConsts.row_mask_porta, &g_keyPinConsts.row_disable_config);
+			continue;
 		}
 
-		const uint32_t col_porta = port_group_get_input_level(&PORTA, g_keyPinConsts.col_mask_porta);
-		const uint32_t col_portb = port_group_get_input_level(&PORTB, g_keyPinConsts.col_mask_portb);
 		for (unsigned c = 0; c < NUM_COLS; c++)
 		{
-			bool is_pressed;
-			if ((COLMAP[c] & 0x20) == 0)
-			{
-				is_pressed = (col_porta & (1 << COLMAP[c])) == 0;
-			}
-			else
-			{
-				is_pressed = (col_portb & (1 << (COLMAP[c] & 0x1f))) == 0;
-			}
-			
-			if (is_pressed)
+			if (keys[r] & (1 << c))
 			{
-				handle_keypress(KEYMAP[r][c], &keyinfo);
+				handle_keypress(g_heldKeys[r][c], &keyinfo);
 			}
 		}
 	}
-	port_group_set_config(&PORTA, g_keyPinConsts.row_mask_porta, &g_keyPinConsts.row_disable_config);
-	port_group_set_config(&PORTB, g_keyPinConsts.row_mask_portb, &g_keyPinConsts.row_disable_config);
+
+	uint8_t num_macro_keys;
+	const uint16_t* macro_keys = macro_get_keys(&num_macro_keys);
+	for (unsigned i = 0; i < num_macro_keys; i++)
+	{
+		handle_keypress(macro_keys[i], &keyinfo);
+	}
 
 	if (g_enableKeyboard)
 	{
@@ -249,17 +283,114 @@ void keyboard_scan_tc_callback(struct tc_module *const module)
 		{
 			memset(keyinfo.keypress_array, 0x01, 6);
 		}
-		udi_hid_kbd_send_event(keyinfo.modifier_code, keyinfo.keypress_array);
+		PROFILE_MARK(PROFILE_REPORT_BUILT);
+		hal_hid_kbd_send(keyinfo.modifier_code, keyinfo.keypress_array);
 	}
 
 	if (g_enableMultimedia)
 	{
-		udi_hid_multimedia_send_event(keyinfo.multimedia_code);
+		hal_hid_multimedia_send(keyinfo.consumer_usages);
 	}
+}
 
-	read_id_adc();
+static void process_matrix(const matrix_row_t* matrix)
+{
+	for (unsigned r = 0; r < NUM_ROWS; r++)
+	{
+		const matrix_row_t changed = matrix[r] ^ g_matrix[r];
+		if (changed == 0)
+		{
+			continue;
+		}
 
-	UNUSED(module);
+		for (unsigned c = 0; c < NUM_COLS; c++)
+		{
+			if (changed & (1 << c))
+			{
+				const uint8_t key = KEY_INDEX(r, c);
+				const bool pressed = (matrix[r] & (1 << c)) != 0;
+				g_keyEventCount++;
+				PROFILE_MARK(PROFILE_KEY_EVENT);
+				TRACE(TRACE_KEY, key | (pressed ? 0x80 : 0));
+				if (pressed)
+				{
+					key_stats_press(key);
+				}
+				if (!gaming_key_event(key, pressed) && !combo_key_event(key, pressed))
+				{
+					keyboard_key_event(key, pressed);
+				}
+			}
+		}
+		g_matrix[r] = matrix[r];
+	}
+}
+
+uint32_t keyboard_get_scan_count(void)
+{
+	return g_scanCount;
+}
+
+static void apply_staged_keymap(void)
+{
+	// Between two scans nothing is resolved against the keymap, so the new
+	// one applies whole. Held keys keep the key they were resolved to; a
+	// playing macro points into the old blob and is stopped.
+	if (!keymap_apply_staged())
+	{
+		return;
+	}
+
+	macro_stop();
+	layer_refresh();
+	combo_init();
+}
+
+void keyboard_scan(void)
+{
+	g_scanCount++;
+	PROFILE_MARK(PROFILE_SCAN_START);
+
+	// A staged keymap applies even while both interfaces are disabled, so
+	// the keymap store can complete
+	apply_staged_keymap();
+	if (!g_enableKeyboard && !g_enableMultimedia)
+	{
+		return;
+	}
+
+	TRACE(TRACE_SCAN_START, g_scanCount);
+
+	matrix_row_t matrix[NUM_ROWS];
+	for (unsigned r = 0; r < NUM_ROWS; r++)
+	{
+		matrix[r] = hal_matrix_read_row(r);
+	}
+	hal_matrix_release_rows();
+	debounce_matrix(matrix);
+
+	// Release the tap keys reported at the previous scan
+	tap_hold_scan();
+
+	process_matrix(matrix);
+	timer_wheel_tick();
+
+	keyboard_send_reports();
+	leader_step();
+	macro_step();
+
+	if (g_enableKeyboard)
+	{
+		hal_hid_kbd_idle_tick();
+	}
+
+	if (g_enableMultimedia)
+	{
+		hal_hid_multimedia_idle_tick();
+	}
+
+	read_id_adc();
+	TRACE(TRACE_SCAN_END, 0);
 }
 
 
@@ -272,6 +403,17 @@ bool hid_keyboard_enable_callback(void)
 void hid_keyboard_disable_callback(void)
 {
 	g_enableKeyboard = false;
+	macro_stop();
+}
+
+void hid_keyboard_report_sent_callback(void)
+{
+	g_keyboardReportCount++;
+	PROFILE_MARK(PROFILE_REPORT_SENT);
+	TRACE(TRACE_KBD_SENT, 0);
+
+	// Macros advance as fast as the host takes the reports
+	macro_step();
 }
 
 
@@ -287,6 +429,67 @@ void hid_multimedia_disable_callback(void)
 }
 
 
+void hid_keyboard_led_callback(uint8_t value)
+{
+	// Called from the USB interrupt at the end of SET_REPORT: update the LEDs
+	// right away, and only when the state changes
+	g_ledLatency.report_frame = hal_usb_frame_number();
+	if (value == g_indicatorLeds)
+	{
+		return;
+	}
+
+	const uint8_t changed = value ^ g_indicatorLeds;
+	g_indicatorLeds = value;
+
+	const uint8_t indicator = settings_get(SETTING_LED_INDICATOR);
+	if (changed & indicator)
+	{
+		hal_led_write((value & indicator) ? settings_get(SETTING_BACKLIGHT) : 0);
+		g_ledLatency.board_frame = hal_usb_frame_number();
+	}
+
+	// Written now if the peripheral is connected, otherwise when it is plugged in
+	i2c_kbd_set_indicator_leds(value);
+}
+
+void get_led_latency(struct kbd_led_latency *latency)
+{
+	system_interrupt_enter_critical_section();
+	*latency = g_ledLatency;
+	system_interrupt_leave_critical_section();
+}
+
+void get_counters(struct kbd_counters *counters)
+{
+	system_interrupt_enter_critical_section();
+	counters->scans = g_scanCount;
+	counters->key_events = g_keyEventCount;
+	counters->keyboard_reports = g_keyboardReportCount;
+	system_interrupt_leave_critical_section();
+}
+
+void keyboard_apply_settings(void)
+{
+	// The LED follows a new indicator or level without waiting for the host
+	system_interrupt_enter_critical_section();
+	const uint8_t indicator = settings_get(SETTING_LED_INDICATOR);
+	hal_led_write((g_indicatorLeds & indicator) ? settings_get(SETTING_BACKLIGHT) : 0);
+	configure_debounce();
+	system_interrupt_leave_critical_section();
+}
+
+
+void i2c_write_callback(uint8_t address)
+{
+	switch (address)
+	{
+		case KBD_I2C_REG_IND_LED:
+			g_ledLatency.peripheral_frame = hal_usb_frame_number();
+			break;
+	}
+}
+
 void i2c_data_callback(uint8_t address, uint8_t* value)
 {
 	switch (address)
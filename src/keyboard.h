@@ -1,29 +1,157 @@
 #ifndef KEYBOARD_H_
 #define KEYBOARD_H_
 
-#include <asf.h>
+#include "hal.h"
 
 #include "keyboard_i2c.h"
 
-#include "udi_hid_kbd.h"
-#include "udi_hid_multimedia.h"
-
 #define KEY_SET_DEFAULT    0x0000
 #define KEY_SET_MULTIMEDIA 0xc000
 #define KEY_SET_META       0xf000
 
+// KEY_SET_META entries are 0xf000 | (operation << 8) | argument
+#define KEY_META_NONE      0x0
+#define KEY_META_MOMENTARY 0x1
+#define KEY_META_TOGGLE    0x2
+#define KEY_META_ONE_SHOT  0x3
+#define KEY_META_TAP_HOLD  0x4
+#define KEY_META_MACRO     0x5
+#define KEY_META_LEADER    0x6
+#define KEY_META_GAMING    0x7
+
+#define KEY_META(op, arg) (KEY_SET_META | ((op) << 8) | (arg))
+
+#define KEY_TRNS    0x0000                              // Transparent (layers above 0)
+#define KEY_NO      KEY_META(KEY_META_NONE, 0)          // No key, hides lower layers
+#define KEY_MO(l)   KEY_META(KEY_META_MOMENTARY, (l))   // Layer active while held
+#define KEY_TG(l)   KEY_META(KEY_META_TOGGLE, (l))      // Layer toggled on press
+#define KEY_OSL(l)  KEY_META(KEY_META_ONE_SHOT, (l))    // Layer active for the next key
+#define KEY_TH(n)   KEY_META(KEY_META_TAP_HOLD, (n))    // Tap-hold key n of the keymap
+#define KEY_MACRO(n) KEY_META(KEY_META_MACRO, (n))      // Macro n of the keymap
+#define KEY_LEADER  KEY_META(KEY_META_LEADER, 0)        // Starts a leader sequence
+#define KEY_GAMING  KEY_META(KEY_META_GAMING, 0)        // Toggles the gaming mode
+#define KEY_MEDIA(n) (KEY_SET_MULTIMEDIA | (n))         // Consumer usage n of the keymap
+
 #define NUM_ROWS 6
 #define NUM_COLS 15
 
-static const uint16_t KEYMAP[NUM_ROWS][NUM_COLS] = {
-	{   0x29,   0x3a,   0x3b,   0x3c,   0x3d,   0x3e,   0x3f,   0x40,   0x41,   0x42,   0x43,   0x44,   0x45,   0x49,   0x4c },
-	{   0x35,   0x1e,   0x1f,   0x20,   0x21,   0x22,   0x23,   0x24,   0x25,   0x26,   0x27,   0x2d,   0x2e,   0x2a,      0 },
-	{   0x2b,   0x14,   0x1a,   0x08,   0x15,   0x17,   0x1c,   0x18,   0x0c,   0x12,   0x13,   0x2f,   0x30,      0,   0x31 },
-	{   0x39,   0x04,   0x16,   0x07,   0x09,   0x0a,   0x0b,   0x0d,   0x0e,   0x0f,   0x33,   0x34,   0x28,      0,      0 },
-	{ 0x0200,      0,   0x1d,   0x1b,   0x06,   0x19,   0x05,   0x11,   0x10,   0x36,   0x37,   0x38,   0x4a,   0x52,   0x4d },
-	{ 0x0100, 0xf015, 0x0400, 0x0300,      0,      0,   0x2c,      0,      0, 0x0700, 0xf0a5, 0xf0b5,   0x50,   0x51,   0x4f }
+// Layers the firmware can hold; keymaps may use fewer
+#define NUM_LAYERS 2
+
+// One bit per column of a matrix row
+typedef uint16_t matrix_row_t;
+
+// Keys are identified by a single index in events and buffers
+#define NUM_KEYS (NUM_ROWS * NUM_COLS)
+#define KEY_INDEX(r, c)  ((r) * NUM_COLS + (c))
+#define KEY_INDEX_ROW(k) ((k) / NUM_COLS)
+#define KEY_INDEX_COL(k) ((k) % NUM_COLS)
+
+// Keys are looked up in the keymap blob loaded by keymap.c, compiled from
+// tools/keymaps/default.json by tools/keymap_compiler.py. Higher layers take
+// precedence over lower ones; KEY_TRNS falls through to the next active
+// layer.
+
+// Scan period of TC3, in ms. Also the unit of the HID idle rate
+#define KBD_SCAN_PERIOD_MS 4
+
+// A tap-hold key sends its tap key when released within TAP_HOLD_TERM_MS,
+// and acts as its hold key (a modifier or a layer key) otherwise. The policy
+// decides earlier when another key is used while it is pending:
+// - TIMEOUT: only the term decides
+// - PERMISSIVE_HOLD: hold when another key is pressed and released
+// - HOLD_ON_OTHER_KEY_PRESS: hold as soon as another key is pressed
+#define TAP_HOLD_POLICY_TIMEOUT                 0
+#define TAP_HOLD_POLICY_PERMISSIVE_HOLD         1
+#define TAP_HOLD_POLICY_HOLD_ON_OTHER_KEY_PRESS 2
+
+#define TAP_HOLD_TERM_MS 200
+
+struct tap_hold_key
+{
+	uint16_t tap;
+	uint16_t hold;
+	uint8_t policy;
+};
+
+// Combos send their key when all of their keys are pressed within
+// COMBO_TERM_MS of the first one. The combo key is released with the first
+// key of the combo. Keys are matrix positions (KEY_INDEX), so combos work on
+// every layer. Keymaps hold them as matrix row masks, matched against the
+// pressed keys with an AND and compare per row. A keymap has at most 8.
+#define COMBO_MAX_KEYS 4
+
+#define COMBO_TERM_MS 40
+
+struct combo
+{
+	uint16_t key_id;
+	matrix_row_t rows[NUM_ROWS];
+};
+
+// Macros are byte code played by KEY_SET_META macro keys. Each key state
+// they produce is sent in its own report.
+#define MACRO_OP_END     0x00
+#define MACRO_OP_PRESS   0x01    // Key id (2 bytes, little endian)
+#define MACRO_OP_RELEASE 0x02    // Key id
+#define MACRO_OP_TAP     0x03    // Key id, pressed then released
+#define MACRO_OP_DELAY   0x04    // Scan periods (1 byte)
+#define MACRO_OP_STRING  0x05    // ASCII characters, terminated by 0
+
+#define MACRO_PRESS(k)   MACRO_OP_PRESS, ((k) & 0xFF), ((k) >> 8)
+#define MACRO_RELEASE(k) MACRO_OP_RELEASE, ((k) & 0xFF), ((k) >> 8)
+#define MACRO_TAP(k)     MACRO_OP_TAP, ((k) & 0xFF), ((k) >> 8)
+#define MACRO_DELAY(ms)  MACRO_OP_DELAY, (((ms) + KBD_SCAN_PERIOD_MS - 1) / KBD_SCAN_PERIOD_MS)
+#define MACRO_STRING     MACRO_OP_STRING
+#define MACRO_END        MACRO_OP_END
+
+// Leader sequences are the keys tapped after KEY_LEADER, stored as a trie
+// in the keymap. Node 0 is the root, the children of a node are the
+// num_children nodes starting at first_child, and a node with an action
+// plays it when its sequence is complete: when the node is a leaf, or when
+// LEADER_TIMEOUT_MS passes without another key. Sequences matching nothing
+// are sent as typed. Both are macro programs of the keymap, played after
+// the macro playing, if any. Layer and other KEY_SET_META keys are not part
+// of sequences, which are at most LEADER_MAX_DEPTH keys long. Children are
+// sorted by key, at most LEADER_MAX_CHILDREN of them, so each tap takes a
+// binary search of at most 5 nodes.
+#define LEADER_MAX_DEPTH    4
+#define LEADER_MAX_CHILDREN 16
+#define LEADER_TIMEOUT_MS   1000
+
+struct leader_node
+{
+	uint16_t key_id;
+	const uint8_t* action;    // NULL without one
+	const uint8_t* typed;     // The keys of the sequence
+	uint8_t parent;
+	uint8_t first_child;
+	uint8_t num_children;
+};
+
+// In gaming mode, keys of the base layer are reported without going
+// through combos, tap-hold keys or layers (KEY_SET_META keys still do),
+// and opposing keys pressed together are resolved (SOCD) by these rules:
+// - LAST_INPUT: the key pressed last wins, the other one comes back when
+//   it is released
+// - NEUTRAL: neither key is reported
+#define SOCD_LAST_INPUT 0
+#define SOCD_NEUTRAL    1
+
+struct socd_pair
+{
+	uint8_t key_a;
+	uint8_t key_b;
+	uint8_t mode;
 };
 
+static const struct socd_pair SOCD_PAIRS[] = {
+	{ KEY_INDEX(3, 1), KEY_INDEX(3, 3), SOCD_LAST_INPUT },    // A / D
+	{ KEY_INDEX(2, 2), KEY_INDEX(3, 2), SOCD_NEUTRAL }        // W / S
+};
+
+#define NUM_SOCD_PAIRS (sizeof(SOCD_PAIRS) / sizeof(SOCD_PAIRS[0]))
+
 #define PA(n) (n)
 #define PB(n) (0x20 | (n))
 
@@ -33,17 +161,59 @@ static const uint8_t COLMAP[NUM_COLS] = { PA(9), PA(8), PA(7), PA(6), PA(5), PA(
 #define PIN_KBD_LED      2
 #define PIN_KBD_LED_CHAN DAC_CHANNEL_0
 
+// Bits of the HID keyboard LED output report
+#define KBD_LED_NUM_LOCK    0x01
+#define KBD_LED_CAPS_LOCK   0x02
+#define KBD_LED_SCROLL_LOCK 0x04
+
+// Defaults of the indicator shown by the on-board LED and its DAC level when
+// lit (10-bit), see settings.h
+#define KBD_LED_DAC_INDICATOR KBD_LED_CAPS_LOCK
+#define KBD_LED_DAC_ON        0x3FF
+
+// USB frame numbers (1 ms, 11 bits) stamped along the LED output report path
+struct kbd_led_latency
+{
+	uint16_t report_frame;     // SET_REPORT data stage received
+	uint16_t board_frame;      // On-board LED updated
+	uint16_t peripheral_frame; // I2C write to the peripheral completed
+};
+
 void configure_pins(void);
+void configure_keymap(void);
 void configure_tc(void);
 void configure_i2c(void);
 void configure_usb_hid(void);
 void configure_dac(void);
 
-void keyboard_scan_tc_callback(struct tc_module *const module);
+void keyboard_scan(void);
+uint32_t keyboard_get_scan_count(void);
+
+void keyboard_key_event(uint8_t key, bool pressed);
+void keyboard_register_key(uint8_t key, uint16_t key_id);
+bool keyboard_unregister_key(uint8_t key);
+void keyboard_send_reports(void);
 // bool usb_keyboard_enable_callback(void);
 // void usb_keyboard_disable_callback(void);
-// void usb_keyboard_led_callback(uint8_t value);
+void hid_keyboard_led_callback(uint8_t value);
+void hid_keyboard_report_sent_callback(void);
+
+void get_led_latency(struct kbd_led_latency *latency);
+
+// Activity counters, free running
+struct kbd_counters
+{
+	uint32_t scans;
+	uint32_t key_events;       // Matrix changes
+	uint32_t keyboard_reports; // Keyboard reports taken by the host
+};
+
+void get_counters(struct kbd_counters *counters);
+
+// Applies settings changed at runtime (see settings.h)
+void keyboard_apply_settings(void);
 
 void i2c_data_callback(uint8_t address, uint8_t* value);
+void i2c_write_callback(uint8_t address);
 
 #endif /* KEYBOARD_H_ */
\ No newline at end of file
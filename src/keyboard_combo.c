@@ -0,0 +1,171 @@
+#include "keyboard_combo.h"
+#include "keymap.h"
+#include "timer_wheel.h"
+
+#include <string.h>
+
+#define COMBO_TERM_TICKS ((COMBO_TERM_MS + KBD_SCAN_PERIOD_MS - 1) / KBD_SCAN_PERIOD_MS)
+
+// Bit n for combo n; keymaps have at most 8
+typedef uint8_t combo_mask_t;
+
+// Combo keys pressed since the first one, in order, and the combos they
+// can still complete
+static matrix_row_t g_pendingMatrix[NUM_ROWS];
+static uint8_t g_pendingKeys[COMBO_MAX_KEYS];
+static uint8_t g_numPendingKeys = 0;
+static combo_mask_t g_candidates = 0;
+
+// Keys of fired combos other than the first one, whose release is dropped
+static matrix_row_t g_consumedKeys[NUM_ROWS];
+
+static void combo_timeout_callback(void);
+
+void combo_init(void)
+{
+	memset(g_pendingMatrix, 0, sizeof(g_pendingMatrix));
+	memset(g_consumedKeys, 0, sizeof(g_consumedKeys));
+	g_numPendingKeys = 0;
+	g_candidates = 0;
+
+	timer_wheel_register_callback(TIMER_COMBO, combo_timeout_callback);
+}
+
+// The keymap in flash holds the combos each key is part of and the matrix
+// row masks of each combo. Keys that are in no combo never enter the
+// buffer.
+static bool is_combo_complete(unsigned index)
+{
+	struct combo combo;
+	keymap_get_combo(index, &combo);
+	for (unsigned r = 0; r < NUM_ROWS; r++)
+	{
+		if ((g_pendingMatrix[r] & combo.rows[r]) != combo.rows[r])
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+static void clear_pending(void)
+{
+	timer_wheel_cancel(TIMER_COMBO);
+	memset(g_pendingMatrix, 0, sizeof(g_pendingMatrix));
+	g_numPendingKeys = 0;
+	g_candidates = 0;
+}
+
+static void fire_combo(unsigned index)
+{
+	const uint8_t owner = g_pendingKeys[0];
+	struct combo combo;
+	keymap_get_combo(index, &combo);
+
+	for (unsigned i = 1; i < g_numPendingKeys; i++)
+	{
+		const uint8_t key = g_pendingKeys[i];
+		g_consumedKeys[KEY_INDEX_ROW(key)] |= 1 << KEY_INDEX_COL(key);
+	}
+	clear_pending();
+
+	keyboard_register_key(owner, combo.key_id);
+}
+
+static void flush_pending(void)
+{
+	uint8_t keys[COMBO_MAX_KEYS];
+	const uint8_t num_keys = g_numPendingKeys;
+	memcpy(keys, g_pendingKeys, num_keys);
+	clear_pending();
+
+	for (unsigned i = 0; i < num_keys; i++)
+	{
+		keyboard_key_event(keys[i], true);
+	}
+}
+
+// Fires the combo completed by the pending keys, or replays them as normal keys
+static void resolve_pending(void)
+{
+	for (unsigned i = 0; g_candidates >> i; i++)
+	{
+		if ((g_candidates & (1 << i)) && is_combo_complete(i))
+		{
+			fire_combo(i);
+			return;
+		}
+	}
+	flush_pending();
+}
+
+static void combo_timeout_callback(void)
+{
+	if (g_numPendingKeys > 0)
+	{
+		resolve_pending();
+	}
+}
+
+bool combo_key_event(uint8_t key, bool pressed)
+{
+	const unsigned r = KEY_INDEX_ROW(key);
+	const matrix_row_t col_bit = 1 << KEY_INDEX_COL(key);
+
+	if (!pressed)
+	{
+		if (g_numPendingKeys > 0)
+		{
+			resolve_pending();
+		}
+
+		if (g_consumedKeys[r] & col_bit)
+		{
+			g_consumedKeys[r] &= ~col_bit;
+			return true;
+		}
+		return false;
+	}
+
+	const combo_mask_t key_combos = keymap_get_key_combos(key);
+
+	if (g_numPendingKeys > 0 && (g_candidates & key_combos) == 0)
+	{
+		// Not part of the started combos, which can't complete anymore
+		resolve_pending();
+	}
+
+	if (key_combos == 0)
+	{
+		return false;
+	}
+
+	if (g_numPendingKeys == 0)
+	{
+		g_candidates = key_combos;
+		timer_wheel_schedule(TIMER_COMBO, COMBO_TERM_TICKS);
+	}
+	else
+	{
+		g_candidates &= key_combos;
+	}
+
+	g_pendingMatrix[r] |= col_bit;
+	g_pendingKeys[g_numPendingKeys++] = key;
+
+	// Fire right away unless a longer combo can still complete
+	for (unsigned i = 0; g_candidates >> i; i++)
+	{
+		const combo_mask_t combo_bit = 1 << i;
+		if ((g_candidates & combo_bit) && is_combo_complete(i))
+		{
+			if (g_candidates == combo_bit || g_numPendingKeys == COMBO_MAX_KEYS)
+			{
+				fire_combo(i);
+			}
+			break;
+		}
+	}
+
+	return true;
+}
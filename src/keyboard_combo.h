@@ -0,0 +1,12 @@
+#ifndef KEYBOARD_COMBO_H_
+#define KEYBOARD_COMBO_H_
+
+#include "hal.h"
+
+#include "keyboard.h"
+
+void combo_init(void);
+
+bool combo_key_event(uint8_t key, bool pressed);
+
+#endif /* KEYBOARD_COMBO_H_ */
@@ -0,0 +1,122 @@
+#include "keyboard_debounce.h"
+#include "key_stats.h"
+
+#include <string.h>
+
+static enum debounce_mode g_mode = DEBOUNCE_NONE;
+static uint8_t g_ticks = 0;
+
+// Debounced keys, keys with a change in progress and its scan count, and the
+// rows read at the last scan to find the bounces
+static matrix_row_t g_stable[NUM_ROWS];
+static matrix_row_t g_busy[NUM_ROWS];
+static uint8_t g_counters[NUM_ROWS][NUM_COLS];
+static matrix_row_t g_raw[NUM_ROWS];
+
+void debounce_init(void)
+{
+	g_mode = DEBOUNCE_NONE;
+	g_ticks = 0;
+	memset(g_stable, 0, sizeof(g_stable));
+	memset(g_busy, 0, sizeof(g_busy));
+	memset(g_raw, 0, sizeof(g_raw));
+}
+
+void debounce_configure(enum debounce_mode mode, uint8_t ticks)
+{
+	g_mode = mode;
+	g_ticks = ticks;
+	memset(g_busy, 0, sizeof(g_busy));
+}
+
+static inline void debounce_eager(unsigned r, unsigned c, matrix_row_t raw, matrix_row_t edges)
+{
+	const matrix_row_t bit = 1 << c;
+	if (g_busy[r] & bit)
+	{
+		// Ignored for the g_ticks scans after the edge; each move away from
+		// the state passed is a bounce
+		if (g_counters[r][c] != 0)
+		{
+			g_counters[r][c]--;
+			if (edges & (raw ^ g_stable[r]) & bit)
+			{
+				key_stats_chatter(KEY_INDEX(r, c));
+			}
+			return;
+		}
+		g_busy[r] &= ~bit;
+	}
+
+	if ((raw ^ g_stable[r]) & bit)
+	{
+		g_stable[r] ^= bit;
+		g_busy[r] |= bit;
+		g_counters[r][c] = g_ticks;
+	}
+}
+
+static inline void debounce_defer(unsigned r, unsigned c, matrix_row_t raw)
+{
+	const matrix_row_t bit = 1 << c;
+	if (((raw ^ g_stable[r]) & bit) == 0)
+	{
+		// Bounced back, or nothing going on
+		if (g_busy[r] & bit)
+		{
+			key_stats_chatter(KEY_INDEX(r, c));
+			g_busy[r] &= ~bit;
+		}
+		return;
+	}
+
+	if ((g_busy[r] & bit) == 0)
+	{
+		g_busy[r] |= bit;
+		g_counters[r][c] = 0;
+	}
+
+	// Seen at the edge and over the debounce time after it
+	if (++g_counters[r][c] > g_ticks)
+	{
+		g_stable[r] ^= bit;
+		g_busy[r] &= ~bit;
+	}
+}
+
+void debounce_matrix(matrix_row_t* matrix)
+{
+	if (g_mode == DEBOUNCE_NONE || g_ticks == 0)
+	{
+		memcpy(g_stable, matrix, sizeof(g_stable));
+		return;
+	}
+
+	for (unsigned r = 0; r < NUM_ROWS; r++)
+	{
+		const matrix_row_t edges = matrix[r] ^ g_raw[r];
+		g_raw[r] = matrix[r];
+
+		const matrix_row_t active = (matrix[r] ^ g_stable[r]) | g_busy[r];
+		if (active == 0)
+		{
+			continue;
+		}
+
+		for (unsigned c = 0; c < NUM_COLS; c++)
+		{
+			if (active & (1 << c))
+			{
+				if (g_mode == DEBOUNCE_EAGER)
+				{
+					debounce_eager(r, c, matrix[r], edges);
+				}
+				else
+				{
+					debounce_defer(r, c, matrix[r]);
+				}
+			}
+		}
+		matrix[r] = g_stable[r];
+	}
+}
@@ -0,0 +1,28 @@
+#ifndef KEYBOARD_DEBOUNCE_H_
+#define KEYBOARD_DEBOUNCE_H_
+
+#include "hal.h"
+
+#include "keyboard.h"
+
+// Contact bounce filter between the matrix read and the key events, per key.
+enum debounce_mode
+{
+	DEBOUNCE_NONE,   // The scan period alone filters
+	DEBOUNCE_EAGER,  // A change passes at once, then the key is ignored for the debounce time
+	DEBOUNCE_DEFER,  // A change passes once it has held for the debounce time
+	NUM_DEBOUNCE_MODES
+};
+
+// Scans covering a debounce time
+#define DEBOUNCE_TICKS(ms) (((ms) + KBD_SCAN_PERIOD_MS - 1) / KBD_SCAN_PERIOD_MS)
+
+void debounce_init(void);
+
+// Changes in progress are dropped; the keys keep their state
+void debounce_configure(enum debounce_mode mode, uint8_t ticks);
+
+// Replaces the rows read from the matrix with the debounced ones
+void debounce_matrix(matrix_row_t* matrix);
+
+#endif /* KEYBOARD_DEBOUNCE_H_ */
@@ -0,0 +1,127 @@
+#include "keyboard_gaming.h"
+#include "keyboard_layer.h"
+#include "keymap.h"
+
+#include <string.h>
+
+static bool g_gamingMode = false;
+
+// Keys of each SOCD pair, and of all pairs
+static matrix_row_t g_socdPairKeys[NUM_SOCD_PAIRS][NUM_ROWS];
+static matrix_row_t g_socdKeys[NUM_ROWS];
+
+// Key of each pair pressed last (SOCD_LAST_INPUT)
+static uint8_t g_socdLastKey[NUM_SOCD_PAIRS];
+
+void gaming_init(void)
+{
+	g_gamingMode = false;
+	memset(g_socdPairKeys, 0, sizeof(g_socdPairKeys));
+	memset(g_socdKeys, 0, sizeof(g_socdKeys));
+
+	for (unsigned i = 0; i < NUM_SOCD_PAIRS; i++)
+	{
+		const uint8_t a = SOCD_PAIRS[i].key_a;
+		const uint8_t b = SOCD_PAIRS[i].key_b;
+		g_socdPairKeys[i][KEY_INDEX_ROW(a)] |= 1 << KEY_INDEX_COL(a);
+		g_socdPairKeys[i][KEY_INDEX_ROW(b)] |= 1 << KEY_INDEX_COL(b);
+		g_socdKeys[KEY_INDEX_ROW(a)] |= 1 << KEY_INDEX_COL(a);
+		g_socdKeys[KEY_INDEX_ROW(b)] |= 1 << KEY_INDEX_COL(b);
+		g_socdLastKey[i] = a;
+	}
+}
+
+bool gaming_toggle_key(uint16_t key_id)
+{
+	if (key_id != KEY_GAMING)
+	{
+		return false;
+	}
+
+	g_gamingMode = !g_gamingMode;
+	return true;
+}
+
+bool gaming_is_enabled(void)
+{
+	return g_gamingMode;
+}
+
+bool gaming_key_event(uint8_t key, bool pressed)
+{
+	// Only the base layer bypasses the keymap engines, so that layer keys
+	// (and the gaming key on them) keep working
+	if (!g_gamingMode || layer_get_state() != 1)
+	{
+		return false;
+	}
+
+	const unsigned r = KEY_INDEX_ROW(key);
+	const unsigned c = KEY_INDEX_COL(key);
+
+	if (!pressed)
+	{
+		// Keys still held back by an engine are released through it
+		return keyboard_unregister_key(key);
+	}
+
+	const uint16_t key_id = keymap_get_key(0, r, c);
+	if ((key_id & 0xf000) == KEY_SET_META)
+	{
+		return false;
+	}
+
+	if (g_socdKeys[r] & (1 << c))
+	{
+		for (unsigned i = 0; i < NUM_SOCD_PAIRS; i++)
+		{
+			if (g_socdPairKeys[i][r] & (1 << c))
+			{
+				g_socdLastKey[i] = key;
+			}
+		}
+	}
+
+	keyboard_register_key(key, key_id);
+	return true;
+}
+
+void gaming_filter_keys(matrix_row_t* keys)
+{
+	if (!g_gamingMode)
+	{
+		return;
+	}
+
+	for (unsigned i = 0; i < NUM_SOCD_PAIRS; i++)
+	{
+		// Both keys of the pair held
+		bool both = true;
+		for (unsigned r = 0; r < NUM_ROWS; r++)
+		{
+			if ((keys[r] & g_socdPairKeys[i][r]) != g_socdPairKeys[i][r])
+			{
+				both = false;
+				break;
+			}
+		}
+		if (!both)
+		{
+			continue;
+		}
+
+		if (SOCD_PAIRS[i].mode == SOCD_NEUTRAL)
+		{
+			for (unsigned r = 0; r < NUM_ROWS; r++)
+			{
+				keys[r] &= ~g_socdPairKeys[i][r];
+			}
+		}
+		else
+		{
+			const uint8_t last = g_socdLastKey[i];
+			const uint8_t other = (last == SOCD_PAIRS[i].key_a) ? SOCD_PAIRS[i].key_b : SOCD_PAIRS[i].key_a;
+			keys[KEY_INDEX_ROW(other)] &= ~(1 << KEY_INDEX_COL(other));
+		}
+	}
+}
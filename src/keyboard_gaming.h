@@ -0,0 +1,16 @@
+#ifndef KEYBOARD_GAMING_H_
+#define KEYBOARD_GAMING_H_
+
+#include "hal.h"
+
+#include "keyboard.h"
+
+void gaming_init(void);
+
+bool gaming_toggle_key(uint16_t key_id);
+bool gaming_is_enabled(void);
+bool gaming_key_event(uint8_t key, bool pressed);
+
+void gaming_filter_keys(matrix_row_t* keys);
+
+#endif /* KEYBOARD_GAMING_H_ */
@@ -1,4 +1,5 @@
 #include "keyboard_i2c.h"
+#include "trace.h"
 
 // Number of consecutive positive ADC high results before I2C data is sent.
 // Since the ADC is read during the keyboard scan, this means that the
@@ -12,11 +13,16 @@
 
 static bool write_i2c_data(uint8_t reg, uint8_t value);
 static bool read_i2c_data(uint8_t reg);
-static void start_next_transmission(struct i2c_master_module *const module);
+static void start_next_transmission(void);
+static void flush_indicator_leds(void);
+static void i2c_write_complete_callback(void);
+static void i2c_read_complete_callback(void);
+static void i2c_error_callback(void);
+static void adc_complete_callback(uint16_t result);
 
 struct i2c_transmission
 {
-	struct i2c_master_packet packet;
+	uint8_t length;
 	bool is_read;
 	bool started;
 	struct
@@ -36,71 +42,52 @@ static struct
 
 static uint8_t g_I2CReceivedData[KBD_I2C_DATA_LEN];
 
-static struct i2c_master_module g_I2CControllerInstance;
-
-static struct adc_module g_adcInstance;
-static uint16_t g_adcResult;
-
 // Number of consecutive ADC HIGH results (see KBD_ADC_DELAY_CYCLES)
 static volatile unsigned g_adcHighCycles = 0;
 
 static i2c_kbd_data_callback_t g_I2CDataCallback;
 static bool g_I2CDataCallbackEnable = false;
 
+static i2c_kbd_write_callback_t g_I2CWriteCallback = NULL;
+
+// Indicator LED state to mirror on the peripheral, and whether it still has
+// to be written (changed, write queue full, or peripheral just plugged in)
+static volatile uint8_t g_I2CIndicatorLeds = 0;
+static volatile bool g_I2CIndicatorLedsDirty = false;
+
 
 void configure_adc(void)
 {
-	struct adc_config adcconfig;
-	adc_get_config_defaults(&adcconfig);
-	
-	adcconfig.gain_factor = ADC_GAIN_FACTOR_1X;
-	adcconfig.clock_prescaler = ADC_CLOCK_PRESCALER_DIV8;
-	adcconfig.reference = ADC_REFERENCE_INT1V;
-	adcconfig.resolution = ADC_RESOLUTION_8BIT;
-	adcconfig.positive_input = PIN_KBD_ID_CHAN;
-	
-	adcconfig.clock_source = GCLK_GENERATOR_3;
-	
-	adc_init(&g_adcInstance, ADC, &adcconfig);
-	adc_enable(&g_adcInstance);
-	
-	adc_register_callback(&g_adcInstance, adc_complete_callback, ADC_CALLBACK_READ_BUFFER);
-	adc_enable_callback(&g_adcInstance, ADC_CALLBACK_READ_BUFFER);
+	hal_id_adc_init(adc_complete_callback);
 }
 
 void configure_i2c_controller(void)
 {
-	struct i2c_master_config i2cconfig;
-	i2c_master_get_config_defaults(&i2cconfig);
-	
-	i2cconfig.buffer_timeout = 65535;
-	i2cconfig.generator_source = GCLK_GENERATOR_3;
-	
-	i2c_master_init(&g_I2CControllerInstance, KBD_I2C_SERCOM_IFACE, &i2cconfig);
-	i2c_master_enable(&g_I2CControllerInstance);
-
-	i2c_master_register_callback(&g_I2CControllerInstance, i2c_read_complete_callback, I2C_MASTER_CALLBACK_READ_COMPLETE);
-	i2c_master_enable_callback(&g_I2CControllerInstance, I2C_MASTER_CALLBACK_READ_COMPLETE);
-	i2c_master_register_callback(&g_I2CControllerInstance, i2c_write_complete_callback, I2C_MASTER_CALLBACK_WRITE_COMPLETE);
-	i2c_master_enable_callback(&g_I2CControllerInstance, I2C_MASTER_CALLBACK_WRITE_COMPLETE);
-	i2c_master_register_callback(&g_I2CControllerInstance, i2c_error_callback, I2C_MASTER_CALLBACK_ERROR);
-	i2c_master_enable_callback(&g_I2CControllerInstance, I2C_MASTER_CALLBACK_ERROR);
+	hal_i2c_init(i2c_write_complete_callback, i2c_read_complete_callback, i2c_error_callback);
 }
 
 
 inline void read_id_adc(void)
 {
-    i2c_master_cancel_job(&g_I2CControllerInstance);
-	adc_read_buffer_job(&g_adcInstance, &g_adcResult, 1);
+    hal_i2c_cancel();
+	hal_id_adc_start();
 }
 
 
-void adc_complete_callback(struct adc_module *const module)
+void adc_complete_callback(uint16_t result)
 {
-	if (g_adcResult > 0xD2)
+	TRACE(TRACE_ADC, Min(result, 0xFF));
+	if (result > 0xD2)
 	{
-		if (++g_adcHighCycles > KBD_ADC_DELAY_CYCLES)
+		if (g_adcHighCycles <= KBD_ADC_DELAY_CYCLES && ++g_adcHighCycles > KBD_ADC_DELAY_CYCLES)
+		{
+			// Peripheral (re)connected: restore its indicator LEDs
+			g_I2CIndicatorLedsDirty = true;
+		}
+
+		if (g_adcHighCycles > KBD_ADC_DELAY_CYCLES)
 		{
+			flush_indicator_leds();
 			read_i2c_data(KBD_I2C_REG_KEY_DATA);
 		}
 	}
@@ -108,8 +95,6 @@ void adc_complete_callback(struct adc_module *const module)
 	{
 		g_adcHighCycles = 0;
 	}
-
-	UNUSED(module);
 }
 
 bool write_i2c_data(uint8_t reg, uint8_t value)
@@ -119,6 +104,7 @@ bool write_i2c_data(uint8_t reg, uint8_t value)
 	system_interrupt_enter_critical_section();
 	if (g_I2CTransmissionBuffer.size == KBD_I2C_TX_BUFFER_SIZE)
 	{
+		system_interrupt_leave_critical_section();
 		return false;
 	}
 
@@ -131,19 +117,13 @@ bool write_i2c_data(uint8_t reg, uint8_t value)
 	i2c_data->is_read = false;
 	i2c_data->started = false;
 
-	i2c_data->packet.address = KBD_I2C_PERIPHERAL_ADDR;
-	i2c_data->packet.ten_bit_address = false;
-	i2c_data->packet.high_speed = false;
-
 	i2c_data->data.reg = reg;
 	i2c_data->data.values[0] = value;
-
-	i2c_data->packet.data = (uint8_t *) &i2c_data->data;
-	i2c_data->packet.data_length = 2;
+	i2c_data->length = 2;
 
 	if (g_I2CTransmissionBuffer.size++ == 0)
 	{
-		start_next_transmission(&g_I2CControllerInstance);
+		start_next_transmission();
 	}
 	system_interrupt_leave_critical_section();
 
@@ -157,6 +137,7 @@ bool read_i2c_data(uint8_t reg)
 	system_interrupt_enter_critical_section();
 	if (g_I2CTransmissionBuffer.size == KBD_I2C_TX_BUFFER_SIZE)
 	{
+		system_interrupt_leave_critical_section();
 		return false;
 	}
 
@@ -169,37 +150,35 @@ bool read_i2c_data(uint8_t reg)
 	i2c_data->is_read = true;
 	i2c_data->started = false;
 
-	i2c_data->packet.address = KBD_I2C_PERIPHERAL_ADDR;
-	i2c_data->packet.ten_bit_address = false;
-	i2c_data->packet.high_speed = false;
-
 	i2c_data->data.reg = reg;
-
-	i2c_data->packet.data = (uint8_t *) &i2c_data->data;
-	i2c_data->packet.data_length = 1;
+	i2c_data->length = 1;
 
 	if (g_I2CTransmissionBuffer.size++ == 0)
 	{
-		start_next_transmission(&g_I2CControllerInstance);
+		start_next_transmission();
 	}
 	system_interrupt_leave_critical_section();
 
 	return true;
 }
 
-void i2c_write_complete_callback(struct i2c_master_module *const module)
+void i2c_write_complete_callback(void)
 {
 	struct i2c_transmission *i2c_data = &g_I2CTransmissionBuffer.data[g_I2CTransmissionBuffer.head];
 	if (i2c_data->is_read)
 	{
-		i2c_data->packet.data = (uint8_t *) g_I2CReceivedData;
-		i2c_data->packet.data_length = KBD_I2C_DATA_LEN; // TODO: may vary based on register
-
-		i2c_master_read_packet_job(&g_I2CControllerInstance, &i2c_data->packet);
+		// TODO: length may vary based on register
+		hal_i2c_read(KBD_I2C_PERIPHERAL_ADDR, g_I2CReceivedData, KBD_I2C_DATA_LEN);
 	}
 	else
 	{
-		i2c_master_send_stop(module);
+		hal_i2c_send_stop();
+		TRACE(TRACE_I2C_DONE, i2c_data->data.reg);
+
+		if (g_I2CWriteCallback != NULL)
+		{
+			g_I2CWriteCallback(i2c_data->data.reg);
+		}
 
 		system_interrupt_enter_critical_section();
 		if (++g_I2CTransmissionBuffer.head >= KBD_I2C_TX_BUFFER_SIZE)
@@ -208,15 +187,16 @@ void i2c_write_complete_callback(struct i2c_master_module *const module)
 		}
 		g_I2CTransmissionBuffer.size--;
 
-		start_next_transmission(module);
+		start_next_transmission();
 
 		system_interrupt_leave_critical_section();
 	}
 }
 
-void i2c_read_complete_callback(struct i2c_master_module *const module)
+void i2c_read_complete_callback(void)
 {
 	const uint8_t reg = g_I2CTransmissionBuffer.data[g_I2CTransmissionBuffer.head].data.reg;
+	TRACE(TRACE_I2C_DONE, reg);
 	g_I2CDataCallback(reg, g_I2CReceivedData);
 
 	system_interrupt_enter_critical_section();
@@ -226,13 +206,14 @@ void i2c_read_complete_callback(struct i2c_master_module *const module)
 	}
 	g_I2CTransmissionBuffer.size--;
 
-	start_next_transmission(module);
+	start_next_transmission();
 
 	system_interrupt_leave_critical_section();
 }
 
-void i2c_error_callback(struct i2c_master_module *const module)
+void i2c_error_callback(void)
 {
+	TRACE(TRACE_I2C_ERROR, 0);
 	system_interrupt_enter_critical_section();
 	if (++g_I2CTransmissionBuffer.head >= KBD_I2C_TX_BUFFER_SIZE)
 	{
@@ -240,12 +221,12 @@ void i2c_error_callback(struct i2c_master_module *const module)
 	}
 	g_I2CTransmissionBuffer.size--;
 
-	start_next_transmission(module);
+	start_next_transmission();
 
 	system_interrupt_leave_critical_section();
 }
 
-void start_next_transmission(struct i2c_master_module *const module)
+void start_next_transmission(void)
 {
 	if (g_I2CTransmissionBuffer.size == 0)
 	{
@@ -258,8 +239,40 @@ void start_next_transmission(struct i2c_master_module *const module)
 		return;
 	}
 	i2c_data->started = true;
+	TRACE(TRACE_I2C_START, i2c_data->data.reg);
 
-	i2c_master_write_packet_job_no_stop(module, &i2c_data->packet);
+	hal_i2c_write_no_stop(KBD_I2C_PERIPHERAL_ADDR, (uint8_t *) &i2c_data->data, i2c_data->length);
+}
+
+
+void flush_indicator_leds(void)
+{
+	if (g_I2CIndicatorLedsDirty && write_i2c_data(KBD_I2C_REG_IND_LED, g_I2CIndicatorLeds))
+	{
+		g_I2CIndicatorLedsDirty = false;
+	}
+}
+
+void i2c_kbd_set_indicator_leds(uint8_t value)
+{
+	system_interrupt_enter_critical_section();
+	if (value != g_I2CIndicatorLeds)
+	{
+		g_I2CIndicatorLeds = value;
+		g_I2CIndicatorLedsDirty = true;
+	}
+
+	// If the peripheral is absent, the state is written when it is connected
+	if (g_adcHighCycles > KBD_ADC_DELAY_CYCLES)
+	{
+		flush_indicator_leds();
+	}
+	system_interrupt_leave_critical_section();
+}
+
+void i2c_kbd_write_register_callback(i2c_kbd_write_callback_t callback)
+{
+	g_I2CWriteCallback = callback;
 }
 
 
@@ -1,7 +1,7 @@
 #ifndef KEYBOARD_I2C_H_
 #define KEYBOARD_I2C_H_
 
-#include <asf.h>
+#include "hal.h"
 
 #define PIN_KBD_ID      3
 #define PIN_KBD_ID_CHAN ADC_POSITIVE_INPUT_PIN1
@@ -17,6 +17,7 @@
 
 
 typedef void (*i2c_kbd_data_callback_t)(uint8_t, uint8_t*);
+typedef void (*i2c_kbd_write_callback_t)(uint8_t);
 
 
 void configure_adc(void);
@@ -24,14 +25,13 @@ void configure_i2c_controller(void);
 
 void read_id_adc(void);
 
-void i2c_write_complete_callback(struct i2c_master_module *const module);
-void i2c_read_complete_callback(struct i2c_master_module *const module);
-void i2c_error_callback(struct i2c_master_module *const module);
-void adc_complete_callback(struct adc_module *const module);
-
 void i2c_kbd_data_register_callback(i2c_kbd_data_callback_t callback);
 void i2c_kbd_data_enable_callback(void);
 void i2c_kbd_data_disable_callback(void);
 
+void i2c_kbd_write_register_callback(i2c_kbd_write_callback_t callback);
+
+void i2c_kbd_set_indicator_leds(uint8_t value);
+
 
 #endif /* KEYBOARD_I2C_H_ */
\ No newline at end of file
@@ -0,0 +1,144 @@
+#include "keyboard_layer.h"
+#include "keymap.h"
+#include "settings.h"
+
+#include <string.h>
+
+#if NUM_LAYERS > 8
+#error "Layer masks are 8 bits wide"
+#endif
+
+// Resolved keymap of the current layer stack: the layer each key resolves
+// to, as bit planes of the layer number, so a key is resolved with a single
+// keymap lookup. Rebuilt only when the set of active layers changes. The
+// key ids themselves (2 bytes per key) no longer fit the RAM budget once
+// keymaps are read in place from flash; the planes take 2 bytes per row
+// and plane.
+#define LAYER_PLANES (NUM_LAYERS > 4 ? 3 : NUM_LAYERS > 2 ? 2 : 1)
+static matrix_row_t g_resolvedLayers[LAYER_PLANES][NUM_ROWS];
+
+// Number of held momentary keys for each layer
+static uint8_t g_layerMomentaryCount[NUM_LAYERS];
+
+// Layers toggled on, and one-shot layers waiting for the next key press
+static uint8_t g_layersToggled = 0;
+static uint8_t g_layersOneShot = 0;
+
+// Active layers the resolved keymap was built for (layer 0 is always active)
+static uint8_t g_layersActive = 0;
+
+static void update_layers(void);
+
+void layer_init(void)
+{
+	memset(g_layerMomentaryCount, 0, sizeof(g_layerMomentaryCount));
+	g_layersToggled = settings_get(SETTING_DEFAULT_LAYERS) & ((1 << NUM_LAYERS) - 2);
+	g_layersOneShot = 0;
+
+	g_layersActive = 0;
+	update_layers();
+}
+
+void layer_refresh(void)
+{
+	// The keymap changed under the same layer stack
+	g_layersActive = 0;
+	update_layers();
+}
+
+uint16_t layer_resolve_key(unsigned row, unsigned col)
+{
+	unsigned layer = 0;
+	for (unsigned p = 0; p < LAYER_PLANES; p++)
+	{
+		layer |= ((g_resolvedLayers[p][row] >> col) & 1) << p;
+	}
+	return keymap_get_key(layer, row, col);
+}
+
+void layer_key_pressed(uint16_t key_id)
+{
+	const uint8_t layer = key_id & 0xFF;
+
+	if ((key_id & 0xf000) == KEY_SET_META && layer > 0 && layer < NUM_LAYERS)
+	{
+		switch ((key_id >> 8) & 0xF)
+		{
+			case KEY_META_MOMENTARY:
+				g_layerMomentaryCount[layer]++;
+				update_layers();
+				return;
+			case KEY_META_TOGGLE:
+				g_layersToggled ^= 1 << layer;
+				update_layers();
+				return;
+			case KEY_META_ONE_SHOT:
+				g_layersOneShot |= 1 << layer;
+				update_layers();
+				return;
+		}
+	}
+
+	// Any other key consumes the one-shot layers (it was resolved with them)
+	if (g_layersOneShot != 0)
+	{
+		g_layersOneShot = 0;
+		update_layers();
+	}
+}
+
+void layer_key_released(uint16_t key_id)
+{
+	const uint8_t layer = key_id & 0xFF;
+
+	if ((key_id & 0xff00) == KEY_META(KEY_META_MOMENTARY, 0) && layer > 0 && layer < NUM_LAYERS)
+	{
+		if (g_layerMomentaryCount[layer] > 0)
+		{
+			g_layerMomentaryCount[layer]--;
+		}
+		update_layers();
+	}
+}
+
+uint8_t layer_get_state(void)
+{
+	return g_layersActive;
+}
+
+void update_layers(void)
+{
+	uint8_t active = 1 | g_layersToggled | g_layersOneShot;
+	for (unsigned l = 1; l < NUM_LAYERS; l++)
+	{
+		if (g_layerMomentaryCount[l] > 0)
+		{
+			active |= 1 << l;
+		}
+	}
+
+	if (active == g_layersActive)
+	{
+		return;
+	}
+	g_layersActive = active;
+
+	memset(g_resolvedLayers, 0, sizeof(g_resolvedLayers));
+	for (unsigned r = 0; r < NUM_ROWS; r++)
+	{
+		for (unsigned c = 0; c < NUM_COLS; c++)
+		{
+			for (unsigned l = NUM_LAYERS - 1; l > 0; l--)
+			{
+				if ((active & (1 << l)) && keymap_get_key(l, r, c) != KEY_TRNS)
+				{
+					for (unsigned p = 0; p < LAYER_PLANES; p++)
+					{
+						g_resolvedLayers[p][r] |= ((l >> p) & 1) << c;
+					}
+					break;
+				}
+			}
+		}
+	}
+}
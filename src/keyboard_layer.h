@@ -0,0 +1,18 @@
+#ifndef KEYBOARD_LAYER_H_
+#define KEYBOARD_LAYER_H_
+
+#include "hal.h"
+
+#include "keyboard.h"
+
+void layer_init(void);
+void layer_refresh(void);
+
+uint16_t layer_resolve_key(unsigned row, unsigned col);
+
+void layer_key_pressed(uint16_t key_id);
+void layer_key_released(uint16_t key_id);
+
+uint8_t layer_get_state(void);
+
+#endif /* KEYBOARD_LAYER_H_ */
@@ -0,0 +1,124 @@
+#include "keyboard_leader.h"
+#include "keyboard_macro.h"
+#include "keymap.h"
+#include "timer_wheel.h"
+
+#define LEADER_INACTIVE 0xFF
+
+#define LEADER_TIMEOUT_TICKS ((LEADER_TIMEOUT_MS + KBD_SCAN_PERIOD_MS - 1) / KBD_SCAN_PERIOD_MS)
+
+// Trie node of the keys tapped since the leader key
+static uint8_t g_cursor = LEADER_INACTIVE;
+
+// Output of a sequence that ended while a macro played, sent after it. The
+// leader key is refused until then.
+static const uint8_t* g_pendingProgram = NULL;
+static uint16_t g_pendingKey = 0;
+
+static void leader_timeout_callback(void);
+
+void leader_init(void)
+{
+	g_cursor = LEADER_INACTIVE;
+	g_pendingProgram = NULL;
+	g_pendingKey = 0;
+	timer_wheel_register_callback(TIMER_LEADER, leader_timeout_callback);
+}
+
+// Plays a program of the keymap, then taps key_id if not 0
+static void play(const uint8_t* program, uint16_t key_id)
+{
+	if (!macro_play_then_tap(program, key_id))
+	{
+		g_pendingProgram = program;
+		g_pendingKey = key_id;
+	}
+}
+
+// The action of the node, or the keys of its sequence as typed
+static void complete(const struct leader_node* node)
+{
+	play(node->action != NULL ? node->action : node->typed, 0);
+}
+
+void leader_step(void)
+{
+	if (g_pendingProgram != NULL && macro_play_then_tap(g_pendingProgram, g_pendingKey))
+	{
+		g_pendingProgram = NULL;
+	}
+}
+
+static void leader_timeout_callback(void)
+{
+	struct leader_node node;
+	if (g_cursor != LEADER_INACTIVE && g_cursor != 0 && keymap_get_leader_node(g_cursor, &node))
+	{
+		complete(&node);
+	}
+	g_cursor = LEADER_INACTIVE;
+}
+
+bool leader_key_event(uint16_t key_id)
+{
+	if (g_cursor == LEADER_INACTIVE)
+	{
+		if (key_id != KEY_LEADER || keymap_num_leader_nodes() == 0)
+		{
+			return false;
+		}
+
+		if (g_pendingProgram == NULL)
+		{
+			g_cursor = 0;
+			timer_wheel_schedule(TIMER_LEADER, LEADER_TIMEOUT_TICKS);
+		}
+		return true;
+	}
+
+	if ((key_id & 0xf000) == KEY_SET_META && key_id != KEY_LEADER)
+	{
+		return false;
+	}
+
+	// The keymap may have changed since the last key
+	struct leader_node node;
+	if (!keymap_get_leader_node(g_cursor, &node))
+	{
+		timer_wheel_cancel(TIMER_LEADER);
+		g_cursor = LEADER_INACTIVE;
+		return false;
+	}
+
+	uint8_t index;
+	if (keymap_find_leader_child(g_cursor, key_id, &index))
+	{
+		struct leader_node child;
+		keymap_get_leader_node(index, &child);
+		if (child.num_children == 0)
+		{
+			timer_wheel_cancel(TIMER_LEADER);
+			complete(&child);
+			g_cursor = LEADER_INACTIVE;
+		}
+		else
+		{
+			g_cursor = index;
+			timer_wheel_schedule(TIMER_LEADER, LEADER_TIMEOUT_TICKS);
+		}
+		return true;
+	}
+
+	// No sequence continues with this key
+	timer_wheel_cancel(TIMER_LEADER);
+	if (key_id != KEY_LEADER)
+	{
+		play(node.typed, key_id);
+	}
+	else if (g_cursor != 0)
+	{
+		play(node.typed, 0);
+	}
+	g_cursor = LEADER_INACTIVE;
+	return true;
+}
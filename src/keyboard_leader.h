@@ -0,0 +1,16 @@
+#ifndef KEYBOARD_LEADER_H_
+#define KEYBOARD_LEADER_H_
+
+#include "hal.h"
+
+#include "keyboard.h"
+
+void leader_init(void);
+
+bool leader_key_event(uint16_t key_id);
+
+// Each scan, before the macro step: sends the output of a sequence that
+// ended while a macro played once it is over
+void leader_step(void);
+
+#endif /* KEYBOARD_LEADER_H_ */
@@ -0,0 +1,224 @@
+#include "keyboard_macro.h"
+#include "keymap.h"
+#include "timer_wheel.h"
+
+#include <string.h>
+
+#define MACRO_ASCII_SHIFT 0x80
+
+#define MACRO_KEY_ARG(pc) ((pc)[1] | ((pc)[2] << 8))
+
+// US layout usage of each ASCII character, with MACRO_ASCII_SHIFT set when
+// it is typed with Left Shift. Characters without a key are 0 and skipped.
+static const uint8_t ASCII_USAGES[128] = {
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x2a, 0x2b, 0x28, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x29, 0x00, 0x00, 0x00, 0x00,
+	0x2c, 0x9e, 0xb4, 0xa0, 0xa1, 0xa2, 0xa4, 0x34, 0xa6, 0xa7, 0xa5, 0xae, 0x36, 0x2d, 0x37, 0x38,
+	0x27, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0xb3, 0x33, 0xb6, 0x2e, 0xb7, 0xb8,
+	0x9f, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x8b, 0x8c, 0x8d, 0x8e, 0x8f, 0x90, 0x91, 0x92,
+	0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0x9b, 0x9c, 0x9d, 0x2f, 0x31, 0x30, 0xa3, 0xad,
+	0x35, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10, 0x11, 0x12,
+	0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0xaf, 0xb1, 0xb0, 0xb5, 0x00
+};
+
+// Next instruction of the macro being played, NULL when idle
+static const uint8_t* g_macroPc = NULL;
+static bool g_inString = false;
+static bool g_delaying = false;
+
+// Key pressed by a tap or a string character, released at the next state
+static uint16_t g_releaseKey = 0;
+
+// Key tapped once the program ends
+static uint16_t g_lastKey = 0;
+
+static uint16_t g_macroKeys[MACRO_MAX_KEYS];
+static uint8_t g_numMacroKeys = 0;
+
+static void macro_delay_callback(void);
+
+void macro_init(void)
+{
+	macro_stop();
+	timer_wheel_register_callback(TIMER_MACRO, macro_delay_callback);
+}
+
+static void add_key(uint16_t key_id)
+{
+	if (g_numMacroKeys < MACRO_MAX_KEYS)
+	{
+		g_macroKeys[g_numMacroKeys++] = key_id;
+	}
+}
+
+static void remove_key(uint16_t key_id)
+{
+	for (unsigned i = 0; i < g_numMacroKeys; i++)
+	{
+		if (g_macroKeys[i] == key_id)
+		{
+			g_macroKeys[i] = g_macroKeys[--g_numMacroKeys];
+			return;
+		}
+	}
+}
+
+// Runs the macro up to its next key state. Returns false when it stops or
+// waits for a delay instead.
+static bool next_state(void)
+{
+	if (g_releaseKey != 0)
+	{
+		remove_key(g_releaseKey);
+		g_releaseKey = 0;
+		return true;
+	}
+
+	while (g_inString)
+	{
+		const uint8_t c = *g_macroPc++;
+		if (c == 0)
+		{
+			g_inString = false;
+			break;
+		}
+
+		const uint8_t usage = ASCII_USAGES[c & 0x7F];
+		if ((usage & ~MACRO_ASCII_SHIFT) != 0)
+		{
+			g_releaseKey = (usage & MACRO_ASCII_SHIFT ? 0x0200 : 0) | (usage & ~MACRO_ASCII_SHIFT);
+			add_key(g_releaseKey);
+			return true;
+		}
+	}
+
+	switch (g_macroPc[0])
+	{
+		case MACRO_OP_PRESS:
+		{
+			const uint16_t key_id = MACRO_KEY_ARG(g_macroPc);
+			g_macroPc += 3;
+			add_key(key_id);
+			return true;
+		}
+		case MACRO_OP_RELEASE:
+		{
+			const uint16_t key_id = MACRO_KEY_ARG(g_macroPc);
+			g_macroPc += 3;
+			remove_key(key_id);
+			return true;
+		}
+		case MACRO_OP_TAP:
+		{
+			const uint16_t key_id = MACRO_KEY_ARG(g_macroPc);
+			g_macroPc += 3;
+			add_key(key_id);
+			g_releaseKey = key_id;
+			return true;
+		}
+		case MACRO_OP_DELAY:
+			timer_wheel_schedule(TIMER_MACRO, g_macroPc[1]);
+			g_macroPc += 2;
+			g_delaying = true;
+			return false;
+		case MACRO_OP_STRING:
+			g_macroPc += 1;
+			g_inString = true;
+			return next_state();
+		default:
+		{
+			if (g_lastKey != 0)
+			{
+				// The program stays at its end for the next state
+				add_key(g_lastKey);
+				g_releaseKey = g_lastKey;
+				g_lastKey = 0;
+				return true;
+			}
+
+			// End of the macro, keys left pressed are released
+			const bool had_keys = g_numMacroKeys > 0;
+			g_macroPc = NULL;
+			g_numMacroKeys = 0;
+			return had_keys;
+		}
+	}
+}
+
+bool macro_begin(uint16_t key_id)
+{
+	if ((key_id & 0xff00) != KEY_META(KEY_META_MACRO, 0))
+	{
+		return false;
+	}
+
+	const uint8_t* program = keymap_get_macro(key_id & 0xFF);
+	if (program != NULL)
+	{
+		macro_play(program);
+	}
+
+	return true;
+}
+
+bool macro_play(const uint8_t* program)
+{
+	return macro_play_then_tap(program, 0);
+}
+
+bool macro_play_then_tap(const uint8_t* program, uint16_t key_id)
+{
+	// Starting a macro while another one plays does nothing
+	if (g_macroPc != NULL)
+	{
+		return false;
+	}
+
+	g_macroPc = program;
+	g_inString = false;
+	g_delaying = false;
+	g_releaseKey = 0;
+	g_lastKey = key_id;
+	g_numMacroKeys = 0;
+	return true;
+}
+
+bool macro_is_playing(void)
+{
+	return g_macroPc != NULL;
+}
+
+void macro_stop(void)
+{
+	timer_wheel_cancel(TIMER_MACRO);
+	g_macroPc = NULL;
+	g_inString = false;
+	g_delaying = false;
+	g_releaseKey = 0;
+	g_lastKey = 0;
+	g_numMacroKeys = 0;
+}
+
+void macro_step(void)
+{
+	// Each state is handed to the HID interface once the previous one has
+	// left it, so that the host sees every state, at most one per poll
+	while (g_macroPc != NULL && !g_delaying && !hal_hid_kbd_is_report_pending())
+	{
+		if (next_state())
+		{
+			keyboard_send_reports();
+		}
+	}
+}
+
+const uint16_t* macro_get_keys(uint8_t* num_keys)
+{
+	*num_keys = g_numMacroKeys;
+	return g_macroKeys;
+}
+
+static void macro_delay_callback(void)
+{
+	g_delaying = false;
+}
@@ -0,0 +1,25 @@
+#ifndef KEYBOARD_MACRO_H_
+#define KEYBOARD_MACRO_H_
+
+#include "hal.h"
+
+#include "keyboard.h"
+
+// Keys a macro can hold down at the same time
+#define MACRO_MAX_KEYS 6
+
+void macro_init(void);
+
+bool macro_begin(uint16_t key_id);
+// The program must stay valid until the macro ends. key_id, if not 0, is
+// tapped after it.
+bool macro_play(const uint8_t* program);
+bool macro_play_then_tap(const uint8_t* program, uint16_t key_id);
+bool macro_is_playing(void);
+void macro_stop(void);
+
+void macro_step(void);
+
+const uint16_t* macro_get_keys(uint8_t* num_keys);
+
+#endif /* KEYBOARD_MACRO_H_ */
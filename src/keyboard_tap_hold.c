@@ -0,0 +1,207 @@
+#include "keyboard_tap_hold.h"
+#include "keymap.h"
+#include "timer_wheel.h"
+
+#include <string.h>
+
+#define TAP_HOLD_NONE       0xFF
+#define TAP_HOLD_EVENT_PRESS 0x80
+
+#define TAP_HOLD_TERM_TICKS ((TAP_HOLD_TERM_MS + KBD_SCAN_PERIOD_MS - 1) / KBD_SCAN_PERIOD_MS)
+
+// Tap-hold key waiting for a decision, and its keymap entry
+static uint8_t g_pendingKey = TAP_HOLD_NONE;
+static struct tap_hold_key g_pendingKeyDef;
+
+// Events received since the pending key was pressed (key | TAP_HOLD_EVENT_PRESS)
+static uint8_t g_eventBuffer[TAP_HOLD_BUFFER_LEN];
+static uint8_t g_numEvents = 0;
+
+// Keys whose tap was reported, released at the next scan
+static matrix_row_t g_tapKeys[NUM_ROWS];
+
+static void tap_hold_timeout_callback(void);
+
+void tap_hold_init(void)
+{
+	g_pendingKey = TAP_HOLD_NONE;
+	g_numEvents = 0;
+	memset(g_tapKeys, 0, sizeof(g_tapKeys));
+
+	timer_wheel_register_callback(TIMER_TAP_HOLD, tap_hold_timeout_callback);
+}
+
+static void replay_events(void)
+{
+	// Replayed events may start another tap-hold key, which buffers the
+	// events after it again
+	uint8_t events[TAP_HOLD_BUFFER_LEN];
+	const uint8_t num_events = g_numEvents;
+	memcpy(events, g_eventBuffer, num_events);
+	g_numEvents = 0;
+
+	matrix_row_t pressed_keys[NUM_ROWS];
+	memset(pressed_keys, 0, sizeof(pressed_keys));
+	for (unsigned i = 0; i < num_events; i++)
+	{
+		const uint8_t key = events[i] & ~TAP_HOLD_EVENT_PRESS;
+		const bool pressed = (events[i] & TAP_HOLD_EVENT_PRESS) != 0;
+		const matrix_row_t col_bit = 1 << KEY_INDEX_COL(key);
+
+		// A key pressed and released within the buffer is released at the
+		// next scan like a tap, so that a report holds it
+		if (!pressed && g_pendingKey == TAP_HOLD_NONE && (pressed_keys[KEY_INDEX_ROW(key)] & col_bit))
+		{
+			g_tapKeys[KEY_INDEX_ROW(key)] |= col_bit;
+			continue;
+		}
+		if (pressed)
+		{
+			pressed_keys[KEY_INDEX_ROW(key)] |= col_bit;
+		}
+		keyboard_key_event(key, pressed);
+	}
+}
+
+static void decide_hold(void)
+{
+	const uint8_t key = g_pendingKey;
+
+	g_pendingKey = TAP_HOLD_NONE;
+	timer_wheel_cancel(TIMER_TAP_HOLD);
+
+	// The hold key may be a layer key, so it is registered before the
+	// buffered keys are resolved
+	keyboard_register_key(key, g_pendingKeyDef.hold);
+	replay_events();
+}
+
+static void decide_tap(void)
+{
+	const uint8_t key = g_pendingKey;
+
+	g_pendingKey = TAP_HOLD_NONE;
+	timer_wheel_cancel(TIMER_TAP_HOLD);
+
+	keyboard_register_key(key, g_pendingKeyDef.tap);
+	g_tapKeys[KEY_INDEX_ROW(key)] |= 1 << KEY_INDEX_COL(key);
+
+	if (g_numEvents > 0)
+	{
+		// Report the tap before the keys pressed after it
+		keyboard_send_reports();
+		replay_events();
+	}
+}
+
+static void tap_hold_timeout_callback(void)
+{
+	if (g_pendingKey != TAP_HOLD_NONE)
+	{
+		decide_hold();
+	}
+}
+
+bool tap_hold_begin(uint8_t key, uint16_t key_id)
+{
+	if ((key_id & 0xff00) != KEY_META(KEY_META_TAP_HOLD, 0))
+	{
+		return false;
+	}
+
+	struct tap_hold_key key_def;
+	if (!keymap_get_tap_hold_key(key_id & 0xFF, &key_def))
+	{
+		return false;
+	}
+
+	// Pressed again before its previous tap was released
+	const matrix_row_t col_bit = 1 << KEY_INDEX_COL(key);
+	if (g_tapKeys[KEY_INDEX_ROW(key)] & col_bit)
+	{
+		g_tapKeys[KEY_INDEX_ROW(key)] &= ~col_bit;
+		keyboard_unregister_key(key);
+	}
+
+	g_pendingKey = key;
+	g_pendingKeyDef = key_def;
+	g_numEvents = 0;
+	timer_wheel_schedule(TIMER_TAP_HOLD, TAP_HOLD_TERM_TICKS);
+
+	return true;
+}
+
+bool tap_hold_buffer_event(uint8_t key, bool pressed)
+{
+	if (g_pendingKey == TAP_HOLD_NONE)
+	{
+		return false;
+	}
+
+	if (key == g_pendingKey)
+	{
+		// Released within the term (the key can't be pressed again while pending)
+		decide_tap();
+		return true;
+	}
+
+	if (g_numEvents == TAP_HOLD_BUFFER_LEN)
+	{
+		// The buffer is replayed first to keep the events in order. A
+		// tap-hold key among them buffers the events after it, this one
+		// included, in fewer than TAP_HOLD_BUFFER_LEN entries.
+		decide_hold();
+		return tap_hold_buffer_event(key, pressed);
+	}
+
+	const uint8_t event = key | (pressed ? TAP_HOLD_EVENT_PRESS : 0);
+	g_eventBuffer[g_numEvents++] = event;
+
+	switch (g_pendingKeyDef.policy)
+	{
+		case TAP_HOLD_POLICY_HOLD_ON_OTHER_KEY_PRESS:
+			if (pressed)
+			{
+				decide_hold();
+			}
+			break;
+		case TAP_HOLD_POLICY_PERMISSIVE_HOLD:
+			// Hold when a key pressed after the tap-hold key is released
+			if (!pressed)
+			{
+				for (unsigned i = 0; i + 1 < g_numEvents; i++)
+				{
+					if (g_eventBuffer[i] == (key | TAP_HOLD_EVENT_PRESS))
+					{
+						decide_hold();
+						break;
+					}
+				}
+			}
+			break;
+		default:
+			break;
+	}
+
+	return true;
+}
+
+void tap_hold_scan(void)
+{
+	for (unsigned r = 0; r < NUM_ROWS; r++)
+	{
+		if (g_tapKeys[r] == 0)
+		{
+			continue;
+		}
+
+		for (unsigned c = 0; c < NUM_COLS; c++)
+		{
+			if (g_tapKeys[r] & (1 << c))
+			{
+				keyboard_unregister_key(KEY_INDEX(r, c));
+			}
+		}
+		g_tapKeys[r] = 0;
+	}
+}
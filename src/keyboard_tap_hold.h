@@ -0,0 +1,19 @@
+#ifndef KEYBOARD_TAP_HOLD_H_
+#define KEYBOARD_TAP_HOLD_H_
+
+#include "hal.h"
+
+#include "keyboard.h"
+
+// Events of other keys held back while a tap-hold key is pending. The key is
+// decided as hold when the buffer would overflow.
+#define TAP_HOLD_BUFFER_LEN 8
+
+void tap_hold_init(void);
+
+bool tap_hold_begin(uint8_t key, uint16_t key_id);
+bool tap_hold_buffer_event(uint8_t key, bool pressed);
+
+void tap_hold_scan(void);
+
+#endif /* KEYBOARD_TAP_HOLD_H_ */
@@ -0,0 +1,252 @@
+#include "keyboard_vendor.h"
+#include "key_stats.h"
+#include "keymap.h"
+#include "keymap_store.h"
+#include "profile.h"
+#include "settings.h"
+#include "stack_monitor.h"
+#include "trace.h"
+
+#include <string.h>
+
+#define READ_U16(p) ((uint16_t)((p)[0] | ((p)[1] << 8)))
+
+// Counters streamed every g_streamPeriod scans when non-zero
+static uint16_t g_streamPeriod = 0;
+static uint32_t g_lastStream = 0;
+
+static inline void write_u16(uint8_t* p, uint16_t value)
+{
+	p[0] = value;
+	p[1] = value >> 8;
+}
+
+static inline void write_u32(uint8_t* p, uint32_t value)
+{
+	write_u16(p, value);
+	write_u16(p + 2, value >> 16);
+}
+
+static void write_counters(uint8_t* p)
+{
+	struct kbd_counters counters;
+	struct kbd_led_latency latency;
+	get_counters(&counters);
+	get_led_latency(&latency);
+
+	write_u32(p, counters.scans);
+	write_u32(p + 4, counters.key_events);
+	write_u32(p + 8, counters.keyboard_reports);
+	write_u16(p + 12, latency.report_frame);
+	write_u16(p + 14, latency.board_frame);
+	write_u16(p + 16, latency.peripheral_frame);
+}
+
+static bool handle_request(const uint8_t* request, uint8_t* response)
+{
+	switch (request[0])
+	{
+	case VENDOR_CMD_INFO:
+		response[2] = VENDOR_PROTOCOL_VERSION;
+		response[3] = NUM_SETTINGS;
+		response[4] = NUM_ROWS;
+		response[5] = NUM_COLS;
+		response[6] = NUM_LAYERS;
+		return true;
+
+	case VENDOR_CMD_SETTING_GET:
+		if (request[1] >= NUM_SETTINGS)
+		{
+			return false;
+		}
+		write_u32(response + 2, settings_get(request[1]));
+		return true;
+
+	case VENDOR_CMD_SETTING_SET:
+		if (!settings_set(request[1], READ_U16(request + 2) | ((uint32_t)READ_U16(request + 4) << 16)))
+		{
+			return false;
+		}
+		keyboard_apply_settings();
+		return true;
+
+	case VENDOR_CMD_COUNTERS:
+		write_counters(response + 2);
+		return true;
+
+	case VENDOR_CMD_COUNTERS_STREAM:
+		g_streamPeriod = READ_U16(request + 1);
+		g_lastStream = keyboard_get_scan_count();
+		return true;
+
+#ifdef KBD_PROFILE
+	case VENDOR_CMD_PROFILE:
+	{
+		if (request[1] >= NUM_PROFILE_INTERVALS)
+		{
+			return false;
+		}
+
+		struct profile_histogram histogram;
+		profile_get_histogram(request[1], &histogram);
+		response[2] = NUM_PROFILE_INTERVALS;
+		response[3] = PROFILE_NUM_BUCKETS;
+		write_u32(response + 4, histogram.max);
+		write_u32(response + 8, histogram.sum);
+		for (unsigned i = 0; i < PROFILE_NUM_BUCKETS; i++)
+		{
+			write_u16(response + 12 + 2 * i, histogram.buckets[i]);
+		}
+		return true;
+	}
+
+	case VENDOR_CMD_PROFILE_RESET:
+		profile_reset();
+		return true;
+#endif
+
+#ifdef KBD_TRACE
+	case VENDOR_CMD_TRACE_READ:
+	{
+		struct trace_record records[VENDOR_TRACE_RECORDS];
+		const unsigned count = trace_read(request[1], records, VENDOR_TRACE_RECORDS);
+		response[2] = TRACE_CAPACITY;
+		response[3] = trace_count();
+		response[4] = count;
+		for (unsigned i = 0; i < count; i++)
+		{
+			uint8_t* p = response + 6 + 4 * i;
+			write_u16(p, records[i].delta);
+			p[2] = records[i].event;
+			p[3] = records[i].payload;
+		}
+		return true;
+	}
+
+	case VENDOR_CMD_TRACE_RESUME:
+		trace_resume(request[1] != 0);
+		return true;
+#endif
+
+	case VENDOR_CMD_STACK:
+		write_u16(response + 2, stack_size());
+		write_u16(response + 4, stack_peak());
+		write_u16(response + 6, stack_static_ram());
+		response[8] = NUM_STACK_ISRS;
+		for (unsigned i = 0; i < NUM_STACK_ISRS; i++)
+		{
+			write_u16(response + 9 + 2 * i, stack_isr_depth(i));
+		}
+		return true;
+
+	case VENDOR_CMD_KEY_STATS:
+	{
+		if (request[1] >= NUM_KEYS)
+		{
+			return false;
+		}
+
+		const unsigned count = min(NUM_KEYS - request[1], VENDOR_KEY_STATS_KEYS);
+		response[2] = NUM_KEYS;
+		response[3] = count;
+		write_u32(response + 4, key_stats_get_sequence());
+		for (unsigned i = 0; i < count; i++)
+		{
+			struct key_stats stats;
+			key_stats_get(request[1] + i, &stats);
+			write_u32(response + 8 + 6 * i, stats.presses);
+			write_u16(response + 12 + 6 * i, stats.chatter);
+		}
+		return true;
+	}
+
+	case VENDOR_CMD_KEY_STATS_RESET:
+		return key_stats_reset();
+
+	case VENDOR_CMD_KEYMAP_BEGIN:
+		return keymap_store_begin(READ_U16(request + 1));
+
+	case VENDOR_CMD_KEYMAP_DATA:
+		if (request[3] > VENDOR_KEYMAP_CHUNK_SIZE)
+		{
+			return false;
+		}
+		return keymap_store_write(READ_U16(request + 1), request + 4, request[3]);
+
+	case VENDOR_CMD_KEYMAP_COMMIT:
+		return keymap_store_commit();
+
+	case VENDOR_CMD_KEYMAP_STATUS:
+	{
+		uint16_t length;
+		const uint8_t* blob = keymap_get_blob(&length);
+		response[2] = keymap_store_get_status();
+		write_u32(response + 3, keymap_store_get_sequence());
+		write_u16(response + 7, length);
+		write_u32(response + 9, keymap_crc32(blob, length));
+		return true;
+	}
+
+	case VENDOR_CMD_KEYMAP_RESET:
+		return keymap_store_reset();
+
+	default:
+		response[1] = VENDOR_STATUS_UNKNOWN;
+		return false;
+	}
+}
+
+static void stream_counters(void)
+{
+	const uint32_t scan = keyboard_get_scan_count();
+	if (g_streamPeriod == 0 || scan - g_lastStream < g_streamPeriod)
+	{
+		return;
+	}
+
+	uint8_t* event = udi_hid_vendor_get_send_buffer();
+	memset(event, 0, UDI_HID_VENDOR_REPORT_SIZE);
+	event[0] = VENDOR_EVENT_COUNTERS;
+	event[1] = VENDOR_STATUS_OK;
+	write_counters(event + 2);
+	if (udi_hid_vendor_send())
+	{
+		g_lastStream = scan;
+	}
+}
+
+void vendor_task(void)
+{
+	// Requests and responses are handled in the endpoint buffers. The next
+	// request stays in its endpoint until the last response is sent, and a
+	// keymap chunk until the store can take it.
+	if (!udi_hid_vendor_is_send_ready())
+	{
+		return;
+	}
+
+	const uint8_t* request = udi_hid_vendor_get_received();
+	if (request == NULL)
+	{
+		stream_counters();
+		return;
+	}
+
+	if (request[0] == VENDOR_CMD_KEYMAP_DATA && !keymap_store_is_write_ready())
+	{
+		return;
+	}
+
+	TRACE(TRACE_VENDOR, request[0]);
+	uint8_t* response = udi_hid_vendor_get_send_buffer();
+	memset(response, 0, UDI_HID_VENDOR_REPORT_SIZE);
+	response[0] = request[0];
+	response[1] = VENDOR_STATUS_ERROR;
+	if (handle_request(request, response))
+	{
+		response[1] = VENDOR_STATUS_OK;
+	}
+
+	udi_hid_vendor_release_received();
+	udi_hid_vendor_send();
+}
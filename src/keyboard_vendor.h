@@ -0,0 +1,55 @@
+#ifndef KEYBOARD_VENDOR_H_
+#define KEYBOARD_VENDOR_H_
+
+#include <asf.h>
+
+#include "keymap_store.h"
+#include "udi_hid_vendor.h"
+
+// Requests on the vendor HID interface are 64-byte reports starting with a
+// command byte. Each one is answered by a report echoing the command,
+// followed by a status byte and the command's data. Multi-byte fields are
+// little endian. tools/kbdctl.py implements the host side.
+#define VENDOR_PROTOCOL_VERSION 1
+
+#define VENDOR_CMD_INFO            0x01    // -> u8 protocol version, u8 settings, u8 rows, u8 cols, u8 layers
+#define VENDOR_CMD_SETTING_GET     0x02    // u8 id -> u32 value
+#define VENDOR_CMD_SETTING_SET     0x03    // u8 id, u32 value
+#define VENDOR_CMD_COUNTERS        0x04    // -> struct kbd_counters, 3 x u16 LED latency frames
+#define VENDOR_CMD_COUNTERS_STREAM 0x05    // u16 period in scans, 0 stops
+#define VENDOR_CMD_PROFILE         0x06    // u8 interval -> u8 intervals, u8 buckets, u32 max, u32 sum, u16 buckets[]
+#define VENDOR_CMD_PROFILE_RESET   0x07    // Both answered UNKNOWN without KBD_PROFILE
+#define VENDOR_CMD_TRACE_READ      0x08    // u8 first -> u8 capacity, u8 records kept, u8 n, u8 0, n x struct trace_record
+#define VENDOR_CMD_TRACE_RESUME    0x09    // u8 clear; reading pauses the trace. Both UNKNOWN without KBD_TRACE
+#define VENDOR_CMD_STACK           0x0A    // -> u16 stack size, u16 peak, u16 static RAM, u8 n, n x u16 ISR entry depth
+#define VENDOR_CMD_KEY_STATS       0x0B    // u8 first key -> u8 keys, u8 n, u32 sequence, n x (u32 presses, u16 chatter)
+#define VENDOR_CMD_KEY_STATS_RESET 0x0C    // ERROR while a flush is in progress
+
+#define VENDOR_CMD_KEYMAP_BEGIN  0x10    // u16 length
+#define VENDOR_CMD_KEYMAP_DATA   0x11    // u16 offset, u8 length, data
+#define VENDOR_CMD_KEYMAP_COMMIT 0x12
+#define VENDOR_CMD_KEYMAP_STATUS 0x13    // -> u8 store status, u32 sequence, u16 length, u32 CRC
+#define VENDOR_CMD_KEYMAP_RESET  0x14    // Stores the default keymap
+
+// Streamed counters use the VENDOR_CMD_COUNTERS layout under this command
+#define VENDOR_EVENT_COUNTERS    0x84
+
+#define VENDOR_STATUS_OK      0x00
+#define VENDOR_STATUS_ERROR   0x01
+#define VENDOR_STATUS_UNKNOWN 0x02
+
+// Largest chunk of a VENDOR_CMD_KEYMAP_DATA request. Chunks must not cross
+// a flash page, and wait in the endpoint while the store writes the last.
+#define VENDOR_KEYMAP_CHUNK_SIZE KEYMAP_STORE_CHUNK_SIZE
+
+// Most trace records in a VENDOR_CMD_TRACE_READ response
+#define VENDOR_TRACE_RECORDS ((UDI_HID_VENDOR_REPORT_SIZE - 6) / 4)
+
+// Most keys in a VENDOR_CMD_KEY_STATS response
+#define VENDOR_KEY_STATS_KEYS ((UDI_HID_VENDOR_REPORT_SIZE - 8) / 6)
+
+// Main loop. Requests are handled outside interrupts, one at a time, so
+// configuration traffic never delays a scan.
+void vendor_task(void);
+
+#endif /* KEYBOARD_VENDOR_H_ */
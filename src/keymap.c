@@ -0,0 +1,504 @@
+#include "keymap.h"
+#include "keymap_default.h"
+
+#include <string.h>
+
+#define TAP_HOLD_KEY_SIZE 6
+#define COMBO_SIZE        (2 + 2 * NUM_ROWS)
+#define LEADER_NODE_SIZE  10
+
+// Leader nodes without an action
+#define LEADER_NO_ACTION 0xFFFF
+
+// Blobs may sit at any address, so multi-byte fields are read byte by byte
+#define READ_U16(p) ((uint16_t)((p)[0] | ((p)[1] << 8)))
+
+// Sparse tables: a bitmap of the keys with an entry for each row and the
+// index of the first entry of each row locate the entry of a key
+#define SPARSE_ENTRIES(t) ((t) + 2 * NUM_ROWS + ((NUM_ROWS + 1) & ~1))
+
+// The combo masks of the keys follow the combos, when there are any
+#define KEY_COMBOS(k) ((k)->combos + COMBO_SIZE * (k)->num_combos)
+
+// The leader trie is rarely walked, so it is found from the blob rather than
+// described in RAM: its nodes come right before the macro offsets
+#define NUM_LEADER_NODES(k) ((k)->blob[16])
+#define LEADER_NODES(k)     ((k)->macro_offsets - LEADER_NODE_SIZE * NUM_LEADER_NODES(k))
+
+// The active keymap and the staged one; only these descriptions are in RAM
+static struct keymap g_keymaps[2];
+static uint8_t g_activeKeymap = 0;
+static volatile bool g_staged = false;
+
+static const struct keymap* g_keymap = &g_keymaps[0];
+
+void keymap_init(void)
+{
+	memset(g_keymaps, 0, sizeof(g_keymaps));
+	g_activeKeymap = 0;
+	g_keymap = &g_keymaps[0];
+	g_staged = false;
+	keymap_load(KEYMAP_DEFAULT, sizeof(KEYMAP_DEFAULT));
+}
+
+static inline unsigned popcount16(uint16_t x)
+{
+	x = x - ((x >> 1) & 0x5555);
+	x = (x & 0x3333) + ((x >> 2) & 0x3333);
+	x = (x + (x >> 4)) & 0x0f0f;
+	return (x + (x >> 8)) & 0x1f;
+}
+
+// Index of the entry of a key in a sparse table, -1 when it has none
+static inline int sparse_index(const uint8_t* table, unsigned row, unsigned col)
+{
+	const uint16_t bitmap = READ_U16(table + 2 * row);
+	const uint16_t bit = 1 << col;
+	if ((bitmap & bit) == 0)
+	{
+		return -1;
+	}
+	return table[2 * NUM_ROWS + row] + popcount16(bitmap & (bit - 1));
+}
+
+// Number of entries of a sparse table, -1 unless each row starts where the
+// entries of the rows above end
+static int parse_sparse(const uint8_t* table)
+{
+	unsigned num_entries = 0;
+	for (unsigned r = 0; r < NUM_ROWS; r++)
+	{
+		if (table[2 * NUM_ROWS + r] != num_entries)
+		{
+			return -1;
+		}
+		num_entries += popcount16(READ_U16(table + 2 * r));
+	}
+	return num_entries;
+}
+
+uint32_t keymap_crc32(const uint8_t* data, uint16_t length)
+{
+	uint32_t crc = 0xFFFFFFFF;
+	for (uint16_t i = 0; i < length; i++)
+	{
+		crc ^= data[i];
+		for (unsigned b = 0; b < 8; b++)
+		{
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+		}
+	}
+	return ~crc;
+}
+
+// The trie must be walkable without further checks: parents come before
+// their children, children point back to their parent and are sorted by
+// key, at most LEADER_MAX_CHILDREN of them, no sequence is longer than
+// LEADER_MAX_DEPTH and the programs are in the macro code
+static bool parse_leader_nodes(const struct keymap* parsed, uint16_t macro_code_size)
+{
+	const unsigned num_nodes = NUM_LEADER_NODES(parsed);
+	const uint8_t* nodes = LEADER_NODES(parsed);
+	for (unsigned i = 0; i < num_nodes; i++)
+	{
+		const uint8_t* node = nodes + LEADER_NODE_SIZE * i;
+		const uint16_t action = READ_U16(node + 2);
+		const uint8_t parent = node[6];
+		const unsigned first_child = node[7];
+		const unsigned num_children = node[8];
+		if ((action != LEADER_NO_ACTION && action >= macro_code_size)
+			|| READ_U16(node + 4) >= macro_code_size
+			|| (i == 0 ? parent != 0 : parent >= i)
+			|| num_children > LEADER_MAX_CHILDREN
+			|| (num_children != 0 && (first_child <= i || first_child + num_children > num_nodes)))
+		{
+			return false;
+		}
+
+		for (unsigned c = first_child; c < first_child + num_children; c++)
+		{
+			const uint8_t* child = nodes + LEADER_NODE_SIZE * c;
+			if (child[6] != i || (c > first_child && READ_U16(child) <= READ_U16(child - LEADER_NODE_SIZE)))
+			{
+				return false;
+			}
+		}
+	}
+
+	// Parents come first, so every walk up to the root ends
+	for (unsigned i = 1; i < num_nodes; i++)
+	{
+		unsigned depth = 0;
+		for (unsigned node = i; node != 0; node = nodes[LEADER_NODE_SIZE * node + 6])
+		{
+			if (++depth > LEADER_MAX_DEPTH)
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// A combo has 2 to COMBO_MAX_KEYS keys of the matrix, and the combo masks
+// of its keys must hold it: the combo engine only reads these
+static bool parse_combo(const struct keymap* parsed, unsigned index)
+{
+	const uint8_t* rows = parsed->combos + COMBO_SIZE * index + 2;
+	const uint8_t* key_combos = KEY_COMBOS(parsed);
+	unsigned num_keys = 0;
+	for (unsigned r = 0; r < NUM_ROWS; r++)
+	{
+		const uint16_t row = READ_U16(rows + 2 * r);
+		if (row >> NUM_COLS)
+		{
+			return false;
+		}
+		for (unsigned c = 0; c < NUM_COLS; c++)
+		{
+			const int entry = sparse_index(key_combos, r, c);
+			if ((row & (1 << c)) != 0
+				&& (entry < 0 || (SPARSE_ENTRIES(key_combos)[entry] & (1 << index)) == 0))
+			{
+				return false;
+			}
+		}
+		num_keys += popcount16(row);
+	}
+	return num_keys >= 2 && num_keys <= COMBO_MAX_KEYS;
+}
+
+// Every combo in the mask of a key holds it
+static bool parse_key_combos(const struct keymap* parsed)
+{
+	const uint8_t* key_combos = KEY_COMBOS(parsed);
+	for (unsigned r = 0; r < NUM_ROWS; r++)
+	{
+		const uint16_t bitmap = READ_U16(key_combos + 2 * r);
+		for (unsigned c = 0; c < NUM_COLS; c++)
+		{
+			const int entry = sparse_index(key_combos, r, c);
+			const uint8_t mask = entry >= 0 ? SPARSE_ENTRIES(key_combos)[entry] : 0;
+			if ((bitmap & (1 << c)) != 0 && (mask == 0 || (mask >> parsed->num_combos) != 0))
+			{
+				return false;
+			}
+			for (unsigned i = 0; i < parsed->num_combos; i++)
+			{
+				if ((mask & (1 << i)) != 0
+					&& (READ_U16(parsed->combos + COMBO_SIZE * i + 2 + 2 * r) & (1 << c)) == 0)
+				{
+					return false;
+				}
+			}
+		}
+		if (bitmap >> NUM_COLS)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool keymap_parse(const uint8_t* blob, uint16_t length, struct keymap* keymap)
+{
+	if (length < KEYMAP_HEADER_SIZE + 4)
+	{
+		return false;
+	}
+
+	const uint32_t magic = READ_U16(blob) | ((uint32_t)READ_U16(blob + 2) << 16);
+	const uint8_t num_layers = blob[5];
+	if (magic != KEYMAP_MAGIC || blob[4] != KEYMAP_VERSION
+		|| num_layers == 0 || num_layers > NUM_LAYERS
+		|| blob[6] != NUM_ROWS || blob[7] != NUM_COLS
+		|| READ_U16(blob + 8) != length)
+	{
+		return false;
+	}
+
+	const uint8_t* crc = blob + length - 4;
+	if (keymap_crc32(blob, length - 4) != (READ_U16(crc) | ((uint32_t)READ_U16(crc + 2) << 16)))
+	{
+		return false;
+	}
+
+	struct keymap parsed;
+	memset(&parsed, 0, sizeof(parsed));
+	parsed.blob = blob;
+	parsed.length = length;
+	parsed.num_consumer_usages = blob[10];
+	parsed.num_tap_hold_keys = blob[11];
+	parsed.num_combos = blob[12];
+	parsed.num_macros = blob[13];
+	const uint16_t macro_code_size = READ_U16(blob + 14);
+
+	// Sections follow each other, the CRC bounds the last one. Every offset
+	// is checked before anything at it is read.
+	const uint32_t end = length - 4u;
+	uint32_t pos = KEYMAP_HEADER_SIZE + 2u * num_layers;
+	for (unsigned l = 0; l < num_layers; l++)
+	{
+		const uint8_t* layer = blob + pos;
+		if (READ_U16(blob + KEYMAP_HEADER_SIZE + 2 * l) != pos || pos + 3u * NUM_ROWS > end)
+		{
+			return false;
+		}
+
+		const int num_keys = parse_sparse(layer);
+		if (num_keys < 0)
+		{
+			return false;
+		}
+
+		pos += SPARSE_ENTRIES(layer) - layer + 2 * num_keys;
+		if (pos > end)
+		{
+			return false;
+		}
+		parsed.layers[l] = layer;
+	}
+
+	parsed.consumer_usages = blob + pos;
+	pos += 2u * parsed.num_consumer_usages;
+	parsed.tap_hold_keys = blob + pos;
+	pos += TAP_HOLD_KEY_SIZE * parsed.num_tap_hold_keys;
+	parsed.combos = blob + pos;
+	pos += COMBO_SIZE * parsed.num_combos;
+	if (parsed.num_combos > 0)
+	{
+		// The row starts are read before the table is bounded
+		const uint8_t* key_combos = blob + pos;
+		const int num_entries = (pos + (SPARSE_ENTRIES(key_combos) - key_combos) <= end)
+			? parse_sparse(key_combos) : -1;
+		if (num_entries < 0)
+		{
+			return false;
+		}
+		pos += ((SPARSE_ENTRIES(key_combos) - key_combos) + num_entries + 1) & ~1u;
+	}
+	pos += LEADER_NODE_SIZE * NUM_LEADER_NODES(&parsed);
+	parsed.macro_offsets = blob + pos;
+	pos += 2u * parsed.num_macros;
+	parsed.macro_code = blob + pos;
+	pos += macro_code_size;
+
+	if (pos != end || parsed.num_combos > 8)
+	{
+		return false;
+	}
+
+	for (unsigned i = 0; i < parsed.num_combos; i++)
+	{
+		if (!parse_combo(&parsed, i))
+		{
+			return false;
+		}
+	}
+	if (parsed.num_combos > 0 && !parse_key_combos(&parsed))
+	{
+		return false;
+	}
+
+	for (unsigned i = 0; i < parsed.num_macros; i++)
+	{
+		if (READ_U16(parsed.macro_offsets + 2 * i) >= macro_code_size)
+		{
+			return false;
+		}
+	}
+
+	if (!parse_leader_nodes(&parsed, macro_code_size))
+	{
+		return false;
+	}
+
+	*keymap = parsed;
+	return true;
+}
+
+bool keymap_load(const uint8_t* blob, uint16_t length)
+{
+	// Boot time only: the scan is not running yet
+	return keymap_stage(blob, length) && keymap_apply_staged();
+}
+
+bool keymap_stage(const uint8_t* blob, uint16_t length)
+{
+	if (g_staged || length > KEYMAP_MAX_SIZE
+		|| !keymap_parse(blob, length, &g_keymaps[g_activeKeymap ^ 1]))
+	{
+		return false;
+	}
+
+	g_staged = true;
+	return true;
+}
+
+bool keymap_is_staged(void)
+{
+	return g_staged;
+}
+
+bool keymap_apply_staged(void)
+{
+	if (!g_staged)
+	{
+		return false;
+	}
+
+	// The only switch between layouts: lookups see either keymap whole
+	g_activeKeymap ^= 1;
+	g_keymap = &g_keymaps[g_activeKeymap];
+	g_staged = false;
+	return true;
+}
+
+const uint8_t* keymap_get_default(uint16_t* length)
+{
+	*length = sizeof(KEYMAP_DEFAULT);
+	return KEYMAP_DEFAULT;
+}
+
+const uint8_t* keymap_get_blob(uint16_t* length)
+{
+	*length = g_keymap->length;
+	return g_keymap->blob;
+}
+
+uint16_t keymap_get_key(unsigned layer, unsigned row, unsigned col)
+{
+	const uint8_t* keys = (layer < NUM_LAYERS) ? g_keymap->layers[layer] : NULL;
+	if (keys == NULL)
+	{
+		return KEY_TRNS;
+	}
+
+	// Only non-empty keys are stored
+	const int index = sparse_index(keys, row, col);
+	if (index < 0)
+	{
+		return KEY_TRNS;
+	}
+	return READ_U16(SPARSE_ENTRIES(keys) + 2 * index);
+}
+
+uint16_t keymap_get_consumer_usage(uint8_t index)
+{
+	if (index >= g_keymap->num_consumer_usages)
+	{
+		return 0;
+	}
+	return READ_U16(g_keymap->consumer_usages + 2 * index);
+}
+
+bool keymap_get_tap_hold_key(uint8_t index, struct tap_hold_key* key)
+{
+	if (index >= g_keymap->num_tap_hold_keys)
+	{
+		return false;
+	}
+
+	const uint8_t* entry = g_keymap->tap_hold_keys + TAP_HOLD_KEY_SIZE * index;
+	key->tap = READ_U16(entry);
+	key->hold = READ_U16(entry + 2);
+	key->policy = entry[4];
+	return true;
+}
+
+uint8_t keymap_num_combos(void)
+{
+	return g_keymap->num_combos;
+}
+
+bool keymap_get_combo(uint8_t index, struct combo* combo)
+{
+	if (index >= g_keymap->num_combos)
+	{
+		return false;
+	}
+
+	const uint8_t* entry = g_keymap->combos + COMBO_SIZE * index;
+	combo->key_id = READ_U16(entry);
+	for (unsigned r = 0; r < NUM_ROWS; r++)
+	{
+		combo->rows[r] = READ_U16(entry + 2 + 2 * r);
+	}
+	return true;
+}
+
+uint8_t keymap_get_key_combos(uint8_t key)
+{
+	if (g_keymap->num_combos == 0 || key >= NUM_KEYS)
+	{
+		return 0;
+	}
+
+	const uint8_t* key_combos = KEY_COMBOS(g_keymap);
+	const int index = sparse_index(key_combos, KEY_INDEX_ROW(key), KEY_INDEX_COL(key));
+	return index >= 0 ? SPARSE_ENTRIES(key_combos)[index] : 0;
+}
+
+uint8_t keymap_num_leader_nodes(void)
+{
+	return NUM_LEADER_NODES(g_keymap);
+}
+
+bool keymap_get_leader_node(uint8_t index, struct leader_node* node)
+{
+	if (index >= NUM_LEADER_NODES(g_keymap))
+	{
+		return false;
+	}
+
+	const uint8_t* entry = LEADER_NODES(g_keymap) + LEADER_NODE_SIZE * index;
+	const uint16_t action = READ_U16(entry + 2);
+	node->key_id = READ_U16(entry);
+	node->action = action != LEADER_NO_ACTION ? g_keymap->macro_code + action : NULL;
+	node->typed = g_keymap->macro_code + READ_U16(entry + 4);
+	node->parent = entry[6];
+	node->first_child = entry[7];
+	node->num_children = entry[8];
+	return true;
+}
+
+bool keymap_find_leader_child(uint8_t index, uint16_t key_id, uint8_t* child)
+{
+	if (index >= NUM_LEADER_NODES(g_keymap))
+	{
+		return false;
+	}
+
+	// Binary search of the children, sorted by key
+	const uint8_t* nodes = LEADER_NODES(g_keymap);
+	unsigned low = nodes[LEADER_NODE_SIZE * index + 7];
+	unsigned high = low + nodes[LEADER_NODE_SIZE * index + 8];
+	while (low < high)
+	{
+		const unsigned middle = (low + high) / 2;
+		const uint16_t key = READ_U16(nodes + LEADER_NODE_SIZE * middle);
+		if (key == key_id)
+		{
+			*child = middle;
+			return true;
+		}
+		if (key < key_id)
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+	return false;
+}
+
+const uint8_t* keymap_get_macro(uint8_t index)
+{
+	if (index >= g_keymap->num_macros)
+	{
+		return NULL;
+	}
+	return g_keymap->macro_code + READ_U16(g_keymap->macro_offsets + 2 * index);
+}
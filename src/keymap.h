@@ -0,0 +1,66 @@
+#ifndef KEYMAP_H_
+#define KEYMAP_H_
+
+#include "hal.h"
+
+#include "keyboard.h"
+
+// Keymap blobs are written by tools/keymap_compiler.py, which documents the
+// format. All the lookups below are constant time.
+#define KEYMAP_MAGIC       0x50414D4B    // "KMAP"
+#define KEYMAP_VERSION     3
+#define KEYMAP_HEADER_SIZE 18
+
+// Blobs fill at most a slot of the keymap store (tools/keymap_compiler.py
+// enforces the same limit)
+#define KEYMAP_MAX_SIZE    448
+
+// Sections of a validated keymap blob. Blobs are read in place, from the
+// built-in default or a keymap store slot in flash.
+struct keymap
+{
+	const uint8_t* blob;
+	uint16_t length;
+	const uint8_t* layers[NUM_LAYERS];
+	const uint8_t* consumer_usages;
+	const uint8_t* tap_hold_keys;
+	const uint8_t* combos;
+	const uint8_t* macro_offsets;
+	const uint8_t* macro_code;
+	uint8_t num_consumer_usages;
+	uint8_t num_tap_hold_keys;
+	uint8_t num_combos;
+	uint8_t num_macros;
+};
+
+void keymap_init(void);
+
+bool keymap_parse(const uint8_t* blob, uint16_t length, struct keymap* keymap);
+bool keymap_load(const uint8_t* blob, uint16_t length);
+
+// Replacing the keymap at runtime: the new blob is validated by keymap_stage
+// and made active by keymap_apply_staged between two scans. It must stay in
+// place, unchanged, while it is staged or active.
+bool keymap_stage(const uint8_t* blob, uint16_t length);
+bool keymap_is_staged(void);
+bool keymap_apply_staged(void);
+
+const uint8_t* keymap_get_blob(uint16_t* length);
+const uint8_t* keymap_get_default(uint16_t* length);
+
+uint16_t keymap_get_key(unsigned layer, unsigned row, unsigned col);
+uint16_t keymap_get_consumer_usage(uint8_t index);
+bool keymap_get_tap_hold_key(uint8_t index, struct tap_hold_key* key);
+uint8_t keymap_num_combos(void);
+bool keymap_get_combo(uint8_t index, struct combo* combo);
+// Mask of the combos a key is part of, bit n for combo n
+uint8_t keymap_get_key_combos(uint8_t key);
+uint8_t keymap_num_leader_nodes(void);
+bool keymap_get_leader_node(uint8_t index, struct leader_node* node);
+// Index of the child of a node for a key, if it has one
+bool keymap_find_leader_child(uint8_t index, uint16_t key_id, uint8_t* child);
+const uint8_t* keymap_get_macro(uint8_t index);
+
+uint32_t keymap_crc32(const uint8_t* data, uint16_t length);
+
+#endif /* KEYMAP_H_ */
@@ -0,0 +1,31 @@
+// Generated by tools/keymap_compiler.py from tools/keymaps/default.json, do not edit
+
+#ifndef KEYMAP_DEFAULT_H_
+#define KEYMAP_DEFAULT_H_
+
+static const uint8_t KEYMAP_DEFAULT[352] __attribute__((aligned(4))) = {
+	0x4b, 0x4d, 0x41, 0x50, 0x03, 0x02, 0x06, 0x0f, 0x60, 0x01, 0x16, 0x00, 0x00, 0x00, 0x10, 0x00,
+	0x03, 0x00, 0x16, 0x00, 0xca, 0x00, 0xff, 0x7f, 0xff, 0x3f, 0xff, 0x5f, 0xff, 0x1f, 0xfd, 0x7f,
+	0x4f, 0x7e, 0x00, 0x0f, 0x1d, 0x2b, 0x38, 0x46, 0x29, 0x00, 0x3a, 0x00, 0x3b, 0x00, 0x3c, 0x00,
+	0x3d, 0x00, 0x3e, 0x00, 0x3f, 0x00, 0x40, 0x00, 0x41, 0x00, 0x42, 0x00, 0x43, 0x00, 0x44, 0x00,
+	0x45, 0x00, 0x49, 0x00, 0x4c, 0x00, 0x35, 0x00, 0x1e, 0x00, 0x1f, 0x00, 0x20, 0x00, 0x21, 0x00,
+	0x22, 0x00, 0x23, 0x00, 0x24, 0x00, 0x25, 0x00, 0x26, 0x00, 0x27, 0x00, 0x2d, 0x00, 0x2e, 0x00,
+	0x2a, 0x00, 0x2b, 0x00, 0x14, 0x00, 0x1a, 0x00, 0x08, 0x00, 0x15, 0x00, 0x17, 0x00, 0x1c, 0x00,
+	0x18, 0x00, 0x0c, 0x00, 0x12, 0x00, 0x13, 0x00, 0x2f, 0x00, 0x30, 0x00, 0x31, 0x00, 0x39, 0x00,
+	0x04, 0x00, 0x16, 0x00, 0x07, 0x00, 0x09, 0x00, 0x0a, 0x00, 0x0b, 0x00, 0x0d, 0x00, 0x0e, 0x00,
+	0x0f, 0x00, 0x33, 0x00, 0x34, 0x00, 0x28, 0x00, 0x00, 0x02, 0x1d, 0x00, 0x1b, 0x00, 0x06, 0x00,
+	0x19, 0x00, 0x05, 0x00, 0x11, 0x00, 0x10, 0x00, 0x36, 0x00, 0x37, 0x00, 0x38, 0x00, 0x4a, 0x00,
+	0x52, 0x00, 0x4d, 0x00, 0x00, 0x01, 0x01, 0xf1, 0x00, 0x04, 0x00, 0x03, 0x2c, 0x00, 0x00, 0x07,
+	0x01, 0xf1, 0x01, 0xf3, 0x50, 0x00, 0x51, 0x00, 0x4f, 0x00, 0xfe, 0x1f, 0x00, 0x00, 0x00, 0x00,
+	0x20, 0x00, 0x00, 0x20, 0x40, 0x78, 0x00, 0x0c, 0x0c, 0x0c, 0x0d, 0x0e, 0x05, 0xc0, 0x07, 0xc0,
+	0x06, 0xc0, 0x01, 0xc0, 0x03, 0xc0, 0x02, 0xc0, 0x04, 0xc0, 0x09, 0xc0, 0x08, 0xc0, 0x0c, 0xc0,
+	0x0e, 0xc0, 0x0f, 0xc0, 0x00, 0xf7, 0x4b, 0x00, 0x00, 0xf6, 0x01, 0xf2, 0x4a, 0x00, 0x4e, 0x00,
+	0x4d, 0x00, 0x00, 0x00, 0xb6, 0x00, 0xb5, 0x00, 0xcd, 0x00, 0xb7, 0x00, 0xe2, 0x00, 0xe9, 0x00,
+	0xea, 0x00, 0x6f, 0x00, 0x70, 0x00, 0x83, 0x01, 0x8a, 0x01, 0x92, 0x01, 0x94, 0x01, 0x96, 0x01,
+	0x9e, 0x01, 0x21, 0x02, 0x23, 0x02, 0x24, 0x02, 0x25, 0x02, 0x27, 0x02, 0x2a, 0x02, 0x00, 0x00,
+	0xff, 0xff, 0x00, 0x00, 0x00, 0x01, 0x01, 0x00, 0x06, 0x00, 0xff, 0xff, 0x01, 0x00, 0x00, 0x02,
+	0x01, 0x00, 0x0f, 0x00, 0x05, 0x00, 0x09, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x03, 0x06, 0x00,
+	0x00, 0x03, 0x0c, 0xc0, 0x00, 0x03, 0x06, 0x00, 0x03, 0x0f, 0x00, 0x00, 0xea, 0x91, 0x1f, 0x05
+};
+
+#endif /* KEYMAP_DEFAULT_H_ */
@@ -0,0 +1,305 @@
+#include "keymap_store.h"
+#include "nvm_flash.h"
+
+#include <string.h>
+
+#ifdef KBD_HOST
+// Emulated in RAM by host/nvm_flash_host.c
+extern uint8_t g_nvmHostKeymaps[];
+#define STORE_START  ((uintptr_t)g_nvmHostKeymaps)
+#define NUM_SLOTS    4
+#else
+// Provided by the linker script
+extern uint8_t _keymap_store_start;
+extern uint8_t _keymap_store_end;
+#define STORE_START  ((uintptr_t)&_keymap_store_start)
+#define NUM_SLOTS    (((uintptr_t)&_keymap_store_end - STORE_START) / KEYMAP_STORE_SLOT_SIZE)
+#endif
+
+#define SLOT_ADDRESS(s) (STORE_START + (s) * KEYMAP_STORE_SLOT_SIZE)
+#define FOOTER_OFFSET (KEYMAP_STORE_SLOT_SIZE - NVM_PAGE_SIZE)
+
+#if KEYMAP_MAX_SIZE > KEYMAP_STORE_SLOT_SIZE - NVM_PAGE_SIZE
+#error "A keymap and its footer must fit a slot"
+#endif
+
+#if NVM_PAGE_SIZE % KEYMAP_STORE_CHUNK_SIZE != 0
+#error "Upload chunks must not cross a flash page"
+#endif
+
+struct keymap_store_footer
+{
+	uint32_t magic;
+	uint32_t sequence;
+	uint16_t length;
+	uint16_t reserved;
+};
+
+enum store_step
+{
+	STEP_ERASE,
+	STEP_WRITE,
+	STEP_FOOTER,
+	STEP_VERIFY
+};
+
+static volatile enum keymap_store_status g_status = KEYMAP_STORE_IDLE;
+static enum store_step g_step;
+
+// Slot and sequence number of the keymap in use
+static uint8_t g_activeSlot = 0;
+static uint32_t g_sequence = 0;
+
+// Upload in progress. Received bytes from g_offset on wait in g_page for
+// their page write; a reset copies the default keymap from g_source instead.
+static uint8_t g_slot;
+static uint16_t g_length = 0;
+static uint16_t g_received = 0;
+static uint16_t g_offset;
+static const uint8_t* g_source;
+static uint8_t g_page[NVM_PAGE_SIZE];
+static bool g_pageFull;
+
+static uint32_t g_lastScan = 0;
+
+static const struct keymap_store_footer* get_footer(uint8_t slot)
+{
+	return (const struct keymap_store_footer*)(SLOT_ADDRESS(slot) + FOOTER_OFFSET);
+}
+
+void keymap_store_init(void)
+{
+	g_status = KEYMAP_STORE_IDLE;
+	g_activeSlot = 0;
+	g_sequence = 0;
+
+	// Use the newest valid slot in place; keymap_init already loaded the
+	// default
+	bool found = false;
+	for (unsigned s = 0; s < NUM_SLOTS; s++)
+	{
+		const struct keymap_store_footer* footer = get_footer(s);
+		if (footer->magic != KEYMAP_STORE_MAGIC || (found && footer->sequence <= g_sequence))
+		{
+			continue;
+		}
+
+		struct keymap parsed;
+		if (footer->length <= KEYMAP_MAX_SIZE
+			&& keymap_parse((const uint8_t*)SLOT_ADDRESS(s), footer->length, &parsed))
+		{
+			found = true;
+			g_activeSlot = s;
+			g_sequence = footer->sequence;
+		}
+	}
+
+	if (found)
+	{
+		keymap_load((const uint8_t*)SLOT_ADDRESS(g_activeSlot), get_footer(g_activeSlot)->length);
+	}
+}
+
+bool keymap_store_begin(uint16_t length)
+{
+	if (g_status == KEYMAP_STORE_BUSY || length > KEYMAP_MAX_SIZE)
+	{
+		return false;
+	}
+
+	// Never the slot of the active keymap, nor of one staged in its place
+	g_slot = (g_activeSlot + 1) % NUM_SLOTS;
+	g_length = length;
+	g_received = 0;
+	g_offset = 0;
+	g_source = NULL;
+	g_pageFull = false;
+	g_step = STEP_ERASE;
+	g_status = KEYMAP_STORE_RECEIVING;
+	return true;
+}
+
+bool keymap_store_is_write_ready(void)
+{
+	return g_status != KEYMAP_STORE_RECEIVING || !g_pageFull;
+}
+
+bool keymap_store_write(uint16_t offset, const uint8_t* data, uint8_t length)
+{
+	// Chunks come in order, so a lost one is detected
+	const unsigned in_page = offset % NVM_PAGE_SIZE;
+	if (g_status != KEYMAP_STORE_RECEIVING || g_pageFull || offset != g_received
+		|| length == 0 || length > g_length - g_received || in_page + length > NVM_PAGE_SIZE)
+	{
+		return false;
+	}
+
+	memcpy(g_page + in_page, data, length);
+	g_received += length;
+	g_pageFull = (g_received % NVM_PAGE_SIZE) == 0 || g_received == g_length;
+	return true;
+}
+
+bool keymap_store_commit(void)
+{
+	if (g_status != KEYMAP_STORE_RECEIVING || g_received != g_length)
+	{
+		return false;
+	}
+
+	// Checked once in flash: a bad keymap never gets a footer
+	g_status = KEYMAP_STORE_BUSY;
+	return true;
+}
+
+bool keymap_store_reset(void)
+{
+	// The default keymap is stored like an upload, so it survives a reboot
+	// as the newest slot
+	uint16_t length;
+	const uint8_t* blob = keymap_get_default(&length);
+	if (!keymap_store_begin(length))
+	{
+		return false;
+	}
+
+	g_source = blob;
+	g_received = length;
+	return keymap_store_commit();
+}
+
+enum keymap_store_status keymap_store_get_status(void)
+{
+	return g_status;
+}
+
+uint32_t keymap_store_get_sequence(void)
+{
+	return g_sequence;
+}
+
+static void store_failed(void)
+{
+	// The keymap in use and its slot are untouched
+	g_status = KEYMAP_STORE_FAILED;
+	nvm_flash_release(NVM_FLASH_KEYMAP_STORE);
+}
+
+void keymap_store_task(void)
+{
+	if (g_status != KEYMAP_STORE_RECEIVING && g_status != KEYMAP_STORE_BUSY)
+	{
+		return;
+	}
+
+	// The CPU stalls on flash fetches while the array is erased or written,
+	// which delays the scan interrupt. Commands are issued just after a scan
+	// so they complete long before the next one.
+	const uint32_t scan = keyboard_get_scan_count();
+	if (scan == g_lastScan || !nvm_flash_is_ready() || !nvm_flash_acquire(NVM_FLASH_KEYMAP_STORE))
+	{
+		return;
+	}
+
+	if (nvm_flash_has_error())
+	{
+		store_failed();
+		return;
+	}
+
+	const uintptr_t slot = SLOT_ADDRESS(g_slot);
+	switch (g_step)
+	{
+	case STEP_ERASE:
+		nvm_flash_erase_row(slot + g_offset);
+		g_offset += NVM_ROW_SIZE;
+		if (g_offset == KEYMAP_STORE_SLOT_SIZE)
+		{
+			g_offset = 0;
+			g_step = STEP_WRITE;
+		}
+		break;
+
+	case STEP_WRITE:
+		if (g_source != NULL)
+		{
+			const uint16_t length = min(g_length - g_offset, NVM_PAGE_SIZE);
+			nvm_flash_write_page(slot + g_offset, g_source + g_offset, length);
+			g_offset += length;
+		}
+		else if (g_pageFull)
+		{
+			nvm_flash_write_page(slot + g_offset, g_page, g_received - g_offset);
+			g_offset = g_received;
+			g_pageFull = false;
+		}
+		else
+		{
+			// The other clients may use the controller while the host is
+			// slow to send the page
+			nvm_flash_release(NVM_FLASH_KEYMAP_STORE);
+			return;
+		}
+
+		if (g_offset == g_length)
+		{
+			g_step = STEP_FOOTER;
+		}
+		break;
+
+	case STEP_FOOTER:
+	{
+		// Once committed, the whole blob is checked where it will be read
+		struct keymap parsed;
+		if (g_status != KEYMAP_STORE_BUSY)
+		{
+			nvm_flash_release(NVM_FLASH_KEYMAP_STORE);
+			return;
+		}
+		if (!keymap_parse((const uint8_t*)slot, g_length, &parsed))
+		{
+			store_failed();
+			return;
+		}
+
+		const struct keymap_store_footer footer = {
+			.magic = KEYMAP_STORE_MAGIC,
+			.sequence = g_sequence + 1,
+			.length = g_length,
+			.reserved = 0xFFFF
+		};
+		nvm_flash_write_page(slot + FOOTER_OFFSET, (const uint8_t*)&footer, sizeof(footer));
+		g_step = STEP_VERIFY;
+		break;
+	}
+
+	case STEP_VERIFY:
+		if (get_footer(g_slot)->magic != KEYMAP_STORE_MAGIC
+			|| get_footer(g_slot)->sequence != g_sequence + 1)
+		{
+			store_failed();
+			return;
+		}
+
+		// A keymap staged earlier is applied by the next scan first; until
+		// then the upload stays busy
+		if (keymap_is_staged())
+		{
+			break;
+		}
+		if (!keymap_stage((const uint8_t*)slot, g_length))
+		{
+			store_failed();
+			return;
+		}
+
+		// Swapped in by the next scan
+		g_activeSlot = g_slot;
+		g_sequence++;
+		g_status = KEYMAP_STORE_DONE;
+		nvm_flash_release(NVM_FLASH_KEYMAP_STORE);
+		break;
+	}
+
+	g_lastScan = scan;
+}
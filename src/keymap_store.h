@@ -0,0 +1,49 @@
+#ifndef KEYMAP_STORE_H_
+#define KEYMAP_STORE_H_
+
+#include "hal.h"
+
+#include "keymap.h"
+
+// The keymaps region of the linker script is split into slots of two rows.
+// Each slot holds a blob followed by a footer in its last page; the footer
+// is written last, so a slot is only valid once completely written. New
+// keymaps go to the slot after the active one to spread the erases, and the
+// active keymap is read in place from its slot.
+#define KEYMAP_STORE_SLOT_SIZE 512
+#define KEYMAP_STORE_MAGIC     0x54534D4B    // "KMST"
+
+// Uploads are written to flash as they arrive, through a single page of RAM.
+// Chunks never cross a page: this size divides the flash page.
+#define KEYMAP_STORE_CHUNK_SIZE 32
+
+enum keymap_store_status
+{
+	KEYMAP_STORE_IDLE,
+	KEYMAP_STORE_RECEIVING,
+	KEYMAP_STORE_BUSY,
+	KEYMAP_STORE_DONE,
+	KEYMAP_STORE_FAILED
+};
+
+void keymap_store_init(void);
+
+// Upload: begin, write the blob in order, then commit. The slot is erased
+// and the blob written while it is received; the commit checks it in flash,
+// writes the footer and swaps it in between scans.
+bool keymap_store_begin(uint16_t length);
+bool keymap_store_write(uint16_t offset, const uint8_t* data, uint8_t length);
+bool keymap_store_commit(void);
+bool keymap_store_reset(void);
+
+// False while the next chunk of an upload must wait for the flash; it is
+// refused until then
+bool keymap_store_is_write_ready(void);
+
+enum keymap_store_status keymap_store_get_status(void);
+uint32_t keymap_store_get_sequence(void);
+
+// Main loop. Issues at most one flash command per scan, right after it.
+void keymap_store_task(void);
+
+#endif /* KEYMAP_STORE_H_ */
@@ -1,28 +1,50 @@
 #include <asf.h>
 
+#include "key_stats.h"
 #include "keyboard.h"
 #include "keyboard_i2c.h"
+#include "keyboard_vendor.h"
+#include "keymap_store.h"
+#include "nvm_flash.h"
+#include "settings.h"
+#include "stack_monitor.h"
+#include "timebase.h"
+#include "trace.h"
 
 int main (void)
 {
+	stack_paint();
 	system_init();
+	timebase_init();
+#ifdef KBD_TRACE
+	trace_init();
+#endif
 	
 	delay_init();
 	
 	delay_ms(500);
 	
 	configure_pins();
+	nvm_flash_init();
+	settings_init();
+	configure_keymap();
+	keymap_store_init();
+	key_stats_init();
 	configure_adc();
+	configure_dac();
 	system_interrupt_enable_global();
 	configure_usb_hid();
 
 	configure_i2c();
 	
 	configure_tc();
-	configure_dac();
 	
 	while (1)
 	{
+		vendor_task();
+		keymap_store_task();
+		settings_task();
+		key_stats_task();
 		// sleepmgr_enter_sleep();
 	}
 }
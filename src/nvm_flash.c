@@ -0,0 +1,124 @@
+#include "nvm_flash.h"
+#include "stack_monitor.h"
+
+static nvm_flash_callback_t g_readyCallback = NULL;
+static volatile uint8_t g_owner = NVM_FLASH_FREE;
+
+static inline bool is_rwwee(uintptr_t address)
+{
+	return address >= NVM_RWWEE_START && address < NVM_RWWEE_START + NVM_RWWEE_SIZE;
+}
+
+static inline void issue_command(uint32_t command, uintptr_t address)
+{
+	NVMCTRL->STATUS.reg = NVMCTRL_STATUS_MASK;
+	// ADDR is in 16-bit words
+	NVMCTRL->ADDR.reg = address / 2;
+	NVMCTRL->CTRLA.reg = command | NVMCTRL_CTRLA_CMDEX_KEY;
+}
+
+void nvm_flash_init(void)
+{
+	// Pages are only written by an explicit command, once complete
+	NVMCTRL->CTRLB.reg |= NVMCTRL_CTRLB_MANW;
+
+	NVMCTRL->INTENCLR.reg = NVMCTRL_INTENCLR_READY | NVMCTRL_INTENCLR_ERROR;
+	system_interrupt_enable(SYSTEM_INTERRUPT_MODULE_NVMCTRL);
+}
+
+void nvm_flash_register_ready_callback(nvm_flash_callback_t callback)
+{
+	g_readyCallback = callback;
+}
+
+void nvm_flash_enable_ready_interrupt(void)
+{
+	// READY is a level, not an event: the interrupt stays enabled only until
+	// it fires once
+	NVMCTRL->INTENSET.reg = NVMCTRL_INTENSET_READY;
+}
+
+void NVMCTRL_Handler(void)
+{
+	stack_sample(STACK_ISR_NVM);
+	NVMCTRL->INTENCLR.reg = NVMCTRL_INTENCLR_READY;
+	if (g_readyCallback != NULL)
+	{
+		g_readyCallback();
+	}
+}
+
+bool nvm_flash_is_ready(void)
+{
+	return NVMCTRL->INTFLAG.reg & NVMCTRL_INTFLAG_READY;
+}
+
+bool nvm_flash_has_error(void)
+{
+	return (NVMCTRL->STATUS.reg & (NVMCTRL_STATUS_NVME | NVMCTRL_STATUS_LOCKE | NVMCTRL_STATUS_PROGE)) != 0;
+}
+
+bool nvm_flash_acquire(enum nvm_flash_owner owner)
+{
+	if (g_owner == owner)
+	{
+		return true;
+	}
+	if (g_owner != NVM_FLASH_FREE)
+	{
+		return false;
+	}
+
+	NVMCTRL->STATUS.reg = NVMCTRL_STATUS_MASK;
+	g_owner = owner;
+	return true;
+}
+
+void nvm_flash_release(enum nvm_flash_owner owner)
+{
+	if (g_owner == owner)
+	{
+		g_owner = NVM_FLASH_FREE;
+	}
+}
+
+bool nvm_flash_erase_row(uintptr_t address)
+{
+	if (!nvm_flash_is_ready())
+	{
+		return false;
+	}
+
+	issue_command(is_rwwee(address) ? NVMCTRL_CTRLA_CMD_RWWEEER : NVMCTRL_CTRLA_CMD_ER,
+		address & ~(NVM_ROW_SIZE - 1));
+	return true;
+}
+
+bool nvm_flash_write_page(uintptr_t address, const uint8_t* data, uint16_t length)
+{
+	if (!nvm_flash_is_ready() || length > NVM_PAGE_SIZE)
+	{
+		return false;
+	}
+
+	issue_command(NVMCTRL_CTRLA_CMD_PBC, 0);
+	while (!nvm_flash_is_ready())
+	{
+	}
+
+	// The page buffer only takes 16 or 32-bit writes; bytes past length are
+	// left erased
+	volatile uint32_t* page = (volatile uint32_t*)(address & ~(NVM_PAGE_SIZE - 1));
+	for (uint16_t i = 0; i < length; i += 4)
+	{
+		uint32_t word = 0xFFFFFFFF;
+		for (uint16_t b = 0; b < 4 && i + b < length; b++)
+		{
+			word &= ~((uint32_t)(~data[i + b] & 0xFF) << (8 * b));
+		}
+		page[i / 4] = word;
+	}
+
+	issue_command(is_rwwee(address) ? NVMCTRL_CTRLA_CMD_RWWEEWP : NVMCTRL_CTRLA_CMD_WP, (uintptr_t)page);
+	return true;
+}
@@ -0,0 +1,59 @@
+#ifndef NVM_FLASH_H_
+#define NVM_FLASH_H_
+
+#include "hal.h"
+
+// Main array geometry: pages are written, rows of 4 pages are erased
+#define NVM_PAGE_SIZE 64
+#define NVM_ROW_SIZE  (4 * NVM_PAGE_SIZE)
+
+// Read-while-write section: erased and written while the CPU keeps running
+// from the main array. Same geometry, addressed by the same functions.
+#ifdef KBD_HOST
+// Emulated in RAM by host/nvm_flash_host.c
+extern uint8_t g_nvmHostRwwee[];
+#define NVM_RWWEE_START ((uintptr_t)g_nvmHostRwwee)
+#define NVM_RWWEE_SIZE  0x400
+#else
+#if FLASH_PAGE_SIZE != NVM_PAGE_SIZE
+#error "Unexpected flash page size"
+#endif
+#define NVM_RWWEE_START NVMCTRL_RWW_EEPROM_ADDR
+#define NVM_RWWEE_SIZE  NVMCTRL_RWW_EEPROM_SIZE
+#endif
+
+// Commands only start the operation and return false while the controller
+// is busy. The CPU stalls on flash reads until a main array operation
+// completes, so callers pace them (see keymap_store_task).
+void nvm_flash_init(void);
+
+// One-shot interrupt when the command in progress completes. The callback
+// runs in the NVMCTRL interrupt and may issue the next command.
+typedef void (*nvm_flash_callback_t)(void);
+void nvm_flash_register_ready_callback(nvm_flash_callback_t callback);
+void nvm_flash_enable_ready_interrupt(void);
+
+bool nvm_flash_is_ready(void);
+bool nvm_flash_has_error(void);
+
+// The controller serves one client at a time, from its first command to the
+// end of its operation, so that a command of another never lands in the
+// middle of a sequence (the settings write runs from the ready interrupt).
+// Acquired from the main loop only; the errors of the previous owner are
+// cleared on a change of owner.
+enum nvm_flash_owner
+{
+	NVM_FLASH_FREE,
+	NVM_FLASH_SETTINGS,
+	NVM_FLASH_KEYMAP_STORE,
+	NVM_FLASH_KEY_STATS
+};
+
+// True when free or already held by this owner
+bool nvm_flash_acquire(enum nvm_flash_owner owner);
+void nvm_flash_release(enum nvm_flash_owner owner);
+
+bool nvm_flash_erase_row(uintptr_t address);
+bool nvm_flash_write_page(uintptr_t address, const uint8_t* data, uint16_t length);
+
+#endif /* NVM_FLASH_H_ */
@@ -0,0 +1,123 @@
+#include "profile.h"
+
+#ifdef KBD_PROFILE
+
+#include "timebase.h"
+
+#include <string.h>
+
+static struct profile_histogram g_histograms[NUM_PROFILE_INTERVALS];
+
+// Mark times of the event followed, up to the last mark reached
+static uint32_t g_times[NUM_PROFILE_MARKS];
+static enum profile_mark g_lastMark = PROFILE_SCAN_START;
+static bool g_following = false;
+static uint32_t g_scanStart = 0;
+
+// Transfers armed and not complete yet, and those ahead of the one followed
+static uint8_t g_transfers = 0;
+static uint8_t g_transfersAhead = 0;
+
+static void add_sample(struct profile_histogram* histogram, uint32_t time)
+{
+	const unsigned bucket = (time == 0) ? 0 : Min(32 - __builtin_clz(time), PROFILE_NUM_BUCKETS - 1);
+	if (histogram->buckets[bucket] != UINT16_MAX)
+	{
+		histogram->buckets[bucket]++;
+	}
+	histogram->sum = (histogram->sum + time >= histogram->sum) ? histogram->sum + time : UINT32_MAX;
+	histogram->max = Max(histogram->max, time);
+}
+
+static void complete(void)
+{
+	for (unsigned i = 0; i < PROFILE_TOTAL; i++)
+	{
+		add_sample(&g_histograms[i], g_times[i + 1] - g_times[i]);
+	}
+	add_sample(&g_histograms[PROFILE_TOTAL], g_times[PROFILE_REPORT_SENT] - g_times[PROFILE_SCAN_START]);
+	g_following = false;
+}
+
+void profile_mark(enum profile_mark mark)
+{
+	const uint32_t time = now();
+
+	switch (mark)
+	{
+	case PROFILE_SCAN_START:
+		g_scanStart = time;
+		// Nothing queued by the last scan: the event did not change the report
+		if (g_following && (g_lastMark == PROFILE_KEY_EVENT
+			|| (g_lastMark == PROFILE_REPORT_BUILT && !hal_hid_kbd_is_report_pending())))
+		{
+			g_following = false;
+		}
+		return;
+
+	case PROFILE_KEY_EVENT:
+		if (g_following)
+		{
+			return;
+		}
+		g_following = true;
+		g_times[PROFILE_SCAN_START] = g_scanStart;
+		break;
+
+	case PROFILE_REPORT_ARMED:
+		if (g_following && g_lastMark == PROFILE_REPORT_BUILT)
+		{
+			g_transfersAhead = g_transfers;
+			g_times[mark] = time;
+			g_lastMark = mark;
+		}
+		g_transfers++;
+		return;
+
+	case PROFILE_REPORT_SENT:
+		if (g_transfers > 0)
+		{
+			g_transfers--;
+		}
+		if (!g_following || g_lastMark != PROFILE_REPORT_ARMED)
+		{
+			return;
+		}
+		if (g_transfersAhead > 0)
+		{
+			g_transfersAhead--;
+			return;
+		}
+		g_times[mark] = time;
+		complete();
+		return;
+
+	default:
+		// The next mark in order
+		if (!g_following || mark != g_lastMark + 1)
+		{
+			return;
+		}
+		break;
+	}
+
+	g_times[mark] = time;
+	g_lastMark = mark;
+}
+
+void profile_get_histogram(unsigned interval, struct profile_histogram* histogram)
+{
+	system_interrupt_enter_critical_section();
+	*histogram = g_histograms[interval];
+	system_interrupt_leave_critical_section();
+}
+
+void profile_reset(void)
+{
+	system_interrupt_enter_critical_section();
+	memset(g_histograms, 0, sizeof(g_histograms));
+	g_following = false;
+	system_interrupt_leave_critical_section();
+}
+
+#endif
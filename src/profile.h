@@ -0,0 +1,47 @@
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include "hal.h"
+
+// Latency profiler of the path from a key event to the host, built with
+// KBD_PROFILE defined; without it the marks compile to nothing. A key event
+// is followed through the pipeline marks and the time between marks goes to
+// log2 histograms, in µs. One event is followed at a time, and only while it
+// changes the keyboard report: events of a scan that does not queue a report
+// are dropped at the next scan.
+enum profile_mark
+{
+	PROFILE_SCAN_START,
+	PROFILE_KEY_EVENT,     // Debounced change
+	PROFILE_REPORT_BUILT,
+	PROFILE_REPORT_ARMED,  // Transfer armed on the keyboard endpoint
+	PROFILE_REPORT_SENT,   // Transfer complete
+	NUM_PROFILE_MARKS
+};
+
+// Histograms: one per step between marks, and the total
+#define PROFILE_TOTAL         (NUM_PROFILE_MARKS - 1)
+#define NUM_PROFILE_INTERVALS NUM_PROFILE_MARKS
+
+// Bucket 0 counts 0 µs, bucket b from 2^(b-1) to 2^b - 1, the last one
+// anything longer
+#define PROFILE_NUM_BUCKETS 16
+
+struct profile_histogram
+{
+	uint16_t buckets[PROFILE_NUM_BUCKETS]; // Saturating
+	uint32_t sum;                          // Saturating
+	uint32_t max;
+};
+
+#ifdef KBD_PROFILE
+void profile_mark(enum profile_mark mark);
+void profile_get_histogram(unsigned interval, struct profile_histogram* histogram);
+void profile_reset(void);
+
+#define PROFILE_MARK(mark) profile_mark(mark)
+#else
+#define PROFILE_MARK(mark) ((void)0)
+#endif
+
+#endif /* PROFILE_H_ */
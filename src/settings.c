@@ -0,0 +1,301 @@
+#include "settings.h"
+#include "keyboard.h"
+#include "keyboard_debounce.h"
+#include "nvm_flash.h"
+
+#include <string.h>
+
+// The RWWEE rows form a log. Records are 8 bytes and written a page at a
+// time. The first page of the active row starts with a header carrying the
+// row sequence number, followed by every setting; the next pages hold the
+// changes. When the row is full the current values are copied to the first
+// page of the next row and the full row is erased.
+#define RECORD_HEADER    0xFE
+#define RECORD_ERASED    0xFF
+#define RECORDS_PER_PAGE (NVM_PAGE_SIZE / sizeof(struct settings_record))
+#define PAGES_PER_ROW    (NVM_ROW_SIZE / NVM_PAGE_SIZE)
+#define NUM_ROWS_RWWEE   (NVM_RWWEE_SIZE / NVM_ROW_SIZE)
+#define ROW_ADDRESS(r)   (NVM_RWWEE_START + (r) * NVM_ROW_SIZE)
+
+#define WRITE_DELAY_SCANS (SETTINGS_WRITE_DELAY_MS / KBD_SCAN_PERIOD_MS)
+
+#if NUM_SETTINGS + 1 > 8
+#error "The header and all the settings must fit in one page"
+#endif
+
+struct settings_record
+{
+	uint8_t id;
+	uint8_t reserved;
+	uint16_t crc;
+	uint32_t value;
+};
+
+enum write_step
+{
+	STEP_IDLE,
+	STEP_ERASE_NEXT,
+	STEP_WRITE,
+	STEP_ERASE_OLD,
+	STEP_DONE
+};
+
+static const uint32_t DEFAULTS[NUM_SETTINGS] = {
+	[SETTING_BACKLIGHT] = KBD_LED_DAC_ON,
+	[SETTING_LED_INDICATOR] = KBD_LED_DAC_INDICATOR,
+	[SETTING_DEFAULT_LAYERS] = 0,
+	[SETTING_DEBOUNCE_MODE] = DEBOUNCE_NONE,
+	[SETTING_DEBOUNCE_MS] = 5,
+};
+
+static const uint32_t MAXIMUMS[NUM_SETTINGS] = {
+	[SETTING_BACKLIGHT] = 0x3FF,
+	[SETTING_LED_INDICATOR] = 0xFF,
+	[SETTING_DEFAULT_LAYERS] = (1 << NUM_LAYERS) - 1,
+	[SETTING_DEBOUNCE_MODE] = NUM_DEBOUNCE_MODES - 1,
+	[SETTING_DEBOUNCE_MS] = 50,
+};
+
+// RAM copy of the settings, and those not written yet
+static uint32_t g_values[NUM_SETTINGS];
+static volatile uint8_t g_dirty = 0;
+static uint32_t g_lastChange = 0;
+
+// Log position
+static uint8_t g_row = 0;
+static uint8_t g_nextPage = 0;
+static uint32_t g_sequence = 0;
+
+// Write in progress, carried on by the NVM ready interrupt
+static volatile enum write_step g_step = STEP_IDLE;
+static uint8_t g_writing = 0;
+static uint8_t g_oldRow;
+
+static uint16_t crc16(const uint8_t* data, unsigned length)
+{
+	// CRC-16/CCITT
+	uint16_t crc = 0xFFFF;
+	for (unsigned i = 0; i < length; i++)
+	{
+		crc ^= (uint16_t)data[i] << 8;
+		for (unsigned b = 0; b < 8; b++)
+		{
+			crc = (crc << 1) ^ (0x1021 & -(crc >> 15));
+		}
+	}
+	return crc;
+}
+
+static uint16_t record_crc(const struct settings_record* record)
+{
+	uint8_t data[5] = {
+		record->id, record->value, record->value >> 8, record->value >> 16, record->value >> 24
+	};
+	return crc16(data, sizeof(data));
+}
+
+static inline void make_record(struct settings_record* record, uint8_t id, uint32_t value)
+{
+	record->id = id;
+	record->reserved = 0xFF;
+	record->value = value;
+	record->crc = record_crc(record);
+}
+
+static inline const struct settings_record* get_page(uint8_t row, uint8_t page)
+{
+	return (const struct settings_record*)(ROW_ADDRESS(row) + page * NVM_PAGE_SIZE);
+}
+
+static inline bool is_valid(const struct settings_record* record)
+{
+	return record->id != RECORD_ERASED && record->crc == record_crc(record);
+}
+
+static void write_step_done(void);
+
+static void build_page(struct settings_record* page)
+{
+	// The first page of a row holds the header and every setting, the next
+	// ones the settings being written
+	memset(page, 0xFF, RECORDS_PER_PAGE * sizeof(*page));
+	unsigned n = 0;
+	if (g_nextPage == 0)
+	{
+		make_record(&page[n++], RECORD_HEADER, g_sequence);
+	}
+	for (unsigned id = 0; id < NUM_SETTINGS; id++)
+	{
+		if (g_nextPage == 0 || (g_writing & (1 << id)))
+		{
+			make_record(&page[n++], id, g_values[id]);
+		}
+	}
+}
+
+static void replay_row(uint8_t row)
+{
+	for (g_nextPage = 0; g_nextPage < PAGES_PER_ROW; g_nextPage++)
+	{
+		const struct settings_record* records = get_page(row, g_nextPage);
+		if (records[0].id == RECORD_ERASED)
+		{
+			break;
+		}
+
+		// A page torn by a reset fails its CRCs and is skipped
+		for (unsigned i = 0; i < RECORDS_PER_PAGE && records[i].id != RECORD_ERASED; i++)
+		{
+			if (is_valid(&records[i]) && records[i].id < NUM_SETTINGS)
+			{
+				g_values[records[i].id] = records[i].value;
+			}
+		}
+	}
+}
+
+void settings_init(void)
+{
+	memcpy(g_values, DEFAULTS, sizeof(g_values));
+	g_dirty = 0;
+	g_step = STEP_IDLE;
+	nvm_flash_register_ready_callback(write_step_done);
+
+	// The active row is the one with the newest header
+	bool found = false;
+	for (unsigned r = 0; r < NUM_ROWS_RWWEE; r++)
+	{
+		const struct settings_record* header = get_page(r, 0);
+		if (header->id == RECORD_HEADER && is_valid(header)
+			&& (!found || header->value > g_sequence))
+		{
+			found = true;
+			g_row = r;
+			g_sequence = header->value;
+		}
+	}
+
+	if (found)
+	{
+		replay_row(g_row);
+	}
+	else
+	{
+		// Nothing stored yet: the first write starts a new row
+		g_row = NUM_ROWS_RWWEE - 1;
+		g_nextPage = PAGES_PER_ROW;
+	}
+}
+
+uint32_t settings_get(enum setting_id id)
+{
+	return (id < NUM_SETTINGS) ? g_values[id] : 0;
+}
+
+bool settings_set(enum setting_id id, uint32_t value)
+{
+	if (id >= NUM_SETTINGS || value > MAXIMUMS[id])
+	{
+		return false;
+	}
+
+	system_interrupt_enter_critical_section();
+	if (g_values[id] != value)
+	{
+		g_values[id] = value;
+		g_dirty |= 1 << id;
+		g_lastChange = keyboard_get_scan_count();
+	}
+	system_interrupt_leave_critical_section();
+	return true;
+}
+
+bool settings_is_pending(void)
+{
+	return g_dirty != 0 || g_step != STEP_IDLE;
+}
+
+static void write_step(void)
+{
+	switch (g_step)
+	{
+	case STEP_ERASE_NEXT:
+		nvm_flash_erase_row(ROW_ADDRESS(g_row));
+		g_step = STEP_WRITE;
+		break;
+
+	case STEP_WRITE:
+	{
+		// Built here, in the interrupt when the erase came first: the write
+		// command copies the page to the controller
+		struct settings_record page[RECORDS_PER_PAGE];
+		build_page(page);
+		nvm_flash_write_page((uintptr_t)get_page(g_row, g_nextPage), (const uint8_t*)page, sizeof(page));
+		g_nextPage++;
+		g_step = (g_nextPage == 1) ? STEP_ERASE_OLD : STEP_DONE;
+		break;
+	}
+
+	case STEP_ERASE_OLD:
+		// The new row is complete, the old one can go
+		nvm_flash_erase_row(ROW_ADDRESS(g_oldRow));
+		g_step = STEP_DONE;
+		break;
+
+	default:
+		g_writing = 0;
+		g_step = STEP_IDLE;
+		nvm_flash_release(NVM_FLASH_SETTINGS);
+		return;
+	}
+
+	nvm_flash_enable_ready_interrupt();
+}
+
+static void write_step_done(void)
+{
+	// NVM ready interrupt
+	if (nvm_flash_has_error())
+	{
+		// Retried with the next change, in a fresh row
+		g_dirty |= g_writing;
+		g_writing = 0;
+		g_nextPage = PAGES_PER_ROW;
+		g_step = STEP_IDLE;
+		nvm_flash_release(NVM_FLASH_SETTINGS);
+		return;
+	}
+
+	write_step();
+}
+
+void settings_task(void)
+{
+	if (g_dirty == 0 || g_step != STEP_IDLE || !nvm_flash_is_ready()
+		|| keyboard_get_scan_count() - g_lastChange < WRITE_DELAY_SCANS
+		|| !nvm_flash_acquire(NVM_FLASH_SETTINGS))
+	{
+		return;
+	}
+
+	system_interrupt_enter_critical_section();
+	g_writing = g_dirty;
+	g_dirty = 0;
+
+	if (g_nextPage == PAGES_PER_ROW)
+	{
+		// Row full: start the next one with all the current values
+		g_oldRow = g_row;
+		g_row = (g_row + 1) % NUM_ROWS_RWWEE;
+		g_nextPage = 0;
+		g_sequence++;
+		g_step = STEP_ERASE_NEXT;
+	}
+	else
+	{
+		g_step = STEP_WRITE;
+	}
+
+	write_step();
+	system_interrupt_leave_critical_section();
+}
@@ -0,0 +1,32 @@
+#ifndef SETTINGS_H_
+#define SETTINGS_H_
+
+#include "hal.h"
+
+// Settings persisted in the RWWEE section. Values are read from RAM; changes
+// are written in the background once no other change came for
+// SETTINGS_WRITE_DELAY_MS, so a setting adjusted step by step is written
+// once.
+enum setting_id
+{
+	SETTING_BACKLIGHT,         // DAC level of the board LED when lit
+	SETTING_LED_INDICATOR,     // Host LED bits lighting the board LED
+	SETTING_DEFAULT_LAYERS,    // Layers toggled on at power up
+	SETTING_DEBOUNCE_MODE,     // enum debounce_mode
+	SETTING_DEBOUNCE_MS,       // Debounce time
+	NUM_SETTINGS
+};
+
+#define SETTINGS_WRITE_DELAY_MS 2000
+
+void settings_init(void);
+
+uint32_t settings_get(enum setting_id id);
+bool settings_set(enum setting_id id, uint32_t value);
+bool settings_is_pending(void);
+
+// Main loop. Starts the write of pending changes; the NVM ready interrupt
+// carries it on.
+void settings_task(void);
+
+#endif /* SETTINGS_H_ */
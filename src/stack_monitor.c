@@ -0,0 +1,59 @@
+#include "stack_monitor.h"
+
+#define STACK_PAINT 0xC5C5C5C5
+
+// Bytes under the stack pointer of stack_paint() left unpainted, for its own
+// frame and that of a memset() the loop may be turned into
+#define PAINT_MARGIN 64
+
+// From the linker script
+extern uint32_t _sstack;
+extern uint32_t _estack;
+extern uint32_t _srelocate;
+
+static uint16_t g_isrDepth[NUM_STACK_ISRS];
+
+void stack_paint(void)
+{
+	uint32_t* const end = (uint32_t*)(__get_MSP() - PAINT_MARGIN);
+	for (uint32_t* p = &_sstack; p < end; p++)
+	{
+		*p = STACK_PAINT;
+	}
+}
+
+uint16_t stack_size(void)
+{
+	return (uint8_t*)&_estack - (uint8_t*)&_sstack;
+}
+
+uint16_t stack_peak(void)
+{
+	const uint32_t* p = &_sstack;
+	while (p < &_estack && *p == STACK_PAINT)
+	{
+		p++;
+	}
+	return (uint8_t*)&_estack - (uint8_t*)p;
+}
+
+uint16_t stack_static_ram(void)
+{
+	// Data, bss and noinit lie between the start of RAM and the stack
+	return (uint8_t*)&_sstack - (uint8_t*)&_srelocate;
+}
+
+void stack_sample(enum stack_isr isr)
+{
+	// An interrupt does not nest in itself, so its entry has no other writer
+	const uint16_t depth = (uint8_t*)&_estack - (uint8_t*)__get_MSP();
+	if (depth > g_isrDepth[isr])
+	{
+		g_isrDepth[isr] = depth;
+	}
+}
+
+uint16_t stack_isr_depth(enum stack_isr isr)
+{
+	return g_isrDepth[isr];
+}
@@ -0,0 +1,33 @@
+#ifndef STACK_MONITOR_H_
+#define STACK_MONITOR_H_
+
+#include "hal.h"
+
+// Stack usage of the firmware. The free stack is painted at boot and the
+// peak use is found from the paint left; each interrupt also records the
+// stack depth at the entry of its handler. tools/ram_report.py gives the
+// static RAM use from the link map.
+enum stack_isr
+{
+	STACK_ISR_USB,      // Report sent and LED set report
+	STACK_ISR_SCAN,     // TC3
+	STACK_ISR_TIME,     // TC4 alarm
+	STACK_ISR_I2C,      // SERCOM3
+	STACK_ISR_ADC,
+	STACK_ISR_NVM,      // NVMCTRL ready, settings writes
+	NUM_STACK_ISRS
+};
+
+// First thing in main(), before interrupts are enabled
+void stack_paint(void);
+
+// In bytes. The peak is the whole stack once it has overflowed.
+uint16_t stack_size(void);
+uint16_t stack_peak(void);
+uint16_t stack_static_ram(void);
+
+// Deepest stack seen at the entry of an interrupt, in bytes
+void stack_sample(enum stack_isr isr);
+uint16_t stack_isr_depth(enum stack_isr isr);
+
+#endif /* STACK_MONITOR_H_ */
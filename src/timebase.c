@@ -0,0 +1,87 @@
+#include "timebase.h"
+
+// Scheduled deadlines, earliest first; the alarm is set to the first one
+static struct deadline* g_deadlines = NULL;
+
+static void unlink_deadline(struct deadline* deadline)
+{
+	struct deadline** link = &g_deadlines;
+	while (*link != deadline)
+	{
+		link = &(*link)->next;
+	}
+	*link = deadline->next;
+	deadline->scheduled = false;
+}
+
+static void set_alarm(void)
+{
+	if (g_deadlines != NULL)
+	{
+		hal_time_set_alarm(g_deadlines->time);
+	}
+	else
+	{
+		hal_time_cancel_alarm();
+	}
+}
+
+static void alarm_callback(void)
+{
+	// Everything due by now, including what the callbacks schedule
+	while (g_deadlines != NULL && time_reached(g_deadlines->time))
+	{
+		struct deadline* deadline = g_deadlines;
+		unlink_deadline(deadline);
+		deadline->callback();
+	}
+	set_alarm();
+}
+
+void timebase_init(void)
+{
+	g_deadlines = NULL;
+	hal_time_init(alarm_callback);
+}
+
+void deadline_schedule(struct deadline* deadline, uint32_t time, deadline_callback_t callback)
+{
+	system_interrupt_enter_critical_section();
+	if (deadline->scheduled)
+	{
+		unlink_deadline(deadline);
+	}
+
+	// After those due at the same time
+	struct deadline** link = &g_deadlines;
+	while (*link != NULL && (int32_t)((*link)->time - time) <= 0)
+	{
+		link = &(*link)->next;
+	}
+	deadline->next = *link;
+	deadline->time = time;
+	deadline->callback = callback;
+	deadline->scheduled = true;
+	*link = deadline;
+
+	if (g_deadlines == deadline)
+	{
+		set_alarm();
+	}
+	system_interrupt_leave_critical_section();
+}
+
+void deadline_cancel(struct deadline* deadline)
+{
+	system_interrupt_enter_critical_section();
+	if (deadline->scheduled)
+	{
+		const bool first = (g_deadlines == deadline);
+		unlink_deadline(deadline);
+		if (first)
+		{
+			set_alarm();
+		}
+	}
+	system_interrupt_leave_critical_section();
+}
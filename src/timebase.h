@@ -0,0 +1,44 @@
+#ifndef TIMEBASE_H_
+#define TIMEBASE_H_
+
+#include "hal.h"
+
+// Monotonic time in µs since power up, counted in standby too. It wraps
+// every 71 minutes, so times are compared through their difference, as
+// time_reached() does, and intervals are at most 35 minutes.
+static inline uint32_t now(void)
+{
+	return hal_time_now();
+}
+
+static inline bool time_reached(uint32_t time)
+{
+	return (int32_t)(now() - time) >= 0;
+}
+
+#define TIME_MS(ms) ((uint32_t)(ms) * 1000)
+
+// One-shot deadlines, multiplexed on the alarm of the timebase. The caller
+// owns the deadline; each one can be scheduled once at a time. Callbacks
+// run in the timer interrupt, at once for a time already passed.
+typedef void (*deadline_callback_t)(void);
+
+struct deadline
+{
+	struct deadline* next;
+	uint32_t time;
+	deadline_callback_t callback;
+	bool scheduled;
+};
+
+void timebase_init(void);
+
+void deadline_schedule(struct deadline* deadline, uint32_t time, deadline_callback_t callback);
+void deadline_cancel(struct deadline* deadline);
+
+static inline bool deadline_is_scheduled(const struct deadline* deadline)
+{
+	return deadline->scheduled;
+}
+
+#endif /* TIMEBASE_H_ */
@@ -0,0 +1,155 @@
+#include "timer_wheel.h"
+
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_NONE       0xFF
+
+#if (TIMER_WHEEL_SLOTS & TIMER_WHEEL_MASK) != 0
+#error "TIMER_WHEEL_SLOTS must be a power of two"
+#endif
+
+struct wheel_timer
+{
+	timer_wheel_callback_t callback;
+	uint8_t next;
+	uint8_t prev;
+	uint8_t slot;
+	uint8_t rounds;
+	bool scheduled;
+};
+
+static struct wheel_timer g_timers[NUM_WHEEL_TIMERS];
+
+// First timer of each slot's list
+static uint8_t g_slots[TIMER_WHEEL_SLOTS];
+static uint8_t g_currentSlot = 0;
+
+// Timers expired at the current tick whose callback has not run yet
+static uint32_t g_expiredTimers = 0;
+
+static void unlink_timer(uint8_t id);
+
+void timer_wheel_init(void)
+{
+	for (unsigned i = 0; i < TIMER_WHEEL_SLOTS; i++)
+	{
+		g_slots[i] = TIMER_NONE;
+	}
+
+	for (unsigned i = 0; i < NUM_WHEEL_TIMERS; i++)
+	{
+		g_timers[i].callback = NULL;
+		g_timers[i].scheduled = false;
+	}
+	g_currentSlot = 0;
+	g_expiredTimers = 0;
+}
+
+void timer_wheel_register_callback(enum timer_wheel_id id, timer_wheel_callback_t callback)
+{
+	g_timers[id].callback = callback;
+}
+
+void timer_wheel_schedule(enum timer_wheel_id id, uint16_t ticks)
+{
+	if (ticks == 0)
+	{
+		ticks = 1;
+	}
+
+	system_interrupt_enter_critical_section();
+	if (g_timers[id].scheduled)
+	{
+		unlink_timer(id);
+	}
+	g_expiredTimers &= ~(1UL << id);
+
+	// The slot is reached after ((ticks - 1) % SLOTS) + 1 ticks, then once per turn
+	const uint8_t slot = (g_currentSlot + ticks) & TIMER_WHEEL_MASK;
+	struct wheel_timer *timer = &g_timers[id];
+	timer->slot = slot;
+	timer->rounds = (ticks - 1) / TIMER_WHEEL_SLOTS;
+	timer->prev = TIMER_NONE;
+	timer->next = g_slots[slot];
+	if (timer->next != TIMER_NONE)
+	{
+		g_timers[timer->next].prev = id;
+	}
+	g_slots[slot] = id;
+	timer->scheduled = true;
+	system_interrupt_leave_critical_section();
+}
+
+void timer_wheel_cancel(enum timer_wheel_id id)
+{
+	system_interrupt_enter_critical_section();
+	if (g_timers[id].scheduled)
+	{
+		unlink_timer(id);
+	}
+	g_expiredTimers &= ~(1UL << id);
+	system_interrupt_leave_critical_section();
+}
+
+bool timer_wheel_is_scheduled(enum timer_wheel_id id)
+{
+	return g_timers[id].scheduled;
+}
+
+void timer_wheel_tick(void)
+{
+	g_currentSlot = (g_currentSlot + 1) & TIMER_WHEEL_MASK;
+
+	// Only the timers of the current slot are visited. Expired timers are
+	// unlinked first, so the callbacks are free to schedule or cancel timers.
+	uint8_t id = g_slots[g_currentSlot];
+	while (id != TIMER_NONE)
+	{
+		struct wheel_timer *timer = &g_timers[id];
+		const uint8_t next = timer->next;
+
+		if (timer->rounds > 0)
+		{
+			timer->rounds--;
+		}
+		else
+		{
+			unlink_timer(id);
+			g_expiredTimers |= 1UL << id;
+		}
+
+		id = next;
+	}
+
+	for (id = 0; g_expiredTimers != 0; id++)
+	{
+		if (g_expiredTimers & (1UL << id))
+		{
+			g_expiredTimers &= ~(1UL << id);
+			if (g_timers[id].callback != NULL)
+			{
+				g_timers[id].callback();
+			}
+		}
+	}
+}
+
+static void unlink_timer(uint8_t id)
+{
+	struct wheel_timer *timer = &g_timers[id];
+
+	if (timer->prev != TIMER_NONE)
+	{
+		g_timers[timer->prev].next = timer->next;
+	}
+	else
+	{
+		g_slots[timer->slot] = timer->next;
+	}
+
+	if (timer->next != TIMER_NONE)
+	{
+		g_timers[timer->next].prev = timer->prev;
+	}
+
+	timer->scheduled = false;
+}
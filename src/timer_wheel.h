@@ -0,0 +1,32 @@
+#ifndef TIMER_WHEEL_H_
+#define TIMER_WHEEL_H_
+
+#include "hal.h"
+
+// Number of slots of the wheel (power of two). Timeouts longer than this
+// many ticks take extra turns of the wheel.
+#define TIMER_WHEEL_SLOTS 32
+
+// Timers multiplexed on the wheel (at most 32). Each one can be scheduled
+// once at a time.
+enum timer_wheel_id
+{
+	TIMER_TAP_HOLD,
+	TIMER_COMBO,
+	TIMER_MACRO,
+	TIMER_LEADER,
+	NUM_WHEEL_TIMERS
+};
+
+typedef void (*timer_wheel_callback_t)(void);
+
+void timer_wheel_init(void);
+void timer_wheel_register_callback(enum timer_wheel_id id, timer_wheel_callback_t callback);
+
+void timer_wheel_schedule(enum timer_wheel_id id, uint16_t ticks);
+void timer_wheel_cancel(enum timer_wheel_id id);
+bool timer_wheel_is_scheduled(enum timer_wheel_id id);
+
+void timer_wheel_tick(void);
+
+#endif /* TIMER_WHEEL_H_ */
@@ -0,0 +1,95 @@
+#include "trace.h"
+
+#ifdef KBD_TRACE
+
+#include <string.h>
+
+// Tells a ring left by this firmware from RAM contents after power-up
+#define TRACE_MAGIC (0x54524300 | TRACE_CAPACITY)
+
+struct trace_ring
+{
+	uint32_t magic;
+	uint32_t last;      // Time of the newest record
+	uint8_t next;       // Slot written next
+	uint8_t count;      // Records kept
+	bool paused;
+	struct trace_record records[TRACE_CAPACITY];
+};
+
+// Not zeroed at startup (see the linker script)
+static struct trace_ring g_trace __attribute__((section(".noinit")));
+
+void trace_init(void)
+{
+	const bool kept = hal_reset_kept_ram() && g_trace.magic == TRACE_MAGIC
+		&& g_trace.next < TRACE_CAPACITY && g_trace.count <= TRACE_CAPACITY;
+	if (!kept)
+	{
+		memset(&g_trace, 0, sizeof(g_trace));
+		g_trace.magic = TRACE_MAGIC;
+	}
+
+	// The timebase started over
+	g_trace.paused = false;
+	g_trace.last = hal_time_now();
+	trace_emit(TRACE_RESET, kept);
+}
+
+void trace_emit(enum trace_event event, uint8_t payload)
+{
+	// The M0+ has no exclusive accesses: a slot is claimed with interrupts
+	// masked for these few instructions instead
+	const irqflags_t flags = cpu_irq_save();
+	if (!g_trace.paused)
+	{
+		const uint32_t time = hal_time_now();
+		struct trace_record* record = &g_trace.records[g_trace.next];
+		record->delta = Min(time - g_trace.last, UINT16_MAX);
+		record->event = event;
+		record->payload = payload;
+		g_trace.last = time;
+		g_trace.next = (g_trace.next + 1) & (TRACE_CAPACITY - 1);
+		if (g_trace.count < TRACE_CAPACITY)
+		{
+			g_trace.count++;
+		}
+	}
+	cpu_irq_restore(flags);
+}
+
+unsigned trace_count(void)
+{
+	g_trace.paused = true;
+	return g_trace.count;
+}
+
+unsigned trace_read(unsigned first, struct trace_record* records, unsigned max)
+{
+	g_trace.paused = true;
+	if (first >= g_trace.count)
+	{
+		return 0;
+	}
+
+	const unsigned count = Min(g_trace.count - first, max);
+	const unsigned oldest = (g_trace.next - g_trace.count) & (TRACE_CAPACITY - 1);
+	for (unsigned i = 0; i < count; i++)
+	{
+		records[i] = g_trace.records[(oldest + first + i) & (TRACE_CAPACITY - 1)];
+	}
+	return count;
+}
+
+void trace_resume(bool clear)
+{
+	const irqflags_t flags = cpu_irq_save();
+	if (clear)
+	{
+		g_trace.count = 0;
+	}
+	g_trace.paused = false;
+	cpu_irq_restore(flags);
+}
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include "hal.h"
+
+// Event trace, built with KBD_TRACE defined; without it the trace points
+// compile to nothing. Records go to a ring in RAM that the startup code
+// leaves alone, so the records of the run before a soft reset are kept.
+// Records are read over the vendor interface (tools/kbdctl.py trace) and
+// decoded by tools/trace_decode.py.
+enum trace_event
+{
+	TRACE_RESET,        // 1 when the records before it were kept
+	TRACE_SCAN_START,   // Low byte of the scan count
+	TRACE_SCAN_END,
+	TRACE_KEY,          // Key index, bit 7 set on press
+	TRACE_KBD_ARMED,    // Keyboard report transfer armed
+	TRACE_KBD_SENT,     // Keyboard report transfer complete
+	TRACE_MEDIA_ARMED,  // Multimedia report transfer armed
+	TRACE_ADC,          // ID pin result, saturated to 8 bits
+	TRACE_I2C_START,    // Register
+	TRACE_I2C_DONE,     // Register
+	TRACE_I2C_ERROR,
+	TRACE_VENDOR,       // Request command
+	NUM_TRACE_EVENTS
+};
+
+struct trace_record
+{
+	uint16_t delta;     // µs since the record before, saturated
+	uint8_t event;
+	uint8_t payload;
+};
+
+// Records kept, a power of 2
+#define TRACE_CAPACITY 64
+
+#ifdef KBD_TRACE
+void trace_init(void);
+void trace_emit(enum trace_event event, uint8_t payload);
+
+// Reading pauses the trace until trace_resume(). Records are numbered from
+// the oldest kept.
+unsigned trace_count(void);
+unsigned trace_read(unsigned first, struct trace_record* records, unsigned max);
+void trace_resume(bool clear);
+
+#define TRACE(event, payload) trace_emit(event, payload)
+#else
+#define TRACE(event, payload) ((void)0)
+#endif
+
+#endif /* TRACE_H_ */
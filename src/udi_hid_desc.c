@@ -26,8 +26,13 @@
 #include "udi_hid.h"
 #include "udi_hid_kbd.h"
 #include "udi_hid_multimedia.h"
+#include "udi_hid_vendor.h"
 
+#ifdef UDI_HID_KBD_SHARED_EP
 #define  USB_DEVICE_NB_INTERFACE       2
+#else
+#define  USB_DEVICE_NB_INTERFACE       3
+#endif
 
 COMPILER_WORD_ALIGNED
 UDC_DESC_STORAGE usb_dev_desc_t udc_device_desc = {
@@ -51,8 +56,11 @@ UDC_DESC_STORAGE usb_dev_desc_t udc_device_desc = {
 COMPILER_PACK_SET(1)
 typedef struct {
 	usb_conf_desc_t conf;
+#ifndef UDI_HID_KBD_SHARED_EP
 	udi_hid_multimedia_desc_t hid_multimedia;
+#endif
 	udi_hid_kbd_desc_t hid_kbd;
+	udi_hid_vendor_desc_t hid_vendor;
 } udc_desc_t;
 COMPILER_PACK_RESET()
 
@@ -67,14 +75,20 @@ UDC_DESC_STORAGE udc_desc_t udc_config_desc = {
 	.conf.iConfiguration       = 0,
 	.conf.bmAttributes         = USB_CONFIG_ATTR_MUST_SET | USB_DEVICE_ATTR,
 	.conf.bMaxPower            = USB_CONFIG_MAX_POWER(USB_DEVICE_POWER),
+#ifndef UDI_HID_KBD_SHARED_EP
     .hid_multimedia            = UDI_HID_MULTIMEDIA_DESC,
+#endif
 	.hid_kbd                   = UDI_HID_KBD_DESC,
+	.hid_vendor                = UDI_HID_VENDOR_DESC,
 };
 
 //! Associate an UDI for each USB interface
 UDC_DESC_STORAGE udi_api_t *udi_apis[USB_DEVICE_NB_INTERFACE] = {
+#ifndef UDI_HID_KBD_SHARED_EP
     &udi_api_hid_multimedia,
+#endif
 	&udi_api_hid_kbd,
+	&udi_api_hid_vendor,
 };
 
 //! Add UDI with USB Descriptors FS & HS
@@ -26,6 +26,9 @@
 #include "udc.h"
 #include "udi_hid.h"
 #include "udi_hid_kbd.h"
+#include "profile.h"
+#include "stack_monitor.h"
+#include "trace.h"
 #include <string.h>
 
 bool udi_hid_kbd_enable(void);
@@ -51,15 +54,29 @@ static bool udi_hid_kbd_send_report(void);
 static void udi_hid_kbd_report_sent(udd_ep_status_t status, iram_size_t nb_sent, udd_ep_id_t ep);
 // Callback called to update report from USB host
 static void udi_hid_kbd_setreport_valid(void);
+#ifdef UDI_HID_KBD_SHARED_EP
+// Callback called to update report with report ID from USB host
+static void udi_hid_kbd_setreport_id_valid(void);
+#endif
 
 
 //! Size of report for standard HID keyboard
 #define UDI_HID_KBD_REPORT_SIZE  8
 
+#ifdef UDI_HID_KBD_SHARED_EP
+//! Size of the transfer buffers, large enough for any report and its ID
+#define UDI_HID_KBD_TRANS_SIZE  (1 + ((UDI_HID_KBD_REPORT_SIZE > UDI_HID_MULTIMEDIA_REPORT_SIZE) \
+		? UDI_HID_KBD_REPORT_SIZE : UDI_HID_MULTIMEDIA_REPORT_SIZE))
+#else
+#define UDI_HID_KBD_TRANS_SIZE  UDI_HID_KBD_REPORT_SIZE
+#endif
+
 
 //! To store current rate of HID keyboard
 COMPILER_WORD_ALIGNED
 		static uint8_t udi_hid_kbd_rate;
+//! Idle units (4 ms) elapsed since the last report was armed
+static uint8_t udi_hid_kbd_idle_elapsed;
 //! To store current protocol of HID keyboard
 COMPILER_WORD_ALIGNED
 		static uint8_t udi_hid_kbd_protocol;
@@ -70,12 +87,24 @@ COMPILER_WORD_ALIGNED
 static bool udi_hid_kbd_b_report_valid;
 //! Report ready to send
 static uint8_t udi_hid_kbd_report[UDI_HID_KBD_REPORT_SIZE];
-//! Signal if a report transfer is on going
-static bool udi_hid_kbd_b_report_trans_ongoing;
-//! Buffer used to send report
+//! Number of report transfers armed on the endpoint (one per bank)
+static uint8_t udi_hid_kbd_nb_trans_ongoing;
+//! Index of the bank buffer to fill with the next report
+static uint8_t udi_hid_kbd_trans_bank;
+//! Buffers used to send report, one per endpoint bank
 COMPILER_WORD_ALIGNED
 		static uint8_t
-		udi_hid_kbd_report_trans[UDI_HID_KBD_REPORT_SIZE];
+		udi_hid_kbd_report_trans[2][UDI_HID_KBD_TRANS_SIZE];
+
+#ifdef UDI_HID_KBD_SHARED_EP
+//! To store report feedback from USB host, prefixed by its report ID
+COMPILER_WORD_ALIGNED
+		static uint8_t udi_hid_kbd_report_set_id[2];
+//! To signal if a valid consumer report is ready to send
+static bool udi_hid_kbd_b_consumer_valid;
+//! Consumer report ready to send
+static uint8_t udi_hid_kbd_consumer_report[UDI_HID_MULTIMEDIA_REPORT_SIZE];
+#endif
 
 //! HID report descriptor for standard HID keyboard
 UDC_DESC_STORAGE udi_hid_kbd_report_desc_t udi_hid_kbd_report_desc = {
@@ -83,6 +112,9 @@ UDC_DESC_STORAGE udi_hid_kbd_report_desc_t udi_hid_kbd_report_desc = {
         0x05, 0x01,	/* Usage Page (Generic Desktop)      */
         0x09, 0x06,	/* Usage (Keyboard)                  */
         0xA1, 0x01,	/* Collection (Application)          */
+#ifdef UDI_HID_KBD_SHARED_EP
+        0x85, UDI_HID_KBD_REPORT_ID,	/* Report ID                         */
+#endif
         0x05, 0x07,	/* Usage Page (Keyboard)             */
         0x19, 224,	/* Usage Minimum (224)               */
         0x29, 231,	/* Usage Maximum (231)               */
@@ -109,7 +141,15 @@ UDC_DESC_STORAGE udi_hid_kbd_report_desc_t udi_hid_kbd_report_desc = {
         0x91, 0x02,	/* Output (Data, Variable, Absolute) */
         0x95, 0x03,	/* Report Count (3)                  */
         0x91, 0x01,	/* Output (Constant)                 */
-        0xC0	/* End Collection                    */
+        0xC0,	/* End Collection                    */
+#ifdef UDI_HID_KBD_SHARED_EP
+        0x05, 0x0c,	/* Usage Page (Consumer Devices)     */
+        0x09, 0x01,	/* Usage (Consumer Control)          */
+        0xA1, 0x01,	/* Collection (Application)          */
+        0x85, UDI_HID_CONSUMER_REPORT_ID,	/* Report ID                         */
+        UDI_HID_MULTIMEDIA_REPORT_ITEMS
+        0xC0,	/* End Collection                    */
+#endif
     }
 };
 
@@ -119,16 +159,31 @@ bool udi_hid_kbd_enable(void)
 {
 	// Initialize internal values
 	udi_hid_kbd_rate = 0;
+	udi_hid_kbd_idle_elapsed = 0;
 	udi_hid_kbd_protocol = 0;
-	udi_hid_kbd_b_report_trans_ongoing = false;
+	udi_hid_kbd_nb_trans_ongoing = 0;
+	udi_hid_kbd_trans_bank = 0;
 	memset(udi_hid_kbd_report, 0, UDI_HID_KBD_REPORT_SIZE);
 	udi_hid_kbd_b_report_valid = false;
 
+#ifdef UDI_HID_KBD_SHARED_EP
+	// Report IDs are only sent in report protocol, which is the default
+	udi_hid_kbd_protocol = 1;
+	memset(udi_hid_kbd_consumer_report, 0, UDI_HID_MULTIMEDIA_REPORT_SIZE);
+	udi_hid_kbd_b_consumer_valid = false;
+
+	if (!UDI_HID_MULTIMEDIA_ENABLE_EXT())
+		return false;
+#endif
+
 	return UDI_HID_KBD_ENABLE_EXT();
 }
 
 void udi_hid_kbd_disable(void)
 {
+#ifdef UDI_HID_KBD_SHARED_EP
+	UDI_HID_MULTIMEDIA_DISABLE_EXT();
+#endif
 	UDI_HID_KBD_DISABLE_EXT();
 }
 
@@ -152,6 +207,15 @@ static bool udi_hid_kbd_setreport(void)
 		udd_g_ctrlreq.payload_size = 1;
 		return true;
 	}
+#ifdef UDI_HID_KBD_SHARED_EP
+	if ((USB_HID_REPORT_TYPE_OUTPUT == (udd_g_ctrlreq.req.wValue >> 8)) && (UDI_HID_KBD_REPORT_ID == (0xFF & udd_g_ctrlreq.req.wValue)) && (2 == udd_g_ctrlreq.req.wLength)) {
+		// Report OUT type on the keyboard report ID, the ID is the first byte of the payload
+		udd_g_ctrlreq.payload = udi_hid_kbd_report_set_id;
+		udd_g_ctrlreq.callback = udi_hid_kbd_setreport_id_valid;
+		udd_g_ctrlreq.payload_size = 2;
+		return true;
+	}
+#endif
 	return false;
 }
 
@@ -175,17 +239,104 @@ bool udi_hid_kbd_send_event(uint8_t modifier_id, uint8_t *pressed_keycodes)
 	return true;
 }
 
+#ifdef UDI_HID_KBD_SHARED_EP
+bool udi_hid_kbd_send_consumer_event(uint8_t *consumer_report)
+{
+	irqflags_t flags = cpu_irq_save();
+
+	// Boot protocol hosts only understand the keyboard report
+	if (udi_hid_kbd_protocol != 0 && memcmp(udi_hid_kbd_consumer_report, consumer_report, UDI_HID_MULTIMEDIA_REPORT_SIZE) != 0)
+	{
+		// Fill report
+		memcpy(udi_hid_kbd_consumer_report, consumer_report, UDI_HID_MULTIMEDIA_REPORT_SIZE);
+		udi_hid_kbd_b_consumer_valid = true;
+
+		// Send report
+		udi_hid_kbd_send_report();
+	}
+
+	cpu_irq_restore(flags);
+	return true;
+}
+#endif
+
+void udi_hid_kbd_idle_tick(void)
+{
+	// Idle rate 0: reports are only sent on change
+	if (udi_hid_kbd_rate == 0)
+		return;
+
+	irqflags_t flags = cpu_irq_save();
+
+	if (udi_hid_kbd_idle_elapsed < udi_hid_kbd_rate)
+		udi_hid_kbd_idle_elapsed++;
+
+	// Duration expired without any report, send the current one again
+	if (udi_hid_kbd_idle_elapsed >= udi_hid_kbd_rate && udi_hid_kbd_nb_trans_ongoing == 0)
+	{
+		udi_hid_kbd_b_report_valid = true;
+#ifdef UDI_HID_KBD_SHARED_EP
+		udi_hid_kbd_b_consumer_valid = (udi_hid_kbd_protocol != 0);
+#endif
+		udi_hid_kbd_send_report();
+	}
+
+	cpu_irq_restore(flags);
+}
+
+bool udi_hid_kbd_is_report_pending(void)
+{
+	return udi_hid_kbd_b_report_valid;
+}
+
 // Internal routines
 
 static bool udi_hid_kbd_send_report(void)
 {
-	if (udi_hid_kbd_b_report_trans_ongoing)
+	// Both banks are armed, the report is sent when one of them is released
+	if (udi_hid_kbd_nb_trans_ongoing >= 2)
+		return false;
+
+	uint8_t *trans = udi_hid_kbd_report_trans[udi_hid_kbd_trans_bank];
+#ifdef UDI_HID_KBD_SHARED_EP
+	// Arbitrate between the collections, keyboard reports go first
+	bool *valid;
+	iram_size_t size;
+	if (udi_hid_kbd_b_report_valid) {
+		valid = &udi_hid_kbd_b_report_valid;
+		if (udi_hid_kbd_protocol == 0) {
+			memcpy(trans, udi_hid_kbd_report, UDI_HID_KBD_REPORT_SIZE);
+			size = UDI_HID_KBD_REPORT_SIZE;
+		} else {
+			trans[0] = UDI_HID_KBD_REPORT_ID;
+			memcpy(&trans[1], udi_hid_kbd_report, UDI_HID_KBD_REPORT_SIZE);
+			size = 1 + UDI_HID_KBD_REPORT_SIZE;
+		}
+	} else if (udi_hid_kbd_b_consumer_valid && udi_hid_kbd_protocol != 0) {
+		valid = &udi_hid_kbd_b_consumer_valid;
+		trans[0] = UDI_HID_CONSUMER_REPORT_ID;
+		memcpy(&trans[1], udi_hid_kbd_consumer_report, UDI_HID_MULTIMEDIA_REPORT_SIZE);
+		size = 1 + UDI_HID_MULTIMEDIA_REPORT_SIZE;
+	} else {
+		return false;
+	}
+	if (!udd_ep_run_next(UDI_HID_KBD_EP_IN, trans, size, udi_hid_kbd_report_sent))
+		return false;
+
+	*valid = false;
+#else
+	memcpy(trans, udi_hid_kbd_report, UDI_HID_KBD_REPORT_SIZE);
+	if (!udd_ep_run_next(UDI_HID_KBD_EP_IN, trans, UDI_HID_KBD_REPORT_SIZE, udi_hid_kbd_report_sent))
 		return false;
 
-	memcpy(udi_hid_kbd_report_trans, udi_hid_kbd_report, UDI_HID_KBD_REPORT_SIZE);
 	udi_hid_kbd_b_report_valid = false;
-	udi_hid_kbd_b_report_trans_ongoing = udd_ep_run(UDI_HID_KBD_EP_IN, false, udi_hid_kbd_report_trans, UDI_HID_KBD_REPORT_SIZE, udi_hid_kbd_report_sent);
-	return udi_hid_kbd_b_report_trans_ongoing;
+#endif
+	PROFILE_MARK(PROFILE_REPORT_ARMED);
+	TRACE(TRACE_KBD_ARMED, 0);
+	udi_hid_kbd_trans_bank ^= 1;
+	udi_hid_kbd_nb_trans_ongoing++;
+	udi_hid_kbd_idle_elapsed = 0;
+	return true;
 }
 
 static void udi_hid_kbd_report_sent(udd_ep_status_t status, iram_size_t nb_sent, udd_ep_id_t ep)
@@ -194,13 +345,32 @@ static void udi_hid_kbd_report_sent(udd_ep_status_t status, iram_size_t nb_sent,
 	UNUSED(nb_sent);
 	UNUSED(ep);
 
-	udi_hid_kbd_b_report_trans_ongoing = false;
+	stack_sample(STACK_ISR_USB);
+	if (udi_hid_kbd_nb_trans_ongoing > 0)
+		udi_hid_kbd_nb_trans_ongoing--;
 	if (udi_hid_kbd_b_report_valid) {
 		udi_hid_kbd_send_report();
 	}
+#ifdef UDI_HID_KBD_SHARED_EP
+	else if (udi_hid_kbd_b_consumer_valid) {
+		udi_hid_kbd_send_report();
+	}
+#endif
+#ifdef UDI_HID_KBD_REPORT_SENT_EXT
+	UDI_HID_KBD_REPORT_SENT_EXT();
+#endif
 }
 
 static void udi_hid_kbd_setreport_valid(void)
 {
+	stack_sample(STACK_ISR_USB);
 	UDI_HID_KBD_CHANGE_LED(udi_hid_kbd_report_set);
-}
\ No newline at end of file
+}
+
+#ifdef UDI_HID_KBD_SHARED_EP
+static void udi_hid_kbd_setreport_id_valid(void)
+{
+	udi_hid_kbd_report_set = udi_hid_kbd_report_set_id[1];
+	udi_hid_kbd_setreport_valid();
+}
+#endif
@@ -25,6 +25,7 @@
 
 #include "udc_desc.h"
 #include "udi_hid.h"
+#include "udi_hid_multimedia.h"
 
 extern UDC_DESC_STORAGE udi_api_t udi_api_hid_kbd;
 
@@ -38,7 +39,11 @@ typedef struct {
 
 //! Report descriptor for HID keyboard
 typedef struct {
+#ifdef UDI_HID_KBD_SHARED_EP
+	uint8_t array[59 + 2 + 9 + UDI_HID_MULTIMEDIA_REPORT_ITEMS_SIZE];
+#else
 	uint8_t array[59];
+#endif
 } udi_hid_kbd_report_desc_t;
 
 
@@ -47,12 +52,28 @@ typedef struct {
 #define UDI_HID_KBD_STRING_ID 0
 #endif
 
+#ifdef UDI_HID_KBD_SHARED_EP
+// Keyboard and consumer control collections share this interface and its
+// endpoint. Reports are prefixed by their report ID, except in boot protocol.
+
+#define UDI_HID_KBD_IFACE_NUMBER 0
+
+//! HID keyboard endpoints size (report ID + largest report)
+#define UDI_HID_KBD_EP_SIZE  16
+
+#define UDI_HID_KBD_EP_IN    (1 | USB_EP_DIR_IN)
+
+//! Report IDs of the collections on the shared interface
+#define UDI_HID_KBD_REPORT_ID       1
+#define UDI_HID_CONSUMER_REPORT_ID  2
+#else
 #define UDI_HID_KBD_IFACE_NUMBER 1
 
 //! HID keyboard endpoints size
 #define UDI_HID_KBD_EP_SIZE  8
 
 #define UDI_HID_KBD_EP_IN    (2 | USB_EP_DIR_IN)
+#endif
 
 //! Content of HID keyboard interface descriptor for all speed
 #define UDI_HID_KBD_DESC    {\
@@ -83,4 +104,16 @@ typedef struct {
 
 bool udi_hid_kbd_send_event(uint8_t modifier_id, uint8_t *pressed_keycodes);
 
+//! Advances the idle rate timer (SET_IDLE) by one 4 ms unit, resending the
+//! current report when the duration expires. Call it from the 4 ms scan tick.
+void udi_hid_kbd_idle_tick(void);
+
+//! Returns true while a report is waiting for a free bank. A report sent
+//! meanwhile replaces it, so distinct states have to wait for this to clear.
+bool udi_hid_kbd_is_report_pending(void);
+
+#ifdef UDI_HID_KBD_SHARED_EP
+bool udi_hid_kbd_send_consumer_event(uint8_t *consumer_report);
+#endif
+
 #endif /* UDI_HID_KBD_H_ */
\ No newline at end of file
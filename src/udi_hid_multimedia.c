@@ -26,8 +26,40 @@
 #include "udc.h"
 #include "udi_hid.h"
 #include "udi_hid_multimedia.h"
+#include "udi_hid_kbd.h"
+#include "trace.h"
 #include <string.h>
 
+// Pack UDI_HID_MULTIMEDIA_MAX_USAGES usages (0 for unused slots) into a report
+static void udi_hid_multimedia_fill_report(uint8_t *report, const uint16_t *usages)
+{
+	for (unsigned i = 0; i < UDI_HID_MULTIMEDIA_MAX_USAGES; i++)
+	{
+		report[2 * i] = usages[i] & 0xFF;
+		report[2 * i + 1] = usages[i] >> 8;
+	}
+}
+
+#ifdef UDI_HID_KBD_SHARED_EP
+
+// The consumer control collection is part of the keyboard interface, which
+// owns the endpoint and arbitrates between both reports.
+
+bool udi_hid_multimedia_send_event(const uint16_t *usages)
+{
+	uint8_t report[UDI_HID_MULTIMEDIA_REPORT_SIZE];
+	udi_hid_multimedia_fill_report(report, usages);
+
+	return udi_hid_kbd_send_consumer_event(report);
+}
+
+void udi_hid_multimedia_idle_tick(void)
+{
+	// The idle rate of the shared interface is handled by udi_hid_kbd_idle_tick()
+}
+
+#else
+
 bool udi_hid_multimedia_enable(void);
 void udi_hid_multimedia_disable(void);
 bool udi_hid_multimedia_setup(void);
@@ -51,13 +83,11 @@ static bool udi_hid_multimedia_send_report(void);
 static void udi_hid_multimedia_report_sent(udd_ep_status_t status, iram_size_t nb_sent, udd_ep_id_t ep);
 
 
-//! Size of report for standard HID keyboard
-#define UDI_HID_MULTIMEDIA_REPORT_SIZE  1
-
-
 //! To store current rate of HID keyboard
 COMPILER_WORD_ALIGNED
 		static uint8_t udi_hid_multimedia_rate;
+//! Idle units (4 ms) elapsed since the last report was armed
+static uint8_t udi_hid_multimedia_idle_elapsed;
 //! To store current protocol of HID keyboard
 COMPILER_WORD_ALIGNED
 		static uint8_t udi_hid_multimedia_protocol;
@@ -65,12 +95,14 @@ COMPILER_WORD_ALIGNED
 static bool udi_hid_multimedia_b_report_valid;
 //! Report ready to send
 static uint8_t udi_hid_multimedia_report[UDI_HID_MULTIMEDIA_REPORT_SIZE];
-//! Signal if a report transfer is on going
-static bool udi_hid_multimedia_b_report_trans_ongoing;
-//! Buffer used to send report
+//! Number of report transfers armed on the endpoint (one per bank)
+static uint8_t udi_hid_multimedia_nb_trans_ongoing;
+//! Index of the bank buffer to fill with the next report
+static uint8_t udi_hid_multimedia_trans_bank;
+//! Buffers used to send report, one per endpoint bank
 COMPILER_WORD_ALIGNED
 		static uint8_t
-		udi_hid_multimedia_report_trans[UDI_HID_MULTIMEDIA_REPORT_SIZE];
+		udi_hid_multimedia_report_trans[2][UDI_HID_MULTIMEDIA_REPORT_SIZE];
 
 //! HID report descriptor for standard HID keyboard
 UDC_DESC_STORAGE udi_hid_multimedia_report_desc_t udi_hid_multimedia_report_desc = {
@@ -78,34 +110,7 @@ UDC_DESC_STORAGE udi_hid_multimedia_report_desc_t udi_hid_multimedia_report_desc
 		0x05, 0x0c,                    // USAGE_PAGE (Consumer Devices)
 		0x09, 0x01,                    // USAGE (Consumer Control)
 		0xa1, 0x01,                    // COLLECTION (Application)
-		0x05, 0x0c,                    //   USAGE_PAGE (Consumer Devices)
-		0x09, 0xb6,                    //   USAGE (Scan Previous Track)
-		0x09, 0xb5,                    //   USAGE (Scan Next Track)
-		0x09, 0xcd,                    //   USAGE (Play/Pause)
-		0x15, 0x00,                    //   LOGICAL_MINIMUM (0)
-		0x25, 0x01,                    //   LOGICAL_MAXIMUM (1)
-		0x75, 0x01,                    //   REPORT_SIZE (1)
-		0x95, 0x03,                    //   REPORT_COUNT (3)
-		0x81, 0x06,                    //   INPUT (Data,Var,Rel)
-		0x75, 0x01,                    //   REPORT_SIZE (1)
-		0x95, 0x01,                    //   REPORT_COUNT (1)
-		0x81, 0x03,                    //   INPUT (Cnst,Var,Abs)
-		0x09, 0xe2,                    //   USAGE (Mute)
-		0x15, 0x00,                    //   LOGICAL_MINIMUM (0)
-		0x25, 0x01,                    //   LOGICAL_MAXIMUM (1)
-		0x75, 0x01,                    //   REPORT_SIZE (1)
-		0x95, 0x01,                    //   REPORT_COUNT (1)
-		0x81, 0x06,                    //   INPUT (Data,Var,Rel)
-		0x09, 0xe9,                    //   USAGE (Volume Up)
-		0x09, 0xea,                    //   USAGE (Volume Down)
-		0x15, 0x00,                    //   LOGICAL_MINIMUM (0)
-		0x25, 0x01,                    //   LOGICAL_MAXIMUM (1)
-		0x75, 0x01,                    //   REPORT_SIZE (1)
-		0x95, 0x02,                    //   REPORT_COUNT (2)
-		0x81, 0x02,                    //   INPUT (Data,Var,Abs)
-		0x75, 0x01,                    //   REPORT_SIZE (1)
-		0x95, 0x01,                    //   REPORT_COUNT (1)
-		0x81, 0x03,                    //   INPUT (Cnst,Var,Abs)
+		UDI_HID_MULTIMEDIA_REPORT_ITEMS
 		0xc0                           // END_COLLECTION
     }
 };
@@ -116,8 +121,10 @@ bool udi_hid_multimedia_enable(void)
 {
 	// Initialize internal values
 	udi_hid_multimedia_rate = 0;
+	udi_hid_multimedia_idle_elapsed = 0;
 	udi_hid_multimedia_protocol = 0;
-	udi_hid_multimedia_b_report_trans_ongoing = false;
+	udi_hid_multimedia_nb_trans_ongoing = 0;
+	udi_hid_multimedia_trans_bank = 0;
 	memset(udi_hid_multimedia_report, 0, UDI_HID_MULTIMEDIA_REPORT_SIZE);
 	udi_hid_multimedia_b_report_valid = false;
 
@@ -146,14 +153,17 @@ static bool udi_hid_multimedia_setreport(void)
 }
 
 
-bool udi_hid_multimedia_send_event(uint8_t media_id)
+bool udi_hid_multimedia_send_event(const uint16_t *usages)
 {
+	uint8_t report[UDI_HID_MULTIMEDIA_REPORT_SIZE];
+	udi_hid_multimedia_fill_report(report, usages);
+
     irqflags_t flags = cpu_irq_save();
 
-	if (udi_hid_multimedia_report[0] != media_id)
+	if (memcmp(udi_hid_multimedia_report, report, UDI_HID_MULTIMEDIA_REPORT_SIZE) != 0)
 	{
 		// Fill report
-		udi_hid_multimedia_report[0] = media_id;
+		memcpy(udi_hid_multimedia_report, report, UDI_HID_MULTIMEDIA_REPORT_SIZE);
 		udi_hid_multimedia_b_report_valid = true;
 		
 		// Send report
@@ -164,18 +174,46 @@ bool udi_hid_multimedia_send_event(uint8_t media_id)
 	return true;
 }
 
+void udi_hid_multimedia_idle_tick(void)
+{
+	// Idle rate 0: reports are only sent on change
+	if (udi_hid_multimedia_rate == 0)
+		return;
+
+	irqflags_t flags = cpu_irq_save();
+
+	if (udi_hid_multimedia_idle_elapsed < udi_hid_multimedia_rate)
+		udi_hid_multimedia_idle_elapsed++;
+
+	// Duration expired without any report, send the current one again
+	if (udi_hid_multimedia_idle_elapsed >= udi_hid_multimedia_rate && udi_hid_multimedia_nb_trans_ongoing == 0)
+	{
+		udi_hid_multimedia_b_report_valid = true;
+		udi_hid_multimedia_send_report();
+	}
+
+	cpu_irq_restore(flags);
+}
+
 // Internal routines
 
 static bool udi_hid_multimedia_send_report(void)
 {
-	if (udi_hid_multimedia_b_report_trans_ongoing)
+	// Both banks are armed, the report is sent when one of them is released
+	if (udi_hid_multimedia_nb_trans_ongoing >= 2)
+		return false;
+
+	uint8_t *trans = udi_hid_multimedia_report_trans[udi_hid_multimedia_trans_bank];
+	memcpy(trans, udi_hid_multimedia_report, UDI_HID_MULTIMEDIA_REPORT_SIZE);
+	if (!udd_ep_run_next(UDI_HID_MULTIMEDIA_EP_IN, trans, UDI_HID_MULTIMEDIA_REPORT_SIZE, udi_hid_multimedia_report_sent))
 		return false;
 
-	memcpy(udi_hid_multimedia_report_trans, udi_hid_multimedia_report, UDI_HID_MULTIMEDIA_REPORT_SIZE);
 	udi_hid_multimedia_b_report_valid = false;
-	udi_hid_multimedia_b_report_trans_ongoing = udd_ep_run(UDI_HID_MULTIMEDIA_EP_IN, false, udi_hid_multimedia_report_trans,
-            UDI_HID_MULTIMEDIA_REPORT_SIZE, udi_hid_multimedia_report_sent);
-	return udi_hid_multimedia_b_report_trans_ongoing;
+	TRACE(TRACE_MEDIA_ARMED, 0);
+	udi_hid_multimedia_trans_bank ^= 1;
+	udi_hid_multimedia_nb_trans_ongoing++;
+	udi_hid_multimedia_idle_elapsed = 0;
+	return true;
 }
 
 static void udi_hid_multimedia_report_sent(udd_ep_status_t status, iram_size_t nb_sent, udd_ep_id_t ep)
@@ -184,8 +222,11 @@ static void udi_hid_multimedia_report_sent(udd_ep_status_t status, iram_size_t n
 	UNUSED(nb_sent);
 	UNUSED(ep);
 
-	udi_hid_multimedia_b_report_trans_ongoing = false;
+	if (udi_hid_multimedia_nb_trans_ongoing > 0)
+		udi_hid_multimedia_nb_trans_ongoing--;
 	if (udi_hid_multimedia_b_report_valid) {
 		udi_hid_multimedia_send_report();
 	}
 }
+
+#endif /* UDI_HID_KBD_SHARED_EP */
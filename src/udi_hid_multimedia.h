@@ -25,13 +25,24 @@
 
 #include "udc_desc.h"
 #include "udi_hid.h"
+#include "hid_consumer.h"
 
-#define HID_MULTIMEDIA_KEY_SCAN_PREVIOUS 0x01
-#define HID_MULTIMEDIA_KEY_SCAN_NEXT     0x02
-#define HID_MULTIMEDIA_KEY_PLAY_PAUSE    0x04
-#define HID_MULTIMEDIA_KEY_MUTE          0x10
-#define HID_MULTIMEDIA_KEY_VOLUME_UP     0x20
-#define HID_MULTIMEDIA_KEY_VOLUME_DOWN   0x40
+//! Size of report for HID consumer control (array of 16-bit usages)
+#define UDI_HID_MULTIMEDIA_REPORT_SIZE  (2 * UDI_HID_MULTIMEDIA_MAX_USAGES)
+
+//! Report items of the consumer control collection (shared with the keyboard
+//! interface when UDI_HID_KBD_SHARED_EP is defined)
+#define UDI_HID_MULTIMEDIA_REPORT_ITEMS \
+	0x05, 0x0c,                    /* USAGE_PAGE (Consumer Devices) */ \
+	0x19, 0x00,                    /* USAGE_MINIMUM (0) */ \
+	0x2a, 0xff, 0x03,              /* USAGE_MAXIMUM (0x3ff) */ \
+	0x15, 0x00,                    /* LOGICAL_MINIMUM (0) */ \
+	0x26, 0xff, 0x03,              /* LOGICAL_MAXIMUM (0x3ff) */ \
+	0x75, 0x10,                    /* REPORT_SIZE (16) */ \
+	0x95, UDI_HID_MULTIMEDIA_MAX_USAGES, /* REPORT_COUNT */ \
+	0x81, 0x00,                    /* INPUT (Data,Array,Abs) */
+
+#define UDI_HID_MULTIMEDIA_REPORT_ITEMS_SIZE 18
 
 extern UDC_DESC_STORAGE udi_api_t udi_api_hid_multimedia;
 
@@ -45,7 +56,7 @@ typedef struct {
 
 //! Report descriptor for HID keyboard
 typedef struct {
-	uint8_t array[63];
+	uint8_t array[7 + UDI_HID_MULTIMEDIA_REPORT_ITEMS_SIZE];
 } udi_hid_multimedia_report_desc_t;
 
 
@@ -88,6 +99,10 @@ typedef struct {
 }
 
 
-bool udi_hid_multimedia_send_event(uint8_t media_id);
+bool udi_hid_multimedia_send_event(const uint16_t *usages);
+
+//! Advances the idle rate timer (SET_IDLE) by one 4 ms unit, resending the
+//! current report when the duration expires. Call it from the 4 ms scan tick.
+void udi_hid_multimedia_idle_tick(void);
 
 #endif /* UDI_HID_MULTIMEDIA_H_ */
\ No newline at end of file
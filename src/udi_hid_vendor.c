@@ -0,0 +1,201 @@
+/**
+ * Copyright (c) 2009-2018 Microchip Technology Inc. and its subsidiaries.
+ * 
+ * Subject to your compliance with these terms, you may use Microchip
+ * software and any derivatives exclusively with Microchip products.
+ * It is your responsibility to comply with third party license terms applicable
+ * to your use of third party software (including open source software) that
+ * may accompany Microchip software.
+ *
+ * THIS SOFTWARE IS SUPPLIED BY MICROCHIP "AS IS". NO WARRANTIES,
+ * WHETHER EXPRESS, IMPLIED OR STATUTORY, APPLY TO THIS SOFTWARE,
+ * INCLUDING ANY IMPLIED WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY,
+ * AND FITNESS FOR A PARTICULAR PURPOSE. IN NO EVENT WILL MICROCHIP BE
+ * LIABLE FOR ANY INDIRECT, SPECIAL, PUNITIVE, INCIDENTAL OR CONSEQUENTIAL
+ * LOSS, DAMAGE, COST OR EXPENSE OF ANY KIND WHATSOEVER RELATED TO THE
+ * SOFTWARE, HOWEVER CAUSED, EVEN IF MICROCHIP HAS BEEN ADVISED OF THE
+ * POSSIBILITY OR THE DAMAGES ARE FORESEEABLE.  TO THE FULLEST EXTENT
+ * ALLOWED BY LAW, MICROCHIP'S TOTAL LIABILITY ON ALL CLAIMS IN ANY WAY
+ * RELATED TO THIS SOFTWARE WILL NOT EXCEED THE AMOUNT OF FEES, IF ANY,
+ * THAT YOU HAVE PAID DIRECTLY TO MICROCHIP FOR THIS SOFTWARE.
+ */
+
+#include "conf_usb.h"
+#include "usb_protocol.h"
+#include "udd.h"
+#include "udc.h"
+#include "udi_hid.h"
+#include "udi_hid_vendor.h"
+#include <string.h>
+
+bool udi_hid_vendor_enable(void);
+void udi_hid_vendor_disable(void);
+bool udi_hid_vendor_setup(void);
+uint8_t udi_hid_vendor_getsetting(void);
+
+//! Global structure which contains standard UDI interface for UDC
+UDC_DESC_STORAGE udi_api_t udi_api_hid_vendor = {
+	.enable = (bool(*)(void))udi_hid_vendor_enable,
+	.disable = (void (*)(void))udi_hid_vendor_disable,
+	.setup = (bool(*)(void))udi_hid_vendor_setup,
+	.getsetting = (uint8_t(*)(void))udi_hid_vendor_getsetting,
+	.sof_notify = NULL,
+};
+
+
+// Reports are only exchanged on the interrupt endpoints
+static bool udi_hid_vendor_setreport(void);
+// Arm the OUT endpoint for the next report
+static bool udi_hid_vendor_arm_out(void);
+// Callback called when a report is received
+static void udi_hid_vendor_report_received(udd_ep_status_t status, iram_size_t nb_received, udd_ep_id_t ep);
+// Callback called when the report is sent
+static void udi_hid_vendor_report_sent(udd_ep_status_t status, iram_size_t nb_sent, udd_ep_id_t ep);
+
+
+//! To store current rate of HID vendor interface
+COMPILER_WORD_ALIGNED
+		static uint8_t udi_hid_vendor_rate;
+//! To store current protocol of HID vendor interface
+COMPILER_WORD_ALIGNED
+		static uint8_t udi_hid_vendor_protocol;
+//! Interface enabled by the host
+static volatile bool udi_hid_vendor_b_enabled;
+//! A received report waits to be read
+static volatile bool udi_hid_vendor_b_report_received;
+//! A report is being sent
+static volatile bool udi_hid_vendor_b_send_ongoing;
+//! Buffers of the OUT and IN transfers
+COMPILER_WORD_ALIGNED
+		static uint8_t udi_hid_vendor_report_out[UDI_HID_VENDOR_REPORT_SIZE];
+COMPILER_WORD_ALIGNED
+		static uint8_t udi_hid_vendor_report_in[UDI_HID_VENDOR_REPORT_SIZE];
+
+//! HID report descriptor for the vendor defined interface
+UDC_DESC_STORAGE udi_hid_vendor_report_desc_t udi_hid_vendor_report_desc = {
+	{
+		0x06, 0x00, 0xff,              // USAGE_PAGE (Vendor Defined 0xFF00)
+		0x09, 0x01,                    // USAGE (Vendor Usage 1)
+		0xa1, 0x01,                    // COLLECTION (Application)
+		0x15, 0x00,                    //   LOGICAL_MINIMUM (0)
+		0x26, 0xff, 0x00,              //   LOGICAL_MAXIMUM (255)
+		0x75, 0x08,                    //   REPORT_SIZE (8)
+		0x95, UDI_HID_VENDOR_REPORT_SIZE, //   REPORT_COUNT
+		0x09, 0x02,                    //   USAGE (Vendor Usage 2)
+		0x81, 0x02,                    //   INPUT (Data,Var,Abs)
+		0x95, UDI_HID_VENDOR_REPORT_SIZE, //   REPORT_COUNT
+		0x09, 0x03,                    //   USAGE (Vendor Usage 3)
+		0x91, 0x02,                    //   OUTPUT (Data,Var,Abs)
+		0xc0                           // END_COLLECTION
+	}
+};
+
+// Interface for UDI HID level (UDI API Functions)
+
+bool udi_hid_vendor_enable(void)
+{
+	// Initialize internal values
+	udi_hid_vendor_rate = 0;
+	udi_hid_vendor_protocol = 0;
+	udi_hid_vendor_b_report_received = false;
+	udi_hid_vendor_b_send_ongoing = false;
+	udi_hid_vendor_b_enabled = true;
+
+	return udi_hid_vendor_arm_out();
+}
+
+void udi_hid_vendor_disable(void)
+{
+	udi_hid_vendor_b_enabled = false;
+}
+
+bool udi_hid_vendor_setup(void)
+{
+	return udi_hid_setup(&udi_hid_vendor_rate, &udi_hid_vendor_protocol, (uint8_t *) &udi_hid_vendor_report_desc, udi_hid_vendor_setreport);
+}
+
+uint8_t udi_hid_vendor_getsetting(void)
+{
+	return 0;
+}
+
+
+static bool udi_hid_vendor_setreport(void)
+{
+	return false;
+}
+
+
+const uint8_t *udi_hid_vendor_get_received(void)
+{
+	return udi_hid_vendor_b_report_received ? udi_hid_vendor_report_out : NULL;
+}
+
+void udi_hid_vendor_release_received(void)
+{
+	irqflags_t flags = cpu_irq_save();
+	if (udi_hid_vendor_b_report_received) {
+		udi_hid_vendor_b_report_received = false;
+		if (udi_hid_vendor_b_enabled)
+			udi_hid_vendor_arm_out();
+	}
+	cpu_irq_restore(flags);
+}
+
+bool udi_hid_vendor_is_send_ready(void)
+{
+	return udi_hid_vendor_b_enabled && !udi_hid_vendor_b_send_ongoing;
+}
+
+uint8_t *udi_hid_vendor_get_send_buffer(void)
+{
+	return udi_hid_vendor_report_in;
+}
+
+bool udi_hid_vendor_send(void)
+{
+	irqflags_t flags = cpu_irq_save();
+
+	if (!udi_hid_vendor_is_send_ready()) {
+		cpu_irq_restore(flags);
+		return false;
+	}
+
+	udi_hid_vendor_b_send_ongoing = udd_ep_run(UDI_HID_VENDOR_EP_IN, false,
+			udi_hid_vendor_report_in, UDI_HID_VENDOR_REPORT_SIZE,
+			udi_hid_vendor_report_sent);
+
+	cpu_irq_restore(flags);
+	return udi_hid_vendor_b_send_ongoing;
+}
+
+// Internal routines
+
+static bool udi_hid_vendor_arm_out(void)
+{
+	return udd_ep_run(UDI_HID_VENDOR_EP_OUT, false,
+			udi_hid_vendor_report_out, UDI_HID_VENDOR_REPORT_SIZE,
+			udi_hid_vendor_report_received);
+}
+
+static void udi_hid_vendor_report_received(udd_ep_status_t status, iram_size_t nb_received, udd_ep_id_t ep)
+{
+	UNUSED(ep);
+
+	if (status != UDD_EP_TRANSFER_OK)
+		return;
+
+	// Short reports are padded, the OUT endpoint stays NAKed until read
+	if (nb_received < UDI_HID_VENDOR_REPORT_SIZE)
+		memset(&udi_hid_vendor_report_out[nb_received], 0, UDI_HID_VENDOR_REPORT_SIZE - nb_received);
+	udi_hid_vendor_b_report_received = true;
+}
+
+static void udi_hid_vendor_report_sent(udd_ep_status_t status, iram_size_t nb_sent, udd_ep_id_t ep)
+{
+	UNUSED(status);
+	UNUSED(nb_sent);
+	UNUSED(ep);
+
+	udi_hid_vendor_b_send_ongoing = false;
+}
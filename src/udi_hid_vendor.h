@@ -0,0 +1,111 @@
+/**
+ * Copyright (c) 2009-2018 Microchip Technology Inc. and its subsidiaries.
+ * 
+ * Subject to your compliance with these terms, you may use Microchip
+ * software and any derivatives exclusively with Microchip products.
+ * It is your responsibility to comply with third party license terms applicable
+ * to your use of third party software (including open source software) that
+ * may accompany Microchip software.
+ *
+ * THIS SOFTWARE IS SUPPLIED BY MICROCHIP "AS IS". NO WARRANTIES,
+ * WHETHER EXPRESS, IMPLIED OR STATUTORY, APPLY TO THIS SOFTWARE,
+ * INCLUDING ANY IMPLIED WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY,
+ * AND FITNESS FOR A PARTICULAR PURPOSE. IN NO EVENT WILL MICROCHIP BE
+ * LIABLE FOR ANY INDIRECT, SPECIAL, PUNITIVE, INCIDENTAL OR CONSEQUENTIAL
+ * LOSS, DAMAGE, COST OR EXPENSE OF ANY KIND WHATSOEVER RELATED TO THE
+ * SOFTWARE, HOWEVER CAUSED, EVEN IF MICROCHIP HAS BEEN ADVISED OF THE
+ * POSSIBILITY OR THE DAMAGES ARE FORESEEABLE.  TO THE FULLEST EXTENT
+ * ALLOWED BY LAW, MICROCHIP'S TOTAL LIABILITY ON ALL CLAIMS IN ANY WAY
+ * RELATED TO THIS SOFTWARE WILL NOT EXCEED THE AMOUNT OF FEES, IF ANY,
+ * THAT YOU HAVE PAID DIRECTLY TO MICROCHIP FOR THIS SOFTWARE.
+ */
+
+#ifndef UDI_HID_VENDOR_H_
+#define UDI_HID_VENDOR_H_
+
+#include "udc_desc.h"
+#include "udi_hid.h"
+
+extern UDC_DESC_STORAGE udi_api_t udi_api_hid_vendor;
+
+//! Interface descriptor structure for the vendor defined HID interface
+typedef struct {
+	usb_iface_desc_t iface;
+	usb_hid_descriptor_t hid;
+	usb_ep_desc_t ep_in;
+	usb_ep_desc_t ep_out;
+} udi_hid_vendor_desc_t;
+
+
+//! Report descriptor for the vendor defined HID interface
+typedef struct {
+	uint8_t array[28];
+} udi_hid_vendor_report_desc_t;
+
+
+//! By default no string associated to this interface
+#ifndef UDI_HID_VENDOR_STRING_ID
+#define UDI_HID_VENDOR_STRING_ID 0
+#endif
+
+//! Size of the raw reports in both directions
+#define UDI_HID_VENDOR_REPORT_SIZE  64
+
+#define UDI_HID_VENDOR_EP_SIZE  UDI_HID_VENDOR_REPORT_SIZE
+
+#ifdef UDI_HID_KBD_SHARED_EP
+#define UDI_HID_VENDOR_IFACE_NUMBER 1
+#define UDI_HID_VENDOR_EP_IN    (2 | USB_EP_DIR_IN)
+#define UDI_HID_VENDOR_EP_OUT   (2 | USB_EP_DIR_OUT)
+#else
+#define UDI_HID_VENDOR_IFACE_NUMBER 2
+#define UDI_HID_VENDOR_EP_IN    (3 | USB_EP_DIR_IN)
+#define UDI_HID_VENDOR_EP_OUT   (3 | USB_EP_DIR_OUT)
+#endif
+
+//! Content of the vendor defined HID interface descriptor for all speed
+#define UDI_HID_VENDOR_DESC    {\
+	.iface.bLength             = sizeof(usb_iface_desc_t),\
+	.iface.bDescriptorType     = USB_DT_INTERFACE,\
+	.iface.bInterfaceNumber    = UDI_HID_VENDOR_IFACE_NUMBER,\
+	.iface.bAlternateSetting   = 0,\
+	.iface.bNumEndpoints       = 2,\
+	.iface.bInterfaceClass     = HID_CLASS,\
+	.iface.bInterfaceSubClass  = HID_SUB_CLASS_NOBOOT,\
+	.iface.bInterfaceProtocol  = HID_PROTOCOL_GENERIC,\
+	.iface.iInterface          = UDI_HID_VENDOR_STRING_ID,\
+	.hid.bLength               = sizeof(usb_hid_descriptor_t),\
+	.hid.bDescriptorType       = USB_DT_HID,\
+	.hid.bcdHID                = LE16(USB_HID_BDC_V1_11),\
+	.hid.bCountryCode          = USB_HID_NO_COUNTRY_CODE,\
+	.hid.bNumDescriptors       = USB_HID_NUM_DESC,\
+	.hid.bRDescriptorType      = USB_DT_HID_REPORT,\
+	.hid.wDescriptorLength     = LE16(sizeof(udi_hid_vendor_report_desc_t)),\
+	.ep_in.bLength             = sizeof(usb_ep_desc_t),\
+	.ep_in.bDescriptorType     = USB_DT_ENDPOINT,\
+	.ep_in.bEndpointAddress    = UDI_HID_VENDOR_EP_IN,\
+	.ep_in.bmAttributes        = USB_EP_TYPE_INTERRUPT,\
+	.ep_in.wMaxPacketSize      = LE16(UDI_HID_VENDOR_EP_SIZE),\
+	.ep_in.bInterval           = 4,\
+	.ep_out.bLength            = sizeof(usb_ep_desc_t),\
+	.ep_out.bDescriptorType    = USB_DT_ENDPOINT,\
+	.ep_out.bEndpointAddress   = UDI_HID_VENDOR_EP_OUT,\
+	.ep_out.bmAttributes       = USB_EP_TYPE_INTERRUPT,\
+	.ep_out.wMaxPacketSize     = LE16(UDI_HID_VENDOR_EP_SIZE),\
+	.ep_out.bInterval          = 4,\
+}
+
+
+//! Last report received from the host, read in place, or NULL. The host is
+//! NAKed until it is released, so it is never overwritten. Call both outside
+//! interrupts.
+const uint8_t *udi_hid_vendor_get_received(void);
+void udi_hid_vendor_release_received(void);
+
+//! Report to send, filled in place while no report is in flight, then sent.
+//! udi_hid_vendor_send returns false while the previous one is in flight.
+bool udi_hid_vendor_is_send_ready(void);
+uint8_t *udi_hid_vendor_get_send_buffer(void);
+bool udi_hid_vendor_send(void);
+
+#endif /* UDI_HID_VENDOR_H_ */
@@ -0,0 +1,365 @@
+#!/usr/bin/env python3
+"""Configuration and telemetry client for the keyboard mainboard.
+
+Talks to the vendor-defined HID interface (usage page 0xFF00) through Linux
+hidraw. Requests and responses are 64-byte reports; src/keyboard_vendor.h
+documents the protocol.
+
+Commands:
+  info                       protocol version and geometry
+  get NAME|ID                read a setting
+  set NAME|ID VALUE          write a setting (stored after a short delay)
+  counters                   activity counters and LED latency frames
+  stream [PERIOD_MS]         print counters as they are streamed, until ^C
+  profile [--reset]          latency histograms (firmware built with KBD_PROFILE)
+  trace DUMP [--clear]       save the event trace for tools/trace_decode.py
+                             (firmware built with KBD_TRACE)
+  stack                      peak stack use and interrupt entry depths
+  key-stats [--reset] [--all]
+                             presses and debounce-rejected bounces per key
+  keymap-status              stored keymap sequence, length and CRC
+  keymap-upload BLOB         upload a blob written by keymap_compiler.py
+  keymap-reset               store and activate the default keymap
+
+The device is found by its vendor/product ids and report descriptor unless
+--device names a /dev/hidrawN node.
+"""
+
+import argparse
+import glob
+import os
+import select
+import struct
+import sys
+import time
+import zlib
+
+USB_VID = 0x03EB
+USB_PID = 0x2401
+REPORT_SIZE = 64
+VENDOR_USAGE_PAGE = bytes([0x06, 0x00, 0xFF])
+
+PROTOCOL_VERSION = 1
+KBD_SCAN_PERIOD_MS = 4
+
+CMD_INFO = 0x01
+CMD_SETTING_GET = 0x02
+CMD_SETTING_SET = 0x03
+CMD_COUNTERS = 0x04
+CMD_COUNTERS_STREAM = 0x05
+CMD_PROFILE = 0x06
+CMD_PROFILE_RESET = 0x07
+CMD_TRACE_READ = 0x08
+CMD_TRACE_RESUME = 0x09
+CMD_STACK = 0x0A
+CMD_KEY_STATS = 0x0B
+CMD_KEY_STATS_RESET = 0x0C
+CMD_KEYMAP_BEGIN = 0x10
+CMD_KEYMAP_DATA = 0x11
+CMD_KEYMAP_COMMIT = 0x12
+CMD_KEYMAP_STATUS = 0x13
+CMD_KEYMAP_RESET = 0x14
+EVENT_COUNTERS = 0x84
+
+STATUS_OK = 0x00
+STATUS_NAMES = {0x01: "error", 0x02: "unknown command"}
+
+# KEYMAP_STORE_CHUNK_SIZE of src/keymap_store.h: chunks never cross a flash page
+KEYMAP_CHUNK_SIZE = 32
+KEYMAP_STORE_STATUS = ["idle", "receiving", "busy", "done", "failed"]
+
+# Same order as enum setting_id in src/settings.h
+SETTINGS = ["backlight", "led_indicator", "default_layers", "debounce_mode", "debounce_ms"]
+
+# Same order as enum profile_mark in src/profile.h, then the total
+PROFILE_INTERVALS = ["scan->event", "event->built", "built->armed", "armed->sent", "total"]
+
+# Same order as enum stack_isr in src/stack_monitor.h
+STACK_ISRS = ["usb", "scan", "time", "i2c", "adc", "nvm"]
+RAM_SIZE = 4096
+
+COUNTERS = ["scans", "key_events", "keyboard_reports"]
+LED_FRAMES = ["led_report_frame", "led_board_frame", "led_peripheral_frame"]
+
+
+class DeviceError(Exception):
+    pass
+
+
+def find_device():
+    for node in sorted(glob.glob("/sys/class/hidraw/hidraw*")):
+        try:
+            with open(os.path.join(node, "device", "uevent")) as f:
+                uevent = dict(line.strip().split("=", 1) for line in f if "=" in line)
+            with open(os.path.join(node, "device", "report_descriptor"), "rb") as f:
+                descriptor = f.read()
+        except OSError:
+            continue
+        _, vid, pid = (int(x, 16) for x in uevent.get("HID_ID", "0:0:0").split(":"))
+        if (vid, pid) == (USB_VID, USB_PID) and descriptor.startswith(VENDOR_USAGE_PAGE):
+            return "/dev/" + os.path.basename(node)
+    raise DeviceError("no keyboard vendor interface found (try --device)")
+
+
+class Device:
+    def __init__(self, path, timeout=1.0):
+        self.fd = os.open(path, os.O_RDWR)
+        self.timeout = timeout
+
+    def close(self):
+        os.close(self.fd)
+
+    def read_report(self, timeout):
+        ready, _, _ = select.select([self.fd], [], [], timeout)
+        if not ready:
+            return None
+        return os.read(self.fd, REPORT_SIZE)
+
+    def request(self, cmd, payload=b""):
+        # No report ids: hidraw takes a leading 0 before the report
+        report = bytes([cmd]) + payload
+        os.write(self.fd, b"\x00" + report.ljust(REPORT_SIZE, b"\x00"))
+
+        deadline = time.monotonic() + self.timeout
+        while True:
+            response = self.read_report(max(0, deadline - time.monotonic()))
+            if response is None:
+                raise DeviceError("no response to command 0x%02x" % cmd)
+            # Streamed counters may come before the response
+            if response[0] == cmd:
+                break
+        if response[1] != STATUS_OK:
+            raise DeviceError("command 0x%02x: %s" % (cmd, STATUS_NAMES.get(response[1], response[1])))
+        return response[2:]
+
+
+def setting_id(name):
+    if name in SETTINGS:
+        return SETTINGS.index(name)
+    try:
+        return int(name, 0)
+    except ValueError:
+        raise DeviceError("unknown setting %r (one of %s)" % (name, ", ".join(SETTINGS)))
+
+
+def setting_name(index):
+    return SETTINGS[index] if index < len(SETTINGS) else str(index)
+
+
+def print_counters(data):
+    values = struct.unpack_from("<IIIHHH", data)
+    for name, value in zip(COUNTERS + LED_FRAMES, values):
+        print("%-22s %d" % (name, value))
+
+
+def cmd_info(dev, args):
+    version, settings, rows, cols, layers = struct.unpack_from("<BBBBB", dev.request(CMD_INFO))
+    print("protocol %d, %d settings, %dx%d matrix, %d layers" % (version, settings, rows, cols, layers))
+    if version != PROTOCOL_VERSION:
+        sys.stderr.write("warning: this tool speaks protocol %d\n" % PROTOCOL_VERSION)
+
+
+def cmd_get(dev, args):
+    index = setting_id(args.name)
+    value, = struct.unpack_from("<I", dev.request(CMD_SETTING_GET, bytes([index])))
+    print("%s %d" % (setting_name(index), value))
+
+
+def cmd_set(dev, args):
+    dev.request(CMD_SETTING_SET, struct.pack("<BI", setting_id(args.name), int(args.value, 0)))
+
+
+def cmd_counters(dev, args):
+    print_counters(dev.request(CMD_COUNTERS))
+
+
+def cmd_stream(dev, args):
+    period = max(1, args.period // KBD_SCAN_PERIOD_MS)
+    dev.request(CMD_COUNTERS_STREAM, struct.pack("<H", period))
+    try:
+        while True:
+            report = dev.read_report(None)
+            if report and report[0] == EVENT_COUNTERS:
+                scans, events, reports = struct.unpack_from("<III", report, 2)
+                print("%10d %10d %10d" % (scans, events, reports), flush=True)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        dev.request(CMD_COUNTERS_STREAM, struct.pack("<H", 0))
+
+
+def bucket_range(bucket, count):
+    if bucket == 0:
+        return "0"
+    if bucket == count - 1:
+        return ">=%d" % (1 << (bucket - 1))
+    return "%d-%d" % (1 << (bucket - 1), (1 << bucket) - 1)
+
+
+def cmd_profile(dev, args):
+    if args.reset:
+        dev.request(CMD_PROFILE_RESET)
+        return
+
+    index = 0
+    intervals = 1
+    while index < intervals:
+        data = dev.request(CMD_PROFILE, bytes([index]))
+        intervals, count, maximum, total = struct.unpack_from("<BBII", data)
+        buckets = struct.unpack_from("<%dH" % count, data, 10)
+        samples = sum(buckets)
+        name = PROFILE_INTERVALS[index] if index < len(PROFILE_INTERVALS) else str(index)
+        mean = total / samples if samples else 0
+        print("%-12s %6d samples, mean %.1f us, max %d us" % (name, samples, mean, maximum))
+        for bucket, value in enumerate(buckets):
+            if value:
+                print("  %12s us %6d" % (bucket_range(bucket, count), value))
+        index += 1
+
+
+def cmd_trace(dev, args):
+    # Reading pauses the trace, so the records do not move under the dump
+    records = b""
+    kept = 1
+    while len(records) // 4 < kept:
+        data = dev.request(CMD_TRACE_READ, bytes([len(records) // 4]))
+        capacity, kept, count = struct.unpack_from("<BBB", data)
+        if count == 0:
+            break
+        records += data[4:4 + 4 * count]
+    dev.request(CMD_TRACE_RESUME, bytes([1 if args.clear else 0]))
+
+    with open(args.dump, "wb") as f:
+        f.write(b"KTRC" + bytes([1]) + records)
+    print("%d of %d records saved" % (len(records) // 4, capacity))
+
+
+def cmd_stack(dev, args):
+    data = dev.request(CMD_STACK)
+    size, peak, static, count = struct.unpack_from("<HHHB", data)
+    depths = struct.unpack_from("<%dH" % count, data, 7)
+    print("static RAM %d of %d bytes, stack %d bytes" % (static, RAM_SIZE, size))
+    print("stack peak %d bytes (%d%%)%s" % (peak, 100 * peak // size, ", overflowed" if peak >= size else ""))
+    for index, depth in enumerate(depths):
+        name = STACK_ISRS[index] if index < len(STACK_ISRS) else str(index)
+        print("  %-6s entry depth %d bytes" % (name, depth))
+
+
+def cmd_key_stats(dev, args):
+    if args.reset:
+        # Refused while the firmware is writing the totals
+        dev.request(CMD_KEY_STATS_RESET)
+        return
+
+    cols = dev.request(CMD_INFO)[3]
+    stats = []
+    keys = 1
+    while len(stats) < keys:
+        data = dev.request(CMD_KEY_STATS, bytes([len(stats)]))
+        keys, count, sequence = struct.unpack_from("<BBI", data)
+        stats += [struct.unpack_from("<IH", data, 6 + 6 * i) for i in range(count)]
+
+    print("%d keys, totals stored %d times" % (keys, sequence))
+    print("%-8s %10s %8s %8s" % ("key", "presses", "chatter", "per 1k"))
+    for key, (presses, chatter) in enumerate(stats):
+        if presses or chatter or args.all:
+            rate = "%8.1f" % (1000.0 * chatter / presses) if presses else "%8s" % "-"
+            print("r%d c%-4d %10d %8d %s" % (key // cols, key % cols, presses, chatter, rate))
+
+
+def print_keymap_status(data):
+    status, sequence, length, crc = struct.unpack_from("<BIHI", data)
+    name = KEYMAP_STORE_STATUS[status] if status < len(KEYMAP_STORE_STATUS) else str(status)
+    print("store %s, sequence %d, active keymap %d bytes, CRC-32 %08x" % (name, sequence, length, crc))
+    return status, length, crc
+
+
+def cmd_keymap_status(dev, args):
+    print_keymap_status(dev.request(CMD_KEYMAP_STATUS))
+
+
+def wait_for_store(dev):
+    # The firmware writes flash one command per scan
+    deadline = time.monotonic() + 5
+    while time.monotonic() < deadline:
+        status = dev.request(CMD_KEYMAP_STATUS)[0]
+        if status < len(KEYMAP_STORE_STATUS) and KEYMAP_STORE_STATUS[status] in ("done", "failed"):
+            return KEYMAP_STORE_STATUS[status]
+        time.sleep(0.02)
+    raise DeviceError("keymap store timed out")
+
+
+def cmd_keymap_upload(dev, args):
+    with open(args.blob, "rb") as f:
+        blob = f.read()
+
+    dev.request(CMD_KEYMAP_BEGIN, struct.pack("<H", len(blob)))
+    for offset in range(0, len(blob), KEYMAP_CHUNK_SIZE):
+        chunk = blob[offset:offset + KEYMAP_CHUNK_SIZE]
+        dev.request(CMD_KEYMAP_DATA, struct.pack("<HB", offset, len(chunk)) + chunk)
+    dev.request(CMD_KEYMAP_COMMIT)
+
+    if wait_for_store(dev) != "done":
+        raise DeviceError("keymap could not be stored")
+    _, length, crc = print_keymap_status(dev.request(CMD_KEYMAP_STATUS))
+    if (length, crc) != (len(blob), zlib.crc32(blob)):
+        raise DeviceError("active keymap differs from the upload")
+
+
+def cmd_keymap_reset(dev, args):
+    dev.request(CMD_KEYMAP_RESET)
+    if wait_for_store(dev) != "done":
+        raise DeviceError("keymap could not be stored")
+    print_keymap_status(dev.request(CMD_KEYMAP_STATUS))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--device", help="hidraw node, e.g. /dev/hidraw3")
+    sub = parser.add_subparsers(dest="command", required=True)
+    sub.add_parser("info").set_defaults(func=cmd_info)
+    p = sub.add_parser("get")
+    p.add_argument("name")
+    p.set_defaults(func=cmd_get)
+    p = sub.add_parser("set")
+    p.add_argument("name")
+    p.add_argument("value")
+    p.set_defaults(func=cmd_set)
+    sub.add_parser("counters").set_defaults(func=cmd_counters)
+    p = sub.add_parser("stream")
+    p.add_argument("period", nargs="?", type=int, default=1000, help="ms between reports")
+    p.set_defaults(func=cmd_stream)
+    p = sub.add_parser("profile")
+    p.add_argument("--reset", action="store_true", help="clear the histograms")
+    p.set_defaults(func=cmd_profile)
+    p = sub.add_parser("trace")
+    p.add_argument("dump", help="file to write")
+    p.add_argument("--clear", action="store_true", help="clear the trace once read")
+    p.set_defaults(func=cmd_trace)
+    sub.add_parser("stack").set_defaults(func=cmd_stack)
+    p = sub.add_parser("key-stats")
+    p.add_argument("--reset", action="store_true", help="clear the counts")
+    p.add_argument("--all", action="store_true", help="list keys never pressed too")
+    p.set_defaults(func=cmd_key_stats)
+    sub.add_parser("keymap-status").set_defaults(func=cmd_keymap_status)
+    p = sub.add_parser("keymap-upload")
+    p.add_argument("blob")
+    p.set_defaults(func=cmd_keymap_upload)
+    sub.add_parser("keymap-reset").set_defaults(func=cmd_keymap_reset)
+    args = parser.parse_args()
+
+    try:
+        dev = Device(args.device or find_device())
+        try:
+            args.func(dev, args)
+        finally:
+            dev.close()
+    except (DeviceError, OSError) as e:
+        sys.stderr.write("kbdctl: %s\n" % e)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
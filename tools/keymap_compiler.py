@@ -0,0 +1,532 @@
+#!/usr/bin/env python3
+"""Keymap compiler for the keyboard mainboard.
+
+Reads a JSON keymap description (layers, tap-hold keys, combos, leader
+sequences, macros and consumer usages) and writes the versioned, checksummed keymap blob loaded by
+src/keymap.c, as a binary file (--blob) and/or a C header (--header).
+
+Key expressions:
+  "" / "TRNS"            transparent (no key on layer 0)
+  "NO"                   no key, hides lower layers
+  "A", "ENTER", "F1"...  keyboard page usages (see USAGES), or "0x29"
+  "LCTRL", "RALT"...     modifiers
+  "LSHIFT(1)"            modifier with a key
+  "MO(1)" "TG(1)" "OSL(1)"  layer keys
+  "MEDIA(VOLUME_UP)"     consumer usage, by name or number
+  "TH(CAPS, LCTRL, HOLD_ON_OTHER_KEY_PRESS)"  tap-hold key
+  "MACRO(name)"          macro key
+  "LEADER", "GAMING"
+
+Leader sequences are listed as {"keys": ["C", "L"], "action": KEY}, where the
+action is a key or a macro key; they are compiled to a trie.
+
+Blob format (version 3, little endian, every section 2-byte aligned):
+  header   magic "KMAP", version, layers, rows, cols, length (u16),
+           consumer usages, tap-hold keys, combos, macros (u8 each),
+           macro code size (u16), leader nodes (u8), 0
+  u16      offset of each layer
+  layer    sparse table of the u16 keys
+  u16      consumer usages
+  6 bytes  tap-hold keys: tap (u16), hold (u16), policy (u8), 0
+  14 bytes combos: key (u16), u16 matrix row mask of the keys of each row
+  combo    with combos only: sparse table of the u8 mask of the combos
+  keys     each key is part of
+  10 bytes leader trie nodes, breadth first from the root, siblings sorted
+           by key and at most 16: key (u16), action and typed keys (u16
+           offsets of programs in the macro code, 0xFFFF for no action),
+           parent, first child, number of children (u8 each), 0
+  u16      offset of each macro in the code, then the code, then the
+           programs of the leader nodes that are not macros
+  u32      CRC-32 of everything before
+
+Sparse tables hold the entries of the keys of the matrix that have one: a
+u16 bitmap of these keys for each row, the u8 index of the first entry of
+each row, then the entries.
+"""
+
+import argparse
+import json
+import re
+import struct
+import sys
+import zlib
+
+KEYMAP_MAGIC = b"KMAP"
+KEYMAP_VERSION = 3
+HEADER_SIZE = 18
+
+NUM_ROWS = 6
+NUM_COLS = 15
+# NUM_LAYERS of src/keyboard.h: the firmware rejects blobs with more layers
+MAX_LAYERS = 2
+COMBO_MAX_KEYS = 4
+# LEADER_MAX_DEPTH and LEADER_MAX_CHILDREN of src/keyboard.h
+LEADER_MAX_DEPTH = 4
+LEADER_MAX_CHILDREN = 16
+LEADER_MAX_NODES = 0xFF
+LEADER_NO_ACTION = 0xFFFF
+# Payload of the flash slots of src/keymap_store.c
+KEYMAP_MAX_SIZE = 448
+KBD_SCAN_PERIOD_MS = 4
+
+KEY_SET_MULTIMEDIA = 0xC000
+KEY_SET_META = 0xF000
+
+META_OPS = {"MO": 0x1, "TG": 0x2, "OSL": 0x3}
+KEY_META_TAP_HOLD = 0x4
+KEY_META_MACRO = 0x5
+KEY_LEADER = 0xF600
+KEY_GAMING = 0xF700
+KEY_NO = 0xF000
+
+TAP_HOLD_POLICIES = {
+    "TIMEOUT": 0,
+    "PERMISSIVE_HOLD": 1,
+    "HOLD_ON_OTHER_KEY_PRESS": 2,
+}
+
+MACRO_OPS = {"end": 0x00, "press": 0x01, "release": 0x02, "tap": 0x03, "delay": 0x04, "string": 0x05}
+
+MODIFIERS = {
+    "LCTRL": 1, "LSHIFT": 2, "LALT": 3, "LGUI": 4,
+    "RCTRL": 5, "RSHIFT": 6, "RALT": 7, "RGUI": 8,
+}
+
+USAGES = {
+    "ENTER": 0x28, "ESC": 0x29, "BSPC": 0x2A, "TAB": 0x2B, "SPACE": 0x2C,
+    "MINUS": 0x2D, "EQUAL": 0x2E, "LBRC": 0x2F, "RBRC": 0x30, "BSLS": 0x31,
+    "NUHS": 0x32, "SCLN": 0x33, "QUOT": 0x34, "GRV": 0x35, "COMM": 0x36,
+    "DOT": 0x37, "SLSH": 0x38, "CAPS": 0x39,
+    "PSCR": 0x46, "SCRL": 0x47, "PAUS": 0x48, "INS": 0x49, "HOME": 0x4A,
+    "PGUP": 0x4B, "DEL": 0x4C, "END": 0x4D, "PGDN": 0x4E, "RIGHT": 0x4F,
+    "LEFT": 0x50, "DOWN": 0x51, "UP": 0x52, "NLCK": 0x53, "PSLS": 0x54,
+    "PAST": 0x55, "PMNS": 0x56, "PPLS": 0x57, "PENT": 0x58, "P0": 0x62,
+    "PDOT": 0x63, "NUBS": 0x64, "APP": 0x65,
+}
+for _i, _c in enumerate("ABCDEFGHIJKLMNOPQRSTUVWXYZ"):
+    USAGES[_c] = 0x04 + _i
+for _i, _c in enumerate("1234567890"):
+    USAGES[_c] = 0x1E + _i
+for _i in range(9):
+    USAGES["P%d" % (_i + 1)] = 0x59 + _i
+for _i in range(12):
+    USAGES["F%d" % (_i + 1)] = 0x3A + _i
+    USAGES["F%d" % (_i + 13)] = 0x68 + _i
+
+# Names of src/udi_hid_multimedia.h (HID_CONSUMER_*)
+CONSUMER_USAGES = {
+    "BRIGHTNESS_UP": 0x006F, "BRIGHTNESS_DOWN": 0x0070,
+    "SCAN_NEXT": 0x00B5, "SCAN_PREVIOUS": 0x00B6, "STOP": 0x00B7,
+    "EJECT": 0x00B8, "PLAY_PAUSE": 0x00CD, "MUTE": 0x00E2,
+    "VOLUME_UP": 0x00E9, "VOLUME_DOWN": 0x00EA,
+    "AL_MEDIA_SELECT": 0x0183, "AL_EMAIL": 0x018A, "AL_CALCULATOR": 0x0192,
+    "AL_FILE_BROWSER": 0x0194, "AL_WEB_BROWSER": 0x0196,
+    "AL_LOCK_SCREEN": 0x019E, "AC_SEARCH": 0x0221, "AC_HOME": 0x0223,
+    "AC_BACK": 0x0224, "AC_FORWARD": 0x0225, "AC_REFRESH": 0x0227,
+    "AC_BOOKMARKS": 0x022A,
+}
+HID_CONSUMER_USAGE_MAX = 0x03FF
+
+
+class KeymapError(Exception):
+    pass
+
+
+def parse_number(text):
+    try:
+        return int(text, 0)
+    except ValueError:
+        raise KeymapError("not a number: %r" % text)
+
+
+def split_args(text):
+    """Splits "a, B(c, d), e" on the top level commas."""
+    args, depth, start = [], 0, 0
+    for i, ch in enumerate(text):
+        if ch == "(":
+            depth += 1
+        elif ch == ")":
+            depth -= 1
+        elif ch == "," and depth == 0:
+            args.append(text[start:i].strip())
+            start = i + 1
+    args.append(text[start:].strip())
+    return args
+
+
+class KeymapCompiler:
+    def __init__(self, desc):
+        self.desc = desc
+        self.consumer_usages = [0]
+        self.tap_hold_keys = []
+        self.macro_names = []
+        self.macros = []
+        self.leader_nodes = []
+
+    def consumer_index(self, text):
+        usage = CONSUMER_USAGES.get(text.upper())
+        if usage is None:
+            usage = parse_number(text)
+        if usage <= 0 or usage > HID_CONSUMER_USAGE_MAX:
+            raise KeymapError("consumer usage out of range: %r" % text)
+        if usage not in self.consumer_usages:
+            self.consumer_usages.append(usage)
+        index = self.consumer_usages.index(usage)
+        if index > 0xFF:
+            raise KeymapError("too many consumer usages")
+        return index
+
+    def tap_hold_index(self, tap, hold, policy):
+        entry = (tap, hold, policy)
+        if entry not in self.tap_hold_keys:
+            self.tap_hold_keys.append(entry)
+        index = self.tap_hold_keys.index(entry)
+        if index > 0xFF:
+            raise KeymapError("too many tap-hold keys")
+        return index
+
+    def key(self, text):
+        text = text.strip()
+        upper = text.upper()
+        if upper in ("", "TRNS", "_______", "___"):
+            return 0
+        if upper == "NO":
+            return KEY_NO
+        if upper == "LEADER":
+            return KEY_LEADER
+        if upper == "GAMING":
+            return KEY_GAMING
+        if upper in USAGES:
+            return USAGES[upper]
+        if upper in MODIFIERS:
+            return MODIFIERS[upper] << 8
+
+        m = re.fullmatch(r"(\w+)\s*\((.*)\)", text, re.S)
+        if m is None:
+            value = parse_number(text)
+            if not 0 <= value <= 0xFFFF:
+                raise KeymapError("key out of range: %r" % text)
+            return value
+
+        func, args = m.group(1).upper(), split_args(m.group(2))
+        if func in MODIFIERS and len(args) == 1:
+            key = self.key(args[0])
+            if key & 0xFF00:
+                raise KeymapError("only one modifier per key: %r" % text)
+            return (MODIFIERS[func] << 8) | key
+        if func in META_OPS and len(args) == 1:
+            layer = parse_number(args[0])
+            if not 0 < layer < MAX_LAYERS:
+                raise KeymapError("layer out of range: %r" % text)
+            return KEY_SET_META | (META_OPS[func] << 8) | layer
+        if func == "MEDIA" and len(args) == 1:
+            return KEY_SET_MULTIMEDIA | self.consumer_index(args[0])
+        if func == "TH" and len(args) in (2, 3):
+            policy = TAP_HOLD_POLICIES.get(args[2].upper() if len(args) == 3 else "TIMEOUT")
+            if policy is None:
+                raise KeymapError("unknown tap-hold policy: %r" % text)
+            index = self.tap_hold_index(self.key(args[0]), self.key(args[1]), policy)
+            return KEY_SET_META | (KEY_META_TAP_HOLD << 8) | index
+        if func == "MACRO" and len(args) == 1:
+            if args[0] not in self.macro_names:
+                raise KeymapError("unknown macro: %r" % text)
+            return KEY_SET_META | (KEY_META_MACRO << 8) | self.macro_names.index(args[0])
+        raise KeymapError("unknown key: %r" % text)
+
+    def macro_code(self, name, steps):
+        code = bytearray()
+        for step in steps:
+            op, arg = step[0].lower(), step[1] if len(step) > 1 else None
+            if op not in MACRO_OPS or op == "end":
+                raise KeymapError("macro %s: unknown step %r" % (name, step))
+            code.append(MACRO_OPS[op])
+            if op in ("press", "release", "tap"):
+                code += struct.pack("<H", self.key(arg))
+            elif op == "delay":
+                ticks = (int(arg) + KBD_SCAN_PERIOD_MS - 1) // KBD_SCAN_PERIOD_MS
+                if not 0 <= ticks <= 0xFF:
+                    raise KeymapError("macro %s: delay out of range" % name)
+                code.append(ticks)
+            else:
+                text = arg.encode("ascii")
+                if b"\0" in text:
+                    raise KeymapError("macro %s: NUL in string" % name)
+                code += text + b"\0"
+        code.append(MACRO_OPS["end"])
+        return bytes(code)
+
+    def leader_action(self, text):
+        """Macro index of a macro key, or the program tapping a key."""
+        key = self.key(text)
+        if key & 0xFF00 == KEY_SET_META | (KEY_META_MACRO << 8):
+            return key & 0xFF
+        if key == 0 or key & 0xF000 == KEY_SET_META:
+            raise KeymapError("leader actions are keys or macro keys: %r" % text)
+        return struct.pack("<BHB", MACRO_OPS["tap"], key, MACRO_OPS["end"])
+
+    def leader_trie(self, sequences):
+        """Nodes of the trie of the leader sequences, breadth first so that
+        the children of a node follow each other, sorted by key for the
+        binary search of the firmware."""
+        root = {"key": 0, "action": None, "path": [], "children": {}}
+        for seq in sequences:
+            keys = [self.key(k) for k in seq["keys"]]
+            if not 0 < len(keys) <= LEADER_MAX_DEPTH:
+                raise KeymapError("leader sequences have 1 to %d keys: %r"
+                                  % (LEADER_MAX_DEPTH, seq["keys"]))
+            if any(k == 0 or k & 0xF000 == KEY_SET_META for k in keys):
+                raise KeymapError("leader sequences take no layer or other meta keys: %r"
+                                  % seq["keys"])
+            node = root
+            for key in keys:
+                node = node["children"].setdefault(
+                    key, {"key": key, "action": None, "path": node["path"] + [key], "children": {}})
+            if node["action"] is not None:
+                raise KeymapError("leader sequence listed twice: %r" % seq["keys"])
+            node["action"] = self.leader_action(seq["action"])
+
+        order = [root]
+        parents = [0]
+        first_children = []
+        for index, node in enumerate(order):
+            if len(node["children"]) > LEADER_MAX_CHILDREN:
+                raise KeymapError("at most %d different keys follow a leader sequence start: %s"
+                                  % (LEADER_MAX_CHILDREN, " ".join("0x%04X" % k for k in node["path"]) or "LEADER"))
+            first_children.append(len(order))
+            for key in sorted(node["children"]):
+                order.append(node["children"][key])
+                parents.append(index)
+        if len(order) > LEADER_MAX_NODES:
+            raise KeymapError("at most %d leader trie nodes" % LEADER_MAX_NODES)
+
+        nodes = []
+        for index, node in enumerate(order):
+            typed = b"".join(struct.pack("<BH", MACRO_OPS["tap"], k) for k in node["path"])
+            nodes.append((node["key"], node["action"], typed + bytes([MACRO_OPS["end"]]),
+                          parents[index], first_children[index] if node["children"] else 0,
+                          len(node["children"])))
+        return nodes
+
+    def compile(self):
+        desc = self.desc
+        rows = desc.get("rows", NUM_ROWS)
+        cols = desc.get("cols", NUM_COLS)
+        if rows != NUM_ROWS or cols != NUM_COLS:
+            raise KeymapError("the matrix is %dx%d" % (NUM_ROWS, NUM_COLS))
+
+        for usage in desc.get("consumer_usages", []):
+            self.consumer_index(usage)
+
+        # Macros are named first so that keys can refer to them
+        self.macro_names = [m["name"] for m in desc.get("macros", [])]
+
+        for th in desc.get("tap_hold", []):
+            self.key("TH(%s)" % th)
+
+        self.macros = [self.macro_code(m["name"], m["steps"]) for m in desc.get("macros", [])]
+
+        sequences = desc.get("leader", [])
+        self.leader_nodes = self.leader_trie(sequences) if sequences else []
+
+        layers = []
+        for index, layer in enumerate(desc["layers"]):
+            keys = layer["keys"]
+            if len(keys) != rows or any(len(row) != cols for row in keys):
+                raise KeymapError("layer %d is not %dx%d" % (index, rows, cols))
+            layers.append((layer.get("name", str(index)), [[self.key(k) for k in row] for row in keys]))
+        if not 0 < len(layers) <= MAX_LAYERS:
+            raise KeymapError("1 to %d layers" % MAX_LAYERS)
+
+        combos = []
+        for combo in desc.get("combos", []):
+            keys = []
+            for r, c in combo["keys"]:
+                if not (0 <= r < rows and 0 <= c < cols):
+                    raise KeymapError("combo key [%d, %d] out of the %dx%d matrix" % (r, c, rows, cols))
+                keys.append(r * cols + c)
+            if not 2 <= len(keys) <= COMBO_MAX_KEYS:
+                raise KeymapError("combos have 2 to %d keys" % COMBO_MAX_KEYS)
+            if len(set(keys)) != len(keys):
+                raise KeymapError("combo key listed twice: %r" % combo["keys"])
+            combos.append((keys, self.key(combo["key"])))
+        if len(combos) > 8:
+            raise KeymapError("at most 8 combos")
+        if len(self.macros) > 0xFF:
+            raise KeymapError("too many macros")
+
+        return self.encode(rows, cols, layers, combos)
+
+    def encode(self, rows, cols, layers, combos):
+        def align(data):
+            if len(data) & 1:
+                data.append(0)
+
+        layer_blobs = []
+        for name, keys in layers:
+            num_keys, data = sparse_table(keys, "<H")
+            layer_blobs.append((name, num_keys, data))
+
+        # The combo engine matches the pressed keys against the row masks of
+        # the combos, found from the keys through the combo masks
+        combo_masks = [[0] * cols for _ in range(rows)]
+        combo_rows = []
+        for index, (keys, _) in enumerate(combos):
+            masks = [0] * rows
+            for key in keys:
+                masks[key // cols] |= 1 << (key % cols)
+                combo_masks[key // cols][key % cols] |= 1 << index
+            combo_rows.append(masks)
+
+        macro_code = bytearray()
+        macro_offsets = []
+        for code in self.macros:
+            macro_offsets.append(len(macro_code))
+            macro_code += code
+
+        # Programs of the leader nodes follow the macros, each stored once
+        programs = {}
+
+        def program_offset(program):
+            if program not in programs:
+                programs[program] = len(macro_code)
+                macro_code.extend(program)
+            return programs[program]
+
+        leader_nodes = []
+        for key, action, typed, parent, first_child, num_children in self.leader_nodes:
+            if action is None:
+                action_offset = LEADER_NO_ACTION
+            elif isinstance(action, int):
+                action_offset = macro_offsets[action]
+            else:
+                action_offset = program_offset(action)
+            leader_nodes.append(struct.pack("<HHHBBBB", key, action_offset, program_offset(typed),
+                                            parent, first_child, num_children, 0))
+        align(macro_code)
+
+        body = bytearray()
+        layer_table_offset = HEADER_SIZE
+        body_offset = layer_table_offset + 2 * len(layers)
+        layer_offsets = []
+        for _, _, data in layer_blobs:
+            layer_offsets.append(body_offset + len(body))
+            body += data
+        for usage in self.consumer_usages:
+            body += struct.pack("<H", usage)
+        for tap, hold, policy in self.tap_hold_keys:
+            body += struct.pack("<HHBB", tap, hold, policy, 0)
+        for (_, key), masks in zip(combos, combo_rows):
+            body += struct.pack("<H%dH" % rows, key, *masks)
+        if combos:
+            body += sparse_table(combo_masks, "<B")[1]
+        for node in leader_nodes:
+            body += node
+        for offset in macro_offsets:
+            body += struct.pack("<H", offset)
+        body += macro_code
+
+        length = body_offset + len(body) + 4
+        if length > KEYMAP_MAX_SIZE:
+            raise KeymapError("keymap is %d bytes, at most %d fit the keymap store"
+                              % (length, KEYMAP_MAX_SIZE))
+
+        blob = bytearray()
+        blob += KEYMAP_MAGIC
+        blob += struct.pack("<BBBBHBBBBHBB", KEYMAP_VERSION, len(layers), rows, cols, length,
+                            len(self.consumer_usages), len(self.tap_hold_keys), len(combos),
+                            len(self.macros), len(macro_code), len(leader_nodes), 0)
+        for offset in layer_offsets:
+            blob += struct.pack("<H", offset)
+        blob += body
+        blob += struct.pack("<I", zlib.crc32(bytes(blob)) & 0xFFFFFFFF)
+
+        self.layer_costs = [(name, n, len(data)) for name, n, data in layer_blobs]
+        return bytes(blob)
+
+
+def sparse_table(rows, fmt):
+    """Sparse table of the non-zero values of rows, each packed with fmt."""
+    data = bytearray()
+    entries = []
+    offsets = []
+    for row in rows:
+        bitmap = 0
+        offsets.append(len(entries))
+        for c, value in enumerate(row):
+            if value != 0:
+                bitmap |= 1 << c
+                entries.append(value)
+        data += struct.pack("<H", bitmap)
+    data += bytes(offsets)
+    if len(data) & 1:
+        data.append(0)
+    for value in entries:
+        data += struct.pack(fmt, value)
+    if len(data) & 1:
+        data.append(0)
+    return len(entries), bytes(data)
+
+
+def write_header(path, blob, source):
+    lines = [
+        "// Generated by tools/keymap_compiler.py from %s, do not edit" % source,
+        "",
+        "#ifndef KEYMAP_DEFAULT_H_",
+        "#define KEYMAP_DEFAULT_H_",
+        "",
+        "static const uint8_t KEYMAP_DEFAULT[%d] __attribute__((aligned(4))) = {" % len(blob),
+    ]
+    for i in range(0, len(blob), 16):
+        chunk = blob[i:i + 16]
+        lines.append("\t" + ", ".join("0x%02x" % b for b in chunk) + ("," if i + 16 < len(blob) else ""))
+    lines += ["};", "", "#endif /* KEYMAP_DEFAULT_H_ */", ""]
+    with open(path, "w", newline="\n") as f:
+        f.write("\n".join(lines))
+
+
+def report(compiler, blob, out):
+    dense = 2 * NUM_ROWS * NUM_COLS
+    out.write("layer        keys  flash (dense)\n")
+    for name, n, size in compiler.layer_costs:
+        out.write("%-10s %6d %6d (%d)\n" % (name, n, size, dense))
+    out.write("consumer usages %d, tap-hold keys %d, macros %d, leader nodes %d\n"
+              % (len(compiler.consumer_usages), len(compiler.tap_hold_keys), len(compiler.macros),
+                 len(compiler.leader_nodes)))
+    out.write("total flash %d bytes\n" % len(blob))
+    # The firmware reads the blob in place from flash (src/keymap.c) and only
+    # keeps a bit plane per layer bit of the resolved layers of the keys
+    # (src/keyboard_layer.c), whatever its size
+    planes = max(1, (MAX_LAYERS - 1).bit_length())
+    out.write("RAM: %d bytes resolved layer planes\n" % (planes * NUM_ROWS * 2))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("keymap", help="JSON keymap description")
+    parser.add_argument("--blob", help="binary keymap to write")
+    parser.add_argument("--header", help="C header to write")
+    parser.add_argument("--quiet", action="store_true", help="no cost report")
+    args = parser.parse_args()
+
+    with open(args.keymap) as f:
+        desc = json.load(f)
+
+    compiler = KeymapCompiler(desc)
+    try:
+        blob = compiler.compile()
+    except (KeymapError, KeyError, TypeError) as e:
+        sys.stderr.write("%s: %s\n" % (args.keymap, e))
+        return 1
+
+    if args.blob:
+        with open(args.blob, "wb") as f:
+            f.write(blob)
+    if args.header:
+        write_header(args.header, blob, args.keymap.replace("\\", "/"))
+    if not args.quiet:
+        report(compiler, blob, sys.stdout)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,150 @@
+#!/usr/bin/env python3
+"""RAM budget of the keyboard mainboard firmware, from its link map.
+
+Reads the map file the linker writes next to the ELF (KeyboardMainboard.map)
+and breaks the static RAM down by module: initialized data, zeroed bss and
+the noinit section kept over resets, then the stack reserved by the linker
+script (STACK_SIZE) and what is left. Objects of ASF are prefixed with
+"ASF/", library members are counted under their library.
+
+With --min-free the exit status is 1 when less RAM than that is left, so a
+build can fail before a new feature silently eats the stack margin. The
+post-build event of KeyboardMainboard.cproj runs it on every link of the
+firmware with --min-free 128.
+"""
+
+import argparse
+import collections
+import os
+import re
+import sys
+
+# Output sections of the linker script in RAM, by column
+COLUMNS = {".relocate": "data", ".bss": "bss", ".noinit": "noinit"}
+STACK_SECTION = ".stack"
+
+OUTPUT_RE = re.compile(r"^(\.\S+)(?:\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+))?")
+INPUT_RE = re.compile(r"^ (\S+)(?:\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)(?:\s+(.*))?)?$")
+CONTINUATION_RE = re.compile(r"^\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)(?:\s+(.*))?$")
+MEMORY_RE = re.compile(r"^(\S+)\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)")
+
+
+class MapError(Exception):
+    pass
+
+
+def module_name(path):
+    path = path.strip().replace("\\", "/")
+    member = re.match(r"(.*)\((.*)\)$", path)
+    if member:
+        return os.path.basename(member.group(1))
+    stem = os.path.splitext(os.path.basename(path))[0]
+    return "ASF/" + stem if "/ASF/" in "/" + path else stem
+
+
+def parse_map(lines):
+    """Returns the RAM (origin, length), the bytes of each module by column
+    and the stack size."""
+    ram = None
+    modules = collections.defaultdict(collections.Counter)
+    stack = 0
+    section = None
+    pending = None
+    in_memory_map = False
+
+    for line in lines:
+        line = line.rstrip("\n")
+        if not in_memory_map:
+            memory = MEMORY_RE.match(line)
+            if memory and memory.group(1) == "ram":
+                ram = (int(memory.group(2), 16), int(memory.group(3), 16))
+            if line.startswith("Linker script and memory map"):
+                in_memory_map = True
+            continue
+
+        # A long input section name puts its address and size on the next line
+        if pending is not None:
+            continuation = CONTINUATION_RE.match(line)
+            if continuation:
+                add_input(modules, section, pending, continuation.group(2), continuation.group(3))
+            pending = None
+            continue
+
+        output = OUTPUT_RE.match(line)
+        if output:
+            section = output.group(1)
+            if section == STACK_SECTION and output.group(3):
+                stack = int(output.group(3), 16)
+            continue
+
+        data = INPUT_RE.match(line)
+        if data is None or section not in COLUMNS:
+            continue
+        if data.group(1).startswith("*"):
+            # Input section patterns, but fill bytes count
+            if data.group(1) == "*fill*" and data.group(3):
+                modules["(fill)"][COLUMNS[section]] += int(data.group(3), 16)
+            continue
+        if data.group(2) is None:
+            pending = data.group(1)
+        else:
+            add_input(modules, section, data.group(1), data.group(3), data.group(4))
+
+    if ram is None:
+        raise MapError("no ram region in the memory configuration")
+    return ram, modules, stack
+
+
+def add_input(modules, section, name, size, path):
+    size = int(size, 16)
+    if size == 0 or not path:
+        return
+    modules[module_name(path)][COLUMNS[section]] += size
+
+
+def report(ram, modules, stack, out, csv=False):
+    columns = list(COLUMNS.values())
+    rows = sorted(modules.items(), key=lambda item: (-sum(item[1].values()), item[0]))
+    static = sum(sum(counts.values()) for _, counts in rows)
+    free = ram[1] - static - stack
+
+    if csv:
+        out.write("module,%s,total\n" % ",".join(columns))
+        for name, counts in rows:
+            out.write("%s,%s,%d\n" % (name, ",".join(str(counts[c]) for c in columns), sum(counts.values())))
+        out.write("stack,%s,%d\n" % (",".join("0" for _ in columns), stack))
+        out.write("free,%s,%d\n" % (",".join("0" for _ in columns), free))
+        return free
+
+    out.write("RAM %d bytes: static %d, stack %d, free %d\n\n" % (ram[1], static, stack, free))
+    out.write("%-24s %s %7s\n" % ("module", " ".join("%7s" % c for c in columns), "total"))
+    for name, counts in rows:
+        out.write("%-24s %s %7d\n" % (name, " ".join("%7d" % counts[c] for c in columns), sum(counts.values())))
+    out.write("%-24s %s %7d\n" % ("stack", " " * (8 * len(columns) - 1), stack))
+    out.write("%-24s %s %7d\n" % ("free", " " * (8 * len(columns) - 1), free))
+    return free
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("map", help="linker map file")
+    parser.add_argument("--csv", action="store_true", help="machine-readable output")
+    parser.add_argument("--min-free", type=int, default=0, help="fail with less free RAM (bytes)")
+    args = parser.parse_args()
+
+    try:
+        with open(args.map) as f:
+            ram, modules, stack = parse_map(f)
+    except (OSError, MapError) as e:
+        sys.stderr.write("%s: %s\n" % (args.map, e))
+        return 1
+
+    free = report(ram, modules, stack, sys.stdout, args.csv)
+    if free < args.min_free:
+        sys.stderr.write("%d bytes of RAM free, %d required\n" % (free, args.min_free))
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
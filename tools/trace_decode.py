@@ -0,0 +1,146 @@
+#!/usr/bin/env python3
+"""Decoder of event trace dumps of the keyboard mainboard.
+
+Reads a dump written by "kbdctl.py trace" or "kbd_replay --dump" and prints
+a timeline, or writes it as Chrome trace JSON (--chrome) for
+chrome://tracing or Perfetto. src/trace.h describes the events.
+
+Dump format (little endian):
+  header   magic "KTRC", version (u8)
+  records  delta (u16, µs since the record before, saturated), event (u8),
+           payload (u8), oldest first
+
+Times are counted from the first record. A saturated delta only gives a
+lower bound; a reset starts the timebase over, so the times before it are
+not related to those after.
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+DUMP_MAGIC = b"KTRC"
+DUMP_VERSION = 1
+DELTA_SATURATED = 0xFFFF
+
+# Same order as enum trace_event in src/trace.h
+EVENTS = ["reset", "scan_start", "scan_end", "key", "kbd_armed", "kbd_sent",
+          "media_armed", "adc", "i2c_start", "i2c_done", "i2c_error", "vendor"]
+
+# Chrome trace: thread of each event, and the events opening and closing spans
+THREADS = {"scan_start": "scan", "scan_end": "scan", "key": "scan",
+           "kbd_armed": "usb", "kbd_sent": "usb", "media_armed": "usb",
+           "adc": "adc", "i2c_start": "i2c", "i2c_done": "i2c", "i2c_error": "i2c",
+           "vendor": "main", "reset": "main"}
+SPANS = {"scan_start": ("B", "scan"), "scan_end": ("E", "scan"),
+         "i2c_start": ("B", "i2c"), "i2c_done": ("E", "i2c"), "i2c_error": ("E", "i2c")}
+NUM_COLS = 15
+
+
+class DumpError(Exception):
+    pass
+
+
+def read_dump(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[:4] != DUMP_MAGIC:
+        raise DumpError("not a trace dump")
+    if data[4] != DUMP_VERSION:
+        raise DumpError("dump version %d, expected %d" % (data[4], DUMP_VERSION))
+    if (len(data) - 5) % 4:
+        raise DumpError("truncated record")
+    return [struct.unpack_from("<HBB", data, offset) for offset in range(5, len(data), 4)]
+
+
+def event_name(event):
+    return EVENTS[event] if event < len(EVENTS) else "event_%d" % event
+
+
+def describe(name, payload):
+    if name == "key":
+        key = payload & 0x7F
+        return "%s r%d c%d" % ("press" if payload & 0x80 else "release", key // NUM_COLS, key % NUM_COLS)
+    if name == "reset":
+        return "records before kept" if payload else "trace cleared"
+    if name in ("i2c_start", "i2c_done"):
+        return "register 0x%02x" % payload
+    if name == "vendor":
+        return "command 0x%02x" % payload
+    if name in ("scan_start", "adc"):
+        return str(payload)
+    return ""
+
+
+def timeline(records):
+    """Yields (time, delta, saturated, name, payload), time in µs."""
+    time = 0
+    for index, (delta, event, payload) in enumerate(records):
+        if index > 0:
+            time += delta
+        yield time, delta, delta == DELTA_SATURATED, event_name(event), payload
+
+
+def print_timeline(records, out):
+    out.write("%12s %8s  %-12s %s\n" % ("time_us", "delta", "event", "detail"))
+    for time, delta, saturated, name, payload in timeline(records):
+        out.write("%12d %7s%s  %-12s %s\n" % (time, delta, ">" if saturated else " ", name, describe(name, payload)))
+
+
+def chrome_trace(records):
+    events = []
+    tids = {}
+    open_spans = set()
+    for time, delta, saturated, name, payload in timeline(records):
+        thread = THREADS.get(name, "main")
+        tid = tids.setdefault(thread, len(tids) + 1)
+        event = {"name": name, "ts": time, "pid": 1, "tid": tid, "args": {"payload": payload}}
+        phase, span = SPANS.get(name, ("i", None))
+        if phase == "B":
+            event["name"] = span
+            open_spans.add(span)
+        elif phase == "E":
+            # A span opened before the oldest record has nothing to close
+            if span not in open_spans:
+                phase = "i"
+            else:
+                event["name"] = span
+                open_spans.discard(span)
+        if name == "reset":
+            open_spans.clear()
+        if phase == "i":
+            event["s"] = "t"
+        event["ph"] = phase
+        detail = describe(name, payload)
+        if detail:
+            event["args"]["detail"] = detail
+        events.append(event)
+
+    for thread, tid in tids.items():
+        events.append({"name": "thread_name", "ph": "M", "pid": 1, "tid": tid, "args": {"name": thread}})
+    return {"traceEvents": events, "displayTimeUnit": "ms"}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("dump", help="trace dump")
+    parser.add_argument("--chrome", help="Chrome trace JSON to write instead of the timeline")
+    args = parser.parse_args()
+
+    try:
+        records = read_dump(args.dump)
+    except (OSError, DumpError) as e:
+        sys.stderr.write("%s: %s\n" % (args.dump, e))
+        return 1
+
+    if args.chrome:
+        with open(args.chrome, "w") as f:
+            json.dump(chrome_trace(records), f, indent=1)
+    else:
+        print_timeline(records, sys.stdout)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())